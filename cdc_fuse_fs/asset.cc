@@ -51,6 +51,7 @@ absl::StatusOr<std::vector<const AssetProto*>> Asset::GetAllChildProtos() {
   }
 
   // Fetch all indirect dir asset lists.
+  PrefetchIndirectLists();
   for (;;) {
     bool list_was_fetched;
     ASSIGN_OR_RETURN(list_was_fetched, FetchNextDirAssetList(),
@@ -94,6 +95,7 @@ absl::StatusOr<const AssetProto*> Asset::Lookup(const char* name) {
     }
 
     // Fetch one more indirect asset list.
+    PrefetchIndirectLists();
     bool list_was_fetched;
     ASSIGN_OR_RETURN(list_was_fetched, FetchNextDirAssetList(),
                      "Failed to fetch directory assets");
@@ -104,44 +106,102 @@ absl::StatusOr<const AssetProto*> Asset::Lookup(const char* name) {
   }
 }
 
+uint64_t Asset::ChunkedSize() const {
+  assert(proto_);
+  if (!proto_->in_progress()) return proto_->file_size();
+  return std::min(proto_->chunked_size(), proto_->file_size());
+}
+
 absl::StatusOr<uint64_t> Asset::Read(uint64_t offset, void* data,
                                      uint64_t size) {
+  // Collect the chunk IDs required to satisfy the read request.
+  ChunkTransferList chunks;
+  uint64_t bytes_to_read;
+  ASSIGN_OR_RETURN(bytes_to_read,
+                   AppendReadChunks(offset, data, size, &chunks));
+  if (bytes_to_read == 0) return 0;
+
+  // Read all data.
+  absl::Status status = data_store_reader_->Get(&chunks);
+  if (!status.ok() || !chunks.ReadDone()) {
+    std::string msg = absl::StrFormat(
+        "Failed to fetch chunk(s) [%s] for file '%s', offset %u, size %u",
+        chunks.ToHexString(
+            [](auto const& chunk) { return chunk.size && !chunk.done; }),
+        proto_->name(), offset, size);
+    return status.ok() ? absl::DataLossError(msg)
+                       : WrapStatus(status, "%s", msg);
+  }
+  return bytes_to_read;
+}
+
+absl::StatusOr<uint64_t> Asset::AppendReadChunks(uint64_t offset, void* data,
+                                                 uint64_t size,
+                                                 ChunkTransferList* chunks) {
   mutex_.AssertNotHeld();
   assert(proto_);
   if (proto_->type() != AssetProto::FILE)
     return absl::InvalidArgumentError("Not a file asset");
 
   if (size == 0) return 0;
+  return CollectChunks(offset, data, size,
+                       data_store_reader_->PrefetchSize(size), chunks);
+}
+
+absl::Status Asset::GetChunkFileRanges(uint64_t offset, uint64_t size,
+                                       std::vector<ChunkFileRange>* ranges) {
+  mutex_.AssertNotHeld();
+  assert(proto_);
+  if (proto_->type() != AssetProto::FILE)
+    return absl::InvalidArgumentError("Not a file asset");
+
+  ranges->clear();
+  if (size == 0) return absl::OkStatus();
+
+  // Cached data does not need to be prefetched.
+  ChunkTransferList chunks;
+  RETURN_IF_ERROR(CollectChunks(offset, nullptr, size, size, &chunks).status());
+  ranges->reserve(chunks.size());
+  for (const ChunkTransferTask& chunk : chunks) {
+    if (chunk.size == 0) continue;
+    std::string path;
+    ASSIGN_OR_RETURN(path, data_store_reader_->GetChunkFilePath(chunk.id));
+    ranges->push_back(
+        ChunkFileRange{std::move(path), chunk.offset, chunk.size});
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<uint64_t> Asset::CollectChunks(uint64_t offset, void* data,
+                                              uint64_t size,
+                                              uint64_t prefetch_size,
+                                              ChunkTransferList* chunks) {
+  PrefetchIndirectLists();
 
   // Find a chunk list such that list offset <= offset < next list offset.
   int list_idx = FindChunkList(offset);
-  const RepeatedChunkRefProto* chunk_refs;
-  ASSIGN_OR_RETURN(chunk_refs, GetChunkRefList(list_idx),
+  const ChunkIndex* index;
+  ASSIGN_OR_RETURN(index, GetChunkIndex(list_idx),
                    "Failed to fetch indirect chunk list %i", list_idx);
-  uint64_t chunk_list_offset = ChunkListOffset(list_idx);
-  if (!chunk_refs) return 0;  // Out of bounds.
+  if (!index) return 0;  // Out of bounds.
 
   // Find a chunk such that chunk offset <= offset < next chunk offset.
-  int chunk_idx = FindChunk(*chunk_refs, chunk_list_offset, offset);
-  if (chunk_idx < 0 || chunk_idx >= chunk_refs->size()) {
+  int chunk_idx = index->Find(offset);
+  if (chunk_idx < 0 || chunk_idx >= index->size()) {
     // Data is malformed, e.g. empty chunk list with non-zero file size.
     return MakeStatus(
         "Invalid chunk ref list %i. Found chunk index %i not in [0, %u).",
-        list_idx, chunk_idx, chunk_refs->size());
+        list_idx, chunk_idx, index->size());
   }
 
   uint64_t data_bytes_left = size;
-  uint64_t prefetch_bytes_left = data_store_reader_->PrefetchSize(size);
-  // Collect the chunk IDs required to satisfy the read request.
-  ChunkTransferList chunks;
-  while (chunk_refs) {
-    const ChunkRefProto& chunk_ref = chunk_refs->at(chunk_idx);
-
+  uint64_t prefetch_bytes_left = prefetch_size;
+  while (index) {
     // Figure out how much data we have to read from the current chunk.
-    uint64_t chunk_absolute_offset = chunk_list_offset + chunk_ref.offset();
+    uint64_t chunk_absolute_offset = index->offsets[chunk_idx];
     uint64_t chunk_offset =
         offset > chunk_absolute_offset ? offset - chunk_absolute_offset : 0;
-    uint64_t chunk_size = ChunkSize(list_idx, chunk_idx, chunk_refs);
+    uint64_t chunk_size = index->offsets[chunk_idx + 1] - chunk_absolute_offset;
     assert(chunk_size >= chunk_offset);
     uint64_t bytes_to_read =
         std::min<uint64_t>(chunk_size - chunk_offset, data_bytes_left);
@@ -149,9 +209,9 @@ absl::StatusOr<uint64_t> Asset::Read(uint64_t offset, void* data,
         std::min<uint64_t>(chunk_size - chunk_offset, prefetch_bytes_left);
 
     // Enqueue a chunk transfer task.
-    chunks.emplace_back(chunk_ref.chunk_id(), chunk_offset,
-                        bytes_to_read ? data : nullptr, bytes_to_read);
-    data = static_cast<char*>(data) + bytes_to_read;
+    chunks->emplace_back(*index->ids[chunk_idx], chunk_offset,
+                         bytes_to_read ? data : nullptr, bytes_to_read);
+    if (data) data = static_cast<char*>(data) + bytes_to_read;
     data_bytes_left =
         data_bytes_left > bytes_to_read ? data_bytes_left - bytes_to_read : 0;
     prefetch_bytes_left -= bytes_to_prefetch;
@@ -162,47 +222,53 @@ absl::StatusOr<uint64_t> Asset::Read(uint64_t offset, void* data,
 
     // Otherwise find next chunk.
     ++chunk_idx;
-    while (chunk_idx >= chunk_refs->size()) {
+    while (chunk_idx >= index->size()) {
       // Go to next list.
       chunk_idx = 0;
       ++list_idx;
-      ASSIGN_OR_RETURN(chunk_refs, GetChunkRefList(list_idx),
+      ASSIGN_OR_RETURN(index, GetChunkIndex(list_idx),
                        "Failed to fetch indirect chunk list %i", list_idx);
-      chunk_list_offset = ChunkListOffset(list_idx);
-      if (!chunk_refs) {
+      if (!index) {
         // Out of bounds. If we're not at the file size now, it's an error.
-        if (offset != proto_->file_size()) {
+        if (offset != ChunkedSize()) {
           return MakeStatus(
               "Read error at position %u. Expected to be at file size %u.",
-              offset, proto_->file_size());
+              offset, ChunkedSize());
         }
         break;
       }
     }
 
-    if (chunk_refs) {
+    if (index) {
       // We should be exactly at a chunk boundary now.
-      uint64_t chunk_rel_offset = chunk_refs->at(chunk_idx).offset();
-      if (offset != chunk_list_offset + chunk_rel_offset) {
+      uint64_t chunk_list_offset = ChunkListOffset(list_idx);
+      uint64_t chunk_rel_offset = index->offsets[chunk_idx] - chunk_list_offset;
+      if (offset != index->offsets[chunk_idx]) {
         return MakeStatus("Unexpected chunk offset %u, expected %u + %u = %u",
                           offset, chunk_list_offset, chunk_rel_offset,
-                          chunk_list_offset + chunk_rel_offset);
+                          index->offsets[chunk_idx]);
       }
     }
   }
+  return size - data_bytes_left;
+}
 
-  // Read all data.
-  absl::Status status = data_store_reader_->Get(&chunks);
-  if (!status.ok() || !chunks.ReadDone()) {
-    std::string msg = absl::StrFormat(
-        "Failed to fetch chunk(s) [%s] for file '%s', offset %u, size %u",
-        chunks.ToHexString(
-            [](auto const& chunk) { return chunk.size && !chunk.done; }),
-        proto_->name(), offset, size);
-    return status.ok() ? absl::DataLossError(msg)
-                       : WrapStatus(status, "%s", msg);
+void Asset::AppendLoadedIndirectListIds(
+    std::vector<ContentIdProto>* ids) const {
+  mutex_.AssertNotHeld();
+  assert(proto_);
+  absl::ReaderMutexLock read_lock(&mutex_);
+
+  // |dir_asset_lists_| are loaded in order, |file_chunk_lists_| might have
+  // gaps.
+  for (size_t n = 0; n < dir_asset_lists_.size(); ++n) {
+    ids->push_back(proto_->dir_indirect_assets(static_cast<int>(n)));
+  }
+  for (size_t n = 0; n < file_chunk_lists_.size(); ++n) {
+    if (!file_chunk_lists_[n]) continue;
+    ids->push_back(
+        proto_->file_indirect_chunks(static_cast<int>(n)).chunk_list_id());
   }
-  return size - data_bytes_left;
 }
 
 size_t Asset::GetNumFetchedFileChunkListsForTesting() {
@@ -232,7 +298,9 @@ void Asset::UpdateProto(const AssetProto* proto) {
   absl::WriterMutexLock write_lock(&mutex_);
   proto_lookup_.clear();
   file_chunk_lists_.clear();
+  chunk_indexes_.clear();
   dir_asset_lists_.clear();
+  indirect_lists_prefetched_ = false;
   proto_ = proto;
   if (proto_) {
     UpdateProtoLookup(proto_->dir_assets());
@@ -370,6 +438,36 @@ bool Asset::IsConsistent(std::string* warning) const {
   return true;
 }
 
+void Asset::PrefetchIndirectLists() {
+  mutex_.AssertNotHeld();
+  assert(proto_);
+  if (indirect_lists_prefetched_.exchange(true)) return;
+
+  // Prefetch tasks have no buffer, the data store just caches the lists.
+  ChunkTransferList lists;
+  {
+    absl::ReaderMutexLock read_lock(&mutex_);
+    for (int n = 0; n < proto_->file_indirect_chunks_size(); ++n) {
+      if (static_cast<size_t>(n) < file_chunk_lists_.size() &&
+          file_chunk_lists_[n]) {
+        continue;
+      }
+      lists.emplace_back(proto_->file_indirect_chunks(n).chunk_list_id(), 0,
+                         nullptr, 0);
+    }
+    for (int n = static_cast<int>(dir_asset_lists_.size());
+         n < proto_->dir_indirect_assets_size(); ++n) {
+      lists.emplace_back(proto_->dir_indirect_assets(n), 0, nullptr, 0);
+    }
+  }
+
+  // A single list is fetched just as fast when it is needed.
+  if (lists.size() < 2) return;
+
+  // Errors are ignored here. They are reported when the lists are loaded.
+  data_store_reader_->Get(&lists).IgnoreError();
+}
+
 absl::StatusOr<bool> Asset::FetchNextDirAssetList() {
   mutex_.AssertNotHeld();
   assert(proto_);
@@ -416,7 +514,7 @@ void Asset::UpdateProtoLookup(const RepeatedAssetProto& list) {
 int Asset::FindChunkList(uint64_t offset) {
   assert(proto_);
   const RepeatedIndirectChunkListProto& lists = proto_->file_indirect_chunks();
-  if (offset >= proto_->file_size()) {
+  if (offset >= ChunkedSize()) {
     // |offset| is not inside the file.
     return proto_->file_indirect_chunks_size();
   }
@@ -430,16 +528,31 @@ int Asset::FindChunkList(uint64_t offset) {
   return it - lists.begin() - 1;
 }
 
-int Asset::FindChunk(const RepeatedChunkRefProto& chunks,
-                     uint64_t chunk_list_offset, uint64_t chunk_offset) {
-  assert(chunk_list_offset <= chunk_offset);
-  uint64_t rel_offset = chunk_offset - chunk_list_offset;
-  // TODO: Optimize search by using average chunk size.
-  auto it = std::upper_bound(chunks.begin(), chunks.end(), rel_offset,
-                             [](uint64_t value, const ChunkRefProto& ch) {
-                               return value < ch.offset();
-                             });
-  return it - chunks.begin() - 1;
+int Asset::ChunkIndex::Find(uint64_t offset) const {
+  const size_t count = ids.size();
+  assert(offsets.size() == count + 1);
+  if (count == 0 || offset < offsets[0]) return -1;
+
+  // Content-defined chunks have similar sizes, so the average chunk size gives
+  // a good first guess. Widen the range around the guess exponentially until
+  // offsets[lo] <= offset < offsets[hi] and binary search in that range.
+  const uint64_t span = offsets[count] - offsets[0];
+  size_t lo = 0;
+  if (span > 0) {
+    lo = static_cast<size_t>(static_cast<double>(offset - offsets[0]) / span *
+                             count);
+    lo = std::min(lo, count - 1);
+  }
+  size_t hi = lo + 1;
+  for (size_t step = 1; offsets[lo] > offset; step *= 2) {
+    lo = lo > step ? lo - step : 0;
+  }
+  for (size_t step = 1; hi < count && offsets[hi] <= offset; step *= 2) {
+    hi = std::min(hi + step, count);
+  }
+  auto begin = offsets.begin();
+  auto it = std::upper_bound(begin + lo, begin + hi, offset);
+  return static_cast<int>(it - begin) - 1;
 }
 
 uint64_t Asset::ChunkListOffset(int list_idx) const {
@@ -449,27 +562,7 @@ uint64_t Asset::ChunkListOffset(int list_idx) const {
   if (list_idx == -1) return 0;
   if (list_idx < proto_->file_indirect_chunks_size())
     return proto_->file_indirect_chunks(list_idx).offset();
-  return proto_->file_size();
-}
-
-uint64_t Asset::ChunkSize(int list_idx, int chunk_idx,
-                          const RepeatedChunkRefProto* chunk_refs) {
-  assert(chunk_idx >= 0 && chunk_idx < chunk_refs->size());
-  assert(list_idx >= -1 && proto_ &&
-         list_idx <= proto_->file_indirect_chunks_size());
-
-  // If the next chunk is in the same chunk_refs list, just return offset diff.
-  if (chunk_idx + 1 < chunk_refs->size()) {
-    return chunk_refs->at(chunk_idx + 1).offset() -
-           chunk_refs->at(chunk_idx).offset();
-  }
-
-  // If the next chunk is on another list, use the next list's offset.
-  // Note that this also works for the last list, where
-  // GetChunkListOffset(list_idx + 1) returns the file size.
-  uint64_t chunk_absolute_offset =
-      chunk_refs->at(chunk_idx).offset() + ChunkListOffset(list_idx);
-  return ChunkListOffset(list_idx + 1) - chunk_absolute_offset;
+  return ChunkedSize();
 }
 
 absl::StatusOr<const RepeatedChunkRefProto*> Asset::GetChunkRefList(
@@ -517,4 +610,43 @@ absl::StatusOr<const RepeatedChunkRefProto*> Asset::GetChunkRefList(
   return &file_chunk_lists_[list_idx]->chunks();
 }
 
+absl::StatusOr<const Asset::ChunkIndex*> Asset::GetChunkIndex(int list_idx) {
+  mutex_.AssertNotHeld();
+  assert(list_idx >= -1 && proto_ &&
+         list_idx <= proto_->file_indirect_chunks_size());
+
+  if (list_idx == proto_->file_indirect_chunks_size()) {
+    // Indicates EOF.
+    return nullptr;
+  }
+
+  const size_t slot = static_cast<size_t>(list_idx + 1);
+  {
+    absl::ReaderMutexLock read_lock(&mutex_);
+    if (slot < chunk_indexes_.size() && chunk_indexes_[slot]) {
+      return chunk_indexes_[slot].get();
+    }
+  }
+
+  // Build the index without holding the lock. The chunk ref list outlives the
+  // index, so that the content ids can be referenced.
+  const RepeatedChunkRefProto* chunk_refs;
+  ASSIGN_OR_RETURN(chunk_refs, GetChunkRefList(list_idx));
+  auto index = std::make_unique<ChunkIndex>();
+  index->offsets.reserve(chunk_refs->size() + 1);
+  index->ids.reserve(chunk_refs->size());
+  const uint64_t list_offset = ChunkListOffset(list_idx);
+  for (const ChunkRefProto& chunk_ref : *chunk_refs) {
+    index->offsets.push_back(list_offset + chunk_ref.offset());
+    index->ids.push_back(&chunk_ref.chunk_id());
+  }
+  index->offsets.push_back(ChunkListOffset(list_idx + 1));
+
+  absl::WriterMutexLock write_lock(&mutex_);
+  if (chunk_indexes_.size() <= slot) chunk_indexes_.resize(slot + 1);
+  // Another thread might have built the index in the meantime.
+  if (!chunk_indexes_[slot]) chunk_indexes_[slot] = std::move(index);
+  return chunk_indexes_[slot].get();
+}
+
 }  // namespace cdc_ft
@@ -17,7 +17,11 @@
 #ifndef CDC_FUSE_FS_ASSET_H_
 #define CDC_FUSE_FS_ASSET_H_
 
+#include <atomic>
+#include <memory>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/status/statusor.h"
@@ -28,6 +32,7 @@
 namespace cdc_ft {
 
 class Buffer;
+class ChunkTransferList;
 class DataStoreReader;
 
 // Wraps an asset proto for reading and adds additional functionality like name
@@ -59,6 +64,13 @@ class Asset {
   // Thread-safe.
   const AssetProto* proto() const { return proto_; }
 
+  // For file assets, returns the number of bytes at the start of the file that
+  // are covered by chunks. This is less than the file size if the file is in
+  // progress and was only chunked partially. Reads beyond it return no data.
+  // |proto_| must be set.
+  // Thread-safe.
+  uint64_t ChunkedSize() const;
+
   // Returns all child asset protos. Loads them if necessary.
   // Returns an error if loading an indirect asset list fails.
   // Returns an InvalidArugmentError if *this is not a directory asset.
@@ -81,13 +93,56 @@ class Asset {
 
   // For file assets, reads |size| bytes from the file, starting from |offset|,
   // and puts the result into |data|. Returns the number of bytes read or 0 if
-  // |offset| >= file size. Loads indirect chunk lists if needed.
+  // |offset| >= ChunkedSize(). Loads indirect chunk lists if needed.
   // Returns an error if loading chunk lists fails.
   // Returns an InvalidArugmentError if *this is not a file asset.
   // |proto_| must be set.
   // Thread-safe.
   absl::StatusOr<uint64_t> Read(uint64_t offset, void* data, uint64_t size);
 
+  // For file assets, appends the chunk transfer tasks to |chunks| that read
+  // |size| bytes of the file, starting from |offset|, into |data| when they are
+  // executed. Prefetches additional data like Read(). This allows reads of
+  // multiple assets to be fetched with a single DataStoreReader::Get() call.
+  // Returns the number of bytes that will be read, see Read().
+  // Returns an InvalidArugmentError if *this is not a file asset.
+  // |proto_| must be set.
+  // Thread-safe.
+  absl::StatusOr<uint64_t> AppendReadChunks(uint64_t offset, void* data,
+                                            uint64_t size,
+                                            ChunkTransferList* chunks);
+
+  // Part of a file asset that is stored in a local chunk file.
+  struct ChunkFileRange {
+    // Path of the chunk file.
+    std::string path;
+
+    // Offset of the data in the chunk file.
+    uint64_t offset = 0;
+
+    // Size of the data.
+    uint64_t size = 0;
+  };
+
+  // For file assets, maps |size| bytes of the file, starting from |offset|, to
+  // the local chunk files that contain them, see
+  // DataStoreReader::GetChunkFilePath(). This allows serving reads without
+  // copying the data. Returns a NotFoundError if any of the chunks is not
+  // available as a local file, in which case Read() has to be used. Returns no
+  // ranges if |offset| >= file size.
+  // Returns an InvalidArugmentError if *this is not a file asset.
+  // |proto_| must be set.
+  // Thread-safe.
+  absl::Status GetChunkFileRanges(uint64_t offset, uint64_t size,
+                                  std::vector<ChunkFileRange>* ranges);
+
+  // Appends the ids of the indirect chunk and asset lists that were loaded so
+  // far to |ids|. Lists that were only prefetched are not included.
+  // |proto_| must be set.
+  // Thread-safe.
+  void AppendLoadedIndirectListIds(std::vector<ContentIdProto>* ids) const
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
   size_t GetNumFetchedFileChunkListsForTesting() ABSL_LOCKS_EXCLUDED(mutex_);
   size_t GetNumFetchedDirAssetsListsForTesting() ABSL_LOCKS_EXCLUDED(mutex_);
 
@@ -102,6 +157,13 @@ class Asset {
   bool IsConsistent(std::string* warning) const ABSL_LOCKS_EXCLUDED(mutex_);
 
  private:
+  // Requests all indirect chunk or asset lists that have not been fetched yet
+  // from |data_store_reader_| in a single batch, so that the lists are cached
+  // by the data store when they are loaded. Only runs once per proto. The
+  // lists are still parsed lazily when they are needed.
+  // |proto_| must be set.
+  void PrefetchIndirectLists() ABSL_LOCKS_EXCLUDED(mutex_);
+
   // Loads the next indirect directory asset list.
   // Returns true if a list was fetched.
   // Returns false if all lists have already been fetched.
@@ -119,10 +181,24 @@ class Asset {
   // |proto_| must be set.
   int FindChunkList(uint64_t offset);
 
-  // Returns the index of the chunk that |chunk_offset| falls into. The offsets
-  // in list |chunks| are interpreted relative to |chunk_list_offset|.
-  int FindChunk(const RepeatedChunkRefProto& chunks, uint64_t chunk_list_offset,
-                uint64_t chunk_offset);
+  // Compact offset index of the chunks of a chunk list. Avoids dereferencing
+  // chunk ref protos when mapping file offsets to chunks.
+  struct ChunkIndex {
+    // Absolute file offsets of the chunks, followed by the offset of the next
+    // chunk list or the file size, so that chunk i spans the range
+    // [offsets[i], offsets[i + 1]).
+    std::vector<uint64_t> offsets;
+
+    // Content ids of the chunks. They point into the chunk list protos.
+    std::vector<const ContentIdProto*> ids;
+
+    // Returns the number of chunks.
+    int size() const { return static_cast<int>(ids.size()); }
+
+    // Returns the index of the chunk that the absolute file |offset| falls
+    // into or -1 if |offset| is smaller than the offset of the first chunk.
+    int Find(uint64_t offset) const;
+  };
 
   // Gets the direct or an indirect chunk list. Fetches indirect chunk lists if
   // necessary. |list_idx| must be in [-1, number of indirect chunk lists].
@@ -135,6 +211,24 @@ class Asset {
   absl::StatusOr<const RepeatedChunkRefProto*> GetChunkRefList(int list_idx)
       ABSL_LOCKS_EXCLUDED(mutex_);
 
+  // Gets the index of the direct or an indirect chunk list. Builds the index
+  // on first use and fetches indirect chunk lists if necessary. Same semantics
+  // as GetChunkRefList() otherwise.
+  // |proto_| must be set.
+  absl::StatusOr<const ChunkIndex*> GetChunkIndex(int list_idx)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Appends a transfer task to |chunks| for each chunk that overlaps with the
+  // |prefetch_size| bytes starting from |offset|. The first |size| bytes are
+  // copied into |data| when the tasks are executed. |data| may be null if the
+  // tasks are not going to be executed. Returns the number of bytes that will
+  // be copied, which is smaller than |size| at the end of the file.
+  // |proto_| must be set.
+  absl::StatusOr<uint64_t> CollectChunks(uint64_t offset, void* data,
+                                         uint64_t size, uint64_t prefetch_size,
+                                         ChunkTransferList* chunks)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
   // Returns the absolute offset of the chunk list with index |list_idx|.
   // |list_idx| must be in [-1, number of indirect chunk lists]. -1 refers to
   // the direct chunk list, in which case 0 is returned. If |list_idx| equals
@@ -143,14 +237,6 @@ class Asset {
   // |proto_| must be set.
   uint64_t ChunkListOffset(int list_idx) const;
 
-  // Returns the chunk size of the chunk with index |chunk_idx| on the chunk
-  // list with index |list_idx| and corresponding proto |chunk_refs|.
-  // |list_idx| must be in [-1, number of indirect chunk lists - 1].
-  // |chunk_idx| must be in [0, chunk_refs->size()].
-  // |proto_| must be set.
-  uint64_t ChunkSize(int list_idx, int chunk_idx,
-                     const RepeatedChunkRefProto* chunk_refs);
-
   // Parent inode, for ".." in dir listings.
   ino_t parent_ino_ = 0;
 
@@ -172,6 +258,14 @@ class Asset {
   std::vector<std::unique_ptr<ChunkListProto>> file_chunk_lists_
       ABSL_GUARDED_BY(mutex_);
 
+  // Indexes of the chunk lists used so far. The index of the chunk list with
+  // index |list_idx| is stored at |list_idx| + 1. Unused lists are nullptrs.
+  std::vector<std::unique_ptr<ChunkIndex>> chunk_indexes_
+      ABSL_GUARDED_BY(mutex_);
+
+  // Whether PrefetchIndirectLists() ran for |proto_|.
+  std::atomic_bool indirect_lists_prefetched_{false};
+
   // Fetched |dir_indirect_assets| fields so far.
   std::vector<std::unique_ptr<AssetListProto>> dir_asset_lists_
       ABSL_GUARDED_BY(mutex_);
@@ -16,23 +16,56 @@
 
 #include <thread>
 
+#include "common/grpc_status.h"
 #include "common/log.h"
+#include "common/status.h"
+#include "common/status_macros.h"
 #include "common/stopwatch.h"
+#include "data_store/chunk_compression.h"
+#include "manifest/content_id.h"
 
 namespace cdc_ft {
 
 using GetContentRequest = proto::GetContentRequest;
 using GetContentResponse = proto::GetContentResponse;
+using StreamContentRequest = proto::StreamContentRequest;
+using StreamContentResponse = proto::StreamContentResponse;
 using SendCachedContentIdsRequest = proto::SendCachedContentIdsRequest;
 using SendCachedContentIdsResponse = proto::SendCachedContentIdsResponse;
 
 AssetStreamClient::AssetStreamClient(std::shared_ptr<grpc::Channel> channel,
-                                     bool enable_stats)
-    : enable_stats_(enable_stats) {
+                                     bool enable_stats, bool enable_compression)
+    : enable_stats_(enable_stats), enable_compression_(enable_compression) {
   stub_ = AssetStreamService::NewStub(std::move(channel));
 }
 
-AssetStreamClient::~AssetStreamClient() = default;
+AssetStreamClient::~AssetStreamClient() {
+  {
+    // Half-close the stream, so that the server finishes it without seeing a
+    // cancellation.
+    absl::MutexLock write_lock(&write_mutex_);
+    ContentStream* stream = nullptr;
+    {
+      absl::MutexLock lock(&mutex_);
+      if (stream_ && !stream_finished_) stream = stream_.get();
+    }
+    if (stream) stream->WritesDone();
+  }
+
+  std::unique_ptr<std::thread> stream_reader;
+  {
+    absl::MutexLock lock(&mutex_);
+    auto cond = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+      return !stream_ || stream_finished_;
+    };
+    if (!mutex_.AwaitWithTimeout(absl::Condition(&cond),
+                                 kStreamCloseTimeout)) {
+      stream_context_->TryCancel();
+    }
+    stream_reader = std::move(stream_reader_);
+  }
+  if (stream_reader && stream_reader->joinable()) stream_reader->join();
+}
 
 size_t TotalDataSize(const RepeatedStringProto& data) {
   size_t total_size = 0;
@@ -44,36 +77,30 @@ size_t TotalDataSize(const RepeatedStringProto& data) {
 
 absl::StatusOr<std::string> AssetStreamClient::GetContent(
     const ContentIdProto& id) {
-  GetContentRequest request;
-  *request.add_id() = id;
-  if (enable_stats_)
-    request.set_thread_id(thread_id_hash_(std::this_thread::get_id()));
-
-  grpc::ClientContext context;
-  GetContentResponse response;
-
-  Stopwatch sw;
-  grpc::Status status = stub_->GetContent(&context, request, &response);
-  LOG_DEBUG("GRPC TIME %0.3f sec for %u chunks with %u bytes",
-            sw.ElapsedSeconds(), response.data().size(),
-            TotalDataSize(response.data()));
-
-  if (!status.ok()) {
-    return absl::Status(static_cast<absl::StatusCode>(status.error_code()),
-                        status.error_message());
-  }
-  assert(response.data_size() == 1);
-  return std::move(*response.mutable_data(0));
+  RepeatedContentIdProto chunk_ids;
+  *chunk_ids.Add() = id;
+  RepeatedStringProto data;
+  ASSIGN_OR_RETURN(data, GetContent(std::move(chunk_ids)));
+  assert(data.size() == 1);
+  return std::move(data[0]);
 }
 
 absl::StatusOr<RepeatedStringProto> AssetStreamClient::GetContent(
     RepeatedContentIdProto chunk_ids) {
   if (chunk_ids.empty()) return RepeatedStringProto();
 
+  absl::StatusOr<RepeatedStringProto> data = StreamContent(chunk_ids);
+  if (!absl::IsUnimplemented(data.status())) return data;
+  return GetContentUnary(std::move(chunk_ids));
+}
+
+absl::StatusOr<RepeatedStringProto> AssetStreamClient::GetContentUnary(
+    RepeatedContentIdProto chunk_ids) {
   GetContentRequest request;
   *request.mutable_id() = std::move(chunk_ids);
   if (enable_stats_)
     request.set_thread_id(thread_id_hash_(std::this_thread::get_id()));
+  request.set_accept_compressed(enable_compression_);
 
   grpc::ClientContext context;
   GetContentResponse response;
@@ -88,9 +115,157 @@ absl::StatusOr<RepeatedStringProto> AssetStreamClient::GetContent(
   LOG_DEBUG("GRPC TIME %0.3f sec for %zu bytes", sw.ElapsedSeconds(),
             TotalDataSize(response.data()));
 
+  for (int n = 0; n < response.compressed_size(); ++n) {
+    if (!response.compressed(n)) continue;
+    std::string* data = response.mutable_data(n);
+    std::string decompressed;
+    RETURN_IF_ERROR(
+        chunk_compression::Decompress(data->data(), data->size(),
+                                      &decompressed),
+        "Failed to decompress chunk '%s'",
+        ContentId::ToHexString(request.id(n)));
+    *data = std::move(decompressed);
+  }
   return std::move(*response.mutable_data());
 }
 
+absl::StatusOr<RepeatedStringProto> AssetStreamClient::StreamContent(
+    const RepeatedContentIdProto& chunk_ids) {
+  Stopwatch sw;
+  PendingBatch batch(chunk_ids.size());
+  uint64_t thread_id =
+      enable_stats_ ? thread_id_hash_(std::this_thread::get_id()) : 0;
+  {
+    // Writes might block due to flow control, e.g. while the server has too
+    // many requests in flight. |mutex_| must not be held while writing, since
+    // the reader thread needs it to complete requests and to drain responses.
+    // |write_mutex_| serializes the writers and keeps the stream alive while
+    // it is used.
+    absl::MutexLock write_lock(&write_mutex_);
+    ContentStream* stream;
+    std::vector<StreamContentRequest> requests(chunk_ids.size());
+    {
+      absl::MutexLock lock(&mutex_);
+      if (!streaming_supported_) {
+        return absl::UnimplementedError("Content streaming is not supported");
+      }
+      EnsureStreamStarted();
+      stream = stream_.get();
+
+      // Register all requests before sending them. If the stream breaks, the
+      // reader thread fails all registered requests.
+      for (int n = 0; n < chunk_ids.size(); ++n) {
+        StreamContentRequest& request = requests[n];
+        request.set_request_id(next_request_id_++);
+        *request.mutable_id() = chunk_ids[n];
+        request.set_thread_id(thread_id);
+        request.set_accept_compressed(enable_compression_);
+        pending_[request.request_id()] = PendingChunk{&batch, n};
+      }
+      batch.remaining = chunk_ids.size();
+    }
+
+    for (const StreamContentRequest& request : requests) {
+      if (!stream->Write(request)) break;
+    }
+  }
+
+  {
+    absl::MutexLock lock(&mutex_);
+    auto cond = [&batch]() { return batch.remaining == 0; };
+    mutex_.Await(absl::Condition(&cond));
+  }
+
+  RepeatedStringProto data;
+  data.Reserve(chunk_ids.size());
+  for (int n = 0; n < chunk_ids.size(); ++n) {
+    const absl::Status& status = batch.status[n];
+    if (absl::IsUnimplemented(status)) return status;
+    if (!status.ok()) {
+      return WrapStatus(status, "Failed to stream chunk '%s'",
+                        ContentId::ToHexString(chunk_ids[n]));
+    }
+    *data.Add() = std::move(batch.data[n]);
+  }
+  LOG_DEBUG("GRPC TIME %0.3f sec for %u streamed chunks with %zu bytes",
+            sw.ElapsedSeconds(), data.size(), TotalDataSize(data));
+  return data;
+}
+
+void AssetStreamClient::EnsureStreamStarted() {
+  if (stream_ && !stream_finished_) return;
+
+  // The reader thread of a previous stream has already finished its work
+  // when |stream_finished_| was set.
+  if (stream_reader_) {
+    if (stream_reader_->joinable()) stream_reader_->join();
+    stream_reader_.reset();
+  }
+  stream_.reset();
+  stream_context_ = std::make_unique<grpc::ClientContext>();
+  stream_ = stub_->StreamContent(stream_context_.get());
+  stream_finished_ = false;
+  stream_reader_ = std::make_unique<std::thread>(
+      [this, stream = stream_.get()]() { StreamReaderThreadMain(stream); });
+}
+
+void AssetStreamClient::StreamReaderThreadMain(ContentStream* stream) {
+  StreamContentResponse response;
+  while (stream->Read(&response)) {
+    std::string data;
+    absl::Status status;
+    if (response.error_code() != 0) {
+      status = absl::Status(
+          static_cast<absl::StatusCode>(response.error_code()),
+          response.error_message());
+    } else if (response.compressed()) {
+      status = chunk_compression::Decompress(response.data().data(),
+                                             response.data().size(), &data);
+    } else {
+      data = std::move(*response.mutable_data());
+    }
+
+    absl::MutexLock lock(&mutex_);
+    auto it = pending_.find(response.request_id());
+    if (it == pending_.end()) {
+      LOG_WARNING("Received response for unknown request id %u",
+                  response.request_id());
+      continue;
+    }
+    CompleteChunk(it->second, std::move(data), status);
+    pending_.erase(it);
+  }
+
+  // Finish() must not run concurrently with other operations on the stream.
+  // Writers fail fast once the stream is broken, so they release
+  // |write_mutex_| soon.
+  absl::MutexLock write_lock(&write_mutex_);
+  absl::MutexLock lock(&mutex_);
+  absl::Status status = ToAbslStatus(stream->Finish());
+  if (absl::IsUnimplemented(status)) {
+    LOG_INFO("Server does not support content streaming, using unary calls");
+    streaming_supported_ = false;
+  } else if (status.ok()) {
+    status = absl::UnavailableError("Content stream was closed by the server");
+  } else {
+    LOG_WARNING("Content stream terminated: %s", status.ToString());
+  }
+  for (auto& [request_id, chunk] : pending_) {
+    CompleteChunk(chunk, std::string(), status);
+  }
+  pending_.clear();
+  stream_finished_ = true;
+}
+
+void AssetStreamClient::CompleteChunk(const PendingChunk& chunk,
+                                      std::string data, absl::Status status) {
+  PendingBatch* batch = chunk.batch;
+  batch->data[chunk.index] = std::move(data);
+  batch->status[chunk.index] = std::move(status);
+  assert(batch->remaining > 0);
+  --batch->remaining;
+}
+
 absl::Status AssetStreamClient::SendCachedContentIds(
     std::vector<ContentIdProto> content_ids) {
   SendCachedContentIdsRequest request;
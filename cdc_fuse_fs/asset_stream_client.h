@@ -20,8 +20,12 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <unordered_map>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "grpcpp/channel.h"
 #include "manifest/manifest_proto_defs.h"
 #include "proto/asset_stream_service.grpc.pb.h"
@@ -34,15 +38,28 @@ namespace cdc_ft {
 
 // gRpc client for streaming assets to a gamelets. The client runs inside the
 // CDC Fuse filesystem and requests chunks from the workstation.
+//
+// Chunks are requested through a single bidirectional stream that is shared by
+// all threads, so that many chunk requests can be in flight at the same time.
+// Falls back to unary GetContent() calls if the server does not support
+// streaming. Thread-safe.
 class AssetStreamClient {
  public:
   // |channel| is a grpc channel to use.
   // |enable_stats| determines whether additional statistics are sent.
-  AssetStreamClient(std::shared_ptr<grpc::Channel> channel, bool enable_stats);
+  // |enable_compression| determines whether the server may send compressed
+  // chunks.
+  AssetStreamClient(std::shared_ptr<grpc::Channel> channel, bool enable_stats,
+                    bool enable_compression);
+
+  // Closes the content stream. Cancels it if the server does not finish it
+  // within |kStreamCloseTimeout|.
   ~AssetStreamClient();
 
   // Gets the content of the chunk with given |id|.
   absl::StatusOr<std::string> GetContent(const ContentIdProto& id);
+
+  // Gets the contents of the chunks with given |chunk_ids|, in the same order.
   absl::StatusOr<RepeatedStringProto> GetContent(
       RepeatedContentIdProto chunk_ids);
 
@@ -51,10 +68,71 @@ class AssetStreamClient {
   absl::Status SendCachedContentIds(std::vector<ContentIdProto> content_ids);
 
  private:
+  // Time the server has to finish the content stream on shutdown.
+  static constexpr absl::Duration kStreamCloseTimeout = absl::Seconds(1);
+
   using AssetStreamService = proto::AssetStreamService;
+  using ContentStream =
+      grpc::ClientReaderWriter<proto::StreamContentRequest,
+                               proto::StreamContentResponse>;
+
+  // Chunks requested by a single StreamContent() call.
+  struct PendingBatch {
+    explicit PendingBatch(int size) : data(size), status(size) {}
+
+    std::vector<std::string> data;
+    std::vector<absl::Status> status;
+    // Number of chunks that have not been received yet.
+    int remaining = 0;
+  };
+
+  // A chunk request that has been sent but not been answered yet.
+  struct PendingChunk {
+    PendingBatch* batch;
+    int index;
+  };
+
+  // Requests |chunk_ids| with a unary GetContent() call.
+  absl::StatusOr<RepeatedStringProto> GetContentUnary(
+      RepeatedContentIdProto chunk_ids);
+
+  // Requests |chunk_ids| through the content stream. Returns an Unimplemented
+  // error if the server does not support streaming.
+  absl::StatusOr<RepeatedStringProto> StreamContent(
+      const RepeatedContentIdProto& chunk_ids)
+      ABSL_LOCKS_EXCLUDED(write_mutex_, mutex_);
+
+  // Opens the content stream and starts the response reader thread if the
+  // stream is not open yet.
+  void EnsureStreamStarted()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(write_mutex_, mutex_);
+
+  // Reads responses from |stream| and completes pending requests. Fails all
+  // remaining requests when the stream terminates.
+  void StreamReaderThreadMain(ContentStream* stream)
+      ABSL_LOCKS_EXCLUDED(write_mutex_, mutex_);
+
+  // Marks |chunk| as completed with the given |data| and |status|.
+  void CompleteChunk(const PendingChunk& chunk, std::string data,
+                     absl::Status status) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   std::unique_ptr<AssetStreamService::Stub> stub_;
   bool enable_stats_;
+  bool enable_compression_;
   std::hash<std::thread::id> thread_id_hash_;
+
+  // Serializes writes to the content stream. Must be acquired before |mutex_|.
+  absl::Mutex write_mutex_ ABSL_ACQUIRED_BEFORE(mutex_);
+  absl::Mutex mutex_;
+  std::unique_ptr<grpc::ClientContext> stream_context_ ABSL_GUARDED_BY(mutex_);
+  std::unique_ptr<ContentStream> stream_ ABSL_GUARDED_BY(mutex_);
+  std::unique_ptr<std::thread> stream_reader_ ABSL_GUARDED_BY(mutex_);
+  // Set by the reader thread when the stream has terminated.
+  bool stream_finished_ ABSL_GUARDED_BY(mutex_) = false;
+  // Cleared if the server does not implement StreamContent().
+  bool streaming_supported_ ABSL_GUARDED_BY(mutex_) = true;
+  uint64_t next_request_id_ ABSL_GUARDED_BY(mutex_) = 0;
+  std::unordered_map<uint64_t, PendingChunk> pending_ ABSL_GUARDED_BY(mutex_);
 };
 
 }  // namespace cdc_ft
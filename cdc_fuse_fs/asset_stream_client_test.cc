@@ -0,0 +1,201 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cdc_fuse_fs/asset_stream_client.h"
+
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "common/status_test_macros.h"
+#include "grpcpp/grpcpp.h"
+#include "gtest/gtest.h"
+#include "manifest/content_id.h"
+
+namespace cdc_ft {
+namespace {
+
+// Serves chunks from memory. Streaming can be disabled or broken on purpose.
+class FakeAssetStreamService : public proto::AssetStreamService::Service {
+ public:
+  // Adds a chunk with the given |data| and returns its id.
+  ContentIdProto AddChunk(const std::string& data) {
+    ContentIdProto id = ContentId::FromDataString(data);
+    chunks_[id] = data;
+    return id;
+  }
+
+  grpc::Status GetContent(grpc::ServerContext* context,
+                          const proto::GetContentRequest* request,
+                          proto::GetContentResponse* response) override {
+    ++num_unary_calls_;
+    for (const ContentIdProto& id : request->id()) {
+      auto it = chunks_.find(id);
+      if (it == chunks_.end()) {
+        return grpc::Status(grpc::StatusCode::NOT_FOUND, "Unknown chunk");
+      }
+      response->add_data(it->second);
+    }
+    return grpc::Status::OK;
+  }
+
+  grpc::Status StreamContent(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<proto::StreamContentResponse,
+                               proto::StreamContentRequest>* stream) override {
+    ++num_streams_;
+    if (!streaming_supported_) {
+      return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "Not implemented");
+    }
+
+    proto::StreamContentRequest request;
+    while (stream->Read(&request)) {
+      if (break_next_stream_.exchange(false)) {
+        return grpc::Status(grpc::StatusCode::UNAVAILABLE, "Stream broke");
+      }
+      proto::StreamContentResponse response;
+      response.set_request_id(request.request_id());
+      auto it = chunks_.find(request.id());
+      if (it != chunks_.end()) {
+        response.set_data(it->second);
+      } else {
+        response.set_error_code(static_cast<int>(absl::StatusCode::kNotFound));
+        response.set_error_message("Unknown chunk");
+      }
+      if (!stream->Write(response)) break;
+    }
+    if (context->IsCancelled()) ++num_cancelled_streams_;
+    return grpc::Status::OK;
+  }
+
+  void SetStreamingSupported(bool supported) {
+    streaming_supported_ = supported;
+  }
+
+  // Makes the next stream fail after it received the first request.
+  void BreakNextStream() { break_next_stream_ = true; }
+
+  int NumUnaryCalls() const { return num_unary_calls_; }
+  int NumStreams() const { return num_streams_; }
+  int NumCancelledStreams() const { return num_cancelled_streams_; }
+
+ private:
+  std::unordered_map<ContentIdProto, std::string> chunks_;
+  std::atomic<bool> streaming_supported_{true};
+  std::atomic<bool> break_next_stream_{false};
+  std::atomic<int> num_unary_calls_{0};
+  std::atomic<int> num_streams_{0};
+  std::atomic<int> num_cancelled_streams_{0};
+};
+
+class AssetStreamClientTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    for (int n = 0; n < kNumChunks; ++n) {
+      data_.push_back(absl::StrFormat("chunk %i", n));
+      *ids_.Add() = service_.AddChunk(data_.back());
+    }
+
+    grpc::ServerBuilder builder;
+    builder.RegisterService(&service_);
+    server_ = builder.BuildAndStart();
+    ASSERT_TRUE(server_);
+    client_ = std::make_unique<AssetStreamClient>(
+        server_->InProcessChannel(grpc::ChannelArguments()),
+        /*enable_stats=*/false, /*enable_compression=*/false);
+  }
+
+  void TearDown() override {
+    client_.reset();
+    server_->Shutdown();
+  }
+
+ protected:
+  static constexpr int kNumChunks = 200;
+
+  // Requests all chunks and verifies their data.
+  void ExpectGetAllChunks() {
+    absl::StatusOr<RepeatedStringProto> data = client_->GetContent(ids_);
+    ASSERT_OK(data);
+    ASSERT_EQ(data->size(), kNumChunks);
+    for (int n = 0; n < kNumChunks; ++n) EXPECT_EQ((*data)[n], data_[n]);
+  }
+
+  FakeAssetStreamService service_;
+  std::unique_ptr<grpc::Server> server_;
+  std::unique_ptr<AssetStreamClient> client_;
+  std::vector<std::string> data_;
+  RepeatedContentIdProto ids_;
+};
+
+TEST_F(AssetStreamClientTest, StreamContentRoundTrip) {
+  ExpectGetAllChunks();
+
+  absl::StatusOr<std::string> data = client_->GetContent(ids_[42]);
+  ASSERT_OK(data);
+  EXPECT_EQ(*data, data_[42]);
+
+  // A missing chunk fails the request, but not the stream.
+  RepeatedContentIdProto missing_ids = ids_;
+  *missing_ids.Add() = ContentId::FromDataString(std::string("missing"));
+  EXPECT_TRUE(absl::IsNotFound(client_->GetContent(missing_ids).status()));
+  ExpectGetAllChunks();
+
+  EXPECT_EQ(service_.NumStreams(), 1);
+  EXPECT_EQ(service_.NumUnaryCalls(), 0);
+}
+
+TEST_F(AssetStreamClientTest, ConcurrentStreamContent) {
+  std::vector<std::thread> threads;
+  for (int n = 0; n < 8; ++n) {
+    threads.emplace_back([this]() {
+      for (int k = 0; k < 10; ++k) ExpectGetAllChunks();
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  EXPECT_EQ(service_.NumStreams(), 1);
+}
+
+TEST_F(AssetStreamClientTest, FallsBackToUnaryIfStreamingIsUnimplemented) {
+  service_.SetStreamingSupported(false);
+  ExpectGetAllChunks();
+  ExpectGetAllChunks();
+
+  // Streaming is not tried again.
+  EXPECT_EQ(service_.NumStreams(), 1);
+  EXPECT_EQ(service_.NumUnaryCalls(), 2);
+}
+
+TEST_F(AssetStreamClientTest, ReopensBrokenStream) {
+  service_.BreakNextStream();
+  EXPECT_TRUE(absl::IsUnavailable(client_->GetContent(ids_).status()));
+
+  ExpectGetAllChunks();
+  EXPECT_EQ(service_.NumStreams(), 2);
+  EXPECT_EQ(service_.NumUnaryCalls(), 0);
+}
+
+TEST_F(AssetStreamClientTest, ShutdownClosesStreamCleanly) {
+  ExpectGetAllChunks();
+
+  // The client half-closes the stream and waits for the server to finish it.
+  client_.reset();
+  EXPECT_EQ(service_.NumStreams(), 1);
+  EXPECT_EQ(service_.NumCancelledStreams(), 0);
+}
+
+}  // namespace
+}  // namespace cdc_ft
@@ -14,16 +14,42 @@
 
 #include "cdc_fuse_fs/asset.h"
 
+#include <cstdio>
+#include <random>
+
 #include "absl/strings/match.h"
 #include "common/buffer.h"
 #include "common/path.h"
 #include "common/status_test_macros.h"
+#include "common/stopwatch.h"
+#include "data_store/data_store_reader.h"
 #include "data_store/mem_data_store.h"
 #include "gtest/gtest.h"
 
 namespace cdc_ft {
 namespace {
 
+// MemDataStore that records the number of prefetch tasks of each Get() call
+// for multiple chunks.
+class PrefetchCountingDataStore : public MemDataStore {
+ public:
+  absl::Status Get(ChunkTransferList* chunks) override {
+    size_t num_prefetches = 0;
+    for (const ChunkTransferTask& chunk : *chunks) {
+      if (!chunk.size) ++num_prefetches;
+    }
+    prefetch_counts_.push_back(num_prefetches);
+    return MemDataStore::Get(chunks);
+  }
+
+  const std::vector<size_t>& prefetch_counts() const {
+    return prefetch_counts_;
+  }
+
+ private:
+  std::vector<size_t> prefetch_counts_;
+};
+
 class AssetTest : public ::testing::Test {
  public:
   AssetTest()
@@ -66,6 +92,32 @@ class AssetTest : public ::testing::Test {
     *offset += indirect_list_offset;
   }
 
+  // Creates a file of |num_lists| indirect chunk lists with |chunks_per_list|
+  // chunks each. Chunks are between 0 and |max_chunk_size| bytes large, byte
+  // n of the file has the value n % 256. Returns the file data.
+  std::vector<char> AddRandomChunks(int num_lists, int chunks_per_list,
+                                    size_t max_chunk_size) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<size_t> size_dist(0, max_chunk_size);
+    std::vector<char> file_data;
+    uint64_t offset = 0;
+    for (int list_idx = 0; list_idx < num_lists; ++list_idx) {
+      std::vector<std::vector<char>> data_vec(chunks_per_list);
+      for (std::vector<char>& data : data_vec) {
+        data.resize(size_dist(rng));
+        for (char& c : data) {
+          c = static_cast<char>(file_data.size());
+          file_data.push_back(c);
+        }
+      }
+      AddIndirectChunks(std::move(data_vec), &offset,
+                        proto_.mutable_file_indirect_chunks());
+    }
+    proto_.set_file_size(offset);
+    proto_.set_type(AssetProto::FILE);
+    return file_data;
+  }
+
   // Checks if the given list |protos| contains an asset having |name|.
   static bool ContainsAsset(const std::vector<const AssetProto*>& protos,
                             const std::string& name) {
@@ -74,7 +126,7 @@ class AssetTest : public ::testing::Test {
            }) != protos.end();
   }
 
-  MemDataStore store_;
+  PrefetchCountingDataStore store_;
   AssetProto proto_;
   Asset asset_;
 
@@ -303,6 +355,23 @@ TEST_F(AssetTest, ReadDirectSucceeds) {
   EXPECT_TRUE(asset_.IsConsistent(&asset_check_));
 }
 
+TEST_F(AssetTest, GetChunkFileRangesWithoutChunkFilesFails) {
+  uint64_t offset = 0;
+  AddChunks({{1, 2}, {3, 4}}, &offset, proto_.mutable_file_chunks());
+  proto_.set_file_size(offset);
+  proto_.set_type(AssetProto::FILE);
+
+  asset_.Initialize(kParentIno, &store_, &proto_);
+
+  // MemDataStore does not store chunks in files.
+  std::vector<Asset::ChunkFileRange> ranges;
+  EXPECT_TRUE(absl::IsNotFound(asset_.GetChunkFileRanges(1, 2, &ranges)));
+
+  // Nothing to map beyond the end of the file.
+  EXPECT_OK(asset_.GetChunkFileRanges(4, 2, &ranges));
+  EXPECT_TRUE(ranges.empty());
+}
+
 TEST_F(AssetTest, ReadIndirectSucceeds) {
   uint64_t offset = 0;
   AddChunks({{1, 2}}, &offset, proto_.mutable_file_chunks());
@@ -407,6 +476,73 @@ TEST_F(AssetTest, ReadFetchesIndirectListsLazily) {
   EXPECT_TRUE(asset_.IsConsistent(&asset_check_));
 }
 
+TEST_F(AssetTest, ReadPrefetchesIndirectListsInOneBatch) {
+  uint64_t offset = 0;
+  AddChunks({{0, 1, 2}}, &offset, proto_.mutable_file_chunks());
+  AddIndirectChunks({{3}}, &offset, proto_.mutable_file_indirect_chunks());
+  AddIndirectChunks({{4, 5, 6}, {7}}, &offset,
+                    proto_.mutable_file_indirect_chunks());
+  AddIndirectChunks({{8, 9}}, &offset, proto_.mutable_file_indirect_chunks());
+  proto_.set_file_size(offset);
+  proto_.set_type(AssetProto::FILE);
+
+  asset_.Initialize(kParentIno, &store_, &proto_);
+
+  // The first read requests all indirect lists at once, followed by the read
+  // itself. The lists are not loaded yet.
+  std::vector<char> data(10);
+  EXPECT_OK(asset_.Read(0, data.data(), 3));
+  EXPECT_EQ(store_.prefetch_counts(), std::vector<size_t>({3, 0}));
+  EXPECT_EQ(asset_.GetNumFetchedFileChunkListsForTesting(), 0);
+
+  // Subsequent reads don't prefetch again.
+  EXPECT_OK(asset_.Read(8, data.data(), 1));
+  EXPECT_EQ(store_.prefetch_counts(), std::vector<size_t>({3, 0, 0}));
+  EXPECT_EQ(asset_.GetNumFetchedFileChunkListsForTesting(), 1);
+}
+
+TEST_F(AssetTest, LookupPrefetchesIndirectListsInOneBatch) {
+  for (size_t n = 0; n < kNumChildProtos; ++n) {
+    AssetListProto list;
+    *list.add_assets() = child_protos_[n];
+    *proto_.add_dir_indirect_assets() = store_.AddProto(list);
+  }
+  proto_.set_type(AssetProto::DIRECTORY);
+
+  asset_.Initialize(kParentIno, &store_, &proto_);
+  absl::StatusOr<const AssetProto*> proto =
+      asset_.Lookup(child_protos_[0].name().c_str());
+  ASSERT_OK(proto);
+  EXPECT_EQ(*proto, asset_.GetLoadedChildProtos()[0]);
+  EXPECT_EQ(store_.prefetch_counts(), std::vector<size_t>({kNumChildProtos}));
+  EXPECT_EQ(asset_.GetNumFetchedDirAssetsListsForTesting(), 1);
+
+  ASSERT_OK(asset_.GetAllChildProtos());
+  EXPECT_EQ(store_.prefetch_counts(), std::vector<size_t>({kNumChildProtos}));
+  EXPECT_EQ(asset_.GetNumFetchedDirAssetsListsForTesting(), kNumChildProtos);
+}
+
+TEST_F(AssetTest, AppendLoadedIndirectListIdsSkipsUnloadedLists) {
+  uint64_t offset = 0;
+  AddIndirectChunks({{0, 1}}, &offset, proto_.mutable_file_indirect_chunks());
+  AddIndirectChunks({{2}}, &offset, proto_.mutable_file_indirect_chunks());
+  AddIndirectChunks({{3}}, &offset, proto_.mutable_file_indirect_chunks());
+  proto_.set_file_size(offset);
+  proto_.set_type(AssetProto::FILE);
+
+  asset_.Initialize(kParentIno, &store_, &proto_);
+  std::vector<ContentIdProto> ids;
+  asset_.AppendLoadedIndirectListIds(&ids);
+  EXPECT_TRUE(ids.empty());
+
+  // Prefetched lists are not included, only the one that was read.
+  std::vector<char> data(1);
+  EXPECT_OK(asset_.Read(2, data.data(), 1));
+  asset_.AppendLoadedIndirectListIds(&ids);
+  EXPECT_EQ(ids, std::vector<ContentIdProto>(
+                     {proto_.file_indirect_chunks(1).chunk_list_id()}));
+}
+
 TEST_F(AssetTest, ReadEmptySucceeds) {
   asset_.Initialize(kParentIno, &store_, &proto_);
   proto_.set_type(AssetProto::FILE);
@@ -566,6 +702,54 @@ TEST_F(AssetTest, ReadWithOffsetAndSizeSucceeds) {
   }
 }
 
+TEST_F(AssetTest, ReadManyChunksAtRandomOffsetsSucceeds) {
+  std::vector<char> file_data = AddRandomChunks(4, 250, 16);
+  asset_.Initialize(kParentIno, &store_, &proto_);
+
+  std::mt19937 rng(2);
+  std::uniform_int_distribution<uint64_t> offset_dist(0, file_data.size());
+  std::uniform_int_distribution<uint64_t> size_dist(0, 64);
+  for (int n = 0; n < 1000; ++n) {
+    uint64_t offset = offset_dist(rng);
+    std::vector<char> data(size_dist(rng));
+    absl::StatusOr<uint64_t> bytes_read =
+        asset_.Read(offset, data.data(), data.size());
+    ASSERT_OK(bytes_read);
+    uint64_t expected_size =
+        std::min<uint64_t>(data.size(), file_data.size() - offset);
+    ASSERT_EQ(*bytes_read, expected_size);
+    EXPECT_TRUE(std::equal(data.begin(), data.begin() + expected_size,
+                           file_data.begin() + offset))
+        << "offset " << offset << ", size " << data.size();
+  }
+  EXPECT_TRUE(asset_.IsConsistent(&asset_check_));
+}
+
+// Microbenchmark for mapping random file offsets to chunks. Run with
+// --gtest_also_run_disabled_tests --gtest_filter=*RandomOffsetBenchmark.
+TEST_F(AssetTest, DISABLED_RandomOffsetBenchmark) {
+  constexpr int kNumLists = 16;
+  constexpr int kChunksPerList = 32 * 1024;
+  constexpr int kNumReads = 1000000;
+  std::vector<char> file_data =
+      AddRandomChunks(kNumLists, kChunksPerList, /*max_chunk_size=*/64);
+  asset_.Initialize(kParentIno, &store_, &proto_);
+
+  std::mt19937 rng(3);
+  std::uniform_int_distribution<uint64_t> offset_dist(0,
+                                                      file_data.size() - 1);
+  ChunkTransferList chunks;
+  Stopwatch sw;
+  for (int n = 0; n < kNumReads; ++n) {
+    chunks.clear();
+    ASSERT_OK(
+        asset_.AppendReadChunks(offset_dist(rng), nullptr, 1, &chunks));
+  }
+  printf("%i random chunk lookups in %i chunks took %0.1f ns each\n",
+         kNumReads, kNumLists * kChunksPerList,
+         sw.ElapsedSeconds() * 1e9 / kNumReads);
+}
+
 TEST_F(AssetTest, UpdateProtoWithEmptyAssetSucceeds) {
   proto_.set_type(AssetProto::DIRECTORY);
   // Put all children into the direct asset list.
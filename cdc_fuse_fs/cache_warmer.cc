@@ -0,0 +1,245 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cdc_fuse_fs/cache_warmer.h"
+
+#include <algorithm>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/strip.h"
+#include "common/log.h"
+#include "common/path.h"
+#include "common/status.h"
+#include "common/status_macros.h"
+#include "manifest/content_id.h"
+
+namespace cdc_ft {
+namespace {
+
+// Threadpool task that fetches a batch of chunks into the cache.
+class PrefetchTask : public Task {
+ public:
+  PrefetchTask(DataStoreReader* data_store_reader, ChunkTransferList chunks)
+      : data_store_reader_(data_store_reader), chunks_(std::move(chunks)) {}
+
+  // Task:
+  void ThreadRun(IsCancelledPredicate is_cancelled) override {
+    status_ = data_store_reader_->Get(&chunks_);
+    if (status_.ok() && !chunks_.PrefetchDone()) {
+      status_ = absl::NotFoundError(absl::StrFormat(
+          "Failed to fetch chunks %s", chunks_.UndoneToHexString()));
+    }
+  }
+
+  const absl::Status& Status() const { return status_; }
+
+ private:
+  DataStoreReader* const data_store_reader_;
+  ChunkTransferList chunks_;
+  absl::Status status_;
+};
+
+// Directory that is visited by WarmUp().
+struct Dir {
+  std::string rel_path;
+  AssetProto proto;
+};
+
+}  // namespace
+
+CacheWarmer::CacheWarmer(DataStoreReader* data_store_reader,
+                         std::vector<std::string> data_paths,
+                         MetadataCallback metadata_callback, size_t num_threads)
+    : data_store_reader_(data_store_reader),
+      data_paths_(std::move(data_paths)),
+      metadata_callback_(std::move(metadata_callback)),
+      pool_(num_threads) {
+  // Strip slashes, so that paths can be compared with relative paths.
+  for (std::string& data_path : data_paths_) {
+    data_path = std::string(absl::StripSuffix(
+        absl::StripPrefix(absl::StripAsciiWhitespace(data_path), "/"), "/"));
+  }
+}
+
+CacheWarmer::~CacheWarmer() { Stop(); }
+
+absl::StatusOr<CacheWarmer::Statistics> CacheWarmer::WarmUp(
+    const ContentIdProto& manifest_id) {
+  Statistics stats;
+  std::vector<ContentIdProto> metadata_ids;
+  ManifestProto manifest;
+  RETURN_IF_ERROR(data_store_reader_->GetProto(manifest_id, &manifest),
+                  "Failed to get manifest '%s'",
+                  ContentId::ToHexString(manifest_id));
+  metadata_ids.push_back(manifest_id);
+
+  // Visit the directory tree level by level, so that the lists of all
+  // directories on a level can be fetched together.
+  std::vector<Dir> dirs(1);
+  dirs[0].proto.Swap(manifest.mutable_root_dir());
+  absl::Status status;
+  while (!dirs.empty() && status.ok()) {
+    std::vector<ContentIdProto> list_ids;
+    for (const Dir& dir : dirs) {
+      list_ids.insert(list_ids.end(), dir.proto.dir_indirect_assets().begin(),
+                      dir.proto.dir_indirect_assets().end());
+    }
+    status = Prefetch(list_ids);
+    if (!status.ok()) break;
+    metadata_ids.insert(metadata_ids.end(), list_ids.begin(), list_ids.end());
+
+    // Move the assets of the lists into their directories.
+    for (Dir& dir : dirs) {
+      for (const ContentIdProto& id : dir.proto.dir_indirect_assets()) {
+        AssetListProto list;
+        status = data_store_reader_->GetProto(id, &list);
+        if (!status.ok()) break;
+        for (AssetProto& asset : *list.mutable_assets()) {
+          dir.proto.add_dir_assets()->Swap(&asset);
+        }
+      }
+      if (!status.ok()) break;
+    }
+    if (!status.ok()) break;
+
+    // Collect the subdirectories and the chunks of the files.
+    std::vector<Dir> subdirs;
+    std::vector<const AssetProto*> data_files;
+    list_ids.clear();
+    for (Dir& dir : dirs) {
+      for (AssetProto& asset : *dir.proto.mutable_dir_assets()) {
+        std::string rel_path = path::JoinUnix(dir.rel_path, asset.name());
+        if (asset.type() == AssetProto::DIRECTORY) {
+          subdirs.emplace_back();
+          subdirs.back().rel_path = std::move(rel_path);
+          subdirs.back().proto.Swap(&asset);
+        } else if (asset.type() == AssetProto::FILE) {
+          for (const IndirectChunkListProto& list :
+               asset.file_indirect_chunks()) {
+            list_ids.push_back(list.chunk_list_id());
+          }
+          if (IsDataPath(rel_path)) data_files.push_back(&asset);
+        }
+      }
+    }
+    status = Prefetch(list_ids);
+    if (!status.ok()) break;
+    metadata_ids.insert(metadata_ids.end(), list_ids.begin(), list_ids.end());
+
+    // Fetch the data after the metadata of the level.
+    std::vector<ContentIdProto> data_ids;
+    for (const AssetProto* file : data_files) {
+      for (const ChunkRefProto& chunk : file->file_chunks()) {
+        data_ids.push_back(chunk.chunk_id());
+      }
+      for (const IndirectChunkListProto& list : file->file_indirect_chunks()) {
+        ChunkListProto chunks;
+        status = data_store_reader_->GetProto(list.chunk_list_id(), &chunks);
+        if (!status.ok()) break;
+        for (const ChunkRefProto& chunk : chunks.chunks()) {
+          data_ids.push_back(chunk.chunk_id());
+        }
+      }
+      if (!status.ok()) break;
+    }
+    if (!status.ok()) break;
+    status = Prefetch(data_ids);
+    if (!status.ok()) break;
+    stats.data_chunks += data_ids.size();
+
+    dirs.swap(subdirs);
+  }
+
+  // Report the metadata that was fetched, even if not all of it was.
+  stats.metadata_chunks = metadata_ids.size();
+  if (metadata_callback_) metadata_callback_(std::move(metadata_ids));
+  RETURN_IF_ERROR(status, "Failed to warm up cache for manifest '%s'",
+                  ContentId::ToHexString(manifest_id));
+  return stats;
+}
+
+void CacheWarmer::Start(const ContentIdProto& manifest_id) {
+  Stop();
+  absl::MutexLock lock(&mutex_);
+  cancelled_ = false;
+  thread_ = std::make_unique<std::thread>([this, manifest_id]() {
+    absl::StatusOr<Statistics> stats = WarmUp(manifest_id);
+    if (stats.ok()) {
+      LOG_INFO(
+          "Warmed up cache for manifest '%s': %u metadata chunks, %u data "
+          "chunks",
+          ContentId::ToHexString(manifest_id), stats->metadata_chunks,
+          stats->data_chunks);
+    } else if (!absl::IsCancelled(stats.status())) {
+      LOG_WARNING("%s", stats.status().ToString());
+    }
+  });
+}
+
+void CacheWarmer::Stop() {
+  absl::MutexLock lock(&mutex_);
+  if (!thread_) return;
+  cancelled_ = true;
+  thread_->join();
+  thread_.reset();
+}
+
+bool CacheWarmer::IsDataPath(const std::string& rel_path) const {
+  for (const std::string& data_path : data_paths_) {
+    if (data_path.empty() || rel_path == data_path ||
+        (absl::StartsWith(rel_path, data_path) &&
+         rel_path[data_path.size()] == '/')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+absl::Status CacheWarmer::Prefetch(const std::vector<ContentIdProto>& ids) {
+  absl::Status status;
+  size_t num_pending = 0;
+  auto wait_for_task = [this, &status, &num_pending]() {
+    std::unique_ptr<Task> task = pool_.GetCompletedTask();
+    --num_pending;
+    const absl::Status& task_status =
+        static_cast<PrefetchTask*>(task.get())->Status();
+    if (status.ok() && !task_status.ok()) status = task_status;
+  };
+
+  for (size_t begin = 0; begin < ids.size() && status.ok() && !cancelled_;
+       begin += kMaxBatchSize) {
+    // Only keep one batch per thread pending, so that Stop() returns quickly.
+    if (num_pending >= pool_.NumThreads()) wait_for_task();
+
+    // Prefetch tasks have no buffer, the data store just caches the chunks.
+    ChunkTransferList chunks;
+    size_t end = std::min(begin + kMaxBatchSize, ids.size());
+    for (size_t n = begin; n < end; ++n) {
+      chunks.emplace_back(ids[n], 0, nullptr, 0);
+    }
+    pool_.QueueTask(
+        std::make_unique<PrefetchTask>(data_store_reader_, std::move(chunks)));
+    ++num_pending;
+  }
+  while (num_pending > 0) wait_for_task();
+
+  if (status.ok() && cancelled_) {
+    return absl::CancelledError("Cache warmup was cancelled");
+  }
+  return status;
+}
+
+}  // namespace cdc_ft
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CDC_FUSE_FS_CACHE_WARMER_H_
+#define CDC_FUSE_FS_CACHE_WARMER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "common/threadpool.h"
+#include "data_store/data_store_reader.h"
+#include "manifest/manifest_proto_defs.h"
+
+namespace cdc_ft {
+
+// Warms up the local chunk cache for a manifest. Fetches all metadata chunks,
+// i.e. the manifest and its indirect asset and chunk lists, and optionally the
+// data chunks of a set of paths. Chunks are requested in batches from several
+// threads, so that they are fetched in parallel.
+// WarmUp() must not be called while a warmup started by Start() is running.
+class CacheWarmer {
+ public:
+  struct Statistics {
+    size_t metadata_chunks = 0;
+    size_t data_chunks = 0;
+  };
+
+  // Called with the ids of the metadata chunks of a manifest.
+  using MetadataCallback = std::function<void(std::vector<ContentIdProto>)>;
+
+  // Maximum number of chunks requested at once.
+  static constexpr size_t kMaxBatchSize = 256;
+
+  // Default number of batches requested concurrently.
+  static constexpr size_t kDefaultNumThreads = 4;
+
+  // |data_store_reader| fetches and caches the chunks, e.g. a DataProvider.
+  // The data of the files at the relative Unix paths |data_paths| is fetched
+  // as well. A directory includes all files below it, an empty path includes
+  // all files. |metadata_callback| is called with the metadata chunks that were
+  // fetched, e.g. to pin them in the cache. May be null.
+  CacheWarmer(DataStoreReader* data_store_reader,
+              std::vector<std::string> data_paths,
+              MetadataCallback metadata_callback,
+              size_t num_threads = kDefaultNumThreads);
+  ~CacheWarmer();
+
+  CacheWarmer(const CacheWarmer&) = delete;
+  CacheWarmer& operator=(const CacheWarmer&) = delete;
+
+  // Fetches the chunks for the manifest with id |manifest_id|. Returns early
+  // with a Cancelled error if Stop() is called.
+  absl::StatusOr<Statistics> WarmUp(const ContentIdProto& manifest_id);
+
+  // Runs WarmUp() for |manifest_id| in a background thread. Cancels a warmup
+  // that is still running, since its manifest is outdated.
+  void Start(const ContentIdProto& manifest_id) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Cancels and waits for a warmup started by Start().
+  void Stop() ABSL_LOCKS_EXCLUDED(mutex_);
+
+ private:
+  // Returns true if the data of the file at |rel_path| should be fetched.
+  bool IsDataPath(const std::string& rel_path) const;
+
+  // Fetches the chunks |ids| into the cache in batches of at most
+  // kMaxBatchSize chunks.
+  absl::Status Prefetch(const std::vector<ContentIdProto>& ids);
+
+  DataStoreReader* const data_store_reader_;
+  std::vector<std::string> data_paths_;
+  const MetadataCallback metadata_callback_;
+  Threadpool pool_;
+  std::atomic<bool> cancelled_{false};
+
+  absl::Mutex mutex_;
+  std::unique_ptr<std::thread> thread_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace cdc_ft
+
+#endif  // CDC_FUSE_FS_CACHE_WARMER_H_
@@ -0,0 +1,212 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cdc_fuse_fs/cache_warmer.h"
+
+#include <unordered_set>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "common/status_test_macros.h"
+#include "data_store/mem_data_store.h"
+#include "gtest/gtest.h"
+#include "manifest/content_id.h"
+
+namespace cdc_ft {
+namespace {
+
+using IdSet = std::unordered_set<ContentIdProto>;
+
+// MemDataStore that records the chunks that are prefetched by Get() calls for
+// multiple chunks.
+class PrefetchRecordingDataStore : public MemDataStore {
+ public:
+  absl::Status Get(ChunkTransferList* chunks) override {
+    absl::MutexLock lock(&mutex_);
+    for (const ChunkTransferTask& chunk : *chunks) {
+      if (!chunk.size) prefetched_.insert(chunk.id);
+    }
+    max_batch_size_ = std::max(max_batch_size_, chunks->size());
+    return MemDataStore::Get(chunks);
+  }
+
+  IdSet prefetched() const {
+    absl::MutexLock lock(&mutex_);
+    return prefetched_;
+  }
+
+  size_t max_batch_size() const {
+    absl::MutexLock lock(&mutex_);
+    return max_batch_size_;
+  }
+
+ private:
+  mutable absl::Mutex mutex_;
+  IdSet prefetched_ ABSL_GUARDED_BY(mutex_);
+  size_t max_batch_size_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+class CacheWarmerTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    // Set up the following structure:
+    // - a.txt with a direct chunk and an indirect chunk list
+    // - dir
+    //    |
+    //     - b.txt in an indirect asset list
+    AssetProto* root = manifest_.mutable_root_dir();
+    root->set_type(AssetProto::DIRECTORY);
+
+    AssetProto* file_a = AddFile(root, "a.txt", {"a0"});
+    ChunkListProto chunks;
+    AddChunk("a1", chunks.add_chunks());
+    AddChunk("a2", chunks.add_chunks());
+    IndirectChunkListProto* list = file_a->add_file_indirect_chunks();
+    chunk_list_id_ = store_.AddProto(chunks);
+    *list->mutable_chunk_list_id() = chunk_list_id_;
+
+    AssetProto* dir = root->add_dir_assets();
+    dir->set_name("dir");
+    dir->set_type(AssetProto::DIRECTORY);
+    AssetListProto assets;
+    AddFile(&assets, "b.txt", {"b0"});
+    asset_list_id_ = store_.AddProto(assets);
+    *dir->add_dir_indirect_assets() = asset_list_id_;
+
+    manifest_id_ = store_.AddProto(manifest_);
+  }
+
+ protected:
+  // Adds a chunk with |data| to the store and references it in |chunk_ref|.
+  void AddChunk(const std::string& data, ChunkRefProto* chunk_ref) {
+    *chunk_ref->mutable_chunk_id() =
+        store_.AddData(std::vector<char>(data.begin(), data.end()));
+    chunk_ids_[data] = chunk_ref->chunk_id();
+  }
+
+  // Adds a file |name| with chunks |data_vec| to |parent|.
+  template <typename Parent>
+  AssetProto* AddFile(Parent* parent, const char* name,
+                      std::vector<std::string> data_vec) {
+    AssetProto* file = AddAsset(parent);
+    file->set_name(name);
+    file->set_type(AssetProto::FILE);
+    for (const std::string& data : data_vec) {
+      AddChunk(data, file->add_file_chunks());
+    }
+    return file;
+  }
+
+  AssetProto* AddAsset(AssetProto* dir) { return dir->add_dir_assets(); }
+  AssetProto* AddAsset(AssetListProto* list) { return list->add_assets(); }
+
+  // Returns the ids of the chunks with the given |data_vec|.
+  IdSet ChunkIds(std::vector<std::string> data_vec) {
+    IdSet ids;
+    for (const std::string& data : data_vec) ids.insert(chunk_ids_[data]);
+    return ids;
+  }
+
+  PrefetchRecordingDataStore store_;
+  ManifestProto manifest_;
+  ContentIdProto manifest_id_;
+  ContentIdProto chunk_list_id_;
+  ContentIdProto asset_list_id_;
+  std::unordered_map<std::string, ContentIdProto> chunk_ids_;
+  std::vector<ContentIdProto> metadata_ids_;
+  CacheWarmer::MetadataCallback metadata_callback_ =
+      [this](std::vector<ContentIdProto> ids) { metadata_ids_ = ids; };
+};
+
+TEST_F(CacheWarmerTest, WarmUpFetchesMetadata) {
+  CacheWarmer warmer(&store_, {}, metadata_callback_);
+  absl::StatusOr<CacheWarmer::Statistics> stats = warmer.WarmUp(manifest_id_);
+  ASSERT_OK(stats);
+  EXPECT_EQ(stats->metadata_chunks, 3);
+  EXPECT_EQ(stats->data_chunks, 0);
+
+  EXPECT_EQ(IdSet(metadata_ids_.begin(), metadata_ids_.end()),
+            IdSet({manifest_id_, chunk_list_id_, asset_list_id_}));
+  EXPECT_EQ(store_.prefetched(), IdSet({chunk_list_id_, asset_list_id_}));
+}
+
+TEST_F(CacheWarmerTest, WarmUpFetchesDataOfFile) {
+  CacheWarmer warmer(&store_, {"a.txt"}, metadata_callback_);
+  absl::StatusOr<CacheWarmer::Statistics> stats = warmer.WarmUp(manifest_id_);
+  ASSERT_OK(stats);
+  EXPECT_EQ(stats->data_chunks, 3);
+
+  IdSet expected = ChunkIds({"a0", "a1", "a2"});
+  expected.insert(chunk_list_id_);
+  expected.insert(asset_list_id_);
+  EXPECT_EQ(store_.prefetched(), expected);
+}
+
+TEST_F(CacheWarmerTest, WarmUpFetchesDataOfDirectory) {
+  CacheWarmer warmer(&store_, {"/dir/"}, metadata_callback_);
+  absl::StatusOr<CacheWarmer::Statistics> stats = warmer.WarmUp(manifest_id_);
+  ASSERT_OK(stats);
+  EXPECT_EQ(stats->data_chunks, 1);
+
+  IdSet expected = ChunkIds({"b0"});
+  expected.insert(chunk_list_id_);
+  expected.insert(asset_list_id_);
+  EXPECT_EQ(store_.prefetched(), expected);
+}
+
+TEST_F(CacheWarmerTest, WarmUpSplitsBatches) {
+  std::vector<std::string> data_vec;
+  for (size_t n = 0; n <= CacheWarmer::kMaxBatchSize; ++n) {
+    data_vec.push_back("c" + std::to_string(n));
+  }
+  AddFile(manifest_.mutable_root_dir(), "c.txt", data_vec);
+  manifest_id_ = store_.AddProto(manifest_);
+
+  CacheWarmer warmer(&store_, {""}, metadata_callback_);
+  absl::StatusOr<CacheWarmer::Statistics> stats = warmer.WarmUp(manifest_id_);
+  ASSERT_OK(stats);
+  EXPECT_EQ(stats->data_chunks, CacheWarmer::kMaxBatchSize + 5);
+  EXPECT_EQ(store_.max_batch_size(), CacheWarmer::kMaxBatchSize);
+}
+
+TEST_F(CacheWarmerTest, WarmUpFailsMissingManifest) {
+  CacheWarmer warmer(&store_, {}, metadata_callback_);
+  ContentIdProto id = ContentId::FromDataString(std::string("missing"));
+  EXPECT_TRUE(absl::IsNotFound(warmer.WarmUp(id).status()));
+  EXPECT_TRUE(metadata_ids_.empty());
+}
+
+TEST_F(CacheWarmerTest, WarmUpFailsMissingList) {
+  store_.Remove(asset_list_id_).IgnoreError();
+  CacheWarmer warmer(&store_, {}, metadata_callback_);
+  EXPECT_TRUE(absl::IsNotFound(warmer.WarmUp(manifest_id_).status()));
+
+  // The metadata that was fetched is reported anyway.
+  EXPECT_EQ(IdSet(metadata_ids_.begin(), metadata_ids_.end()),
+            IdSet({manifest_id_, chunk_list_id_}));
+}
+
+TEST_F(CacheWarmerTest, StartRunsInBackground) {
+  absl::Notification done;
+  CacheWarmer warmer(&store_, {}, [&done](std::vector<ContentIdProto> ids) {
+    EXPECT_EQ(ids.size(), 3);
+    done.Notify();
+  });
+  warmer.Start(manifest_id_);
+  EXPECT_TRUE(done.WaitForNotificationWithTimeout(absl::Seconds(10)));
+  warmer.Stop();
+}
+
+}  // namespace
+}  // namespace cdc_ft
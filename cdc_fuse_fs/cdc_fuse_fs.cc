@@ -20,13 +20,27 @@
 #include <algorithm>
 #include <atomic>
 #include <deque>
-#include <unordered_map>
-
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_join.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "cdc_fuse_fs/asset.h"
+#include "cdc_fuse_fs/manifest_snapshot.h"
 #include "common/buffer.h"
+#include "common/file_handle_cache.h"
 #include "common/log.h"
 #include "common/path.h"
 #include "common/platform.h"
+#include "common/slab_allocator.h"
 #include "common/status.h"
 #include "common/status_macros.h"
 #include "common/threadpool.h"
@@ -44,6 +58,11 @@
 #include "cdc_fuse_fs/mock_libfuse.h"
 #endif
 
+#if PLATFORM_LINUX
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace cdc_ft {
 namespace {
 
@@ -122,14 +141,14 @@ struct Inode {
   }
 };
 
-// Asset proto -> inode map.
-using InodeMap = std::unordered_map<const AssetProto*, std::shared_ptr<Inode>>;
+// Asset proto -> inode map. Inodes are owned by CdcFuseFsContext.
+using InodeMap = absl::flat_hash_map<const AssetProto*, Inode*>;
 
 // Queued request that cannot be processed yet and should be processed once the
 // manifest is updated.
 struct QueuedRequest {
   // The request type that was blocked.
-  enum class Type { kOpen, kOpenDir, kLookup };
+  enum class Type { kOpen, kOpenDir, kLookup, kRead };
   Type type;
   std::string rel_path;
 
@@ -146,15 +165,47 @@ struct QueuedRequest {
       fuse_ino_t parent_ino;
       const char* name;
     } lookup;
+    // Only valid for type == kRead.
+    struct Read {
+      fuse_req_t req;
+      fuse_ino_t ino;
+      size_t size;
+      off_t off;
+    } read;
   } u;
 };
 
+// Read request that is served by a read thread.
+struct PendingRead {
+  fuse_req_t req;
+  fuse_ino_t ino;
+  size_t size;
+  off_t off;
+};
+
+// Kernel cache entries that have to be invalidated after a manifest update.
+struct KernelInvalidations {
+  // Inodes whose attributes or content changed.
+  std::vector<fuse_ino_t> inodes;
+
+  // Directory entries (parent inode, name) of assets that were removed.
+  std::vector<std::pair<fuse_ino_t, std::string>> entries;
+
+  void Append(KernelInvalidations&& other) {
+    inodes.insert(inodes.end(), other.inodes.begin(), other.inodes.end());
+    entries.insert(entries.end(),
+                   std::make_move_iterator(other.entries.begin()),
+                   std::make_move_iterator(other.entries.end()));
+  }
+};
+
 // Global context. Fuse is based on loose callbacks, so this holds the fs state.
 struct CdcFuseFsContext {
+  // Fuse channel, used to send notifications to the kernel.
+  fuse_chan* channel = nullptr;
 #ifndef USE_MOCK_LIBFUSE
   // Fuse state.
   fuse_args args = FUSE_ARGS_INIT(0, nullptr);
-  fuse_chan* channel = nullptr;
   char* mountpoint = nullptr;
   fuse_session* session = nullptr;
   bool signal_handlers_set = false;
@@ -173,12 +224,18 @@ struct CdcFuseFsContext {
       std::make_unique<ManifestProto>();
 
   // Root inode (points to manifest->root_dir()).
-  std::shared_ptr<Inode> root ABSL_GUARDED_BY(manifest_mutex) =
-      std::make_shared<Inode>();
+  std::unique_ptr<Inode> root ABSL_GUARDED_BY(manifest_mutex) =
+      std::make_unique<Inode>();
 
   // Mutex to protect inodes.
   absl::Mutex inodes_mutex ABSL_ACQUIRED_AFTER(manifest_mutex);
 
+  // Allocates all inodes except for the root. Inodes are created and deleted
+  // frequently and are small, so a slab keeps the per-inode memory overhead
+  // low. Inode addresses are stable, which is required as they are used as
+  // fuse_ino_t.
+  SlabAllocator<Inode> inode_allocator;
+
   // Maps asset protos to Inodes, which contains the proto + metadata.
   InodeMap inodes ABSL_GUARDED_BY(inodes_mutex);
 
@@ -194,13 +251,68 @@ struct CdcFuseFsContext {
   std::vector<QueuedRequest> queued_requests
       ABSL_GUARDED_BY(queued_requests_mutex);
 
+  // Reads that wait to be served by |read_threads|.
+  absl::Mutex pending_reads_mutex;
+  std::deque<PendingRead> pending_reads ABSL_GUARDED_BY(pending_reads_mutex);
+
+  // Number of reads taken from |pending_reads| that are not replied yet.
+  size_t active_reads ABSL_GUARDED_BY(pending_reads_mutex) = 0;
+
+  // Whether |read_threads| accept new reads.
+  bool read_threads_running ABSL_GUARDED_BY(pending_reads_mutex) = false;
+
+  // Threads that fetch the data for reads, so that FUSE threads do not block
+  // on the network.
+  std::vector<std::thread> read_threads;
+
+#if PLATFORM_LINUX
+  // Descriptors of chunk files that replies are spliced from, so that reads
+  // don't have to open and close them every time. Chunk files are immutable,
+  // so descriptors of chunk files that were evicted in the meantime still
+  // return the right data.
+  FileHandleCache chunk_file_handles{std::string()};
+#endif
+
   // Identifies whether FUSE consistency should be inspected after manifest
   // update.
   bool consistency_check = false;
 
+  // Path of the snapshot of the last acknowledged manifest. Empty if disabled.
+  std::string manifest_snapshot_path;
+
+  // Called with the chunks that are needed to mount the snapshot.
+  std::function<void(std::vector<ContentIdProto>)> add_metadata_chunks;
+
+  // Returns whether a chunk can be read from the local cache.
+  std::function<bool(const ContentIdProto&)> is_chunk_cached;
+
+  // Serializes saving the snapshot.
+  absl::Mutex snapshot_mutex;
+
+  // Time when the snapshot was saved last.
+  absl::Time snapshot_time ABSL_GUARDED_BY(snapshot_mutex) =
+      absl::InfinitePast();
+
+  // Called with the id of every acknowledged manifest.
+  std::function<void(const ContentIdProto&)> manifest_ack_callback;
+
+  // Id of the last manifest that was acknowledged to the workstation.
+  ContentIdProto acked_manifest_id ABSL_GUARDED_BY(manifest_mutex);
+
+  // Id of the loaded manifest. Empty before the first manifest is loaded.
+  ContentIdProto manifest_id ABSL_GUARDED_BY(manifest_mutex);
+
+  // Called with the manifest chunks that are received with a manifest update.
+  std::function<absl::Status(const ContentIdProto&, const std::string&)>
+      store_manifest_chunk;
+
   // Contains invalid inodes, which should be deleted after they are forgotten.
-  std::unordered_map<fuse_ino_t, std::shared_ptr<Inode>> invalid_inodes
-      ABSL_GUARDED_BY(inodes_mutex);
+  absl::flat_hash_set<Inode*> invalid_inodes ABSL_GUARDED_BY(inodes_mutex);
+
+  ~CdcFuseFsContext() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    for (const auto& [proto, inode] : inodes) inode_allocator.Delete(inode);
+    for (Inode* inode : invalid_inodes) inode_allocator.Delete(inode);
+  }
 };
 
 thread_local Buffer CdcFuseFsContext::buffer;
@@ -278,9 +390,9 @@ void FillStatBuffer(fuse_ino_t ino, struct stat* stbuf)
 }
 
 // Gets or creates an inode for |proto|.
-Inode* GetOrCreateInode(Inode& parent, const AssetProto* proto)
+Inode* GetOrCreateInodeLocked(Inode& parent, const AssetProto* proto)
     ABSL_EXCLUSIVE_LOCKS_REQUIRED(ctx->inodes_mutex) {
-  std::shared_ptr<Inode>& inode = ctx->inodes[proto];
+  Inode*& inode = ctx->inodes[proto];
   if (inode) {
     assert(inode->asset.proto());
     // Found existing inode.
@@ -288,12 +400,46 @@ Inode* GetOrCreateInode(Inode& parent, const AssetProto* proto)
   } else {
     // A new inode was created.
     // Note: No other thread can access this node right now.
-    inode = std::make_shared<Inode>();
+    inode = ctx->inode_allocator.New();
     inode->asset.Initialize(GetIno(parent), ctx->data_store_reader, proto);
     inode->nlookup = 1;
     ++parent.children_nlookup;
   }
-  return inode.get();
+  return inode;
+}
+
+// Gets or creates an inode for |proto|. Existing inodes are found under a
+// shared lock, so that lookups of known files do not serialize.
+Inode* GetOrCreateInode(Inode& parent, const AssetProto* proto)
+    ABSL_LOCKS_EXCLUDED(ctx->inodes_mutex) {
+  {
+    absl::ReaderMutexLock inode_lock(&ctx->inodes_mutex);
+    InodeMap::iterator it = ctx->inodes.find(proto);
+    if (it != ctx->inodes.end()) {
+      // nlookup is atomic. Forget() requires an exclusive lock, so the inode
+      // cannot be removed concurrently.
+      ++it->second->nlookup;
+      return it->second;
+    }
+  }
+  absl::MutexLock inode_lock(&ctx->inodes_mutex);
+  return GetOrCreateInodeLocked(parent, proto);
+}
+
+// Removes the forgotten |inode| from the inode maps and deletes it.
+void DeleteInode(Inode* inode)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(ctx->inodes_mutex) {
+  size_t count = 0;
+  if (!inode->asset.proto()) {
+    count = ctx->invalid_inodes.erase(inode);
+    LOG_DEBUG("Erased invalid inode");
+  } else {
+    count = ctx->inodes.erase(inode->asset.proto());
+    LOG_DEBUG("Erased inode");
+  }
+  assert(count);
+  (void)count;
+  ctx->inode_allocator.Delete(inode);
 }
 
 // Adds an entry with given |name| and stat info from the asset at the given
@@ -330,9 +476,8 @@ void ForgetChild(fuse_ino_t ino) ABSL_SHARED_LOCKS_REQUIRED(ctx->manifest_mutex)
     return;
   }
   if (inode.nlookup == 0 && inode.children_nlookup == 0) {
-    const AssetProto* proto = inode.asset.proto();
     ForgetChild(inode.asset.parent_ino());
-    ctx->inodes.erase(proto);
+    DeleteInode(&inode);
   }
 }
 
@@ -349,18 +494,8 @@ void ForgetOne(fuse_ino_t ino, uint64_t nlookup)
     return;
   }
   if (inode.nlookup == 0 && inode.children_nlookup == 0) {
-    const AssetProto* proto = inode.asset.proto();
     ForgetChild(inode.asset.parent_ino());
-    size_t count = 0;
-    if (!proto) {
-      count = ctx->invalid_inodes.erase(ino);
-      LOG_DEBUG("Erased invalid inode");
-    } else {
-      count = ctx->inodes.erase(proto);
-      LOG_DEBUG("Erased inode");
-    }
-    assert(count);
-    (void)count;
+    DeleteInode(&inode);
   }
 }
 
@@ -373,7 +508,7 @@ std::vector<fuse_ino_t> CollectLoadedChildInos(const Asset& asset)
   for (const AssetProto* proto : protos) {
     InodeMap::iterator it = ctx->inodes.find(proto);
     if (it != ctx->inodes.end()) {
-      children.push_back(GetIno(*it->second.get()));
+      children.push_back(GetIno(*it->second));
     }
   }
   return children;
@@ -390,6 +525,22 @@ bool ValidateInode(fuse_req_t req, Inode& inode, fuse_ino_t ino) {
   return true;
 }
 
+// Returns true if the file of |inode| with |ino| can be read. Otherwise,
+// replies to |req| with an error.
+bool ValidateReadInode(fuse_req_t req, Inode& inode, fuse_ino_t ino)
+    ABSL_SHARED_LOCKS_REQUIRED(ctx->manifest_mutex) {
+  if (!ValidateInode(req, inode, ino)) {
+    return false;
+  }
+  if (inode.IsUpdated()) {
+    LOG_ERROR("Manifest has been updated, the file '%s' should be reopened",
+              inode.asset.proto()->name());
+    fuse_reply_err(req, EIO);
+    return false;
+  }
+  return true;
+}
+
 // Returns the full relative file path for the given |inode|.
 std::string GetRelativePath(const Inode& inode) {
   if (inode.asset.parent_ino() == FUSE_ROOT_ID)
@@ -458,8 +609,221 @@ void QueueLookupRequest(const std::string& rel_path, fuse_req_t req,
   PrioritizeAssetOnServer(rel_path);
 }
 
+// Queues a CdcFuseRead request in the list of pending requests. Thread-safe.
+void QueueReadRequest(const std::string& rel_path, fuse_req_t req,
+                      fuse_ino_t ino, size_t size, off_t off)
+    ABSL_LOCKS_EXCLUDED(ctx->queued_requests_mutex) {
+  QueuedRequest qr{QueuedRequest::Type::kRead, rel_path};
+  qr.u.read.req = req;
+  qr.u.read.ino = ino;
+  qr.u.read.size = size;
+  qr.u.read.off = off;
+  {
+    absl::MutexLock lock(&ctx->queued_requests_mutex);
+    ctx->queued_requests.emplace_back(std::move(qr));
+  }
+  PrioritizeAssetOnServer(rel_path);
+}
+
+#if PLATFORM_LINUX
+// Tries to reply to a read request of |size| bytes at |off| from |inode| with
+// the chunk files in the local cache. Lets the kernel splice the data from the
+// files into the reply, so that it is not copied through user space. Returns
+// false without replying if the data is not fully available as chunk files,
+// e.g. because chunks are cached in memory, which the regular read serves
+// faster.
+bool ReplyFromChunkFiles(fuse_req_t req, Inode& inode, size_t size, off_t off)
+    ABSL_SHARED_LOCKS_REQUIRED(ctx->manifest_mutex) {
+  std::vector<Asset::ChunkFileRange> ranges;
+  absl::Status status = inode.asset.GetChunkFileRanges(off, size, &ranges);
+  if (!status.ok() || ranges.empty()) return false;
+
+  std::vector<char> bufv_data(sizeof(fuse_bufvec) +
+                              (ranges.size() - 1) * sizeof(fuse_buf));
+  fuse_bufvec* bufv = reinterpret_cast<fuse_bufvec*>(bufv_data.data());
+  bufv->count = 0;
+  bufv->idx = 0;
+  bufv->off = 0;
+  // Keeps the descriptors open until the reply is sent.
+  std::vector<std::shared_ptr<const int>> fds;
+  fds.reserve(ranges.size());
+  for (const Asset::ChunkFileRange& range : ranges) {
+    absl::StatusOr<std::shared_ptr<const int>> fd =
+        ctx->chunk_file_handles.GetFd(range.path);
+    if (!fd.ok()) {
+      // The chunk might have been evicted in the meantime.
+      return false;
+    }
+
+    // Guard against chunk files that are being rewritten.
+    struct stat st;
+    if (fstat(**fd, &st) != 0 ||
+        static_cast<uint64_t>(st.st_size) < range.offset + range.size) {
+      return false;
+    }
+
+    fuse_buf& buf = bufv->buf[bufv->count++];
+    buf.size = range.size;
+    buf.flags = static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+    buf.mem = nullptr;
+    buf.fd = **fd;
+    buf.pos = static_cast<off_t>(range.offset);
+    fds.push_back(std::move(*fd));
+  }
+
+  int res = fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+  if (res != 0) LOG_WARNING("fuse_reply_data() failed: %i", res);
+  return true;
+}
+#endif
+
+// Maximum number of reads that a read thread serves at once.
+constexpr size_t kMaxReadBatchSize = 64;
+
+// Queues |read| for a read thread. Returns false if read threads are not
+// running.
+bool QueueRead(const PendingRead& read)
+    ABSL_LOCKS_EXCLUDED(ctx->pending_reads_mutex) {
+  absl::MutexLock lock(&ctx->pending_reads_mutex);
+  if (!ctx->read_threads_running) {
+    return false;
+  }
+  ctx->pending_reads.push_back(read);
+  return true;
+}
+
+// Serves |reads| with a single DataStoreReader::Get() call, so that the chunks
+// of all reads are fetched in one batch.
+void ServeReads(const std::vector<PendingRead>& reads)
+    ABSL_LOCKS_EXCLUDED(ctx->manifest_mutex) {
+  absl::ReaderMutexLock manifest_lock(&ctx->manifest_mutex);
+
+  // The chunks of reads[n] are chunks[first_chunk[n], first_chunk[n + 1]).
+  std::vector<Buffer> buffers(reads.size());
+  std::vector<size_t> first_chunk(reads.size() + 1);
+  std::vector<uint64_t> bytes_read(reads.size(), 0);
+  std::vector<bool> replied(reads.size(), false);
+  ChunkTransferList chunks;
+  for (size_t n = 0; n < reads.size(); ++n) {
+    const PendingRead& read = reads[n];
+    first_chunk[n] = chunks.size();
+    Inode& inode = GetInode(read.ino);
+    if (!ValidateReadInode(read.req, inode, read.ino)) {
+      replied[n] = true;
+      continue;
+    }
+    buffers[n].resize(read.size);
+    absl::StatusOr<uint64_t> bytes = inode.asset.AppendReadChunks(
+        read.off, buffers[n].data(), read.size, &chunks);
+    if (!bytes.ok()) {
+      LOG_ERROR("Reading %u bytes from offset %u of asset '%s' failed: '%s'",
+                read.size, read.off, inode.asset.proto()->name(),
+                bytes.status().ToString());
+      fuse_reply_err(read.req, EIO);
+      replied[n] = true;
+      chunks.erase(chunks.begin() + first_chunk[n], chunks.end());
+      continue;
+    }
+    bytes_read[n] = *bytes;
+  }
+  first_chunk[reads.size()] = chunks.size();
+
+  absl::Status status = ctx->data_store_reader->Get(&chunks);
+  for (size_t n = 0; n < reads.size(); ++n) {
+    if (replied[n]) continue;
+    const PendingRead& read = reads[n];
+    std::vector<std::string> missing_ids;
+    for (size_t k = first_chunk[n]; k < first_chunk[n + 1]; ++k) {
+      if (chunks[k].size && !chunks[k].done) {
+        missing_ids.push_back(ContentId::ToHexString(chunks[k].id));
+      }
+    }
+    if (!missing_ids.empty()) {
+      LOG_ERROR(
+          "Reading %u bytes from offset %u of asset '%s' failed: Failed to "
+          "fetch chunk(s) [%s]: '%s'",
+          read.size, read.off, GetInode(read.ino).asset.proto()->name(),
+          absl::StrJoin(missing_ids, ", "), status.ToString());
+      fuse_reply_err(read.req, EIO);
+      continue;
+    }
+    fuse_reply_buf(read.req, buffers[n].data(), bytes_read[n]);
+  }
+}
+
+// Main function of the read threads. Serves queued reads in batches until the
+// read threads are stopped and all queued reads are served.
+void ReadThreadMain() ABSL_LOCKS_EXCLUDED(ctx->pending_reads_mutex) {
+  for (;;) {
+    std::vector<PendingRead> reads;
+    {
+      absl::MutexLock lock(&ctx->pending_reads_mutex);
+      auto cond = []() ABSL_EXCLUSIVE_LOCKS_REQUIRED(
+                      ctx->pending_reads_mutex) {
+        return !ctx->pending_reads.empty() || !ctx->read_threads_running;
+      };
+      ctx->pending_reads_mutex.Await(absl::Condition(&cond));
+      if (ctx->pending_reads.empty()) {
+        return;
+      }
+      size_t count = std::min(ctx->pending_reads.size(), kMaxReadBatchSize);
+      reads.assign(ctx->pending_reads.begin(),
+                   ctx->pending_reads.begin() + count);
+      ctx->pending_reads.erase(ctx->pending_reads.begin(),
+                               ctx->pending_reads.begin() + count);
+      ctx->active_reads += count;
+    }
+    ServeReads(reads);
+    absl::MutexLock lock(&ctx->pending_reads_mutex);
+    ctx->active_reads -= reads.size();
+  }
+}
+
+// Stops the read threads after they served all queued reads.
+void StopReadThreads() ABSL_LOCKS_EXCLUDED(ctx->pending_reads_mutex) {
+  {
+    absl::MutexLock lock(&ctx->pending_reads_mutex);
+    ctx->read_threads_running = false;
+  }
+  for (std::thread& thread : ctx->read_threads) {
+    thread.join();
+  }
+  ctx->read_threads.clear();
+}
+
+// Starts |num_threads| threads to serve reads. If |num_threads| is 0, reads
+// are served on the FUSE threads.
+void StartReadThreads(unsigned int num_threads)
+    ABSL_LOCKS_EXCLUDED(ctx->pending_reads_mutex) {
+  StopReadThreads();
+  if (num_threads == 0) {
+    return;
+  }
+  {
+    absl::MutexLock lock(&ctx->pending_reads_mutex);
+    ctx->read_threads_running = true;
+  }
+  for (unsigned int n = 0; n < num_threads; ++n) {
+    ctx->read_threads.emplace_back(ReadThreadMain);
+  }
+}
+
 }  // namespace
 
+#ifndef USE_MOCK_LIBFUSE
+// Implementation of the FUSE init() method.
+// See include/fuse_lowlevel.h.
+void CdcFuseInit(void* /*userdata*/, struct fuse_conn_info* conn) {
+  // Allow replies to be spliced from chunk files, see ReplyFromChunkFiles().
+  if (conn->capable & FUSE_CAP_SPLICE_WRITE) {
+    conn->want |= FUSE_CAP_SPLICE_WRITE;
+  }
+  if (conn->capable & FUSE_CAP_SPLICE_MOVE) {
+    conn->want |= FUSE_CAP_SPLICE_MOVE;
+  }
+}
+#endif
+
 // Implementation of the Fuse lookup() method.
 // See include/fuse_lowlevel.h.
 void CdcFuseLookup(fuse_req_t req, fuse_ino_t parent_ino, const char* name)
@@ -493,11 +857,7 @@ void CdcFuseLookup(fuse_req_t req, fuse_ino_t parent_ino, const char* name)
     return;
   }
 
-  Inode* inode;
-  {
-    absl::MutexLock inode_lock(&ctx->inodes_mutex);
-    inode = GetOrCreateInode(parent, *proto);
-  }
+  Inode* inode = GetOrCreateInode(parent, *proto);
   if (!ValidateInode(req, *inode, GetIno(*inode))) {
     return;
   }
@@ -565,9 +925,11 @@ void CdcFuseOpen(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
     return;
   }
 
-  if (proto->file_size() > 0 && proto->in_progress()) {
+  if (proto->file_size() > 0 && proto->in_progress() &&
+      inode.asset.ChunkedSize() == 0) {
     // This file has not been processed yet. Queue up the request Block until an
-    // updated manifest is available.
+    // updated manifest is available. Files that are partially chunked can be
+    // opened, reads beyond the chunked part are queued in CdcFuseRead().
     LOG_DEBUG("Request to open ino %u queued (file not ready)", ino);
     QueueOpenRequest(GetRelativePath(inode), req, ino, fi);
     return;
@@ -598,13 +960,25 @@ void CdcFuseRead(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
   LOG_DEBUG("CdcFuseRead, ino=%u, size=%u, off=%u", ino, size, off);
   absl::ReaderMutexLock manifest_lock(&ctx->manifest_mutex);
   Inode& inode = GetInode(ino);
-  if (!ValidateInode(req, inode, ino)) {
+  if (!ValidateReadInode(req, inode, ino)) {
     return;
   }
-  if (inode.IsUpdated()) {
-    LOG_ERROR("Manifest has been updated, the file '%s' should be reopened",
-              inode.asset.proto()->name());
-    fuse_reply_err(req, EIO);
+  const uint64_t end = std::min<uint64_t>(static_cast<uint64_t>(off) + size,
+                                          inode.asset.proto()->file_size());
+  if (end > inode.asset.ChunkedSize()) {
+    // The requested data has not been chunked yet. Queue up the request until
+    // an updated manifest is available.
+    LOG_DEBUG("Request to read ino %u queued (data not ready)", ino);
+    QueueReadRequest(GetRelativePath(inode), req, ino, size, off);
+    return;
+  }
+#if PLATFORM_LINUX
+  if (ReplyFromChunkFiles(req, inode, size, off)) {
+    return;
+  }
+#endif
+  // Data has to be fetched. Don't block the FUSE thread if possible.
+  if (QueueRead(PendingRead{req, ino, size, off})) {
     return;
   }
   ctx->buffer.resize(size);
@@ -709,7 +1083,7 @@ void CdcFuseReadDir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     }
     absl::MutexLock inode_lock(&ctx->inodes_mutex);
     for (const AssetProto* child_proto : *protos) {
-      const Inode& child_inode = *GetOrCreateInode(inode, child_proto);
+      const Inode& child_inode = *GetOrCreateInodeLocked(inode, child_proto);
       if (!child_inode.IsValid()) continue;
       AddDirectoryEntry(req, &buffer, child_proto->name().c_str(),
                         GetIno(child_inode));
@@ -929,6 +1303,21 @@ size_t CdcFuseGetInvalidInodeCountForTesting()
   return ctx->invalid_inodes.size();
 }
 
+void CdcFuseStartReadThreadsForTesting(unsigned int num_threads) {
+  assert(ctx);
+  StartReadThreads(num_threads);
+}
+
+void CdcFuseWaitForReadsForTesting()
+    ABSL_LOCKS_EXCLUDED(ctx->pending_reads_mutex) {
+  assert(ctx);
+  absl::MutexLock lock(&ctx->pending_reads_mutex);
+  auto cond = []() ABSL_EXCLUSIVE_LOCKS_REQUIRED(ctx->pending_reads_mutex) {
+    return ctx->pending_reads.empty() && ctx->active_reads == 0;
+  };
+  ctx->pending_reads_mutex.Await(absl::Condition(&cond));
+}
+
 namespace cdc_fuse_fs {
 
 absl::Status Initialize(int argc, char** argv) {
@@ -952,7 +1341,8 @@ absl::Status Initialize(int argc, char** argv) {
   }
 
   // Initialize session.
-  fuse_lowlevel_ops fs_operations = {.lookup = CdcFuseLookup,
+  fuse_lowlevel_ops fs_operations = {.init = CdcFuseInit,
+                                     .lookup = CdcFuseLookup,
                                      .forget = CdcFuseForget,
                                      .getattr = CdcFuseGetAttr,
                                      .setattr = CdcFuseSetAttr,
@@ -1017,6 +1407,7 @@ absl::Status Initialize(int argc, char** argv) {
 
 void Shutdown() {
   assert(ctx);
+  StopReadThreads();
 
 #ifndef USE_MOCK_LIBFUSE
   // Exact opposite of Create().
@@ -1053,13 +1444,12 @@ void Shutdown() {
 
 // Adds a warning message to |warnings| if |inode| does not point to
 // |context_proto|.
-void CheckProtoMismatch(const std::shared_ptr<Inode>& inode,
-                        const AssetProto* context_proto,
+void CheckProtoMismatch(const Inode* inode, const AssetProto* context_proto,
                         Json::Value& warnings) {
   if (context_proto != inode->asset.proto()) {
-    LOG_WARNING("Proto mismatch %u", GetIno(*inode.get()));
+    LOG_WARNING("Proto mismatch %u", GetIno(*inode));
     Json::Value value;
-    value["ino"] = GetIno(*inode.get());
+    value["ino"] = GetIno(*inode);
     value["state"] = InodeStateToString(inode->state);
     value["context_proto"] = context_proto;
     value["actual_proto"] = inode->asset.proto();
@@ -1070,13 +1460,11 @@ void CheckProtoMismatch(const std::shared_ptr<Inode>& inode,
 // Adds a warning message to |warnings| if the proto of |inode| is not nullptr.
 // This check is relevant for invalidated inodes (corresponding files and
 // directories were removed from the manifest).
-void CheckProtoNotNull(const std::shared_ptr<Inode>& inode,
-                       Json::Value& warnings) {
+void CheckProtoNotNull(const Inode* inode, Json::Value& warnings) {
   if (inode->asset.proto()) {
-    LOG_WARNING("Proto for invalidated inode is not NULL %u",
-                GetIno(*inode.get()));
+    LOG_WARNING("Proto for invalidated inode is not NULL %u", GetIno(*inode));
     Json::Value value;
-    value["ino"] = GetIno(*inode.get());
+    value["ino"] = GetIno(*inode);
     warnings.append(value);
   }
 }
@@ -1210,7 +1598,7 @@ std::set<const Inode*> CheckProtoReachability(Json::Value& warnings)
           "Proto for inode %i is not reachable from the manifest",
           reinterpret_cast<fuse_ino_t>(&(*inode)));
       reachability_warning.append(message);
-      unreachable_inodes.emplace(inode.get());
+      unreachable_inodes.emplace(inode);
     }
   }
   if (!reachability_warning.empty()) {
@@ -1269,17 +1657,17 @@ void CheckFUSEConsistency(size_t inodes_size)
           break;
         case InodeState::kUpdatedProto:
           CheckProtoMismatch(inode, context_proto, wrong_protos_json);
-          inodes_to_check.push_back(inode.get());
+          inodes_to_check.push_back(inode);
           ++updated_proto_total;
           break;
         case InodeState::kUpdated:
           CheckProtoMismatch(inode, context_proto, wrong_protos_json);
-          inodes_to_check.push_back(inode.get());
+          inodes_to_check.push_back(inode);
           ++updated_total;
           break;
         case InodeState::kInvalid:
           CheckProtoNotNull(inode, wrong_protos_json);
-          invalid_inodes.push_back(inode.get());
+          invalid_inodes.push_back(inode);
           break;
       }
     }
@@ -1370,11 +1758,10 @@ void InvalidateTree(fuse_ino_t ino)
     }
     {
       absl::MutexLock inode_lock(&ctx->inodes_mutex);
-      const AssetProto* outdated_proto = inode.asset.proto();
-      ctx->invalid_inodes[tmp_ino] = ctx->inodes[outdated_proto];
-      size_t count = ctx->inodes.erase(outdated_proto);
+      size_t count = ctx->inodes.erase(inode.asset.proto());
       assert(count);
       (void)count;
+      ctx->invalid_inodes.insert(&inode);
     }
     inode.asset.UpdateProto(nullptr);
     inos.pop_front();
@@ -1382,11 +1769,26 @@ void InvalidateTree(fuse_ino_t ino)
 }
 
 struct UpdateInode {
-  std::shared_ptr<Inode> new_parent;
+  Inode* new_parent;
   fuse_ino_t old_ino;
 };
 
 // ThreadPool task that runs the update of inodes.
+// Returns true if |new_proto| only adds chunks to the partially chunked file
+// |old_proto|, i.e. the file itself did not change.
+bool ExtendsPartialFile(const AssetProto& old_proto,
+                        const AssetProto& new_proto) {
+  if (old_proto.type() != AssetProto::FILE || !old_proto.in_progress() ||
+      old_proto.chunked_size() == 0) {
+    return false;
+  }
+  return new_proto.type() == AssetProto::FILE &&
+         new_proto.mtime_seconds() == old_proto.mtime_seconds() &&
+         new_proto.file_size() == old_proto.file_size() &&
+         (!new_proto.in_progress() ||
+          new_proto.chunked_size() >= old_proto.chunked_size());
+}
+
 class UpdateInodeTask : public Task {
  public:
   UpdateInodeTask(UpdateInode* inode, std::vector<UpdateInode>* result)
@@ -1399,7 +1801,7 @@ class UpdateInodeTask : public Task {
     LOG_DEBUG("Updating inode %u", update_inode_->old_ino);
     assert((ctx->manifest_mutex.AssertHeld(), true));
 
-    const std::shared_ptr<Inode>& new_parent = update_inode_->new_parent;
+    Inode* new_parent = update_inode_->new_parent;
     Inode& old_inode = GetInode(update_inode_->old_ino);
     assert(old_inode.IsValid());
 
@@ -1412,23 +1814,33 @@ class UpdateInodeTask : public Task {
     // invalidated as well. The final removal from the inode map can only be
     // done via forget() and forget_multi() calls.
     if (!new_proto.ok() || !*new_proto) {
+      invalidations_.entries.emplace_back(GetIno(*new_parent), name);
       InvalidateTree(update_inode_->old_ino);
       return;
     }
     // Asset still exists in a new proto. Its inode id should be preserved. If a
     // new proto exists for the same name, but the asset has changed, an update
     // is necessary, the inode id remains stable.
-    if (*(*new_proto) != *(old_inode.asset.proto())) {
+    if (ExtendsPartialFile(*old_inode.asset.proto(), **new_proto)) {
+      // Only more chunks of the same file were published. Keep open handles
+      // and cached data valid.
+      old_inode.state = InodeState::kUpdatedProto;
+      if (old_inode.asset.proto()->permissions() !=
+          (*new_proto)->permissions()) {
+        invalidations_.inodes.push_back(update_inode_->old_ino);
+      }
+    } else if (*(*new_proto) != *(old_inode.asset.proto())) {
       LOG_DEBUG("Inode %u is marked for update", update_inode_->old_ino);
       old_inode.state = InodeState::kUpdated;
+      invalidations_.inodes.push_back(update_inode_->old_ino);
     } else {
       old_inode.state = InodeState::kUpdatedProto;
     }
     const AssetProto* old_proto = old_inode.asset.proto();
-    std::shared_ptr<Inode> new_inode;
     {
       absl::MutexLock inode_lock(&ctx->inodes_mutex);
-      new_inode = ctx->inodes[*new_proto] = ctx->inodes[old_proto];
+      assert(ctx->inodes.find(old_proto) != ctx->inodes.end());
+      ctx->inodes[*new_proto] = &old_inode;
     }
     // As there is an updated valid entry for the same inode in the map,
     // the old one can be removed.
@@ -1438,7 +1850,7 @@ class UpdateInodeTask : public Task {
         CollectLoadedChildInos(old_inode.asset);
     for (fuse_ino_t child_ino : child_inos) {
       UpdateInode child_to_update;
-      child_to_update.new_parent = new_inode;
+      child_to_update.new_parent = &old_inode;
       child_to_update.old_ino = child_ino;
       child_inodes_to_update_->emplace_back(std::move(child_to_update));
     }
@@ -1447,10 +1859,14 @@ class UpdateInodeTask : public Task {
 
   const AssetProto* ProtoToRemove() const { return proto_to_remove_; }
 
+  // Returns the kernel cache entries invalidated by the update.
+  KernelInvalidations* Invalidations() { return &invalidations_; }
+
  private:
   const UpdateInode* const update_inode_;
   std::vector<UpdateInode>* child_inodes_to_update_;
   const AssetProto* proto_to_remove_ = nullptr;
+  KernelInvalidations invalidations_;
 };
 
 // Recursive procedure to update the inodes contents on a level after a request
@@ -1458,7 +1874,8 @@ class UpdateInodeTask : public Task {
 void ParallelUpdateProtosOnLevel(
     Threadpool& pool, std::vector<UpdateInode>& input_inodes,
     std::vector<std::vector<UpdateInode>>& result,
-    std::vector<const AssetProto*>& outdated_protos) {
+    std::vector<const AssetProto*>& outdated_protos,
+    KernelInvalidations* invalidations) {
   LOG_DEBUG("Update asset protos in parallel on the same level");
   assert(input_inodes.size() == result.size());
 
@@ -1472,16 +1889,20 @@ void ParallelUpdateProtosOnLevel(
     if (update_task->ProtoToRemove()) {
       outdated_protos.push_back(update_task->ProtoToRemove());
     }
+    invalidations->Append(std::move(*update_task->Invalidations()));
   }
 }
 
-std::shared_ptr<Inode> UpdateProtosFromRoot(const AssetProto* new_root_proto)
+// Updates the inode hierarchy to |new_root_proto|. Appends kernel cache entries
+// of changed and removed assets to |invalidations|.
+std::unique_ptr<Inode> UpdateProtosFromRoot(const AssetProto* new_root_proto,
+                                            KernelInvalidations* invalidations)
     ABSL_LOCKS_EXCLUDED(ctx->inodes_mutex) {
   LOG_DEBUG("Updating inode hierarchy starting from the root");
   assert((ctx->manifest_mutex.AssertHeld(), true));
 
   // Create the new root. Make sure to preserve the lookup counts!
-  std::shared_ptr<Inode> new_root = std::make_shared<Inode>();
+  std::unique_ptr<Inode> new_root = std::make_unique<Inode>();
   new_root->asset.Initialize(FUSE_ROOT_ID, ctx->data_store_reader,
                              new_root_proto);
   new_root->nlookup = ctx->root->nlookup.load();
@@ -1489,13 +1910,12 @@ std::shared_ptr<Inode> UpdateProtosFromRoot(const AssetProto* new_root_proto)
   new_root->state = ctx->root->state.load();
   new_root->is_root = true;
 
-  std::shared_ptr<Inode> old_root = ctx->root;
-  std::vector<fuse_ino_t> children = CollectLoadedChildInos(old_root->asset);
+  std::vector<fuse_ino_t> children = CollectLoadedChildInos(ctx->root->asset);
   std::vector<UpdateInode> inos_to_update;
   inos_to_update.reserve(children.size());
   for (fuse_ino_t child : children) {
     UpdateInode to_update;
-    to_update.new_parent = new_root;
+    to_update.new_parent = new_root.get();
     to_update.old_ino = child;
     inos_to_update.emplace_back(std::move(to_update));
   }
@@ -1508,7 +1928,7 @@ std::shared_ptr<Inode> UpdateProtosFromRoot(const AssetProto* new_root_proto)
     std::vector<std::vector<UpdateInode>> level_result(
         inos_to_update.size(), std::vector<UpdateInode>());
     ParallelUpdateProtosOnLevel(pool, inos_to_update, level_result,
-                                outdated_protos);
+                                outdated_protos, invalidations);
     inos_to_update.clear();
     for (unsigned int idx = 0; idx < level_result.size(); ++idx) {
       for (unsigned int jdx = 0; jdx < level_result[idx].size(); ++jdx) {
@@ -1529,12 +1949,91 @@ std::shared_ptr<Inode> UpdateProtosFromRoot(const AssetProto* new_root_proto)
   return new_root;
 }
 
-absl::Status SetManifest(const ContentIdProto& manifest_id)
+// Drops the kernel's cached attributes, pages and directory entries for assets
+// that changed in a manifest update. Unchanged assets keep their caches, see
+// CdcFuseOpen(). Must be called without holding any locks, as the kernel might
+// have to wait for requests in flight to finish.
+void InvalidateKernelCaches(const KernelInvalidations& invalidations)
+    ABSL_LOCKS_EXCLUDED(ctx->manifest_mutex, ctx->inodes_mutex) {
+  for (fuse_ino_t ino : invalidations.inodes) {
+    int res = fuse_lowlevel_notify_inval_inode(ctx->channel, ino, 0, 0);
+    // -ENOENT means that the kernel does not know the inode.
+    if (res != 0 && res != -ENOENT) {
+      LOG_WARNING("Failed to invalidate kernel cache for ino %u: %i", ino, res);
+    }
+  }
+  for (const auto& [parent_ino, name] : invalidations.entries) {
+    int res = fuse_lowlevel_notify_inval_entry(ctx->channel, parent_ino,
+                                               name.c_str(), name.size());
+    if (res != 0 && res != -ENOENT) {
+      LOG_WARNING("Failed to invalidate kernel entry '%s' in ino %u: %i", name,
+                  parent_ino, res);
+    }
+  }
+}
+
+// Returns the ids of the chunks that are needed to mount the current manifest
+// with id |manifest_id| up to the point that was explored so far, i.e. the
+// manifest itself and the indirect lists that were loaded for the root and for
+// all inodes. Lists of assets that were only looked up are not included, so
+// that they don't prevent the snapshot from being mounted.
+std::vector<ContentIdProto> CollectManifestChunkIds(
+    const ContentIdProto& manifest_id)
+    ABSL_SHARED_LOCKS_REQUIRED(ctx->manifest_mutex)
+        ABSL_LOCKS_EXCLUDED(ctx->inodes_mutex) {
+  std::vector<ContentIdProto> ids;
+  ids.push_back(manifest_id);
+  ctx->root->asset.AppendLoadedIndirectListIds(&ids);
+  absl::ReaderMutexLock inodes_lock(&ctx->inodes_mutex);
+  for (const auto& [proto, inode] : ctx->inodes) {
+    inode->asset.AppendLoadedIndirectListIds(&ids);
+  }
+  return ids;
+}
+
+// Minimum time between two snapshot saves for acknowledged manifests. Saving
+// walks all inodes, and the workstation pushes several intermediate manifests
+// during an update.
+constexpr absl::Duration kMinSnapshotInterval = absl::Seconds(60);
+
+// Writes the last acknowledged manifest to the snapshot file, if enabled, and
+// classifies the chunks that are needed to mount it again as metadata. Unless
+// |force| is set, does nothing if the snapshot was saved less than
+// kMinSnapshotInterval ago.
+void SaveManifestSnapshot(bool force)
+    ABSL_LOCKS_EXCLUDED(ctx->manifest_mutex, ctx->inodes_mutex,
+                        ctx->snapshot_mutex) {
+  if (ctx->manifest_snapshot_path.empty()) return;
+  absl::MutexLock snapshot_lock(&ctx->snapshot_mutex);
+  absl::Time now = absl::Now();
+  if (!force && now - ctx->snapshot_time < kMinSnapshotInterval) return;
+
+  ManifestSnapshot snapshot;
+  {
+    absl::ReaderMutexLock manifest_lock(&ctx->manifest_mutex);
+    if (ctx->acked_manifest_id.blake3_sum_160().empty()) return;
+    snapshot.manifest_id = ctx->acked_manifest_id;
+    snapshot.chunk_ids = CollectManifestChunkIds(snapshot.manifest_id);
+  }
+  ctx->snapshot_time = now;
+
+  // Metadata chunks are only evicted if they exceed their own budget, so the
+  // chunks of the snapshot are likely still cached on the next start.
+  // RestoreManifestSnapshot() checks that.
+  if (ctx->add_metadata_chunks) ctx->add_metadata_chunks(snapshot.chunk_ids);
+  absl::Status status = snapshot.Save(ctx->manifest_snapshot_path);
+  if (!status.ok()) {
+    LOG_WARNING("Failed to save manifest snapshot: %s", status.ToString());
+  }
+}
+
+// Replaces the current manifest by the manifest with id |manifest_id|,
+// invalidates kernel caches and resumes queued requests.
+absl::Status UpdateManifest(const ContentIdProto& manifest_id)
     ABSL_LOCKS_EXCLUDED(ctx->manifest_mutex, ctx->inodes_mutex) {
-  LOG_DEBUG("Setting manifest '%s' in FUSE",
-            ContentId::ToHexString(manifest_id));
   assert(ctx && ctx->initialized && ctx->data_store_reader);
 
+  KernelInvalidations invalidations;
   {
     absl::WriterMutexLock manifest_lock(&ctx->manifest_mutex);
     size_t old_inodes_size;
@@ -1552,13 +2051,16 @@ absl::Status SetManifest(const ContentIdProto& manifest_id)
       return WrapStatus(status, "Failed to get manifest '%s'",
                         ContentId::ToHexString(manifest_id));
     }
-    ctx->root = UpdateProtosFromRoot(&new_manifest->root_dir());
+    ctx->root =
+        UpdateProtosFromRoot(&new_manifest->root_dir(), &invalidations);
     if (ctx->manifest->root_dir() != new_manifest->root_dir()) {
       ctx->root->state = InodeState::kUpdated;
+      invalidations.inodes.push_back(FUSE_ROOT_ID);
     } else {
       ctx->root->state = InodeState::kUpdatedProto;
     }
     ctx->manifest.swap(new_manifest);
+    ctx->manifest_id = manifest_id;
     if (ctx->consistency_check) {
       CheckFUSEConsistency(old_inodes_size);
     }
@@ -1576,6 +2078,7 @@ absl::Status SetManifest(const ContentIdProto& manifest_id)
     }
     ctx->root->state = InodeState::kInitialized;
   }
+  InvalidateKernelCaches(invalidations);
 
   // Process outstanding open requests. Be sure to move the vector because
   // processing might requeue requests.
@@ -1602,8 +2105,109 @@ absl::Status SetManifest(const ContentIdProto& manifest_id)
                   qr.u.open.ino);
         CdcFuseOpenDir(qr.u.open.req, qr.u.open.ino, &qr.u.open.fi);
         break;
+      case QueuedRequest::Type::kRead:
+        LOG_DEBUG("Resuming request to read %u bytes at offset %u of '%s'",
+                  qr.u.read.size, qr.u.read.off, qr.rel_path);
+        CdcFuseRead(qr.u.read.req, qr.u.read.ino, qr.u.read.size,
+                    qr.u.read.off, nullptr);
+        break;
     }
   }
+  return absl::OkStatus();
+}
+
+// Mounts the manifest of the snapshot file, if there is one, so that the
+// cached parts of the file system are available before the workstation sends
+// the first manifest.
+void RestoreManifestSnapshot() {
+  if (ctx->manifest_snapshot_path.empty()) return;
+  absl::StatusOr<ManifestSnapshot> snapshot =
+      ManifestSnapshot::Load(ctx->manifest_snapshot_path);
+  if (!snapshot.ok()) {
+    if (absl::IsNotFound(snapshot.status())) {
+      LOG_INFO("No manifest snapshot found at '%s'",
+               ctx->manifest_snapshot_path);
+    } else {
+      LOG_WARNING("Failed to load manifest snapshot: %s",
+                  snapshot.status().ToString());
+    }
+    return;
+  }
+
+  // Chunks might have been evicted since the snapshot was saved, and the
+  // workstation might not have them anymore. Don't mount a snapshot that
+  // cannot be served from the cache.
+  std::string hex_id = ContentId::ToHexString(snapshot->manifest_id);
+  if (ctx->is_chunk_cached) {
+    for (const ContentIdProto& id : snapshot->chunk_ids) {
+      if (ctx->is_chunk_cached(id)) continue;
+      LOG_INFO("Not mounting manifest '%s' from snapshot, chunk '%s' is not "
+               "cached",
+               hex_id, ContentId::ToHexString(id));
+      return;
+    }
+  }
+
+  if (ctx->add_metadata_chunks) {
+    ctx->add_metadata_chunks(std::move(snapshot->chunk_ids));
+  }
+  absl::Status status = UpdateManifest(snapshot->manifest_id);
+  if (!status.ok()) {
+    LOG_WARNING("Failed to mount manifest '%s' from snapshot: %s", hex_id,
+                status.ToString());
+    return;
+  }
+  // Not acknowledged, the manifest is validated by the first update from the
+  // workstation.
+  LOG_INFO("Mounted manifest '%s' from snapshot", hex_id);
+}
+
+// Requests the manifest chunks that changed between the loaded manifest and
+// the manifest |manifest_id| in a single round-trip and stores them, so that
+// UpdateManifest() does not have to fetch them one by one. Failures are not
+// fatal, the chunks are fetched on demand then.
+void FetchManifestDelta(const ContentIdProto& manifest_id)
+    ABSL_LOCKS_EXCLUDED(ctx->manifest_mutex) {
+  if (!ctx->store_manifest_chunk || !ctx->config_stream_client) return;
+  ContentIdProto old_manifest_id;
+  {
+    absl::ReaderMutexLock manifest_lock(&ctx->manifest_mutex);
+    old_manifest_id = ctx->manifest_id;
+  }
+  if (old_manifest_id == manifest_id) return;
+
+  std::string hex_id = ContentId::ToHexString(manifest_id);
+  std::vector<ConfigStreamClient::ManifestChunk> chunks;
+  absl::Status status = ctx->config_stream_client->GetManifestDelta(
+      old_manifest_id, manifest_id, &chunks);
+  if (!status.ok()) {
+    LOG_WARNING("Failed to get changed chunks of manifest '%s': %s", hex_id,
+                status.ToString());
+    return;
+  }
+  for (const ConfigStreamClient::ManifestChunk& chunk : chunks) {
+    if (ContentId::FromDataString(chunk.data) != chunk.id) {
+      LOG_WARNING("Received corrupt chunk '%s' of manifest '%s'",
+                  ContentId::ToHexString(chunk.id), hex_id);
+      continue;
+    }
+    status = ctx->store_manifest_chunk(chunk.id, chunk.data);
+    if (!status.ok()) {
+      LOG_WARNING("Failed to store chunk '%s' of manifest '%s': %s",
+                  ContentId::ToHexString(chunk.id), hex_id, status.ToString());
+      return;
+    }
+  }
+  LOG_DEBUG("Received %u changed chunks of manifest '%s'", chunks.size(),
+            hex_id);
+}
+
+absl::Status SetManifest(const ContentIdProto& manifest_id)
+    ABSL_LOCKS_EXCLUDED(ctx->manifest_mutex, ctx->inodes_mutex) {
+  LOG_DEBUG("Setting manifest '%s' in FUSE",
+            ContentId::ToHexString(manifest_id));
+  FetchManifestDelta(manifest_id);
+  RETURN_IF_ERROR(UpdateManifest(manifest_id));
 
 #ifndef USE_MOCK_LIBFUSE
   // Acknowledge that the manifest id was received and FUSE was updated.
@@ -1616,6 +2220,12 @@ absl::Status SetManifest(const ContentIdProto& manifest_id)
   }
 #endif
 
+  {
+    absl::WriterMutexLock manifest_lock(&ctx->manifest_mutex);
+    ctx->acked_manifest_id = manifest_id;
+  }
+  SaveManifestSnapshot(/*force=*/false);
+  if (ctx->manifest_ack_callback) ctx->manifest_ack_callback(manifest_id);
   return absl::OkStatus();
 }
 
@@ -1629,6 +2239,29 @@ void SetConfigClient(
   ctx->config_stream_client = std::move(config_client);
 }
 
+void SetManifestAckCallback(
+    std::function<void(const ContentIdProto&)> callback) {
+  assert(ctx && ctx->initialized);
+  ctx->manifest_ack_callback = std::move(callback);
+}
+
+void SetManifestChunkStore(
+    std::function<absl::Status(const ContentIdProto&, const std::string&)>
+        store_chunk) {
+  assert(ctx && ctx->initialized);
+  ctx->store_manifest_chunk = std::move(store_chunk);
+}
+
+void SetManifestSnapshot(
+    std::string path,
+    std::function<void(std::vector<ContentIdProto>)> add_metadata_chunks,
+    std::function<bool(const ContentIdProto&)> is_chunk_cached) {
+  assert(ctx && ctx->initialized);
+  ctx->manifest_snapshot_path = std::move(path);
+  ctx->add_metadata_chunks = std::move(add_metadata_chunks);
+  ctx->is_chunk_cached = std::move(is_chunk_cached);
+}
+
 // Initializes FUSE with a manifest for an empty directory:
 // The user will be able to check the empty folder before the first update
 // of the manifest id is received.
@@ -1642,11 +2275,14 @@ void InitializeRootManifest() {
   ctx->root->nlookup = 1;
 }
 
-absl::Status Run(DataStoreReader* data_store_reader, bool consistency_check) {
+absl::Status Run(DataStoreReader* data_store_reader, bool consistency_check,
+                 unsigned int num_read_threads) {
   assert(ctx && ctx->initialized && data_store_reader);
   ctx->consistency_check = consistency_check;
   ctx->data_store_reader = data_store_reader;
   InitializeRootManifest();
+  StartReadThreads(num_read_threads);
+  RestoreManifestSnapshot();
 #ifndef USE_MOCK_LIBFUSE
   RETURN_IF_ERROR(ctx->config_stream_client->StartListeningToManifestUpdates(
                       [](const ContentIdProto& id) { return SetManifest(id); }),
@@ -1656,10 +2292,15 @@ absl::Status Run(DataStoreReader* data_store_reader, bool consistency_check) {
            ctx->multithreaded ? "true" : "false");
   int res = ctx->multithreaded ? fuse_session_loop_mt(ctx->session)
                                : fuse_session_loop(ctx->session);
+  StopReadThreads();
   if (res == -1) return MakeStatus("Session loop failed");
   LOG_INFO("Session loop finished.");
 
   ctx->config_stream_client->Shutdown();
+
+  // Save the last acknowledged manifest, which might have been skipped, and the
+  // indirect lists that were loaded during the session.
+  SaveManifestSnapshot(/*force=*/true);
 #else
   // This code is not unit tested.
 #endif
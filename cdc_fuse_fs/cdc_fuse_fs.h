@@ -27,7 +27,10 @@
 #define X_OK 1
 #endif
 
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "cdc_fuse_fs/config_stream_client.h"
@@ -51,8 +54,10 @@ constexpr int kCdcFuseCloudcastGid = 1000;
 constexpr int kCdcFuseRootUid = 0;
 constexpr int kCdcFuseRootGid = 0;
 
-// Default timeout after which the kernel will assume inodes are stale.
-constexpr double kCdcFuseInodeTimeoutSec = 1.0;
+// Timeout after which the kernel will assume inodes and directory entries are
+// stale. Assets only change with a new manifest, and the kernel caches of
+// changed assets are invalidated explicitly on manifest updates.
+constexpr double kCdcFuseInodeTimeoutSec = 3600.0;
 }  // namespace internal
 
 namespace cdc_fuse_fs {
@@ -65,12 +70,47 @@ absl::Status Initialize(int argc, char** argv);
 // Sets the client to read configuration updates to |config_client|.
 void SetConfigClient(std::unique_ptr<ConfigStreamClient> config_client);
 
+// Persists the last acknowledged manifest in a snapshot file at |path|. Run()
+// mounts the manifest of an existing snapshot before it listens to manifest
+// updates, so that cached parts of the file system can be served before the
+// workstation is connected. The first manifest update from the workstation
+// then validates the snapshot like any other manifest update.
+// The snapshot is saved at most once a minute and when the file system shuts
+// down. |add_metadata_chunks| is called with the ids of the chunks that are
+// needed to mount the snapshot whenever the snapshot is loaded or saved, so
+// that they can be kept in the cache. The snapshot is only mounted if
+// |is_chunk_cached| returns true for all of these chunks. Must be called before
+// Run().
+void SetManifestSnapshot(
+    std::string path,
+    std::function<void(std::vector<ContentIdProto>)> add_metadata_chunks,
+    std::function<bool(const ContentIdProto&)> is_chunk_cached);
+
+// Sets a |callback| that is called with the id of every manifest that was
+// acknowledged to the workstation, e.g. to warm up the cache. Must be called
+// before Run().
+void SetManifestAckCallback(
+    std::function<void(const ContentIdProto&)> callback);
+
+// Sets a |store_chunk| function that is called with the manifest chunks that
+// are received with a manifest update. Before a new manifest is loaded, the
+// chunks that changed since the loaded manifest are requested from the
+// workstation in a single round-trip and handed to |store_chunk|, e.g. to put
+// them into the cache. Must be called before Run().
+void SetManifestChunkStore(
+    std::function<absl::Status(const ContentIdProto&, const std::string&)>
+        store_chunk);
+
 // Sets the |data_store_reader| to load data from, initializes FUSE with a
 // manifest for an empty directory, and starts the filesystem. The call does
 // not return until the filesystem finishes running.
 // |consistency_check| defines whether FUSE consistency should be inspected
 // after each manifest update.
-absl::Status Run(DataStoreReader* data_store_reader, bool consistency_check);
+// |num_read_threads| threads fetch the data of reads in batches, so that the
+// FUSE threads are not blocked by the network. If 0, data is fetched on the
+// FUSE threads.
+absl::Status Run(DataStoreReader* data_store_reader, bool consistency_check,
+                 unsigned int num_read_threads = 0);
 
 // Releases resources. Should be called when the filesystem finished running.
 void Shutdown();
@@ -20,18 +20,33 @@
 
 #include "cdc_fuse_fs/cdc_fuse_fs.h"
 
+#include <cstdio>
+#include <fstream>
 #include <memory>
+#include <random>
+#include <unordered_set>
 #include <vector>
 
+#include "cdc_fuse_fs/manifest_snapshot.h"
 #include "cdc_fuse_fs/mock_config_stream_client.h"
 #include "cdc_fuse_fs/mock_libfuse.h"
 #include "common/log.h"
 #include "common/path.h"
+#include "common/platform.h"
+#include "common/status_macros.h"
 #include "common/status_test_macros.h"
+#include "common/stopwatch.h"
 #include "data_store/mem_data_store.h"
 #include "gtest/gtest.h"
+#include "manifest/content_id.h"
 #include "manifest/fake_manifest_builder.h"
 
+#if PLATFORM_LINUX
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+#endif
+
 namespace cdc_ft {
 
 // FUSE callback methods. Declared here since they depend on Fuse types that
@@ -52,8 +67,14 @@ void CdcFuseReleaseDir(fuse_req_t req, fuse_ino_t ino,
                        struct fuse_file_info* fi);
 size_t CdcFuseGetInodeCountForTesting();
 size_t CdcFuseGetInvalidInodeCountForTesting();
+void CdcFuseStartReadThreadsForTesting(unsigned int num_threads);
+void CdcFuseWaitForReadsForTesting();
 void CdcFuseAccess(fuse_req_t req, fuse_ino_t ino, int mask);
 
+namespace cdc_fuse_fs {
+void SaveManifestSnapshot(bool force);
+}  // namespace cdc_fuse_fs
+
 namespace {
 
 class FuseLog : public ConsoleLog {
@@ -73,6 +94,52 @@ class FuseLog : public ConsoleLog {
   std::string last_message_;
 };
 
+// MemDataStore that can expose its chunks as files, like DiskDataStore.
+class ChunkFileDataStore : public MemDataStore {
+ public:
+  // Writes chunks into |dir| when GetChunkFilePath() is called for the first
+  // time. Chunk files are not available if |dir| is empty.
+  void SetChunkFileDir(std::string dir) { chunk_file_dir_ = std::move(dir); }
+
+  absl::StatusOr<std::string> GetChunkFilePath(
+      const ContentIdProto& content_id) override {
+    if (chunk_file_dir_.empty()) {
+      return MemDataStore::GetChunkFilePath(content_id);
+    }
+    std::string path =
+        path::Join(chunk_file_dir_, ContentId::ToHexString(content_id));
+    if (path::FileExists(path)) return path;
+    Buffer data;
+    RETURN_IF_ERROR(Get(content_id, &data));
+    RETURN_IF_ERROR(path::WriteFile(path, data));
+    return path;
+  }
+
+ private:
+  std::string chunk_file_dir_;
+};
+
+// Returns the resident set size of the process in bytes or 0 if unknown.
+uint64_t GetResidentSetSize() {
+#if PLATFORM_LINUX
+  std::ifstream statm("/proc/self/statm");
+  uint64_t size_pages = 0, resident_pages = 0;
+  if (statm >> size_pages >> resident_pages) {
+    return resident_pages * sysconf(_SC_PAGESIZE);
+  }
+#endif
+  return 0;
+}
+
+// Returns the number of allocated heap bytes or 0 if unknown.
+uint64_t GetHeapSize() {
+#if PLATFORM_LINUX
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
 class CdcFuseFsTest : public ::testing::Test {
  protected:
   static constexpr char kFile1Name[] = "file1.txt";
@@ -188,9 +255,29 @@ class CdcFuseFsTest : public ::testing::Test {
     return cache_.AddProto(manifest);
   }
 
-  MemDataStore cache_;
+  // Restarts the file system with a manifest snapshot at |path| and stores the
+  // chunks it classifies as metadata in |metadata_ids_|. Chunks in
+  // |evicted_ids_| are reported as not cached.
+  void RestartWithSnapshot(const std::string& path) {
+    cdc_fuse_fs::Shutdown();
+    cdc_fuse_fs::Initialize(0, nullptr).IgnoreError();
+    cdc_fuse_fs::SetConfigClient(std::make_unique<MockConfigStreamClient>());
+    cdc_fuse_fs::SetManifestSnapshot(
+        path,
+        [this](std::vector<ContentIdProto> ids) {
+          metadata_ids_ = std::move(ids);
+        },
+        [this](const ContentIdProto& id) {
+          return evicted_ids_.find(id) == evicted_ids_.end();
+        });
+    EXPECT_OK(cdc_fuse_fs::Run(&cache_, true));
+  }
+
+  ChunkFileDataStore cache_;
   MockLibFuse fuse_;
   fuse_req_t req_ = nullptr;
+  std::vector<ContentIdProto> metadata_ids_;
+  std::unordered_set<ContentIdProto> evicted_ids_;
   ContentIdProto manifest_id_;
   FakeManifestBuilder builder_;
   FuseLog* Log() const { return static_cast<FuseLog*>(Log::Instance()); }
@@ -342,6 +429,51 @@ TEST_F(CdcFuseFsTest, QueuedRequestsRequeue) {
   ASSERT_EQ(fuse_.open_files.size(), 2);
 }
 
+TEST_F(CdcFuseFsTest, ReadsQueuedBeyondChunkedPartOfFile) {
+  // Simulate a manifest in which only the first 3 bytes of file1 are chunked.
+  ManifestProto manifest;
+  ASSERT_OK(cache_.GetProto(manifest_id_, &manifest));
+  AssetProto* file1 = manifest.mutable_root_dir()->mutable_dir_assets(0);
+  ASSERT_EQ(file1->name(), kFile1Name);
+  file1->clear_file_chunks();
+  ChunkRefProto* chunk = file1->add_file_chunks();
+  *chunk->mutable_chunk_id() =
+      cache_.AddData({kFile1Data.begin(), kFile1Data.begin() + 3});
+  chunk->set_offset(0);
+  file1->set_in_progress(true);
+  file1->set_chunked_size(3);
+  EXPECT_OK(cdc_fuse_fs::SetManifest(cache_.AddProto(manifest)));
+  auto cfg_client_ptr = std::make_unique<MockConfigStreamClient>();
+  MockConfigStreamClient* cfg_client = cfg_client_ptr.get();
+  cdc_fuse_fs::SetConfigClient(std::move(cfg_client_ptr));
+
+  // Opening file1 should succeed since it is partially chunked.
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
+  ASSERT_EQ(fuse_.entries.size(), 1);
+  fuse_file_info fi;
+  CdcFuseOpen(req_, fuse_.entries[0].ino, &fi);
+  EXPECT_EQ(fuse_.open_files.size(), 1);
+
+  // Reading the chunked part should succeed.
+  CdcFuseRead(req_, fuse_.entries[0].ino, 3, 0, &fi);
+  ASSERT_EQ(fuse_.buffers.size(), 1);
+  EXPECT_EQ(fuse_.buffers[0],
+            std::vector<char>(kFile1Data.begin(), kFile1Data.begin() + 3));
+
+  // Reading beyond the chunked part should be queued.
+  CdcFuseRead(req_, fuse_.entries[0].ino, kFile1Data.size(), 0, &fi);
+  EXPECT_EQ(fuse_.buffers.size(), 1);
+  EXPECT_EQ(cfg_client->ReleasePrioritizedAssets(),
+            std::vector<std::string>({kFile1Name}));
+
+  // Setting the final manifest should fulfill the queued read request without
+  // invalidating the open file.
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+  ASSERT_EQ(fuse_.buffers.size(), 2);
+  EXPECT_EQ(fuse_.buffers[1], kFile1Data);
+  EXPECT_TRUE(fuse_.errors.empty());
+}
+
 TEST_F(CdcFuseFsTest, ReadSucceeds) {
   CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
   ASSERT_EQ(fuse_.entries.size(), 1);
@@ -354,6 +486,60 @@ TEST_F(CdcFuseFsTest, ReadSucceeds) {
   EXPECT_EQ(fuse_.buffers[0], data);
 }
 
+TEST_F(CdcFuseFsTest, ReadOnReadThreadSucceeds) {
+  // Use a single read thread, so that replies are ordered.
+  CdcFuseStartReadThreadsForTesting(1);
+
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kSubdirName);
+  ASSERT_EQ(fuse_.entries.size(), 2);
+  CdcFuseLookup(req_, fuse_.entries[1].ino, kFile2Name);
+  ASSERT_EQ(fuse_.entries.size(), 3);
+
+  fuse_file_info fi;
+  CdcFuseRead(req_, fuse_.entries[0].ino, kFile1Data.size(), 0, &fi);
+  CdcFuseRead(req_, fuse_.entries[2].ino, kFile2Data.size() - 1, 1, &fi);
+  CdcFuseRead(req_, fuse_.entries[1].ino, 1, 0, &fi);
+  CdcFuseWaitForReadsForTesting();
+
+  ASSERT_EQ(fuse_.buffers.size(), 2);
+  EXPECT_EQ(fuse_.buffers[0], kFile1Data);
+  std::vector<char> data(kFile2Data.begin() + 1, kFile2Data.end());
+  EXPECT_EQ(fuse_.buffers[1], data);
+
+  // Reading the directory fails.
+  ASSERT_EQ(fuse_.errors.size(), 1);
+  EXPECT_EQ(fuse_.errors[0], EIO);
+}
+
+TEST_F(CdcFuseFsTest, ReadFromChunkFilesSucceeds) {
+  std::string chunk_file_dir =
+      path::Join(path::GetTempDir(), "cdc_fuse_fs_test_chunks");
+  EXPECT_OK(path::RemoveDirRec(chunk_file_dir));
+  EXPECT_OK(path::CreateDirRec(chunk_file_dir));
+  cache_.SetChunkFileDir(chunk_file_dir);
+
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
+  ASSERT_EQ(fuse_.entries.size(), 1);
+
+  fuse_file_info fi;
+  CdcFuseRead(req_, fuse_.entries[0].ino, kFile1Data.size() - 2, 1, &fi);
+  ASSERT_EQ(fuse_.buffers.size(), 1);
+  std::vector<char> data(kFile1Data.begin() + 1, kFile1Data.end() - 1);
+  EXPECT_EQ(fuse_.buffers[0], data);
+#if PLATFORM_LINUX
+  EXPECT_EQ(fuse_.data_counter, 1);
+#endif
+
+  // Reading beyond the end of the file falls back to a regular reply.
+  CdcFuseRead(req_, fuse_.entries[0].ino, 1, kFile1Data.size(), &fi);
+  ASSERT_EQ(fuse_.buffers.size(), 2);
+  EXPECT_TRUE(fuse_.buffers[1].empty());
+
+  cache_.SetChunkFileDir(std::string());
+  EXPECT_OK(path::RemoveDirRec(chunk_file_dir));
+}
+
 TEST_F(CdcFuseFsTest, ReadFailsNotAFile) {
   fuse_file_info fi;
   CdcFuseRead(req_, FUSE_ROOT_ID, kFile1Data.size(), 0, &fi);
@@ -812,6 +998,43 @@ TEST_F(CdcFuseFsTest, AddFileUpdateManifestOldInodesValid) {
   EXPECT_EQ(fuse_.buffers[0], kFile1Data);
 }
 
+TEST_F(CdcFuseFsTest, UpdateManifestInvalidatesKernelCachesOfChangedAssets) {
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kSubdirName);
+  ASSERT_EQ(fuse_.entries.size(), 2u);
+  fuse_ino_t file1_ino = fuse_.entries[0].ino;
+  EXPECT_EQ(fuse_.entries[0].entry_timeout, internal::kCdcFuseInodeTimeoutSec);
+  EXPECT_EQ(fuse_.entries[0].attr_timeout, internal::kCdcFuseInodeTimeoutSec);
+
+  // Setting the same manifest again does not invalidate anything.
+  fuse_.invalidated_inodes.clear();
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+  EXPECT_TRUE(fuse_.invalidated_inodes.empty());
+  EXPECT_TRUE(fuse_.invalidated_entries.empty());
+
+  // Modifying file1 invalidates file1 and the root, but not subdir.
+  builder_.ModifyFile(builder_.Root(), kFile1Name, kFile2Mtime, kFile2Perm,
+                      kFile2Data);
+  manifest_id_ = cache_.AddProto(*builder_.Manifest());
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+  EXPECT_EQ(fuse_.invalidated_inodes,
+            std::vector<fuse_ino_t>({file1_ino, FUSE_ROOT_ID}));
+  EXPECT_TRUE(fuse_.invalidated_entries.empty());
+  fuse_.invalidated_inodes.clear();
+
+  // Removing file1 invalidates its directory entry.
+  FakeManifestBuilder builder2(&cache_);
+  AssetProto* subdir = builder2.AddDirectory(builder2.Root(), kSubdirName,
+                                             kSubdirMtime, kSubdirPerm);
+  builder2.AddFile(subdir, kFile2Name, kFile2Mtime, kFile2Perm, kFile2Data);
+  manifest_id_ = cache_.AddProto(*builder2.Manifest());
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+  EXPECT_EQ(fuse_.invalidated_inodes, std::vector<fuse_ino_t>({FUSE_ROOT_ID}));
+  ASSERT_EQ(fuse_.invalidated_entries.size(), 1u);
+  EXPECT_EQ(fuse_.invalidated_entries[0].first, FUSE_ROOT_ID);
+  EXPECT_EQ(fuse_.invalidated_entries[0].second, kFile1Name);
+}
+
 TEST_F(CdcFuseFsTest, ModifyFileUpdateManifestOldInodesValid) {
   // Get inode.
   CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
@@ -1178,5 +1401,298 @@ TEST_F(CdcFuseFsTest, UpdateManifestEmptyFile) {
   EXPECT_EQ(CdcFuseGetInvalidInodeCountForTesting(), 0u);
 }
 
+TEST_F(CdcFuseFsTest, SetManifestCallsAckCallback) {
+  std::vector<ContentIdProto> acked_ids;
+  cdc_fuse_fs::SetManifestAckCallback(
+      [&acked_ids](const ContentIdProto& id) { acked_ids.push_back(id); });
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+  EXPECT_EQ(acked_ids, std::vector<ContentIdProto>({manifest_id_}));
+}
+
+TEST_F(CdcFuseFsTest, SetManifestStoresManifestDelta) {
+  auto cfg_client_ptr = std::make_unique<MockConfigStreamClient>();
+  MockConfigStreamClient* cfg_client = cfg_client_ptr.get();
+  cdc_fuse_fs::SetConfigClient(std::move(cfg_client_ptr));
+  std::vector<ContentIdProto> stored_ids;
+  cdc_fuse_fs::SetManifestChunkStore(
+      [this, &stored_ids](const ContentIdProto& id, const std::string& data) {
+        stored_ids.push_back(id);
+        return cache_.Put(id, data.data(), data.size());
+      });
+
+  // The new manifest is only available through the delta.
+  FakeManifestBuilder builder(&cache_);
+  builder.AddFile(builder.Root(), kFile1Name, kFile1Mtime, kFile1Perm,
+                  kFile1Data);
+  std::string manifest_data = builder.Manifest()->SerializeAsString();
+  ContentIdProto new_id = ContentId::FromDataString(manifest_data);
+  ContentIdProto corrupt_id = ContentId::FromDataString(std::string("other"));
+  cfg_client->SetManifestDelta(
+      {{new_id, manifest_data}, {corrupt_id, "corrupt"}});
+
+  EXPECT_OK(cdc_fuse_fs::SetManifest(new_id));
+  std::vector<std::pair<ContentIdProto, ContentIdProto>> requests =
+      cfg_client->ReleaseManifestDeltaRequests();
+  ASSERT_EQ(requests.size(), 1);
+  EXPECT_EQ(requests[0].first, manifest_id_);
+  EXPECT_EQ(requests[0].second, new_id);
+
+  // The corrupt chunk was dropped.
+  EXPECT_EQ(stored_ids, std::vector<ContentIdProto>({new_id}));
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kSubdirName);
+  EXPECT_EQ(fuse_.entries.size(), 0);
+
+  // Setting the same manifest again does not request a delta.
+  EXPECT_OK(cdc_fuse_fs::SetManifest(new_id));
+  EXPECT_TRUE(cfg_client->ReleaseManifestDeltaRequests().empty());
+}
+
+TEST_F(CdcFuseFsTest, SetManifestSavesSnapshot) {
+  std::string path =
+      path::Join(path::GetTempDir(), "cdc_fuse_fs_test_snapshot");
+  path::RemoveFile(path).IgnoreError();
+  RestartWithSnapshot(path);
+  EXPECT_TRUE(metadata_ids_.empty());
+
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+  absl::StatusOr<ManifestSnapshot> snapshot = ManifestSnapshot::Load(path);
+  ASSERT_OK(snapshot);
+  EXPECT_EQ(snapshot->manifest_id, manifest_id_);
+  EXPECT_EQ(snapshot->chunk_ids, metadata_ids_);
+  ASSERT_FALSE(metadata_ids_.empty());
+  EXPECT_EQ(metadata_ids_[0], manifest_id_);
+  EXPECT_OK(path::RemoveFile(path));
+}
+
+TEST_F(CdcFuseFsTest, RunRestoresSnapshot) {
+  std::string path =
+      path::Join(path::GetTempDir(), "cdc_fuse_fs_test_snapshot");
+  path::RemoveFile(path).IgnoreError();
+  RestartWithSnapshot(path);
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+  metadata_ids_.clear();
+
+  // The manifest is mounted without calling SetManifest().
+  RestartWithSnapshot(path);
+  ASSERT_FALSE(metadata_ids_.empty());
+  EXPECT_EQ(metadata_ids_[0], manifest_id_);
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
+  ASSERT_EQ(fuse_.entries.size(), 1);
+  ExpectAttr(fuse_.entries[0].attr, kFile1Perm | path::MODE_IFREG,
+             kFile1Data.size(), kFile1Mtime);
+  EXPECT_OK(path::RemoveFile(path));
+}
+
+TEST_F(CdcFuseFsTest, SetManifestThrottlesSnapshot) {
+  std::string path =
+      path::Join(path::GetTempDir(), "cdc_fuse_fs_test_snapshot");
+  path::RemoveFile(path).IgnoreError();
+  RestartWithSnapshot(path);
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+
+  // The next manifest follows too quickly to be saved.
+  FakeManifestBuilder builder(&cache_);
+  builder.AddFile(builder.Root(), kFile1Name, kFile1Mtime, kFile1Perm,
+                  kFile1Data);
+  ContentIdProto new_id = cache_.AddProto(*builder.Manifest());
+  EXPECT_OK(cdc_fuse_fs::SetManifest(new_id));
+  absl::StatusOr<ManifestSnapshot> snapshot = ManifestSnapshot::Load(path);
+  ASSERT_OK(snapshot);
+  EXPECT_EQ(snapshot->manifest_id, manifest_id_);
+  EXPECT_OK(path::RemoveFile(path));
+}
+
+TEST_F(CdcFuseFsTest, RunIgnoresSnapshotWithEvictedChunks) {
+  std::string path =
+      path::Join(path::GetTempDir(), "cdc_fuse_fs_test_snapshot");
+  path::RemoveFile(path).IgnoreError();
+  RestartWithSnapshot(path);
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+  metadata_ids_.clear();
+
+  // The file system starts with an empty root.
+  evicted_ids_.insert(manifest_id_);
+  RestartWithSnapshot(path);
+  EXPECT_TRUE(metadata_ids_.empty());
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
+  EXPECT_EQ(fuse_.entries.size(), 0);
+  ASSERT_EQ(fuse_.errors.size(), 1);
+  EXPECT_EQ(fuse_.errors[0], ENOENT);
+  EXPECT_OK(path::RemoveFile(path));
+}
+
+TEST_F(CdcFuseFsTest, RunIgnoresSnapshotWithMissingManifest) {
+  std::string path =
+      path::Join(path::GetTempDir(), "cdc_fuse_fs_test_snapshot");
+  ManifestSnapshot snapshot;
+  snapshot.manifest_id = ContentId::FromDataString(std::string("missing"));
+  EXPECT_OK(snapshot.Save(path));
+
+  // The file system starts with an empty root.
+  RestartWithSnapshot(path);
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
+  EXPECT_EQ(fuse_.entries.size(), 0);
+  ASSERT_EQ(fuse_.errors.size(), 1);
+  EXPECT_EQ(fuse_.errors[0], ENOENT);
+  EXPECT_OK(path::RemoveFile(path));
+}
+
+TEST_F(CdcFuseFsTest, RunRestoresSnapshotWithUnloadedLists) {
+  std::string path =
+      path::Join(path::GetTempDir(), "cdc_fuse_fs_test_snapshot");
+  path::RemoveFile(path).IgnoreError();
+  RestartWithSnapshot(path);
+
+  // A large file with an indirect chunk list and a directory with an indirect
+  // asset list. Neither list is loaded by a lookup.
+  FakeManifestBuilder builder(&cache_);
+  builder.AddFile(builder.Root(), kFile1Name, kFile1Mtime, kFile1Perm,
+                  kFile1Data);
+  AssetProto* large_file = builder.Root()->add_dir_assets();
+  large_file->set_name("large_file");
+  large_file->set_type(AssetProto::FILE);
+  large_file->set_file_size(kFile1Data.size());
+  ChunkListProto chunk_list;
+  ChunkRefProto* chunk_ref = chunk_list.add_chunks();
+  *chunk_ref->mutable_chunk_id() = cache_.AddData(kFile1Data);
+  IndirectChunkListProto* indirect_chunks =
+      large_file->add_file_indirect_chunks();
+  *indirect_chunks->mutable_chunk_list_id() = cache_.AddProto(chunk_list);
+  AssetProto* dir =
+      builder.AddDirectory(builder.Root(), "dir", kFile1Mtime, kFile1Perm);
+  AssetListProto asset_list;
+  asset_list.add_assets()->set_name("child");
+  *dir->add_dir_indirect_assets() = cache_.AddProto(asset_list);
+  ContentIdProto manifest_id = cache_.AddProto(*builder.Manifest());
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id));
+
+  CdcFuseLookup(req_, FUSE_ROOT_ID, "large_file");
+  CdcFuseLookup(req_, FUSE_ROOT_ID, "dir");
+  ASSERT_EQ(fuse_.entries.size(), 2);
+  cdc_fuse_fs::SaveManifestSnapshot(/*force=*/true);
+  metadata_ids_.clear();
+
+  // The unloaded lists were evicted, which doesn't prevent the restore.
+  evicted_ids_.insert(indirect_chunks->chunk_list_id());
+  evicted_ids_.insert(dir->dir_indirect_assets(0));
+  RestartWithSnapshot(path);
+  EXPECT_EQ(metadata_ids_, std::vector<ContentIdProto>({manifest_id}));
+  CdcFuseLookup(req_, FUSE_ROOT_ID, "large_file");
+  ASSERT_EQ(fuse_.entries.size(), 3);
+  EXPECT_TRUE(fuse_.errors.empty());
+  EXPECT_OK(path::RemoveFile(path));
+}
+
+// Microbenchmark for the memory usage and the throughput of inode lookups. Run
+// with --gtest_also_run_disabled_tests --gtest_filter=*LookupBenchmark.
+TEST_F(CdcFuseFsTest, DISABLED_LookupBenchmark) {
+  constexpr int kNumFiles = 200000;
+  constexpr int kNumPasses = 10;
+  FakeManifestBuilder builder(&cache_);
+  std::vector<std::string> names;
+  names.reserve(kNumFiles);
+  for (int n = 0; n < kNumFiles; ++n) {
+    names.push_back("file" + std::to_string(n));
+    builder.AddFile(builder.Root(), names.back().c_str(), kFile1Mtime,
+                    kFile1Perm, {});
+  }
+  manifest_id_ = cache_.AddProto(*builder.Manifest());
+  EXPECT_OK(cdc_fuse_fs::SetManifest(manifest_id_));
+
+  // The first pass creates the inodes.
+  uint64_t rss = GetResidentSetSize();
+  uint64_t heap = GetHeapSize();
+  Stopwatch sw;
+  for (const std::string& name : names) {
+    CdcFuseLookup(req_, FUSE_ROOT_ID, name.c_str());
+    fuse_.entries.clear();
+  }
+  double create_sec = sw.ElapsedSeconds();
+  rss = GetResidentSetSize() - rss;
+  heap = GetHeapSize() - heap;
+  ASSERT_EQ(CdcFuseGetInodeCountForTesting(), kNumFiles);
+
+  // Further passes look up existing inodes.
+  sw.Reset();
+  for (int pass = 0; pass < kNumPasses; ++pass) {
+    for (const std::string& name : names) {
+      CdcFuseLookup(req_, FUSE_ROOT_ID, name.c_str());
+      fuse_.entries.clear();
+    }
+  }
+  double lookup_sec = sw.ElapsedSeconds();
+  EXPECT_TRUE(fuse_.errors.empty());
+
+  printf("%i inodes: %0.1f bytes RSS and %0.1f heap bytes per inode, "
+         "%0.0f creations/sec, %0.0f lookups/sec\n",
+         kNumFiles, static_cast<double>(rss) / kNumFiles,
+         static_cast<double>(heap) / kNumFiles, kNumFiles / create_sec,
+         kNumFiles * kNumPasses / lookup_sec);
+}
+
+#if PLATFORM_LINUX
+// Microbenchmark for the throughput of reads that are served from chunk files
+// in the local cache, compared to reads from a local file. The mock copies the
+// data where the kernel would splice it. Run with
+// --gtest_also_run_disabled_tests --gtest_filter=*CachedReadBenchmark.
+TEST_F(CdcFuseFsTest, DISABLED_CachedReadBenchmark) {
+  constexpr size_t kFileSize = 64 << 20;
+  // The default maximum size of FUSE read requests.
+  constexpr size_t kReadSize = 128 << 10;
+  constexpr int kNumPasses = 10;
+  std::string chunk_file_dir =
+      path::Join(path::GetTempDir(), "cdc_fuse_fs_test_chunks");
+  EXPECT_OK(path::RemoveDirRec(chunk_file_dir));
+  EXPECT_OK(path::CreateDirRec(chunk_file_dir));
+  cache_.SetChunkFileDir(chunk_file_dir);
+
+  std::vector<char> data(kFileSize);
+  std::mt19937 rng(1);
+  for (char& c : data) c = static_cast<char>(rng());
+  FakeManifestBuilder builder(&cache_);
+  builder.AddFile(builder.Root(), kFile1Name, kFile1Mtime, kFile1Perm, data);
+  EXPECT_OK(cdc_fuse_fs::SetManifest(cache_.AddProto(*builder.Manifest())));
+  CdcFuseLookup(req_, FUSE_ROOT_ID, kFile1Name);
+  ASSERT_EQ(fuse_.entries.size(), 1);
+  fuse_ino_t ino = fuse_.entries[0].ino;
+
+  // The first pass writes the chunk files.
+  fuse_file_info fi;
+  for (size_t off = 0; off < kFileSize; off += kReadSize) {
+    CdcFuseRead(req_, ino, kReadSize, off, &fi);
+    fuse_.buffers.clear();
+  }
+  Stopwatch sw;
+  for (int pass = 0; pass < kNumPasses; ++pass) {
+    for (size_t off = 0; off < kFileSize; off += kReadSize) {
+      CdcFuseRead(req_, ino, kReadSize, off, &fi);
+      fuse_.buffers.clear();
+    }
+  }
+  double cached_sec = sw.ElapsedSeconds();
+  EXPECT_EQ(fuse_.data_counter, (kNumPasses + 1) * kFileSize / kReadSize);
+
+  std::string local_path = path::Join(chunk_file_dir, "local_file");
+  EXPECT_OK(path::WriteFile(local_path, data.data(), data.size()));
+  int fd = open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+  ASSERT_GE(fd, 0);
+  std::vector<char> buffer(kReadSize);
+  sw.Reset();
+  for (int pass = 0; pass < kNumPasses; ++pass) {
+    for (size_t off = 0; off < kFileSize; off += kReadSize) {
+      EXPECT_EQ(pread(fd, buffer.data(), kReadSize, off), kReadSize);
+    }
+  }
+  double local_sec = sw.ElapsedSeconds();
+  close(fd);
+
+  constexpr double kTotalMiB = kNumPasses * kFileSize / (1024.0 * 1024.0);
+  printf("Cached reads: %0.0f MiB/s, local file reads: %0.0f MiB/s\n",
+         kTotalMiB / cached_sec, kTotalMiB / local_sec);
+  cache_.SetChunkFileDir(std::string());
+  EXPECT_OK(path::RemoveDirRec(chunk_file_dir));
+}
+#endif
+
 }  // namespace
 }  // namespace cdc_ft
@@ -16,8 +16,11 @@
 
 #include <thread>
 
+#include "absl/strings/str_format.h"
 #include "common/grpc_status.h"
 #include "common/log.h"
+#include "common/status_macros.h"
+#include "data_store/chunk_compression.h"
 #include "manifest/content_id.h"
 
 namespace cdc_ft {
@@ -129,6 +132,47 @@ absl::Status ConfigStreamGrpcClient::ProcessAssets(
   return absl::OkStatus();
 }
 
+absl::Status ConfigStreamGrpcClient::GetManifestDelta(
+    const ContentIdProto& old_manifest_id,
+    const ContentIdProto& new_manifest_id, std::vector<ManifestChunk>* chunks) {
+  proto::GetManifestDeltaRequest request;
+  *request.mutable_old_manifest_id() = old_manifest_id;
+  *request.mutable_new_manifest_id() = new_manifest_id;
+  request.set_accept_compressed(true);
+
+  grpc::ClientContext context;
+  proto::GetManifestDeltaResponse response;
+  RETURN_ABSL_IF_ERROR(stub_->GetManifestDelta(&context, request, &response));
+  if (response.id_size() != response.data_size()) {
+    return absl::DataLossError(
+        absl::StrFormat("Received %i manifest chunk ids, but %i chunks",
+                        response.id_size(), response.data_size()));
+  }
+
+  chunks->clear();
+  chunks->reserve(response.data_size());
+  for (int n = 0; n < response.data_size(); ++n) {
+    ManifestChunk chunk;
+    chunk.id = std::move(*response.mutable_id(n));
+    if (n < response.compressed_size() && response.compressed(n)) {
+      const std::string& data = response.data(n);
+      RETURN_IF_ERROR(
+          chunk_compression::Decompress(data.data(), data.size(), &chunk.data),
+          "Failed to decompress manifest chunk '%s'",
+          ContentId::ToHexString(chunk.id));
+    } else {
+      chunk.data = std::move(*response.mutable_data(n));
+    }
+    chunks->push_back(std::move(chunk));
+  }
+  if (!response.complete()) {
+    LOG_DEBUG("Received %u chunks of manifest '%s', the rest is loaded on "
+              "demand",
+              chunks->size(), ContentId::ToHexString(new_manifest_id));
+  }
+  return absl::OkStatus();
+}
+
 void ConfigStreamGrpcClient::Shutdown() {
   LOG_INFO("Stopping to listen to manifest updates");
   read_client_->Shutdown();
@@ -18,6 +18,8 @@
 #define CDC_FUSE_FS_CONFIG_STREAM_CLIENT_H_
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "grpcpp/grpcpp.h"
@@ -35,6 +37,12 @@ class ManifestIdReader;
 // Interface class for the config stream client.
 class ConfigStreamClient {
  public:
+  // Manifest chunk received via GetManifestDelta().
+  struct ManifestChunk {
+    ContentIdProto id;
+    std::string data;
+  };
+
   ConfigStreamClient() = default;
   virtual ~ConfigStreamClient() = default;
 
@@ -52,6 +60,16 @@ class ConfigStreamClient {
   // All assets are given as full relative Unix paths to the file or directory.
   virtual absl::Status ProcessAssets(std::vector<std::string> assets) = 0;
 
+  // Requests the manifest chunks that are part of the manifest
+  // |new_manifest_id|, but not of |old_manifest_id|, and stores them
+  // uncompressed in |chunks|. |old_manifest_id| may be empty. The workstation
+  // might leave out chunks if the delta is too large, so the caller must still
+  // be able to fetch manifest chunks on demand.
+  virtual absl::Status GetManifestDelta(
+      const ContentIdProto& old_manifest_id,
+      const ContentIdProto& new_manifest_id,
+      std::vector<ManifestChunk>* chunks) = 0;
+
   // Stops listening for manifest updates.
   virtual void Shutdown() = 0;
 };
@@ -70,6 +88,9 @@ class ConfigStreamGrpcClient : public ConfigStreamClient {
       std::function<absl::Status(const ContentIdProto&)> callback) override;
   absl::Status SendManifestAck(ContentIdProto manifest_id) override;
   absl::Status ProcessAssets(std::vector<std::string> assets) override;
+  absl::Status GetManifestDelta(const ContentIdProto& old_manifest_id,
+                                const ContentIdProto& new_manifest_id,
+                                std::vector<ManifestChunk>* chunks) override;
   void Shutdown() override;
 
  private:
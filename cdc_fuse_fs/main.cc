@@ -18,6 +18,7 @@
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl_helper/jedec_size_flag.h"
+#include "cdc_fuse_fs/cache_warmer.h"
 #include "cdc_fuse_fs/cdc_fuse_fs.h"
 #include "cdc_fuse_fs/config_stream_client.h"
 #include "cdc_fuse_fs/constants.h"
@@ -114,16 +115,45 @@ ABSL_FLAG(cdc_ft::JedecSize, prefetch_size, cdc_ft::JedecSize(512 << 10),
           "request. Supports common unit suffixes K, M, G");
 ABSL_FLAG(std::string, cache_dir, "/var/cache/asset_streaming",
           "Cache directory to store data chunks.");
+ABSL_FLAG(std::string, manifest_snapshot,
+          "/var/cache/asset_streaming.manifest",
+          "File to store the last acknowledged manifest in, so that it can be "
+          "mounted from the cache right away after a restart. Must be outside "
+          "of the cache directory. Set to empty to disable.");
 ABSL_FLAG(int, cache_dir_levels, 2,
           "Fanout of sub-directories to create within the cache directory.");
 ABSL_FLAG(int, verbosity, 0, "Log verbosity");
 ABSL_FLAG(bool, stats, false, "Enable statistics");
+ABSL_FLAG(bool, compression, true,
+          "Allow the workstation to send zstd-compressed chunks");
+ABSL_FLAG(int, cache_compression_level, 0,
+          "zstd level for compressing chunks in the cache directory. Set to 0 "
+          "to store chunks uncompressed.");
 ABSL_FLAG(bool, check, false, "Execute consistency check");
 ABSL_FLAG(cdc_ft::JedecSize, cache_capacity,
           cdc_ft::JedecSize(cdc_ft::DiskDataStore::kDefaultCapacity),
           "Cache capacity. Supports common unit suffixes K, M, G.");
+ABSL_FLAG(cdc_ft::JedecSize, metadata_cache_capacity,
+          cdc_ft::JedecSize(cdc_ft::DiskDataStore::kDefaultMetadataCapacity),
+          "Part of the cache capacity that manifest metadata may occupy "
+          "without being evicted for file data. Supports common unit suffixes "
+          "K, M, G.");
+ABSL_FLAG(bool, warmup, false,
+          "Fetch all metadata of every new manifest into the cache in the "
+          "background");
+ABSL_FLAG(std::vector<std::string>, warmup_paths, {},
+          "Comma-separated relative paths of files and directories whose data "
+          "is fetched into the cache as well. Implies --warmup.");
+ABSL_FLAG(cdc_ft::JedecSize, mem_cache_capacity,
+          cdc_ft::JedecSize(128 << 20),
+          "Capacity of the in-memory cache for frequently read chunks. Set to "
+          "0 to disable. Supports common unit suffixes K, M, G.");
 ABSL_FLAG(uint32_t, cleanup_timeout, cdc_ft::DataProvider::kCleanupTimeoutSec,
           "Period in seconds at which instance cache cleanups are run");
+ABSL_FLAG(uint32_t, read_threads, 8,
+          "Number of threads that fetch data for file reads in batches, so "
+          "that FUSE threads are not blocked by the network. Set to 0 to "
+          "fetch data on the FUSE threads.");
 ABSL_FLAG(uint32_t, access_idle_timeout, cdc_ft::DataProvider::kAccessIdleSec,
           "Do not run instance cache cleanups for this many seconds after the "
           "last file access");
@@ -141,13 +171,23 @@ int main(int argc, char* argv[]) {
   uint16_t port = absl::GetFlag(FLAGS_port);
   std::string cache_dir = absl::GetFlag(FLAGS_cache_dir);
   int cache_dir_levels = absl::GetFlag(FLAGS_cache_dir_levels);
+  std::string manifest_snapshot = absl::GetFlag(FLAGS_manifest_snapshot);
   int verbosity = absl::GetFlag(FLAGS_verbosity);
   bool stats = absl::GetFlag(FLAGS_stats);
+  bool compression = absl::GetFlag(FLAGS_compression);
+  int cache_compression_level = absl::GetFlag(FLAGS_cache_compression_level);
   bool consistency_check = absl::GetFlag(FLAGS_check);
   uint64_t cache_capacity = absl::GetFlag(FLAGS_cache_capacity).Size();
+  uint64_t metadata_cache_capacity =
+      absl::GetFlag(FLAGS_metadata_cache_capacity).Size();
+  std::vector<std::string> warmup_paths = absl::GetFlag(FLAGS_warmup_paths);
+  bool warmup = absl::GetFlag(FLAGS_warmup) || !warmup_paths.empty();
+  uint64_t mem_cache_capacity =
+      absl::GetFlag(FLAGS_mem_cache_capacity).Size();
   unsigned int dp_cleanup_timeout = absl::GetFlag(FLAGS_cleanup_timeout);
   unsigned int dp_access_idle_timeout =
       absl::GetFlag(FLAGS_access_idle_timeout);
+  unsigned int read_threads = absl::GetFlag(FLAGS_read_threads);
 
   // Log to console. Logs are streamed back to the workstation through the SSH
   // session.
@@ -187,6 +227,12 @@ int main(int argc, char* argv[]) {
   }
   LOG_INFO("Setting cache capacity to '%u'", cache_capacity);
   store.value()->SetCapacity(cache_capacity);
+  store.value()->SetMetadataCapacity(metadata_cache_capacity);
+  if (cache_compression_level > 0) {
+    LOG_INFO("Compressing cached chunks with level %i",
+             cache_compression_level);
+    store.value()->SetCompressionLevel(cache_compression_level);
+  }
   LOG_INFO("Caching chunks in '%s'", store.value()->RootDir());
 
   // Start a gRpc client.
@@ -197,7 +243,7 @@ int main(int argc, char* argv[]) {
       client_address, grpc::InsecureChannelCredentials(), channel_args);
   std::vector<std::unique_ptr<cdc_ft::DataStoreReader>> readers;
   readers.emplace_back(
-      std::make_unique<cdc_ft::GrpcReader>(grpc_channel, stats));
+      std::make_unique<cdc_ft::GrpcReader>(grpc_channel, stats, compression));
   cdc_ft::GrpcReader* grpc_reader =
       static_cast<cdc_ft::GrpcReader*>(readers[0].get());
 
@@ -220,22 +266,73 @@ int main(int argc, char* argv[]) {
 
   // Create data provider.
   size_t prefetch_size = absl::GetFlag(FLAGS_prefetch_size).Size();
-  cdc_ft::DataProvider data_provider(std::move(*store), std::move(readers),
-                                     prefetch_size, dp_cleanup_timeout,
-                                     dp_access_idle_timeout);
+  LOG_INFO("Setting memory cache capacity to '%u'", mem_cache_capacity);
+  cdc_ft::DataProvider data_provider(
+      std::move(*store), std::move(readers), prefetch_size, dp_cleanup_timeout,
+      dp_access_idle_timeout, mem_cache_capacity);
 
   cdc_ft::cdc_fuse_fs::SetConfigClient(
       std::make_unique<cdc_ft::ConfigStreamGrpcClient>(
           std::move(instance), std::move(grpc_channel)));
 
+  // Store the manifest chunks received with manifest updates in the cache.
+  // Manifest chunks received with a manifest delta are metadata, just like the
+  // ones loaded through the data provider.
+  cdc_ft::cdc_fuse_fs::SetManifestChunkStore(
+      [&data_provider](const cdc_ft::ContentIdProto& id,
+                       const std::string& data) {
+        absl::Status status = data_provider.Put(id, data.data(), data.size());
+        if (status.ok()) data_provider.AddMetadataChunks({id});
+        return status;
+      });
+
+  // Keep the chunks of the manifest snapshot in the cache.
+  if (!manifest_snapshot.empty()) {
+    LOG_INFO("Storing manifest snapshot in '%s'", manifest_snapshot);
+    cdc_ft::cdc_fuse_fs::SetManifestSnapshot(
+        std::move(manifest_snapshot),
+        [&data_provider](std::vector<cdc_ft::ContentIdProto> ids) {
+          data_provider.AddMetadataChunks(std::move(ids));
+        },
+        [&data_provider](const cdc_ft::ContentIdProto& id) {
+          return data_provider.IsCached(id);
+        });
+  }
+
+  // Warm up the cache for every acknowledged manifest.
+  std::unique_ptr<cdc_ft::CacheWarmer> warmer;
+  if (warmup) {
+    LOG_INFO("Warming up the cache for new manifests");
+    warmer = std::make_unique<cdc_ft::CacheWarmer>(
+        &data_provider, std::move(warmup_paths),
+        [&data_provider](std::vector<cdc_ft::ContentIdProto> ids) {
+          data_provider.AddMetadataChunks(std::move(ids));
+        });
+  }
+
+  // Metadata chunks that are not loaded again for new manifests become data
+  // chunks.
+  cdc_ft::cdc_fuse_fs::SetManifestAckCallback(
+      [&data_provider,
+       cache_warmer = warmer.get()](const cdc_ft::ContentIdProto& id) {
+        data_provider.StartMetadataGeneration();
+        if (cache_warmer) cache_warmer->Start(id);
+      });
+
   // Run FUSE.
   LOG_INFO("Running filesystem");
-  status = cdc_ft::cdc_fuse_fs::Run(&data_provider, consistency_check);
+  status = cdc_ft::cdc_fuse_fs::Run(&data_provider, consistency_check,
+                                    read_threads);
   if (!status.ok()) {
     LOG_ERROR("Filesystem stopped with error: %s", status.ToString());
   }
   LOG_INFO("Filesystem ran successfully and shuts down");
+  if (stats) {
+    data_provider.LogMemCacheStatistics();
+    data_provider.LogFetchStatistics();
+  }
 
+  if (warmer) warmer->Stop();
   data_provider.Shutdown();
   cdc_ft::cdc_fuse_fs::Shutdown();
   cdc_ft::Log::Shutdown();
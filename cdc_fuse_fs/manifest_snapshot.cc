@@ -0,0 +1,75 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cdc_fuse_fs/manifest_snapshot.h"
+
+#include "absl/strings/str_format.h"
+#include "common/path.h"
+#include "common/status.h"
+#include "common/status_macros.h"
+#include "manifest/content_id.h"
+
+namespace cdc_ft {
+
+absl::Status ManifestSnapshot::Save(const std::string& path) const {
+  std::string data = ContentId::ToHexString(manifest_id) + "\n";
+  for (const ContentIdProto& id : chunk_ids) {
+    data += ContentId::ToHexString(id) + "\n";
+  }
+
+  // Write to a temp file and rename it, so that the snapshot is replaced
+  // atomically.
+  std::string tmp_path = path + ".tmp";
+  RETURN_IF_ERROR(path::WriteFile(tmp_path, data),
+                  "Failed to write manifest snapshot '%s'", tmp_path);
+  RETURN_IF_ERROR(path::RenameFile(tmp_path, path),
+                  "Failed to rename manifest snapshot '%s' to '%s'", tmp_path,
+                  path);
+  return absl::OkStatus();
+}
+
+// static
+absl::StatusOr<ManifestSnapshot> ManifestSnapshot::Load(
+    const std::string& path) {
+  if (!path::Exists(path)) {
+    return absl::NotFoundError(
+        absl::StrFormat("Manifest snapshot '%s' does not exist", path));
+  }
+
+  std::vector<std::string> lines;
+  RETURN_IF_ERROR(
+      path::ReadAllLines(
+          path, &lines,
+          path::ReadFlags::kRemoveEmpty | path::ReadFlags::kTrimWhitespace),
+      "Failed to read manifest snapshot '%s'", path);
+  if (lines.empty()) {
+    return absl::DataLossError(
+        absl::StrFormat("Manifest snapshot '%s' is empty", path));
+  }
+
+  ManifestSnapshot snapshot;
+  snapshot.chunk_ids.resize(lines.size() - 1);
+  for (size_t n = 0; n < lines.size(); ++n) {
+    ContentIdProto* id =
+        n == 0 ? &snapshot.manifest_id : &snapshot.chunk_ids[n - 1];
+    if (!ContentId::FromHexString(lines[n], id)) {
+      return absl::DataLossError(
+          absl::StrFormat("Invalid content id '%s' in manifest snapshot '%s'",
+                          lines[n], path));
+    }
+  }
+  return snapshot;
+}
+
+}  // namespace cdc_ft
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CDC_FUSE_FS_MANIFEST_SNAPSHOT_H_
+#define CDC_FUSE_FS_MANIFEST_SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "manifest/manifest_proto_defs.h"
+
+namespace cdc_ft {
+
+// Snapshot of the last manifest that FUSE acknowledged to the workstation. It
+// allows a restarted FUSE to mount the manifest from the local cache before
+// the workstation is connected.
+// The snapshot is stored as a text file with one hex content id per line,
+// starting with the manifest id.
+struct ManifestSnapshot {
+  // Id of the manifest proto.
+  ContentIdProto manifest_id;
+
+  // Ids of the chunks that are needed to serve the manifest, i.e. the manifest
+  // proto and its indirect asset and chunk lists. These chunks should be kept
+  // in the cache.
+  std::vector<ContentIdProto> chunk_ids;
+
+  // Writes the snapshot to the file at |path|. The file is replaced
+  // atomically, so that a crash does not leave a partial snapshot behind.
+  absl::Status Save(const std::string& path) const;
+
+  // Reads the snapshot from the file at |path|. Returns a NotFound error if
+  // there is no snapshot.
+  static absl::StatusOr<ManifestSnapshot> Load(const std::string& path);
+};
+
+}  // namespace cdc_ft
+
+#endif  // CDC_FUSE_FS_MANIFEST_SNAPSHOT_H_
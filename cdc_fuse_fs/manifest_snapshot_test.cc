@@ -0,0 +1,80 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cdc_fuse_fs/manifest_snapshot.h"
+
+#include "common/path.h"
+#include "common/status_test_macros.h"
+#include "gtest/gtest.h"
+#include "manifest/content_id.h"
+
+namespace cdc_ft {
+namespace {
+
+class ManifestSnapshotTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    path_ = path::Join(path::GetTempDir(), "manifest_snapshot_test");
+    path::RemoveFile(path_).IgnoreError();
+  }
+
+  void TearDown() override { path::RemoveFile(path_).IgnoreError(); }
+
+ protected:
+  std::string path_;
+};
+
+TEST_F(ManifestSnapshotTest, SaveAndLoad) {
+  ManifestSnapshot snapshot;
+  snapshot.manifest_id = ContentId::FromDataString(std::string("manifest"));
+  snapshot.chunk_ids.push_back(snapshot.manifest_id);
+  snapshot.chunk_ids.push_back(ContentId::FromDataString(std::string("list")));
+  EXPECT_OK(snapshot.Save(path_));
+
+  absl::StatusOr<ManifestSnapshot> loaded = ManifestSnapshot::Load(path_);
+  ASSERT_OK(loaded);
+  EXPECT_EQ(loaded->manifest_id, snapshot.manifest_id);
+  EXPECT_EQ(loaded->chunk_ids, snapshot.chunk_ids);
+}
+
+TEST_F(ManifestSnapshotTest, SaveReplacesExistingSnapshot) {
+  ManifestSnapshot snapshot;
+  snapshot.manifest_id = ContentId::FromDataString(std::string("old"));
+  snapshot.chunk_ids.push_back(snapshot.manifest_id);
+  EXPECT_OK(snapshot.Save(path_));
+
+  snapshot.manifest_id = ContentId::FromDataString(std::string("new"));
+  snapshot.chunk_ids.clear();
+  EXPECT_OK(snapshot.Save(path_));
+
+  absl::StatusOr<ManifestSnapshot> loaded = ManifestSnapshot::Load(path_);
+  ASSERT_OK(loaded);
+  EXPECT_EQ(loaded->manifest_id, snapshot.manifest_id);
+  EXPECT_TRUE(loaded->chunk_ids.empty());
+}
+
+TEST_F(ManifestSnapshotTest, LoadFailsIfSnapshotDoesNotExist) {
+  EXPECT_TRUE(absl::IsNotFound(ManifestSnapshot::Load(path_).status()));
+}
+
+TEST_F(ManifestSnapshotTest, LoadFailsForInvalidSnapshot) {
+  EXPECT_OK(path::WriteFile(path_, std::string("")));
+  EXPECT_TRUE(absl::IsDataLoss(ManifestSnapshot::Load(path_).status()));
+
+  EXPECT_OK(path::WriteFile(path_, std::string("not a content id\n")));
+  EXPECT_TRUE(absl::IsDataLoss(ManifestSnapshot::Load(path_).status()));
+}
+
+}  // namespace
+}  // namespace cdc_ft
@@ -20,6 +20,16 @@ std::vector<std::string> MockConfigStreamClient::ReleasePrioritizedAssets() {
   return std::move(prioritized_assets_);
 }
 
+void MockConfigStreamClient::SetManifestDelta(
+    std::vector<ManifestChunk> chunks) {
+  manifest_delta_ = std::move(chunks);
+}
+
+std::vector<std::pair<ContentIdProto, ContentIdProto>>
+MockConfigStreamClient::ReleaseManifestDeltaRequests() {
+  return std::move(manifest_delta_requests_);
+}
+
 absl::Status MockConfigStreamClient::StartListeningToManifestUpdates(
     std::function<absl::Status(const ContentIdProto&)> callback) {
   return absl::OkStatus();
@@ -37,6 +47,14 @@ absl::Status MockConfigStreamClient::ProcessAssets(
   return absl::OkStatus();
 }
 
+absl::Status MockConfigStreamClient::GetManifestDelta(
+    const ContentIdProto& old_manifest_id,
+    const ContentIdProto& new_manifest_id, std::vector<ManifestChunk>* chunks) {
+  manifest_delta_requests_.emplace_back(old_manifest_id, new_manifest_id);
+  *chunks = manifest_delta_;
+  return absl::OkStatus();
+}
+
 void MockConfigStreamClient::Shutdown() {
   // Do nothing.
 }
@@ -15,6 +15,9 @@
 #ifndef CDC_FUSE_FS_MOCK_CONFIG_STREAM_CLIENT_H_
 #define CDC_FUSE_FS_MOCK_CONFIG_STREAM_CLIENT_H_
 
+#include <utility>
+#include <vector>
+
 #include "cdc_fuse_fs/config_stream_client.h"
 
 namespace cdc_ft {
@@ -26,16 +29,30 @@ class MockConfigStreamClient : public ConfigStreamClient {
   // prioritized via ProcessAssets() and clears the list.
   std::vector<std::string> ReleasePrioritizedAssets();
 
+  // Sets the chunks returned by GetManifestDelta().
+  void SetManifestDelta(std::vector<ManifestChunk> chunks);
+
+  // Returns the pairs of old and new manifest ids that have been requested via
+  // GetManifestDelta() and clears the list.
+  std::vector<std::pair<ContentIdProto, ContentIdProto>>
+  ReleaseManifestDeltaRequests();
+
   // ConfigStreamClient
 
   absl::Status StartListeningToManifestUpdates(
       std::function<absl::Status(const ContentIdProto&)> callback) override;
   absl::Status SendManifestAck(ContentIdProto manifest_id) override;
   absl::Status ProcessAssets(std::vector<std::string> assets) override;
+  absl::Status GetManifestDelta(const ContentIdProto& old_manifest_id,
+                                const ContentIdProto& new_manifest_id,
+                                std::vector<ManifestChunk>* chunks) override;
   void Shutdown() override;
 
  private:
   std::vector<std::string> prioritized_assets_;
+  std::vector<ManifestChunk> manifest_delta_;
+  std::vector<std::pair<ContentIdProto, ContentIdProto>>
+      manifest_delta_requests_;
 };
 
 }  // namespace cdc_ft
@@ -17,6 +17,12 @@
 #include <cassert>
 #include <cstring>
 
+#include "common/platform.h"
+
+#if PLATFORM_LINUX
+#include <unistd.h>
+#endif
+
 namespace cdc_ft {
 namespace {
 MockLibFuse* g_fuse;
@@ -76,6 +82,33 @@ int fuse_reply_buf(fuse_req_t req, const char* buf, size_t size) {
   return 0;
 }
 
+int fuse_reply_data(fuse_req_t req, struct fuse_bufvec* bufv,
+                    enum fuse_buf_copy_flags flags) {
+  assert(g_fuse);
+  assert(bufv);
+  std::vector<char> data;
+  for (size_t n = bufv->idx; n < bufv->count; ++n) {
+    const fuse_buf& buf = bufv->buf[n];
+    size_t offset = data.size();
+    data.resize(offset + buf.size);
+    if (!(buf.flags & FUSE_BUF_IS_FD)) {
+      memcpy(data.data() + offset, buf.mem, buf.size);
+      continue;
+    }
+#if PLATFORM_LINUX
+    assert(buf.flags & FUSE_BUF_FD_SEEK);
+    ssize_t bytes_read = pread(buf.fd, data.data() + offset, buf.size, buf.pos);
+    assert(bytes_read == static_cast<ssize_t>(buf.size));
+    (void)bytes_read;
+#else
+    assert(false);
+#endif
+  }
+  g_fuse->buffers.push_back(std::move(data));
+  ++g_fuse->data_counter;
+  return 0;
+}
+
 int fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param* e) {
   assert(g_fuse);
   assert(e);
@@ -108,4 +141,19 @@ struct fuse_context* fuse_get_context() {
   return &g_fuse->context;
 }
 
+int fuse_lowlevel_notify_inval_inode(struct fuse_chan* ch, fuse_ino_t ino,
+                                     off_t off, off_t len) {
+  assert(g_fuse);
+  g_fuse->invalidated_inodes.push_back(ino);
+  return 0;
+}
+
+int fuse_lowlevel_notify_inval_entry(struct fuse_chan* ch, fuse_ino_t parent,
+                                     const char* name, size_t namelen) {
+  assert(g_fuse);
+  g_fuse->invalidated_entries.emplace_back(parent,
+                                           std::string(name, namelen));
+  return 0;
+}
+
 }  // namespace cdc_ft
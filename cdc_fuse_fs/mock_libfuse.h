@@ -21,6 +21,8 @@
 #include <sys/stat.h>
 
 #include <cstdint>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace cdc_ft {
@@ -33,6 +35,7 @@ namespace cdc_ft {
 // Definitions.
 using fuse_ino_t = uint64_t;
 using fuse_req_t = void*;
+struct fuse_chan;
 using nlink_t = uint64_t;
 
 constexpr fuse_ino_t FUSE_ROOT_ID = 1;
@@ -57,6 +60,30 @@ struct fuse_file_info {
       : flags(flags), direct_io(0), keep_cache(0) {}
 };
 
+enum fuse_buf_flags {
+  FUSE_BUF_IS_FD = (1 << 1),
+  FUSE_BUF_FD_SEEK = (1 << 2),
+};
+
+enum fuse_buf_copy_flags {
+  FUSE_BUF_SPLICE_MOVE = (1 << 3),
+};
+
+struct fuse_buf {
+  size_t size;
+  enum fuse_buf_flags flags;
+  void* mem;
+  int fd;
+  off_t pos;
+};
+
+struct fuse_bufvec {
+  size_t count;
+  size_t idx;
+  size_t off;
+  struct fuse_buf buf[1];
+};
+
 struct fuse_forget_data {
   uint64_t ino;
   uint64_t nlookup;
@@ -78,12 +105,18 @@ size_t fuse_add_direntry(fuse_req_t req, char* buf, size_t bufsize,
 int fuse_reply_attr(fuse_req_t req, const struct stat* attr,
                     double attr_timeout);
 int fuse_reply_buf(fuse_req_t req, const char* buf, size_t size);
+int fuse_reply_data(fuse_req_t req, struct fuse_bufvec* bufv,
+                    enum fuse_buf_copy_flags flags);
 int fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param* e);
 int fuse_reply_err(fuse_req_t req, int err);
 int fuse_reply_open(fuse_req_t req, const struct fuse_file_info* fi);
 void fuse_reply_none(fuse_req_t req);
 int fuse_reply_statfs(fuse_req_t req, const struct statvfs* stbuf);
 struct fuse_context* fuse_get_context();
+int fuse_lowlevel_notify_inval_inode(struct fuse_chan* ch, fuse_ino_t ino,
+                                     off_t off, off_t len);
+int fuse_lowlevel_notify_inval_entry(struct fuse_chan* ch, fuse_ino_t parent,
+                                     const char* name, size_t namelen);
 
 // FUSE mocking class. Basically just a recorder for the fuse_* callbacks above.
 struct MockLibFuse {
@@ -114,7 +147,11 @@ struct MockLibFuse {
   std::vector<int> errors;
   std::vector<fuse_file_info> open_files;
   std::vector<std::vector<char>> buffers;
+  // Number of |buffers| that were replied by fuse_reply_data().
+  unsigned int data_counter = 0;
   unsigned int none_counter = 0;
+  std::vector<fuse_ino_t> invalidated_inodes;
+  std::vector<std::pair<fuse_ino_t, std::string>> invalidated_entries;
   fuse_context context;
 };
 
@@ -26,11 +26,13 @@ AssetStreamServer::AssetStreamServer(std::string src_dir,
 std::unique_ptr<AssetStreamServer> AssetStreamServer::Create(
     AssetStreamServerType type, std::string src_dir,
     DataStoreReader* data_store_reader, FileChunkMap* file_chunks,
-    ContentSentHandler content_sent, PrioritizeAssetsHandler prio_assets) {
+    ContentSentHandler content_sent, PrioritizeAssetsHandler prio_assets,
+    ChunkMismatchHandler chunk_mismatch) {
   switch (type) {
     case AssetStreamServerType::kGrpc:
       return std::make_unique<GrpcAssetStreamServer>(
-          src_dir, data_store_reader, file_chunks, content_sent, prio_assets);
+          src_dir, data_store_reader, file_chunks, content_sent, prio_assets,
+          chunk_mismatch);
     case AssetStreamServerType::kTest:
       return std::make_unique<TestingAssetStreamServer>(
           src_dir, data_store_reader, file_chunks);
@@ -39,6 +39,11 @@ using ContentSentHandler = std::function<void(
 using PrioritizeAssetsHandler =
     std::function<void(std::vector<std::string> rel_paths)>;
 
+// Handles a data chunk that does not match its content id anymore, usually
+// because the file changed after it was chunked. |rel_path| is the relative
+// Unix path of the file that should be re-chunked.
+using ChunkMismatchHandler = std::function<void(const std::string& rel_path)>;
+
 class DataStoreReader;
 class FileChunkMap;
 
@@ -52,10 +57,12 @@ class AssetStreamServer {
   // |file_chunks| is used for mapping data chunk ids to file locations.
   // |content_sent| handles event when data is transferred from the workstation
   // to a gamelet.
+  // |chunk_mismatch| is called when a served file chunk fails verification.
   static std::unique_ptr<AssetStreamServer> Create(
       AssetStreamServerType type, std::string src_dir,
       DataStoreReader* data_store_reader, FileChunkMap* file_chunks,
-      ContentSentHandler content_sent, PrioritizeAssetsHandler prio_assets);
+      ContentSentHandler content_sent, PrioritizeAssetsHandler prio_assets,
+      ChunkMismatchHandler chunk_mismatch = ChunkMismatchHandler());
 
   AssetStreamServer(const AssetStreamServer& other) = delete;
   AssetStreamServer& operator=(const AssetStreamServer& other) = delete;
@@ -83,6 +90,11 @@ class AssetStreamServer {
   // Thread-safe.
   virtual ContentIdProto GetManifestId() const = 0;
 
+  // Closes cached handles of the file at the relative Unix path |rel_path| and
+  // of all files below it. An empty |rel_path| closes all cached handles.
+  // Thread-safe.
+  virtual void InvalidateFileHandles(const std::string& rel_path) = 0;
+
  protected:
   // Creates a new asset streaming server.
   // |src_dir| is the directory on the workstation to mount.
@@ -16,14 +16,17 @@
 
 #include "absl/strings/str_format.h"
 #include "absl/time/time.h"
+#include "common/file_handle_cache.h"
 #include "common/grpc_status.h"
 #include "common/log.h"
-#include "common/path.h"
 #include "common/status.h"
 #include "common/status_macros.h"
+#include "common/threadpool.h"
+#include "data_store/chunk_compression.h"
 #include "data_store/data_store_reader.h"
 #include "grpcpp/grpcpp.h"
 #include "manifest/file_chunk_map.h"
+#include "manifest/manifest_delta.h"
 #include "proto/asset_stream_service.grpc.pb.h"
 
 namespace cdc_ft {
@@ -31,6 +34,8 @@ namespace {
 
 using GetContentRequest = proto::GetContentRequest;
 using GetContentResponse = proto::GetContentResponse;
+using StreamContentRequest = proto::StreamContentRequest;
+using StreamContentResponse = proto::StreamContentResponse;
 using SendCachedContentIdsRequest = proto::SendCachedContentIdsRequest;
 using SendCachedContentIdsResponse = proto::SendCachedContentIdsResponse;
 using AssetStreamService = proto::AssetStreamService;
@@ -42,6 +47,40 @@ using AckManifestIdReceivedResponse = proto::AckManifestIdReceivedResponse;
 using ConfigStreamService = proto::ConfigStreamService;
 using ProcessAssetsRequest = proto::ProcessAssetsRequest;
 using ProcessAssetsResponse = proto::ProcessAssetsResponse;
+using GetManifestDeltaRequest = proto::GetManifestDeltaRequest;
+using GetManifestDeltaResponse = proto::GetManifestDeltaResponse;
+
+// Number of threads per content stream that read chunks concurrently.
+constexpr size_t kStreamContentThreads = 8;
+
+// Maximum number of chunk requests per content stream that have been read but
+// not been answered yet.
+constexpr size_t kMaxStreamContentInFlight = 64;
+
+// Threadpool task that runs an arbitrary function.
+class FunctionTask : public Task {
+ public:
+  explicit FunctionTask(std::function<void()> func) : func_(std::move(func)) {}
+
+  // Task:
+  void ThreadRun(IsCancelledPredicate is_cancelled) override { func_(); }
+
+ private:
+  std::function<void()> func_;
+};
+
+// Replaces |data| by its compressed version if it compresses well. Returns
+// true if |data| was compressed.
+bool MaybeCompress(std::string* data) {
+  std::string compressed;
+  if (!chunk_compression::Compress(data->data(), data->size(),
+                                   chunk_compression::kTransferLevel,
+                                   &compressed)) {
+    return false;
+  }
+  *data = std::move(compressed);
+  return true;
+}
 
 }  // namespace
 
@@ -50,40 +89,97 @@ class AssetStreamServiceImpl final : public AssetStreamService::Service {
   AssetStreamServiceImpl(std::string src_dir,
                          DataStoreReader* data_store_reader,
                          FileChunkMap* file_chunks, InstanceIdMap* instance_ids,
-                         ContentSentHandler content_sent)
+                         ContentSentHandler content_sent,
+                         ChunkMismatchHandler chunk_mismatch)
       : src_dir_(std::move(src_dir)),
+        file_handles_(src_dir_),
         data_store_reader_(data_store_reader),
         file_chunks_(file_chunks),
         started_(absl::Now()),
         instance_ids_(instance_ids),
-        content_sent_(content_sent) {}
+        content_sent_(content_sent),
+        chunk_mismatch_(std::move(chunk_mismatch)) {}
 
+  // Note that a chunk that cannot be read, e.g. because it failed
+  // verification, fails the whole batch. The response has no way to report
+  // errors for single chunks, and the client needs all chunks of a batch
+  // anyway. StreamContent() reports errors per chunk.
   grpc::Status GetContent(grpc::ServerContext* context,
                           const GetContentRequest* request,
                           GetContentResponse* response) override {
-    // See if this is a data chunk first. The hash lookup is faster than the
-    // file lookup from the data store.
-    std::string rel_path;
-    uint64_t offset;
-    size_t size;
     std::string instance_id = instance_ids_->Get(context->peer());
-
+    bool any_compressed = false;
     for (const ContentIdProto& id : request->id()) {
-      uint32_t uint32_size;
-      if (file_chunks_->Lookup(id, &rel_path, &offset, &uint32_size)) {
-        size = uint32_size;
-        // File data chunk.
-        RETURN_GRPC_IF_ERROR(ReadFromFile(id, rel_path, offset, uint32_size,
-                                          response->add_data()));
-        file_chunks_->RecordStreamedChunk(id, request->thread_id());
-      } else {
-        // Manifest chunk.
-        RETURN_GRPC_IF_ERROR(
-            ReadFromDataStore(id, response->add_data(), &size));
+      std::string* data = response->add_data();
+      RETURN_GRPC_IF_ERROR(
+          ReadContent(id, request->thread_id(), instance_id, data));
+      bool compressed = request->accept_compressed() && MaybeCompress(data);
+      if (compressed && !any_compressed) {
+        // Backfill flags for the previous, uncompressed chunks.
+        response->mutable_compressed()->Resize(response->data_size() - 1,
+                                               false);
+        any_compressed = true;
       }
-      if (content_sent_ != nullptr) {
-        content_sent_(size, 1, instance_id);
+      if (any_compressed) response->add_compressed(compressed);
+    }
+    return grpc::Status::OK;
+  }
+
+  grpc::Status StreamContent(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<StreamContentResponse, StreamContentRequest>*
+          stream) override {
+    std::string instance_id = instance_ids_->Get(context->peer());
+
+    // Read the chunks in parallel and send each one as soon as it is ready.
+    // gRPC allows one concurrent reader and one concurrent writer per stream,
+    // so the writes have to be serialized. No more requests are read while
+    // kMaxStreamContentInFlight requests are being processed, so that a fast
+    // client cannot make the server buffer an unbounded amount of work. Flow
+    // control then throttles the client.
+    Threadpool pool(kStreamContentThreads);
+    pool.SetTaskCompletedCallback([](std::unique_ptr<Task>) {});
+    absl::Mutex write_mutex;
+    absl::Mutex in_flight_mutex;
+    size_t in_flight = 0;
+    std::atomic<bool> write_failed{false};
+
+    StreamContentRequest request;
+    for (;;) {
+      {
+        absl::MutexLock lock(&in_flight_mutex);
+        auto can_read = [&in_flight, &write_failed]() {
+          return in_flight < kMaxStreamContentInFlight || write_failed;
+        };
+        in_flight_mutex.Await(absl::Condition(&can_read));
+      }
+      if (write_failed || context->IsCancelled() || !stream->Read(&request)) {
+        break;
+      }
+      {
+        absl::MutexLock lock(&in_flight_mutex);
+        ++in_flight;
       }
+      pool.QueueTask(std::make_unique<FunctionTask>(
+          [this, request = std::move(request), context, &instance_id, stream,
+           &write_mutex, &in_flight_mutex, &in_flight, &write_failed]() {
+            if (!write_failed && !context->IsCancelled()) {
+              StreamContentResponse response =
+                  ProcessStreamRequest(request, instance_id);
+              absl::MutexLock lock(&write_mutex);
+              if (!write_failed && !stream->Write(response)) {
+                write_failed = true;
+              }
+            }
+            absl::MutexLock lock(&in_flight_mutex);
+            --in_flight;
+          }));
+      request.Clear();
+    }
+    pool.Wait();
+    if (context->IsCancelled()) {
+      return grpc::Status(grpc::StatusCode::CANCELLED,
+                          "Content stream was cancelled");
     }
     return grpc::Status::OK;
   }
@@ -92,33 +188,101 @@ class AssetStreamServiceImpl final : public AssetStreamService::Service {
       grpc::ServerContext* context, const SendCachedContentIdsRequest* request,
       SendCachedContentIdsResponse* response) override {
     for (const ContentIdProto& id : request->id())
-      file_chunks_->RecordCachedChunk(id);
+      file_chunks_->RecordCachedChunk(ContentId(id));
     return grpc::Status::OK;
   }
 
+  void InvalidateFileHandles(const std::string& rel_path) {
+    file_handles_.Invalidate(rel_path);
+  }
+
  private:
+  // Reads the chunk with the given |id| into |data|, either from the source
+  // files or from the data store, and updates the statistics.
+  absl::Status ReadContent(const ContentIdProto& id, uint64_t thread_id,
+                           const std::string& instance_id, std::string* data) {
+    // See if this is a data chunk first. The hash lookup is faster than the
+    // file lookup from the data store.
+    std::string rel_path;
+    uint64_t offset;
+    size_t size;
+    uint32_t uint32_size;
+    const ContentId file_chunk_id(id);
+    if (file_chunks_->Lookup(file_chunk_id, &rel_path, &offset,
+                             &uint32_size)) {
+      size = uint32_size;
+      // File data chunk.
+      RETURN_IF_ERROR(ReadFromFile(id, rel_path, offset, uint32_size, data));
+      RETURN_IF_ERROR(VerifyFileChunk(id, rel_path, offset, *data));
+      file_chunks_->RecordStreamedChunk(file_chunk_id, thread_id);
+    } else {
+      // Manifest chunk.
+      RETURN_IF_ERROR(ReadFromDataStore(id, data, &size));
+    }
+    if (content_sent_ != nullptr) {
+      content_sent_(size, 1, instance_id);
+    }
+    return absl::OkStatus();
+  }
+
+  // Reads the chunk requested by |request| and returns the response for it. A
+  // failure is reported in the response.
+  StreamContentResponse ProcessStreamRequest(
+      const StreamContentRequest& request, const std::string& instance_id) {
+    StreamContentResponse response;
+    response.set_request_id(request.request_id());
+    absl::Status status = ReadContent(request.id(), request.thread_id(),
+                                      instance_id, response.mutable_data());
+    if (status.ok()) {
+      response.set_compressed(request.accept_compressed() &&
+                              MaybeCompress(response.mutable_data()));
+      return response;
+    }
+    LOG_WARNING("Failed to stream chunk '%s': %s",
+                ContentId::ToHexString(request.id()), status.ToString());
+    response.clear_data();
+    response.set_error_code(static_cast<int>(status.code()));
+    response.set_error_message(std::string(status.message()));
+    return response;
+  }
+
   absl::Status ReadFromFile(const ContentIdProto& id,
                             const std::string& rel_path, uint64_t offset,
                             uint32_t size, std::string* data) {
-    std::string path = path::Join(src_dir_, rel_path);
-    path::FixPathSeparators(&path);
     data->resize(size);
     size_t read_size;
     ASSIGN_OR_RETURN(
         read_size,
-        path::ReadFile(path, const_cast<char*>(data->data()), offset, size),
+        file_handles_.Read(rel_path, const_cast<char*>(data->data()), offset,
+                           size),
         "Failed to read chunk '%s', file '%s', offset %d, size %d",
-        ContentId::ToHexString(id), path, offset, size);
+        ContentId::ToHexString(id), rel_path, offset, size);
 
     absl::Time now = absl::Now();
     LOG_VERBOSE("'%s', %d, '%s', '%s', %u, %u",
                 absl::FormatTime("%H:%M:%S", now, absl::UTCTimeZone()),
                 absl::ToInt64Milliseconds(now - started_),
-                ContentId::ToHexString(id), path, offset, size);
+                ContentId::ToHexString(id), rel_path, offset, size);
 
     return absl::OkStatus();
   }
 
+  // Verifies that |data| read from |rel_path| at |offset| still hashes to |id|.
+  // The file might have changed after it was chunked, in which case the
+  // mismatch handler is notified to re-chunk the file.
+  absl::Status VerifyFileChunk(const ContentIdProto& id,
+                               const std::string& rel_path, uint64_t offset,
+                               const std::string& data) {
+    if (ContentId::FromDataString(data) == id) return absl::OkStatus();
+
+    LOG_WARNING("Chunk '%s' in file '%s' at offset %u changed, re-chunking",
+                ContentId::ToHexString(id), rel_path, offset);
+    if (chunk_mismatch_) chunk_mismatch_(rel_path);
+    return absl::DataLossError(
+        absl::StrFormat("Chunk '%s' does not match file '%s' at offset %u",
+                        ContentId::ToHexString(id), rel_path, offset));
+  }
+
   absl::Status ReadFromDataStore(const ContentIdProto& id, std::string* data,
                                  size_t* size) {
     Buffer buf;
@@ -138,18 +302,23 @@ class AssetStreamServiceImpl final : public AssetStreamService::Service {
   }
 
   const std::string src_dir_;
+  FileHandleCache file_handles_;
   DataStoreReader* const data_store_reader_;
   FileChunkMap* const file_chunks_;
   const absl::Time started_;
   InstanceIdMap* instance_ids_;
   ContentSentHandler content_sent_;
+  ChunkMismatchHandler chunk_mismatch_;
 };
 
 class ConfigStreamServiceImpl final : public ConfigStreamService::Service {
  public:
-  ConfigStreamServiceImpl(InstanceIdMap* instance_ids,
+  ConfigStreamServiceImpl(DataStoreReader* data_store_reader,
+                          InstanceIdMap* instance_ids,
                           PrioritizeAssetsHandler prio_handler)
-      : instance_ids_(instance_ids), prio_handler_(std::move(prio_handler)) {}
+      : data_store_reader_(data_store_reader),
+        instance_ids_(instance_ids),
+        prio_handler_(std::move(prio_handler)) {}
   ~ConfigStreamServiceImpl() { Shutdown(); }
 
   grpc::Status GetManifestId(
@@ -201,6 +370,34 @@ class ConfigStreamServiceImpl final : public ConfigStreamService::Service {
     return grpc::Status::OK;
   }
 
+  grpc::Status GetManifestDelta(grpc::ServerContext* context,
+                                const GetManifestDeltaRequest* request,
+                                GetManifestDeltaResponse* response) override {
+    ManifestDelta delta(data_store_reader_);
+    RETURN_GRPC_IF_ERROR(delta.Compute(request->old_manifest_id(),
+                                       request->new_manifest_id()));
+    bool any_compressed = false;
+    for (ManifestDelta::Chunk& chunk : delta.ReleaseChunks()) {
+      *response->add_id() = std::move(chunk.id);
+      std::string* data = response->add_data();
+      *data = std::move(chunk.data);
+      bool compressed = request->accept_compressed() && MaybeCompress(data);
+      if (compressed && !any_compressed) {
+        // Backfill flags for the previous, uncompressed chunks.
+        response->mutable_compressed()->Resize(response->data_size() - 1,
+                                               false);
+        any_compressed = true;
+      }
+      if (any_compressed) response->add_compressed(compressed);
+    }
+    response->set_complete(delta.Complete());
+    LOG_INFO("Sending %u changed chunks of manifest '%s'%s",
+             response->data_size(),
+             ContentId::ToHexString(request->new_manifest_id()),
+             delta.Complete() ? "" : " (truncated)");
+    return grpc::Status::OK;
+  }
+
   void SetManifestId(const ContentIdProto& id) ABSL_LOCKS_EXCLUDED(mutex_) {
     LOG_INFO("Updating manifest id '%s' in configuration service",
              ContentId::ToHexString(id));
@@ -256,6 +453,7 @@ class ConfigStreamServiceImpl final : public ConfigStreamService::Service {
   mutable absl::Mutex mutex_;
   ContentIdProto id_ ABSL_GUARDED_BY(mutex_);
   bool running_ ABSL_GUARDED_BY(mutex_) = true;
+  DataStoreReader* const data_store_reader_;
   InstanceIdMap* instance_ids_ = nullptr;
   PrioritizeAssetsHandler prio_handler_;
 
@@ -267,13 +465,13 @@ class ConfigStreamServiceImpl final : public ConfigStreamService::Service {
 GrpcAssetStreamServer::GrpcAssetStreamServer(
     std::string src_dir, DataStoreReader* data_store_reader,
     FileChunkMap* file_chunks, ContentSentHandler content_sent,
-    PrioritizeAssetsHandler prio_assets)
+    PrioritizeAssetsHandler prio_assets, ChunkMismatchHandler chunk_mismatch)
     : AssetStreamServer(src_dir, data_store_reader, file_chunks),
       asset_stream_service_(std::make_unique<AssetStreamServiceImpl>(
           std::move(src_dir), data_store_reader, file_chunks, &instance_ids_,
-          content_sent)),
+          content_sent, std::move(chunk_mismatch))),
       config_stream_service_(std::make_unique<ConfigStreamServiceImpl>(
-          &instance_ids_, std::move(prio_assets))) {}
+          data_store_reader, &instance_ids_, std::move(prio_assets))) {}
 
 GrpcAssetStreamServer::~GrpcAssetStreamServer() = default;
 
@@ -288,14 +486,17 @@ absl::Status GrpcAssetStreamServer::Start(int port) {
   builder.RegisterService(asset_stream_service_.get());
   builder.RegisterService(config_stream_service_.get());
   server_ = builder.BuildAndStart();
-  if (selected_port != port) {
+  if (port != 0 && selected_port != port) {
     return MakeStatus(
         "Failed to start streaming server: Could not listen on port %i. Is the "
         "port in use?",
         port);
   }
-  if (!server_) return MakeStatus("Failed to start streaming server");
-  LOG_INFO("Streaming server listening on '%s'", server_address);
+  if (!server_ || selected_port == 0) {
+    return MakeStatus("Failed to start streaming server");
+  }
+  port_ = selected_port;
+  LOG_INFO("Streaming server listening on 'localhost:%i'", port_);
   return absl::OkStatus();
 }
 
@@ -325,4 +526,9 @@ ContentIdProto GrpcAssetStreamServer::GetManifestId() const {
   return config_stream_service_->GetStoredManifestId();
 }
 
+void GrpcAssetStreamServer::InvalidateFileHandles(const std::string& rel_path) {
+  assert(asset_stream_service_);
+  asset_stream_service_->InvalidateFileHandles(rel_path);
+}
+
 }  // namespace cdc_ft
@@ -41,7 +41,8 @@ class GrpcAssetStreamServer : public AssetStreamServer {
   GrpcAssetStreamServer(std::string src_dir, DataStoreReader* data_store_reader,
                         FileChunkMap* file_chunks,
                         ContentSentHandler content_sent,
-                        PrioritizeAssetsHandler prio_assets);
+                        PrioritizeAssetsHandler prio_assets,
+                        ChunkMismatchHandler chunk_mismatch);
 
   ~GrpcAssetStreamServer();
 
@@ -58,11 +59,18 @@ class GrpcAssetStreamServer : public AssetStreamServer {
 
   ContentIdProto GetManifestId() const override;
 
+  void InvalidateFileHandles(const std::string& rel_path) override;
+
+  // Returns the port the server listens on. If Start() was called with port 0,
+  // this is the port that was picked by the system.
+  int Port() const { return port_; }
+
  private:
   InstanceIdMap instance_ids_;
   const std::unique_ptr<AssetStreamServiceImpl> asset_stream_service_;
   const std::unique_ptr<ConfigStreamServiceImpl> config_stream_service_;
   std::unique_ptr<grpc::Server> server_;
+  int port_ = 0;
 };
 
 }  // namespace cdc_ft
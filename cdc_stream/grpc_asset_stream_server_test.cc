@@ -0,0 +1,200 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cdc_stream/grpc_asset_stream_server.h"
+
+#include <unordered_map>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "common/path.h"
+#include "common/status_test_macros.h"
+#include "data_store/mem_data_store.h"
+#include "grpcpp/grpcpp.h"
+#include "gtest/gtest.h"
+#include "manifest/content_id.h"
+#include "manifest/file_chunk_map.h"
+#include "proto/asset_stream_service.grpc.pb.h"
+
+namespace cdc_ft {
+namespace {
+
+constexpr char kTestDirName[] = "grpc_asset_stream_server_test";
+constexpr char kFileName[] = "file.bin";
+
+// Size of the chunks of the test file.
+constexpr size_t kChunkSize = 64;
+
+// Number of chunks of the test file. Exceeds the number of requests the server
+// processes at the same time.
+constexpr int kNumChunks = 500;
+
+using StreamResponses =
+    std::unordered_map<uint64_t, proto::StreamContentResponse>;
+
+class GrpcAssetStreamServerTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    src_dir_ = path::Join(path::GetTempDir(), kTestDirName);
+    EXPECT_OK(path::RemoveDirRec(src_dir_));
+    EXPECT_OK(path::CreateDirRec(src_dir_));
+
+    // Write a file and register its chunks.
+    std::vector<FileChunk> chunks;
+    for (int n = 0; n < kNumChunks; ++n) {
+      std::string data = absl::StrFormat("%063i\n", n);
+      ContentIdProto id = ContentId::FromDataString(data);
+      chunks.emplace_back(ContentId(id), file_data_.size());
+      chunk_ids_.push_back(id);
+      file_data_ += data;
+    }
+    ASSERT_OK(path::WriteFile(path::Join(src_dir_, kFileName), file_data_));
+    file_chunks_.Init(kFileName, file_data_.size(), &chunks);
+    file_chunks_.FlushUpdates();
+
+    manifest_chunk_id_ = store_.AddData({'m', 'a', 'n', 'i'});
+
+    server_ = std::make_unique<GrpcAssetStreamServer>(
+        src_dir_, &store_, &file_chunks_, ContentSentHandler(),
+        PrioritizeAssetsHandler(),
+        [this](const std::string& rel_path) {
+          mismatched_files_.push_back(rel_path);
+        });
+    ASSERT_OK(server_->Start(/*port=*/0));
+    stub_ = proto::AssetStreamService::NewStub(grpc::CreateChannel(
+        absl::StrFormat("localhost:%i", server_->Port()),
+        grpc::InsecureChannelCredentials()));
+  }
+
+  void TearDown() override {
+    server_->Shutdown();
+    EXPECT_OK(path::RemoveDirRec(src_dir_));
+  }
+
+ protected:
+  // Requests |ids| through a single content stream and returns the responses
+  // by request id. The request id is the index in |ids|.
+  StreamResponses StreamContent(const std::vector<ContentIdProto>& ids) {
+    grpc::ClientContext context;
+    auto stream = stub_->StreamContent(&context);
+    for (size_t n = 0; n < ids.size(); ++n) {
+      proto::StreamContentRequest request;
+      request.set_request_id(n);
+      *request.mutable_id() = ids[n];
+      EXPECT_TRUE(stream->Write(request));
+    }
+    EXPECT_TRUE(stream->WritesDone());
+
+    StreamResponses responses;
+    proto::StreamContentResponse response;
+    while (stream->Read(&response)) {
+      EXPECT_TRUE(responses.emplace(response.request_id(), response).second)
+          << "Duplicate response for request " << response.request_id();
+    }
+    EXPECT_TRUE(stream->Finish().ok());
+    return responses;
+  }
+
+  std::string FileChunkData(int index) const {
+    return file_data_.substr(index * kChunkSize, kChunkSize);
+  }
+
+  std::string src_dir_;
+  std::string file_data_;
+  std::vector<ContentIdProto> chunk_ids_;
+  ContentIdProto manifest_chunk_id_;
+  MemDataStore store_;
+  FileChunkMap file_chunks_{/*enable_stats=*/false};
+  std::vector<std::string> mismatched_files_;
+  std::unique_ptr<GrpcAssetStreamServer> server_;
+  std::unique_ptr<proto::AssetStreamService::Stub> stub_;
+};
+
+TEST_F(GrpcAssetStreamServerTest, StreamContentRoundTrip) {
+  std::vector<ContentIdProto> ids = chunk_ids_;
+  ids.push_back(manifest_chunk_id_);
+  StreamResponses responses = StreamContent(ids);
+
+  ASSERT_EQ(responses.size(), ids.size());
+  for (int n = 0; n < kNumChunks; ++n) {
+    EXPECT_EQ(responses[n].error_code(), 0);
+    EXPECT_FALSE(responses[n].compressed());
+    EXPECT_EQ(responses[n].data(), FileChunkData(n));
+  }
+  EXPECT_EQ(responses[kNumChunks].data(), "mani");
+  EXPECT_TRUE(mismatched_files_.empty());
+}
+
+TEST_F(GrpcAssetStreamServerTest, StreamContentReportsMissingChunk) {
+  StreamResponses responses = StreamContent(
+      {ContentId::FromDataString(std::string("missing")), chunk_ids_[0]});
+
+  // The error is reported for the chunk and does not end the stream.
+  ASSERT_EQ(responses.size(), 2);
+  EXPECT_EQ(responses[0].error_code(),
+            static_cast<int>(absl::StatusCode::kNotFound));
+  EXPECT_TRUE(responses[0].data().empty());
+  EXPECT_EQ(responses[1].error_code(), 0);
+  EXPECT_EQ(responses[1].data(), FileChunkData(0));
+}
+
+TEST_F(GrpcAssetStreamServerTest, StreamContentStopsOnCancellation) {
+  grpc::ClientContext context;
+  auto stream = stub_->StreamContent(&context);
+  for (int n = 0; n < kNumChunks; ++n) {
+    proto::StreamContentRequest request;
+    request.set_request_id(n);
+    *request.mutable_id() = chunk_ids_[n];
+    if (!stream->Write(request)) break;
+  }
+
+  // The server stops processing requests. Shutting it down in TearDown() does
+  // not block on the cancelled stream.
+  context.TryCancel();
+  EXPECT_EQ(stream->Finish().error_code(), grpc::StatusCode::CANCELLED);
+}
+
+TEST_F(GrpcAssetStreamServerTest, StreamContentReportsChangedFile) {
+  // Change the data of chunk 3 after the file was indexed.
+  std::string changed_data = file_data_;
+  changed_data[3 * kChunkSize] = 'x';
+  ASSERT_OK(path::WriteFile(path::Join(src_dir_, kFileName), changed_data));
+
+  StreamResponses responses = StreamContent({chunk_ids_[3], chunk_ids_[4]});
+  ASSERT_EQ(responses.size(), 2);
+  EXPECT_EQ(responses[0].error_code(),
+            static_cast<int>(absl::StatusCode::kDataLoss));
+  EXPECT_EQ(responses[1].error_code(), 0);
+  EXPECT_EQ(responses[1].data(), FileChunkData(4));
+  EXPECT_EQ(mismatched_files_, std::vector<std::string>({kFileName}));
+}
+
+TEST_F(GrpcAssetStreamServerTest, GetContentReportsChangedFile) {
+  std::string changed_data = file_data_;
+  changed_data[3 * kChunkSize] = 'x';
+  ASSERT_OK(path::WriteFile(path::Join(src_dir_, kFileName), changed_data));
+
+  // The mismatch fails the whole batch.
+  grpc::ClientContext context;
+  proto::GetContentRequest request;
+  *request.add_id() = chunk_ids_[3];
+  *request.add_id() = chunk_ids_[4];
+  proto::GetContentResponse response;
+  EXPECT_EQ(stub_->GetContent(&context, request, &response).error_code(),
+            grpc::StatusCode::DATA_LOSS);
+  EXPECT_EQ(mismatched_files_, std::vector<std::string>({kFileName}));
+}
+
+}  // namespace
+}  // namespace cdc_ft
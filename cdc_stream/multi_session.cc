@@ -15,7 +15,6 @@
 #include "cdc_stream/multi_session.h"
 
 #include "cdc_stream/session.h"
-#include "common/file_watcher_win.h"
 #include "common/log.h"
 #include "common/path.h"
 #include "common/path_filter.h"
@@ -31,20 +30,32 @@
 #include "metrics/enums.h"
 #include "metrics/messages.h"
 
+#if PLATFORM_WINDOWS
+#include "common/file_watcher_win.h"
+#elif PLATFORM_LINUX
+#include "common/file_watcher_linux.h"
+#endif
+
 namespace cdc_ft {
 namespace {
 
+#if PLATFORM_WINDOWS
+using FileWatcher = FileWatcherWin;
+#elif PLATFORM_LINUX
+using FileWatcher = FileWatcherLinux;
+#endif
+
 // Stats output period (if enabled).
 constexpr double kStatsPrintDelaySec = 0.1f;
 
 ManifestUpdater::Operator FileWatcherActionToOperation(
-    FileWatcherWin::FileAction action) {
+    FileWatcher::FileAction action) {
   switch (action) {
-    case FileWatcherWin::FileAction::kAdded:
+    case FileWatcher::FileAction::kAdded:
       return ManifestUpdater::Operator::kAdd;
-    case FileWatcherWin::FileAction::kModified:
+    case FileWatcher::FileAction::kModified:
       return ManifestUpdater::Operator::kUpdate;
-    case FileWatcherWin::FileAction::kDeleted:
+    case FileWatcher::FileAction::kDeleted:
       return ManifestUpdater::Operator::kDelete;
   }
   // The switch must cover all actions.
@@ -56,7 +67,7 @@ ManifestUpdater::Operator FileWatcherActionToOperation(
 // Converts |modified_files| (as returned from the file watcher) into an
 // OperationList (as required by the manifest updater).
 ManifestUpdater::OperationList GetFileOperations(
-    const FileWatcherWin::FileMap& modified_files) {
+    const FileWatcher::FileMap& modified_files) {
   AssetInfo ai;
   ManifestUpdater::OperationList ops;
   ops.reserve(modified_files.size());
@@ -70,6 +81,33 @@ ManifestUpdater::OperationList GetFileOperations(
   return ops;
 }
 
+// Adds the files in |rel_paths| that failed chunk verification to
+// |modified_files|, unless the file watcher reported them already.
+void AddMismatchedFiles(const std::string& src_dir,
+                        const std::unordered_set<std::string>& rel_paths,
+                        FileWatcher::FileMap* modified_files) {
+  for (const std::string& rel_path : rel_paths) {
+    if (modified_files->find(rel_path) != modified_files->end()) continue;
+
+    std::string full_path = path::Join(src_dir, rel_path);
+    path::FixPathSeparators(&full_path);
+    uint64_t size;
+    time_t mtime;
+    absl::Status status = path::FileSize(full_path, &size);
+    if (status.ok()) status = path::GetFileTime(full_path, &mtime);
+    if (!status.ok()) {
+      // The file watcher will pick up the deletion.
+      LOG_WARNING("Failed to get stats for mismatched file '%s': %s",
+                  full_path, status.ToString());
+      continue;
+    }
+    modified_files->emplace(
+        rel_path,
+        FileWatcher::FileInfo(FileWatcher::FileAction::kModified,
+                              /*is_dir=*/false, size, mtime));
+  }
+}
+
 }  // namespace
 
 MultiSessionRunner::MultiSessionRunner(
@@ -96,6 +134,8 @@ absl::Status MultiSessionRunner::Initialize(int port,
   UpdaterConfig cfg;
   cfg.num_threads = num_updater_threads_;
   cfg.src_dir = src_dir_;
+  // |file_chunks_| lives as long as the updater.
+  cfg.skip_unchanged_dirs = true;
 
   assert(!manifest_updater_);
   manifest_updater_ =
@@ -106,15 +146,25 @@ absl::Status MultiSessionRunner::Initialize(int port,
       std::bind(&ManifestUpdater::AddPriorityAssets, manifest_updater_.get(),
                 std::placeholders::_1);
 
+  // Re-chunk files whose data does not match the manifest anymore.
+  ChunkMismatchHandler chunk_mismatch =
+      std::bind(&MultiSessionRunner::OnChunkMismatch, this,
+                std::placeholders::_1);
+
   // Start the server.
   assert(!server_);
-  server_ = AssetStreamServer::Create(type, src_dir_, data_store_,
-                                      &file_chunks_, std::move(content_sent),
-                                      std::move(prio_assets));
+  server_ = AssetStreamServer::Create(
+      type, src_dir_, data_store_, &file_chunks_, std::move(content_sent),
+      std::move(prio_assets), std::move(chunk_mismatch));
   assert(server_);
   RETURN_IF_ERROR(server_->Start(port),
                   "Failed to start asset stream server for '%s'", src_dir_);
 
+  // Close cached file handles of assets that change on the workstation.
+  manifest_updater_->SetFileChangedHandler(
+      std::bind(&AssetStreamServer::InvalidateFileHandles, server_.get(),
+                std::placeholders::_1));
+
   assert(!thread_);
   thread_ = std::make_unique<std::thread>([this]() { Run(); });
 
@@ -175,7 +225,7 @@ ContentIdProto MultiSessionRunner::ManifestId() const {
 void MultiSessionRunner::Run() {
   // Set up file watcher.
   // The streamed path should be a directory and exist at the beginning.
-  FileWatcherWin watcher(src_dir_);
+  FileWatcher watcher(src_dir_);
   absl::Status status = watcher.StartWatching([this]() { OnFilesChanged(); },
                                               [this]() { OnDirRecreated(); });
   if (!status.ok()) {
@@ -205,7 +255,8 @@ void MultiSessionRunner::Run() {
            sw.ElapsedSeconds());
 
   while (!shutdown_) {
-    FileWatcherWin::FileMap modified_files;
+    FileWatcher::FileMap modified_files;
+    std::unordered_set<std::string> mismatched_files;
     bool clean_manifest = false;
     {
       // Wait for changes.
@@ -221,7 +272,8 @@ void MultiSessionRunner::Run() {
         files_changed_timer_.Reset();
       }
       auto cond = [this]() {
-        return shutdown_ || files_changed_ || dir_recreated_;
+        return shutdown_ || files_changed_ || dir_recreated_ ||
+               !mismatched_files_.empty();
       };
       mutex_.AwaitWithTimeout(absl::Condition(&cond), timeout);
 
@@ -243,12 +295,19 @@ void MultiSessionRunner::Run() {
         files_changed_timer_.Reset();
       }
 
+      // Pick up files that have to be re-chunked.
+      mismatched_files.swap(mismatched_files_);
+
       if (dir_recreated_) {
         clean_manifest = true;
         dir_recreated_ = false;
       }
     }  // mutex_ lock
 
+    if (!clean_manifest) {
+      AddMismatchedFiles(src_dir_, mismatched_files, &modified_files);
+    }
+
     if (clean_manifest) {
       LOG_DEBUG(
           "Streamed directory '%s' was possibly re-created or not all changes "
@@ -378,6 +437,11 @@ void MultiSessionRunner::OnDirRecreated() {
   dir_recreated_ = true;
 }
 
+void MultiSessionRunner::OnChunkMismatch(const std::string& rel_path) {
+  absl::MutexLock lock(&mutex_);
+  mismatched_files_.insert(rel_path);
+}
+
 void MultiSessionRunner::SetManifest(const ContentIdProto& manifest_id) {
   server_->SetManifestId(manifest_id);
   if (Log::Instance()->GetLogLevel() <= LogLevel::kVerbose) {
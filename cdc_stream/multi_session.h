@@ -21,6 +21,7 @@
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -95,12 +96,16 @@ class MultiSessionRunner {
 
   void SetStatus(absl::Status status) ABSL_LOCKS_EXCLUDED(mutex_);
 
-  // Files changed callback called from FileWatcherWin.
+  // Files changed callback called from the file watcher.
   void OnFilesChanged() ABSL_LOCKS_EXCLUDED(mutex_);
 
-  // Directory recreated callback called from FileWatcherWin.
+  // Directory recreated callback called from the file watcher.
   void OnDirRecreated() ABSL_LOCKS_EXCLUDED(mutex_);
 
+  // Called from the asset stream server when a chunk of the file at |rel_path|
+  // failed verification. Queues the file for re-chunking.
+  void OnChunkMismatch(const std::string& rel_path) ABSL_LOCKS_EXCLUDED(mutex_);
+
   // Called during manifest update when the intermediate manifest or the final
   // manifest is available. Pushes the manifest to connected FUSEs.
   void SetManifest(const ContentIdProto& manifest_id);
@@ -120,6 +125,7 @@ class MultiSessionRunner {
   bool shutdown_ ABSL_GUARDED_BY(mutex_) = false;
   bool files_changed_ ABSL_GUARDED_BY(mutex_) = false;
   bool dir_recreated_ ABSL_GUARDED_BY(mutex_) = false;
+  std::unordered_set<std::string> mismatched_files_ ABSL_GUARDED_BY(mutex_);
   bool manifest_set_ ABSL_GUARDED_BY(mutex_) = false;
   Stopwatch files_changed_timer_ ABSL_GUARDED_BY(mutex_);
   absl::Status status_ ABSL_GUARDED_BY(mutex_);
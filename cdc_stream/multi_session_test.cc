@@ -20,14 +20,19 @@
 #include <vector>
 
 #include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "cdc_stream/grpc_asset_stream_server.h"
 #include "cdc_stream/testing_asset_stream_server.h"
 #include "common/path.h"
 #include "common/platform.h"
 #include "common/process.h"
 #include "common/status_test_macros.h"
 #include "common/test_main.h"
+#include "grpcpp/grpcpp.h"
 #include "gtest/gtest.h"
+#include "manifest/content_id.h"
 #include "manifest/manifest_test_base.h"
+#include "proto/asset_stream_service.grpc.pb.h"
 
 namespace cdc_ft {
 namespace {
@@ -553,5 +558,92 @@ TEST_F(MultiSessionTest,
   EXPECT_OK(runner.Shutdown());
 }
 
+// Re-chunk a file if a chunk fails verification because the file changed
+// without the file watcher noticing.
+TEST_F(MultiSessionTest, MultiSessionRunnerRechunksMismatchedFile) {
+  cfg_.src_dir = test_dir_path_;
+  const std::string old_data = "old data";
+  const std::string new_data = "new data";
+  const std::string file_path = path::Join(test_dir_path_, "file.txt");
+  EXPECT_OK(path::WriteFile(file_path, old_data));
+  time_t mtime;
+  EXPECT_OK(path::GetFileTime(file_path, &mtime));
+
+  {
+    SCOPED_TRACE("Index file.txt with the old data.");
+    MultiSessionRunner runner(cfg_.src_dir, &data_store_, &process_factory_,
+                              /*enable_stats=*/false, kTimeout, kNumThreads,
+                              metrics_service_,
+                              [this]() { OnManifestUpdated(); });
+    EXPECT_OK(runner.Initialize(kPort, AssetStreamServerType::kTest));
+    ASSERT_TRUE(metrics_service_->WaitForEvents(
+        metrics::EventType::kMultiSessionStart));
+    EXPECT_OK(runner.Shutdown());
+  }
+
+  // Change the file behind the runner's back. Size and mtime stay the same, so
+  // the next runner keeps the chunks from the stored manifest.
+  EXPECT_OK(path::WriteFile(file_path, new_data));
+  EXPECT_OK(path::SetFileTime(file_path, mtime));
+
+  // Find a free port.
+  int port;
+  {
+    GrpcAssetStreamServer server(
+        cfg_.src_dir, &data_store_, &file_chunks_, ContentSentHandler(),
+        PrioritizeAssetsHandler(), ChunkMismatchHandler());
+    ASSERT_OK(server.Start(/*port=*/0));
+    port = server.Port();
+    server.Shutdown();
+  }
+
+  MultiSessionRunner runner(cfg_.src_dir, &data_store_, &process_factory_,
+                            /*enable_stats=*/false, kTimeout, kNumThreads,
+                            metrics_service_,
+                            [this]() { OnManifestUpdated(); });
+  EXPECT_OK(runner.Initialize(port, AssetStreamServerType::kGrpc));
+  ASSERT_TRUE(metrics_service_->WaitForEvents(
+      metrics::EventType::kMultiSessionStart, /*num_events=*/2));
+  metrics_service_->GetEventsAndClear(metrics::EventType::kManifestUpdated);
+
+  auto stub = proto::AssetStreamService::NewStub(
+      grpc::CreateChannel(absl::StrFormat("localhost:%i", port),
+                          grpc::InsecureChannelCredentials()));
+  auto get_content = [&stub](const std::string& data,
+                             proto::GetContentResponse* response) {
+    grpc::ClientContext context;
+    proto::GetContentRequest request;
+    *request.add_id() = ContentId::FromDataString(data);
+    return stub->GetContent(&context, request, response).error_code();
+  };
+
+  {
+    SCOPED_TRACE("Request the old chunk -> file.txt is re-chunked.");
+    proto::GetContentResponse response;
+    EXPECT_EQ(get_content(old_data, &response), grpc::StatusCode::DATA_LOSS);
+
+    ASSERT_TRUE(metrics_service_->WaitForEvents(
+        metrics::EventType::kManifestUpdated, /*num_events=*/1,
+        absl::Seconds(5)));
+    ASSERT_NO_FATAL_FAILURE(
+        ExpectManifestEquals({"file.txt"}, runner.ManifestId()));
+    CheckManifestUpdateRecorded(
+        std::vector<metrics::ManifestUpdateData>{GetManifestUpdateData(
+            metrics::UpdateTrigger::kRegularUpdate, absl::StatusCode::kOk, 1, 0,
+            1, 1, 0, new_data.size())});
+  }
+
+  {
+    SCOPED_TRACE("The new chunk is served.");
+    proto::GetContentResponse response;
+    EXPECT_EQ(get_content(new_data, &response), grpc::StatusCode::OK);
+    ASSERT_EQ(response.data_size(), 1);
+    EXPECT_EQ(response.data(0), new_data);
+  }
+
+  EXPECT_OK(runner.Status());
+  EXPECT_OK(runner.Shutdown());
+}
+
 }  // namespace
 }  // namespace cdc_ft
@@ -47,4 +47,7 @@ ContentIdProto TestingAssetStreamServer::GetManifestId() const {
   absl::MutexLock lock(&mutex_);
   return manifest_id_;
 }
+
+void TestingAssetStreamServer::InvalidateFileHandles(
+    const std::string& rel_path) {}
 }  // namespace cdc_ft
@@ -50,6 +50,8 @@ class TestingAssetStreamServer : public AssetStreamServer {
 
   ContentIdProto GetManifestId() const ABSL_LOCKS_EXCLUDED(mutex_) override;
 
+  void InvalidateFileHandles(const std::string& rel_path) override;
+
  private:
   mutable absl::Mutex mutex_;
   ContentIdProto manifest_id_ ABSL_GUARDED_BY(mutex_);
@@ -0,0 +1,228 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/file_handle_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+#include "absl/strings/match.h"
+#include "common/errno_mapping.h"
+#include "common/path.h"
+#include "common/platform.h"
+#include "common/status.h"
+#include "common/util.h"
+
+#if PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "common/scoped_handle_win.h"
+#elif PLATFORM_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace cdc_ft {
+
+// Owns an open, read-only OS file handle.
+class FileHandleCache::Handle {
+ public:
+  // Opens the file at |path| for reading.
+  static absl::StatusOr<HandlePtr> Open(const std::string& path) {
+#if PLATFORM_WINDOWS
+    // Allow other processes to modify, rename and delete the file while the
+    // handle is open, so that the cache does not interfere with the user.
+    ScopedHandle handle(
+        CreateFileW(Util::Utf8ToWideStr(path).c_str(), GENERIC_READ,
+                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                    nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!handle.IsValid()) {
+      DWORD error = GetLastError();
+      std::string msg = absl::StrFormat("Failed to open file '%s': %s", path,
+                                        Util::GetWin32Error(error));
+      if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) {
+        return absl::NotFoundError(msg);
+      }
+      return MakeStatus("%s", msg);
+    }
+    return std::make_shared<Handle>(std::move(handle));
+#elif PLATFORM_LINUX
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return ErrnoToCanonicalStatus(errno, "Failed to open file '%s'", path);
+    }
+    return std::make_shared<Handle>(fd);
+#endif
+  }
+
+#if PLATFORM_WINDOWS
+  explicit Handle(ScopedHandle handle) : handle_(std::move(handle)) {}
+#elif PLATFORM_LINUX
+  explicit Handle(int fd) : fd_(fd) {}
+  ~Handle() { close(fd_); }
+
+  // Returns a pointer to the file descriptor, valid while *this is alive.
+  const int* fd() const { return &fd_; }
+#endif
+
+  Handle(const Handle&) = delete;
+  Handle& operator=(const Handle&) = delete;
+
+  // Reads at most |size| bytes at |offset| into |data| without changing any
+  // shared file position. Returns the number of bytes read.
+  absl::StatusOr<size_t> Read(void* data, uint64_t offset, size_t size) {
+    char* dst = static_cast<char*>(data);
+    size_t total = 0;
+    while (total < size) {
+#if PLATFORM_WINDOWS
+      OVERLAPPED overlapped = {};
+      uint64_t pos = offset + total;
+      overlapped.Offset = static_cast<DWORD>(pos);
+      overlapped.OffsetHigh = static_cast<DWORD>(pos >> 32);
+      DWORD to_read = static_cast<DWORD>(
+          std::min<size_t>(size - total, std::numeric_limits<DWORD>::max()));
+      DWORD bytes_read = 0;
+      if (!ReadFile(handle_.Get(), dst + total, to_read, &bytes_read,
+                    &overlapped)) {
+        DWORD error = GetLastError();
+        if (error == ERROR_HANDLE_EOF) break;
+        return MakeStatus("ReadFile() failed: %s", Util::GetWin32Error(error));
+      }
+#elif PLATFORM_LINUX
+      ssize_t bytes_read = pread(fd_, dst + total, size - total,
+                                 static_cast<off_t>(offset + total));
+      if (bytes_read < 0) {
+        if (errno == EINTR) continue;
+        return ErrnoToCanonicalStatus(errno, "pread() failed");
+      }
+#endif
+      if (bytes_read == 0) break;
+      total += bytes_read;
+    }
+    return total;
+  }
+
+ private:
+#if PLATFORM_WINDOWS
+  ScopedHandle handle_;
+#elif PLATFORM_LINUX
+  int fd_;
+#endif
+};
+
+FileHandleCache::FileHandleCache(std::string base_dir, size_t capacity)
+    : base_dir_(std::move(base_dir)), capacity_(capacity) {
+  assert(capacity_ > 0);
+}
+
+FileHandleCache::~FileHandleCache() = default;
+
+absl::StatusOr<size_t> FileHandleCache::Read(const std::string& rel_path,
+                                             void* data, uint64_t offset,
+                                             size_t size) {
+  if (size == 0) return 0;
+  absl::StatusOr<HandlePtr> handle = GetHandle(rel_path);
+  if (!handle.ok()) return handle.status();
+  return (*handle)->Read(data, offset, size);
+}
+
+#if PLATFORM_LINUX
+absl::StatusOr<std::shared_ptr<const int>> FileHandleCache::GetFd(
+    const std::string& rel_path) {
+  absl::StatusOr<HandlePtr> handle = GetHandle(rel_path);
+  if (!handle.ok()) return handle.status();
+  // Shares ownership of the handle, so that it is not closed while in use.
+  return std::shared_ptr<const int>(*handle, (*handle)->fd());
+}
+#endif
+
+void FileHandleCache::Invalidate(const std::string& rel_path) {
+  absl::MutexLock lock(&mutex_);
+  ++generation_;
+  if (rel_path.empty()) {
+    lookup_.clear();
+    lru_.clear();
+    return;
+  }
+
+  auto it = lookup_.find(rel_path);
+  if (it != lookup_.end()) {
+    lru_.erase(it->second);
+    lookup_.erase(it);
+  }
+
+  // Remove files below |rel_path| in case it is a directory.
+  const std::string prefix = rel_path + "/";
+  for (auto lru_it = lru_.begin(); lru_it != lru_.end();) {
+    if (absl::StartsWith(lru_it->first, prefix)) {
+      lookup_.erase(lru_it->first);
+      lru_it = lru_.erase(lru_it);
+    } else {
+      ++lru_it;
+    }
+  }
+}
+
+void FileHandleCache::Clear() { Invalidate(std::string()); }
+
+size_t FileHandleCache::Size() const {
+  absl::MutexLock lock(&mutex_);
+  return lru_.size();
+}
+
+absl::StatusOr<FileHandleCache::HandlePtr> FileHandleCache::GetHandle(
+    const std::string& rel_path) {
+  uint64_t generation;
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = lookup_.find(rel_path);
+    if (it != lookup_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return it->second->second;
+    }
+    generation = generation_;
+  }
+
+  // Open the file without holding the lock, so that reads from other files
+  // are not blocked by slow opens.
+  std::string path = path::Join(base_dir_, rel_path);
+  path::FixPathSeparators(&path);
+  absl::StatusOr<HandlePtr> handle = Handle::Open(path);
+  if (!handle.ok()) return handle.status();
+
+  absl::MutexLock lock(&mutex_);
+  if (generation != generation_) {
+    // The file might have changed while it was opened. Use the handle for this
+    // read only.
+    return handle;
+  }
+  auto it = lookup_.find(rel_path);
+  if (it != lookup_.end()) {
+    // Another thread opened the file in the meantime.
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->second;
+  }
+  lru_.emplace_front(rel_path, *handle);
+  lookup_[rel_path] = lru_.begin();
+  while (lru_.size() > capacity_) {
+    lookup_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+  return handle;
+}
+
+}  // namespace cdc_ft
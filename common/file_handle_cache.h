@@ -0,0 +1,102 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMMON_FILE_HANDLE_CACHE_H_
+#define COMMON_FILE_HANDLE_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "common/platform.h"
+
+namespace cdc_ft {
+
+// Thread-safe, bounded LRU cache of read-only file handles. Files are read
+// with positional reads, so that multiple threads can share the same handle
+// without synchronizing on a file position.
+class FileHandleCache {
+ public:
+  static constexpr size_t kDefaultCapacity = 256;
+
+  // |base_dir| is the directory that relative paths are resolved against.
+  // At most |capacity| handles are kept open at the same time.
+  explicit FileHandleCache(std::string base_dir,
+                           size_t capacity = kDefaultCapacity);
+  ~FileHandleCache();
+
+  FileHandleCache(const FileHandleCache&) = delete;
+  FileHandleCache& operator=(const FileHandleCache&) = delete;
+
+  // Reads at most |size| bytes starting at |offset| of the file at the relative
+  // Unix path |rel_path| into |data|. Opens the file if it is not cached yet.
+  // Returns the number of bytes read, which is less than |size| only if the
+  // end of the file was reached.
+  absl::StatusOr<size_t> Read(const std::string& rel_path, void* data,
+                              uint64_t offset, size_t size)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+#if PLATFORM_LINUX
+  // Returns the file descriptor of the file at the relative Unix path
+  // |rel_path|. Opens the file if it is not cached yet. The descriptor stays
+  // open as long as the returned pointer is alive, even if the handle is
+  // evicted or invalidated in the meantime.
+  absl::StatusOr<std::shared_ptr<const int>> GetFd(const std::string& rel_path)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+#endif
+
+  // Closes the cached handle for |rel_path| and for all files below it if
+  // |rel_path| is a directory. An empty |rel_path| invalidates all handles.
+  // Reads that are in progress finish on the old handle.
+  void Invalidate(const std::string& rel_path) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Closes all cached handles.
+  void Clear() ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Returns the number of cached handles.
+  size_t Size() const ABSL_LOCKS_EXCLUDED(mutex_);
+
+ private:
+  class Handle;
+  using HandlePtr = std::shared_ptr<Handle>;
+  using HandleList = std::list<std::pair<std::string, HandlePtr>>;
+
+  // Returns the cached handle for |rel_path| or opens a new one.
+  absl::StatusOr<HandlePtr> GetHandle(const std::string& rel_path)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  const std::string base_dir_;
+  const size_t capacity_;
+
+  mutable absl::Mutex mutex_;
+
+  // Most recently used handles are at the front.
+  HandleList lru_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<std::string, HandleList::iterator> lookup_
+      ABSL_GUARDED_BY(mutex_);
+
+  // Incremented on every invalidation. Prevents handles that were opened
+  // concurrently with an invalidation from being cached.
+  uint64_t generation_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace cdc_ft
+
+#endif  // COMMON_FILE_HANDLE_CACHE_H_
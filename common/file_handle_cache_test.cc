@@ -0,0 +1,175 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/file_handle_cache.h"
+
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "common/path.h"
+#include "common/platform.h"
+#include "common/status_test_macros.h"
+#include "gtest/gtest.h"
+
+#if PLATFORM_LINUX
+#include <unistd.h>
+#endif
+
+namespace cdc_ft {
+namespace {
+
+class FileHandleCacheTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    base_dir_ = path::Join(path::GetTempDir(), "file_handle_cache_test");
+    EXPECT_OK(path::RemoveDirRec(base_dir_));
+    EXPECT_OK(path::CreateDirRec(path::Join(base_dir_, "dir")));
+  }
+
+  void TearDown() override { EXPECT_OK(path::RemoveDirRec(base_dir_)); }
+
+ protected:
+  void WriteFile(const std::string& rel_path, const std::string& data) {
+    std::string file_path = path::Join(base_dir_, rel_path);
+    path::FixPathSeparators(&file_path);
+    EXPECT_OK(path::WriteFile(file_path, data));
+  }
+
+  // Reads |size| bytes at |offset| from |rel_path| through |cache|.
+  std::string Read(FileHandleCache* cache, const std::string& rel_path,
+                   uint64_t offset, size_t size) {
+    std::string data(size, 0);
+    absl::StatusOr<size_t> bytes_read =
+        cache->Read(rel_path, const_cast<char*>(data.data()), offset, size);
+    EXPECT_OK(bytes_read);
+    data.resize(bytes_read.ok() ? *bytes_read : 0);
+    return data;
+  }
+
+  std::string base_dir_;
+};
+
+TEST_F(FileHandleCacheTest, ReadAtOffset) {
+  WriteFile("a.txt", "0123456789");
+  FileHandleCache cache(base_dir_);
+
+  EXPECT_EQ(Read(&cache, "a.txt", 0, 4), "0123");
+  EXPECT_EQ(Read(&cache, "a.txt", 6, 4), "6789");
+  EXPECT_EQ(Read(&cache, "a.txt", 8, 4), "89");
+  EXPECT_EQ(Read(&cache, "a.txt", 12, 4), "");
+  EXPECT_EQ(cache.Size(), 1);
+}
+
+TEST_F(FileHandleCacheTest, ReadMissingFileFails) {
+  FileHandleCache cache(base_dir_);
+  char data[4];
+  EXPECT_TRUE(absl::IsNotFound(
+      cache.Read("missing.txt", data, 0, sizeof(data)).status()));
+  EXPECT_EQ(cache.Size(), 0);
+}
+
+TEST_F(FileHandleCacheTest, EvictsLeastRecentlyUsed) {
+  FileHandleCache cache(base_dir_, 2);
+  for (int n = 0; n < 3; ++n) WriteFile(absl::StrFormat("%i.txt", n), "data");
+
+  Read(&cache, "0.txt", 0, 4);
+  Read(&cache, "1.txt", 0, 4);
+  Read(&cache, "0.txt", 0, 4);
+  Read(&cache, "2.txt", 0, 4);
+  EXPECT_EQ(cache.Size(), 2);
+
+  // 1.txt was evicted and is reopened.
+  EXPECT_EQ(Read(&cache, "1.txt", 0, 4), "data");
+  EXPECT_EQ(cache.Size(), 2);
+}
+
+TEST_F(FileHandleCacheTest, InvalidateRemovesFileAndChildren) {
+  WriteFile("a.txt", "a");
+  WriteFile("dir/b.txt", "b");
+  WriteFile("dir/c.txt", "c");
+  FileHandleCache cache(base_dir_);
+  Read(&cache, "a.txt", 0, 1);
+  Read(&cache, "dir/b.txt", 0, 1);
+  Read(&cache, "dir/c.txt", 0, 1);
+  EXPECT_EQ(cache.Size(), 3);
+
+  cache.Invalidate("a.txt");
+  EXPECT_EQ(cache.Size(), 2);
+  cache.Invalidate("dir");
+  EXPECT_EQ(cache.Size(), 0);
+
+  Read(&cache, "a.txt", 0, 1);
+  cache.Clear();
+  EXPECT_EQ(cache.Size(), 0);
+}
+
+TEST_F(FileHandleCacheTest, InvalidateReopensReplacedFile) {
+  WriteFile("a.txt", "old");
+  FileHandleCache cache(base_dir_);
+  EXPECT_EQ(Read(&cache, "a.txt", 0, 3), "old");
+
+  std::string file_path = path::Join(base_dir_, "a.txt");
+  std::string tmp_path = path::Join(base_dir_, "a.tmp");
+  EXPECT_OK(path::WriteFile(tmp_path, std::string("new")));
+  EXPECT_OK(path::RemoveFile(file_path));
+  EXPECT_OK(path::RenameFile(tmp_path, file_path));
+
+  cache.Invalidate("a.txt");
+  EXPECT_EQ(Read(&cache, "a.txt", 0, 3), "new");
+}
+
+TEST_F(FileHandleCacheTest, ConcurrentReadsShareHandle) {
+  std::string data;
+  for (int n = 0; n < 1000; ++n) data += absl::StrFormat("%04i", n);
+  WriteFile("a.txt", data);
+  FileHandleCache cache(base_dir_);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([this, &cache, &data, t]() {
+      for (int n = t; n < 1000; n += 4) {
+        EXPECT_EQ(Read(&cache, "a.txt", n * 4, 4), data.substr(n * 4, 4));
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  EXPECT_EQ(cache.Size(), 1);
+}
+
+#if PLATFORM_LINUX
+TEST_F(FileHandleCacheTest, GetFdKeepsEvictedHandleOpen) {
+  WriteFile("a.txt", "a");
+  WriteFile("b.txt", "b");
+  FileHandleCache cache(base_dir_, 1);
+
+  absl::StatusOr<std::shared_ptr<const int>> fd = cache.GetFd("a.txt");
+  ASSERT_OK(fd);
+  absl::StatusOr<std::shared_ptr<const int>> cached_fd = cache.GetFd("a.txt");
+  ASSERT_OK(cached_fd);
+  EXPECT_EQ(**cached_fd, **fd);
+
+  // Evicting a.txt does not close the descriptor that is still in use.
+  EXPECT_EQ(Read(&cache, "b.txt", 0, 1), "b");
+  EXPECT_EQ(cache.Size(), 1);
+  char data = 0;
+  EXPECT_EQ(pread(**fd, &data, 1, 0), 1);
+  EXPECT_EQ(data, 'a');
+
+  EXPECT_TRUE(absl::IsNotFound(cache.GetFd("missing.txt").status()));
+}
+#endif
+
+}  // namespace
+}  // namespace cdc_ft
@@ -0,0 +1,620 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/file_watcher_linux.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "common/errno_mapping.h"
+#include "common/log.h"
+#include "common/path.h"
+#include "common/status.h"
+#include "common/status_macros.h"
+#include "common/stopwatch.h"
+
+namespace cdc_ft {
+namespace {
+
+// Events watched on every directory of the tree. IN_ATTRIB catches
+// modification time changes that don't write data, e.g. touch.
+static constexpr uint32_t kWatchMask =
+    IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM |
+    IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW |
+    IN_EXCL_UNLINK;
+
+static constexpr size_t kDefaultBufferSize = 1U << 18;  // 256 KiB.
+
+// Returns |name| relative to the watched directory if |rel_dir| is the
+// relative path of its parent directory.
+std::string JoinRelPath(const std::string& rel_dir, const char* name) {
+  return rel_dir.empty() ? std::string(name) : path::Join(rel_dir, name);
+}
+
+}  // namespace
+
+// Background thread to read directory changes.
+class AsyncFileWatcher {
+ public:
+  enum class FileWatcherState {
+    kDefault,      // Not started.
+    kFailed,       // Some error during watching, e.g. directory got deleted.
+                   // Will attempt to recover automatically.
+    kWatching,     // Actively watching directory.
+    kShuttingDown  // Shutdown() was called, winding watcher down.
+  };
+
+  using FileAction = FileWatcherLinux::FileAction;
+  using FileInfo = FileWatcherLinux::FileInfo;
+  using FileMap = FileWatcherLinux::FileMap;
+  using FilesChangedCb = FileWatcherLinux::FilesChangedCb;
+  using DirRecreatedCb = FileWatcherLinux::DirRecreatedCb;
+
+  AsyncFileWatcher(std::string dir_path, FilesChangedCb files_changed_cb,
+                   DirRecreatedCb dir_recreated_cb, unsigned int timeout_ms)
+      : dir_path_(dir_path),
+        files_changed_cb_(std::move(files_changed_cb)),
+        dir_recreated_cb_(std::move(dir_recreated_cb)),
+        timeout_ms_(timeout_ms) {
+    shutdown_fd_ = eventfd(0, EFD_CLOEXEC);
+    if (shutdown_fd_ < 0) {
+      SetStatus(ErrnoToCanonicalStatus(errno, "Failed to create shutdown fd"));
+      return;
+    }
+    dir_reader_ = std::thread([this]() { WatchDirChanges(); });
+  }
+
+  ~AsyncFileWatcher() {
+    Shutdown();
+    if (shutdown_fd_ >= 0) close(shutdown_fd_);
+  }
+
+  absl::Status GetStatus() const ABSL_LOCKS_EXCLUDED(status_mutex_) {
+    absl::MutexLock mutex(&status_mutex_);
+    return status_;
+  }
+
+  FileMap GetModifiedFiles() ABSL_LOCKS_EXCLUDED(modified_files_mutex_) {
+    FileMap files;
+    {
+      absl::MutexLock mutex(&modified_files_mutex_);
+      std::swap(modified_files_, files);
+    }
+
+    // inotify events don't carry file stats, so get them now. This also
+    // collapses multiple writes to the same file into one stat call.
+    if (!files.empty()) {
+      Stopwatch sw;
+      for (auto& [path, info] : files) {
+        if (info.action == FileAction::kDeleted) continue;
+
+        std::string full_path = path::Join(dir_path_, path);
+        struct stat st;
+        if (lstat(full_path.c_str(), &st) != 0) {
+          // The file watcher will pick up the deletion.
+          LOG_WARNING("Failed to get stats for path '%s'", full_path);
+          continue;
+        }
+        info.is_dir = S_ISDIR(st.st_mode);
+        info.size = info.is_dir ? 0 : static_cast<uint64_t>(st.st_size);
+        info.mtime = st.st_mtime;
+      }
+      LOG_DEBUG("Time to fix file stats: %0.3f sec.", sw.ElapsedSeconds());
+    }
+
+    return files;
+  }
+
+  void ClearModifiedFiles() ABSL_LOCKS_EXCLUDED(modified_files_mutex_) {
+    absl::MutexLock mutex(&modified_files_mutex_);
+    modified_files_.clear();
+  }
+
+  uint32_t GetEventCount() const ABSL_LOCKS_EXCLUDED(modified_files_mutex_) {
+    absl::MutexLock mutex(&modified_files_mutex_);
+    return event_count_;
+  }
+
+  uint32_t GetDirRecreateEventCount() const
+      ABSL_LOCKS_EXCLUDED(modified_files_mutex_) {
+    absl::MutexLock mutex(&modified_files_mutex_);
+    return dir_recreate_count_;
+  }
+
+  bool IsStarted() const ABSL_LOCKS_EXCLUDED(state_mutex_) {
+    absl::MutexLock mutex(&state_mutex_);
+    return state_ != FileWatcherState::kDefault &&
+           state_ != FileWatcherState::kShuttingDown;
+  }
+
+  bool IsWatching() const ABSL_LOCKS_EXCLUDED(state_mutex_) {
+    absl::MutexLock mutex(&state_mutex_);
+    return state_ == FileWatcherState::kWatching;
+  }
+
+  void Shutdown() ABSL_LOCKS_EXCLUDED(state_mutex_) {
+    {
+      absl::MutexLock mutex(&state_mutex_);
+      state_ = FileWatcherState::kShuttingDown;
+    }
+
+    // The event stays signaled, so that both the read loop and the retry
+    // loop of the background thread pick it up.
+    uint64_t value = 1;
+    if (shutdown_fd_ >= 0 &&
+        write(shutdown_fd_, &value, sizeof(value)) != sizeof(value)) {
+      LOG_ERROR("Writing the shutdown event failed: '%s'", strerror(errno));
+      exit(1);
+    }
+
+    if (dir_reader_.joinable()) {
+      dir_reader_.join();
+    }
+  }
+
+ private:
+  // Reasons for ReadDirChanges() to return.
+  enum class ReadResult {
+    kContinue,     // Internal, keep reading.
+    kShutdown,     // Shutdown() was called.
+    kDirRemoved,   // The watched directory was removed or moved away.
+    kOverflow,     // The kernel event queue overflowed, events were lost.
+    kError         // Unrecoverable error, the status is set.
+  };
+
+  // Sets up the watches for the watched directory and reads directory
+  // changes. It detects removal, creation, and re-creation of the watched
+  // directory. Lost events are handled like a re-creation.
+  void WatchDirChanges() {
+    bool first_run = true, prev_run_was_success = false;
+    while (true) {
+      absl::Status status = AddWatches();
+      SetStatus(status);
+      if (status.ok()) {
+        // The watched directory exists and all directories are watched.
+        if (!first_run) NotifyDirRecreated();
+        first_run = false;
+        prev_run_was_success = true;
+        MaybeSetState(FileWatcherState::kWatching);
+
+        // Keep reading directory changes. This function only returns once it
+        // gets the shutdown signal, the watched directory is removed, events
+        // were lost, or an error occurs.
+        ReadResult result = ReadDirChanges();
+        RemoveWatches();
+        if (result == ReadResult::kShutdown) {
+          LOG_DEBUG("Shutting down watching '%s'.", dir_path_);
+          return;
+        }
+        ClearModifiedFiles();
+        if (result == ReadResult::kError) {
+          LOG_ERROR("Stopped watching '%s': %s", dir_path_,
+                    GetStatus().ToString());
+          MaybeSetState(FileWatcherState::kFailed);
+          return;
+        }
+        if (result == ReadResult::kOverflow) {
+          // Set up new watches right away. The caller has to rescan the
+          // directory anyway, which is signaled by the re-creation callback.
+          LOG_WARNING("Event queue for '%s' overflowed, changes were lost.",
+                      dir_path_);
+          continue;
+        }
+        LOG_WARNING("Watched directory '%s' was possibly removed.", dir_path_);
+        MaybeSetState(FileWatcherState::kFailed);
+      } else if (absl::IsResourceExhausted(status)) {
+        // Retrying won't help unless the limits are raised.
+        LOG_ERROR("%s", status.ToString());
+        RemoveWatches();
+        MaybeSetState(FileWatcherState::kFailed);
+        return;
+      } else if (prev_run_was_success) {
+        prev_run_was_success = false;
+        NotifyDirRecreated();
+      }
+      RemoveWatches();
+
+      // Poll for the watched directory to be created again. If a shutdown
+      // was triggered, stop watching. The current file-watcher status should
+      // not be changed.
+      if (WaitForShutdown(timeout_ms_)) {
+        LOG_DEBUG("Shutting down watching '%s'.", dir_path_);
+        return;
+      }
+    }
+  }
+
+  // Waits up to |timeout_ms| milliseconds for the shutdown event. Returns true
+  // if the event is signaled.
+  bool WaitForShutdown(int timeout_ms) const {
+    pollfd fd = {shutdown_fd_, POLLIN, 0};
+    int res;
+    do {
+      res = poll(&fd, 1, timeout_ms);
+    } while (res < 0 && errno == EINTR);
+    return res > 0 && (fd.revents & POLLIN) != 0;
+  }
+
+  // Creates an inotify instance and adds watches for the watched directory
+  // and all its subdirectories. Returns a FailedPrecondition error if the
+  // watched directory does not exist and a ResourceExhausted error if the
+  // inotify limits are too low for the directory tree.
+  absl::Status AddWatches() {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0) {
+      int err = errno;
+      if (err == EMFILE || err == ENFILE) {
+        return absl::ResourceExhaustedError(absl::StrFormat(
+            "Could not start watching '%s': '%s'. Consider raising "
+            "fs.inotify.max_user_instances.",
+            dir_path_, strerror(err)));
+      }
+      return ErrnoToCanonicalStatus(err, "inotify_init1() failed");
+    }
+
+    Stopwatch sw;
+    RETURN_IF_ERROR(AddWatchRec(std::string(), /*report_added=*/false));
+    LOG_DEBUG("Added %u watches for '%s' in %0.3f sec.", wd_to_dir_.size(),
+              dir_path_, sw.ElapsedSeconds());
+    return absl::OkStatus();
+  }
+
+  // Closes the inotify instance, which removes all watches.
+  void RemoveWatches() {
+    if (inotify_fd_ >= 0) close(inotify_fd_);
+    inotify_fd_ = -1;
+    wd_to_dir_.clear();
+    dir_to_wd_.clear();
+  }
+
+  // Adds a watch for the directory at |rel_dir| and recursively for all of
+  // its subdirectories. The watch is added before the directory is listed,
+  // so that no file creation is missed. If |report_added| is true, all
+  // directory contents are reported as added. This is needed for directories
+  // created or moved in while watching, since files in them might have been
+  // created before the watch was added.
+  absl::Status AddWatchRec(const std::string& rel_dir, bool report_added) {
+    std::string dir =
+        rel_dir.empty() ? dir_path_ : path::Join(dir_path_, rel_dir);
+    int wd = inotify_add_watch(inotify_fd_, dir.c_str(), kWatchMask);
+    if (wd < 0) {
+      int err = errno;
+      if (err == ENOSPC) {
+        return absl::ResourceExhaustedError(absl::StrFormat(
+            "Could not watch '%s': Too many directories. Consider raising "
+            "fs.inotify.max_user_watches.",
+            dir));
+      }
+      if (rel_dir.empty()) {
+        return absl::FailedPreconditionError(
+            absl::StrFormat("Could not start watching '%s': '%s'", dir_path_,
+                            strerror(err)));
+      }
+      // The directory was removed or replaced in the meantime, which is
+      // reported by the watch of its parent.
+      return absl::OkStatus();
+    }
+    wd_to_dir_[wd] = rel_dir;
+    dir_to_wd_[rel_dir] = wd;
+
+    DIR* dir_stream = opendir(dir.c_str());
+    if (!dir_stream) return absl::OkStatus();
+    std::vector<std::string> subdirs;
+    while (struct dirent* entry = readdir(dir_stream)) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        continue;
+
+      bool is_dir = entry->d_type == DT_DIR;
+      if (entry->d_type == DT_UNKNOWN) {
+        struct stat st;
+        is_dir = fstatat(dirfd(dir_stream), entry->d_name, &st,
+                         AT_SYMLINK_NOFOLLOW) == 0 &&
+                 S_ISDIR(st.st_mode);
+      }
+      std::string rel_path = JoinRelPath(rel_dir, entry->d_name);
+      if (report_added) AddChange(rel_path, FileAction::kAdded, is_dir);
+      if (is_dir) subdirs.push_back(std::move(rel_path));
+    }
+    closedir(dir_stream);
+
+    for (const std::string& subdir : subdirs) {
+      RETURN_IF_ERROR(AddWatchRec(subdir, report_added));
+    }
+    return absl::OkStatus();
+  }
+
+  // Removes the watches for the directory at |rel_dir| and all directories
+  // below it.
+  void RemoveWatchRec(const std::string& rel_dir) {
+    auto remove = [this](std::map<std::string, int>::iterator it) {
+      // Fails if the directory was deleted already, which is fine.
+      inotify_rm_watch(inotify_fd_, it->second);
+      wd_to_dir_.erase(it->second);
+      return dir_to_wd_.erase(it);
+    };
+
+    auto it = dir_to_wd_.find(rel_dir);
+    if (it != dir_to_wd_.end()) remove(it);
+    const std::string prefix = rel_dir + "/";
+    it = dir_to_wd_.lower_bound(prefix);
+    while (it != dir_to_wd_.end() && absl::StartsWith(it->first, prefix)) {
+      it = remove(it);
+    }
+  }
+
+  // Reads changes in the watched directory tree until the shutdown event is
+  // signaled, the watched directory is removed, events were lost, or an error
+  // occurs. Collects the changes in |modified_files_| and notifies the caller
+  // about them.
+  ReadResult ReadDirChanges() {
+    // Aligned for struct inotify_event.
+    std::vector<uint64_t> buffer(kDefaultBufferSize / sizeof(uint64_t));
+    pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {shutdown_fd_, POLLIN, 0}};
+    while (true) {
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) continue;
+        SetStatus(ErrnoToCanonicalStatus(errno, "poll() failed"));
+        return ReadResult::kError;
+      }
+      if (fds[1].revents & POLLIN) return ReadResult::kShutdown;
+      if (!(fds[0].revents & POLLIN)) continue;
+
+      // Drain all pending events before notifying the caller.
+      bool changed = false;
+      while (true) {
+        ssize_t bytes_read =
+            read(inotify_fd_, buffer.data(), buffer.size() * sizeof(uint64_t));
+        if (bytes_read < 0) {
+          if (errno == EINTR) continue;
+          if (errno == EAGAIN) break;
+          SetStatus(ErrnoToCanonicalStatus(errno, "Failed to read events"));
+          return ReadResult::kError;
+        }
+        ReadResult result =
+            ProcessDirChanges(buffer.data(), bytes_read, &changed);
+        if (result != ReadResult::kContinue) return result;
+      }
+
+      // Invoke files changed callback if present.
+      if (changed && files_changed_cb_) files_changed_cb_();
+    }
+  }
+
+  // Classifies the inotify events in |buffer| of |read_bytes| bytes and
+  // merges them into |modified_files_|. Sets |changed| to true if any change
+  // was recorded. Maintains the watches of created, moved and removed
+  // directories.
+  ReadResult ProcessDirChanges(const void* buffer, size_t read_bytes,
+                               bool* changed) {
+    size_t offset = 0;
+    while (offset < read_bytes) {
+      const auto* event = reinterpret_cast<const struct inotify_event*>(
+          static_cast<const char*>(buffer) + offset);
+      offset += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) return ReadResult::kOverflow;
+
+      // Events for watches that were removed already are skipped.
+      auto wd_it = wd_to_dir_.find(event->wd);
+      if (wd_it == wd_to_dir_.end()) continue;
+      const std::string rel_dir = wd_it->second;
+
+      if (event->mask & IN_IGNORED) {
+        // The watch was removed because its directory was deleted.
+        if (rel_dir.empty()) return ReadResult::kDirRemoved;
+        dir_to_wd_.erase(rel_dir);
+        wd_to_dir_.erase(wd_it);
+        continue;
+      }
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+        // Other directories are handled by the events of their parents.
+        if (rel_dir.empty()) return ReadResult::kDirRemoved;
+        continue;
+      }
+
+      // Events without name concern the watched directory itself and are
+      // also reported to the watch of its parent.
+      if (event->len == 0) continue;
+
+      std::string rel_path = JoinRelPath(rel_dir, event->name);
+      bool is_dir = (event->mask & IN_ISDIR) != 0;
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (is_dir) RemoveWatchRec(rel_path);
+        AddChange(rel_path, FileAction::kDeleted, is_dir);
+      } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        AddChange(rel_path, FileAction::kAdded, is_dir);
+        if (is_dir) {
+          absl::Status status = AddWatchRec(rel_path, /*report_added=*/true);
+          if (!status.ok()) {
+            SetStatus(status);
+            return ReadResult::kError;
+          }
+        }
+      } else if (event->mask & (IN_MODIFY | IN_ATTRIB)) {
+        AddChange(rel_path, FileAction::kModified, is_dir);
+      } else {
+        continue;
+      }
+      *changed = true;
+    }
+    return ReadResult::kContinue;
+  }
+
+  // Merges |action| for |rel_path| into |modified_files_| in a way so that
+  // sequences that use temp files (e.g. ADDED - MODIFIED - REMOVED) result in
+  // no entry in |modified_files_| at all.
+  void AddChange(const std::string& rel_path, FileAction action, bool is_dir)
+      ABSL_LOCKS_EXCLUDED(modified_files_mutex_) {
+    absl::MutexLock mutex(&modified_files_mutex_);
+    ++event_count_;
+
+    auto iter = modified_files_.find(rel_path);
+    bool was_added = iter != modified_files_.end() &&
+                     iter->second.action == FileAction::kAdded;
+    if (action == FileAction::kDeleted && was_added) {
+      // If the entry was originally added, remove it again.
+      modified_files_.erase(iter);
+      return;
+    }
+    // Keep the "added" state if the file was originally added.
+    if (action == FileAction::kModified && was_added) {
+      action = FileAction::kAdded;
+    }
+    // The file stats are filled in by GetModifiedFiles().
+    modified_files_.insert_or_assign(rel_path,
+                                     FileInfo(action, is_dir, 0, 0));
+  }
+
+  void NotifyDirRecreated() ABSL_LOCKS_EXCLUDED(modified_files_mutex_) {
+    {
+      absl::MutexLock mutex(&modified_files_mutex_);
+      ++dir_recreate_count_;
+    }
+    if (dir_recreated_cb_) dir_recreated_cb_();
+  }
+
+  void SetStatus(const absl::Status& status)
+      ABSL_LOCKS_EXCLUDED(status_mutex_) {
+    LOG_DEBUG("Setting status '%s' of the file watcher process",
+              status.ToString().c_str());
+    absl::MutexLock mutex(&status_mutex_);
+    status_ = status;
+  }
+
+  // Modifies the file watcher state iff it is not shutting down.
+  void MaybeSetState(FileWatcherState state) ABSL_LOCKS_EXCLUDED(state_mutex_) {
+    LOG_DEBUG("Setting state %u of the file watcher process", state);
+    absl::MutexLock mutex(&state_mutex_);
+    if (state_ != FileWatcherState::kShuttingDown) state_ = state;
+  }
+
+  std::string dir_path_;  // the path to the watched directory.
+
+  int shutdown_fd_ = -1;    // eventfd to shut down the watcher.
+  std::thread dir_reader_;  // watching thread.
+
+  // Only accessed by the watching thread.
+  int inotify_fd_ = -1;
+  absl::flat_hash_map<int, std::string> wd_to_dir_;
+  // Ordered, so that the watches below a directory can be found by prefix.
+  std::map<std::string, int> dir_to_wd_;
+
+  mutable absl::Mutex status_mutex_;
+  absl::Status status_ ABSL_GUARDED_BY(status_mutex_);
+
+  mutable absl::Mutex modified_files_mutex_;
+  FileMap modified_files_ ABSL_GUARDED_BY(modified_files_mutex_);
+  uint32_t event_count_ ABSL_GUARDED_BY(modified_files_mutex_) = 0;
+  uint32_t dir_recreate_count_ ABSL_GUARDED_BY(modified_files_mutex_) = 0;
+
+  mutable absl::Mutex state_mutex_;
+  FileWatcherState state_ ABSL_GUARDED_BY(state_mutex_) =
+      FileWatcherState::kDefault;  // the current watcher state.
+
+  FilesChangedCb files_changed_cb_;  // callback to react on modifications
+                                     // inside the watched directory.
+  DirRecreatedCb dir_recreated_cb_;  // callback to react on the
+                                     // creation/removal/re-creation of the
+                                     // watched directory and on lost events.
+  unsigned int timeout_ms_;  // timeout in ms to poll for the directory.
+};
+
+FileWatcherLinux::FileWatcherLinux(std::string directory)
+    : dir_path_(directory) {}
+
+FileWatcherLinux::~FileWatcherLinux() {
+  absl::Status status = StopWatching();
+  if (!status.ok()) {
+    LOG_WARNING("Failed to stop watching files: %s", status.ToString());
+  }
+}
+
+FileWatcherLinux::FileMap FileWatcherLinux::GetModifiedFiles() {
+  absl::MutexLock mutex(&modified_files_mutex_);
+  FileMap files;
+  modified_files_.swap(files);
+  if (async_watcher_) {
+    for (const auto& [path, info] : async_watcher_->GetModifiedFiles())
+      files.insert_or_assign(path, info);
+  }
+  return files;
+}
+
+absl::Status FileWatcherLinux::StartWatching(FilesChangedCb files_changed_cb,
+                                             DirRecreatedCb dir_recreated_cb,
+                                             unsigned int timeout_ms) {
+  LOG_INFO("Starting the file watcher");
+  async_watcher_ = std::make_unique<AsyncFileWatcher>(
+      dir_path_, std::move(files_changed_cb), std::move(dir_recreated_cb),
+      timeout_ms);
+  while (GetStatus().ok() && !IsStarted()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return GetStatus();
+}
+
+absl::Status FileWatcherLinux::StopWatching() {
+  LOG_INFO("Stopping the file watcher");
+  if (!async_watcher_) {
+    return absl::OkStatus();
+  }
+  async_watcher_->Shutdown();
+  absl::MutexLock mutex(&modified_files_mutex_);
+  FileMap files = async_watcher_->GetModifiedFiles();
+  if (modified_files_.empty()) {
+    modified_files_.swap(files);
+  } else {
+    for (const auto& [path, info] : files)
+      modified_files_.insert_or_assign(path, info);
+  }
+  absl::Status async_status = async_watcher_->GetStatus();
+  async_watcher_.reset();
+  return async_status;
+}
+
+bool FileWatcherLinux::IsStarted() const {
+  return async_watcher_ ? async_watcher_->IsStarted() : false;
+}
+
+bool FileWatcherLinux::IsWatching() const {
+  return async_watcher_ ? async_watcher_->IsWatching() : false;
+}
+
+absl::Status FileWatcherLinux::GetStatus() const {
+  return async_watcher_ ? async_watcher_->GetStatus() : absl::OkStatus();
+}
+
+uint32_t FileWatcherLinux::GetEventCountForTesting() const {
+  return async_watcher_ ? async_watcher_->GetEventCount() : 0;
+}
+
+uint32_t FileWatcherLinux::GetDirRecreateEventCountForTesting() const {
+  return async_watcher_ ? async_watcher_->GetDirRecreateEventCount() : 0;
+}
+
+}  // namespace cdc_ft
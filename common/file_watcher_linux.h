@@ -0,0 +1,114 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMMON_FILE_WATCHER_LINUX_H_
+#define COMMON_FILE_WATCHER_LINUX_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+
+namespace cdc_ft {
+class AsyncFileWatcher;
+
+// FileWatcherLinux observes changes done in a specific directory on Linux.
+// It uses inotify and keeps one watch per directory of the watched tree.
+// Watches for directories created while watching are added automatically.
+// Has the same interface as FileWatcherWin.
+class FileWatcherLinux {
+ public:
+  // Default timeout in milliseconds.
+  static constexpr unsigned int kFileWatcherTimeoutMs = 1000;
+
+  using FilesChangedCb = std::function<void()>;
+  using DirRecreatedCb = std::function<void()>;
+
+  enum class FileAction { kAdded, kModified, kDeleted };
+
+  struct FileInfo {
+    FileAction action;
+    bool is_dir;
+    uint64_t size;
+    int64_t mtime;
+
+    FileInfo(FileAction action, bool is_dir, uint64_t size, int64_t mtime)
+        : action(action), is_dir(is_dir), size(size), mtime(mtime) {}
+  };
+
+  using FileMap = std::unordered_map<std::string, FileInfo>;
+
+  explicit FileWatcherLinux(std::string directory);
+  FileWatcherLinux(const FileWatcherLinux& other) = delete;
+  FileWatcherLinux& operator=(const FileWatcherLinux& other) = delete;
+
+  ~FileWatcherLinux();
+
+  // Returns a map that maps relative paths of modified files to their file
+  // attributes.
+  FileMap GetModifiedFiles() ABSL_LOCKS_EXCLUDED(modified_files_mutex_);
+
+  // Starts watching directory changes.
+  // |files_changed_cb| is called on a background thread whenever files changed.
+  // |dir_recreated_cb| is called on a background thread whenever the watched
+  // directory was removed/created/re-created, or when the kernel event queue
+  // overflowed and changes were lost. It does not guarantee that the watched
+  // directory exists. The callback shows that all outstanding changes are not
+  // valid anymore.
+  // |timeout_ms| is a timeout in ms for polling the watched directory while it
+  // does not exist.
+  absl::Status StartWatching(FilesChangedCb files_changed_cb = FilesChangedCb(),
+                             DirRecreatedCb dir_recreated_cb = DirRecreatedCb(),
+                             unsigned int timeout_ms = kFileWatcherTimeoutMs);
+
+  // Stops watching directory changes.
+  absl::Status StopWatching() ABSL_LOCKS_EXCLUDED(modified_files_mutex_);
+
+  // Indicates whether StartWatching() was called, but StopWatching() was not
+  // called yet.
+  bool IsStarted() const;
+
+  // Indicates whether a directory is actively watched for changes. In contrast
+  // to IsStarted(), returns false while the directory does not exist.
+  bool IsWatching() const;
+
+  // Returns the watching status.
+  absl::Status GetStatus() const;
+
+  // Returns the total file changed events received so far.
+  // Returns 0 if the watcher is currently in stopped state.
+  uint32_t GetEventCountForTesting() const;
+
+  // Returns the total number of events for the directory changes received so
+  // far. Returns 0 if the watcher is currently in stopped state.
+  uint32_t GetDirRecreateEventCountForTesting() const;
+
+ private:
+  std::string dir_path_;
+
+  std::unique_ptr<AsyncFileWatcher> async_watcher_;
+
+  absl::Mutex modified_files_mutex_;
+  FileMap modified_files_ ABSL_GUARDED_BY(modified_files_mutex_);
+};
+
+}  // namespace cdc_ft
+
+#endif  // COMMON_FILE_WATCHER_LINUX_H_
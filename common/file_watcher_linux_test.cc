@@ -0,0 +1,590 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/file_watcher_linux.h"
+
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "common/buffer.h"
+#include "common/log.h"
+#include "common/path.h"
+#include "common/status_test_macros.h"
+#include "common/stopwatch.h"
+#include "common/util.h"
+#include "gtest/gtest.h"
+
+namespace cdc_ft {
+
+const char* ActionToString(const FileWatcherLinux::FileAction& fa) {
+  switch (fa) {
+    case FileWatcherLinux::FileAction::kAdded:
+      return "ADDED";
+    case FileWatcherLinux::FileAction::kModified:
+      return "MODIFIED";
+    case FileWatcherLinux::FileAction::kDeleted:
+      return "DELETED";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+std::ostream& operator<<(std::ostream& os,
+                         const FileWatcherLinux::FileMap& files) {
+  for (const auto& [path, fi] : files) {
+    os << "path=" << path << ", action=" << ActionToString(fi.action)
+       << ", is_dir=" << fi.is_dir << ", mtime=" << fi.mtime
+       << ", size=" << fi.size << std::endl;
+  }
+  return os;
+}
+
+namespace {
+
+constexpr char kWatcherTestDir[] = "watcher_test_dir";
+constexpr char kWatcherWatchedDir[] = "watcher_watched_dir";
+constexpr char kFirstData[] = {10, 20, 30, 40, 50, 60, 70, 80, 90};
+constexpr char kSecondData[] = {100, 101, 102, 103, 104, 105, 106, 107, 108,
+                                100, 101, 102, 103, 104, 105, 106, 107, 108};
+constexpr size_t kFirstDataSize = sizeof(kFirstData);
+constexpr size_t kSecondDataSize = sizeof(kSecondData);
+
+constexpr char kFirstFile[] = "first_test_file.txt";
+constexpr char kSecondFile[] = "second_test_file.txt";
+constexpr char kFirstDir[] = "first_test_dir";
+constexpr char kSecondDir[] = "second_test_dir";
+
+constexpr bool kFile = false;
+constexpr bool kDir = true;
+
+constexpr absl::Duration kWaitTimeout = absl::Seconds(5);
+constexpr unsigned int kFWTimeout = 10;
+
+using FileMap = FileWatcherLinux::FileMap;
+using FileAction = FileWatcherLinux::FileAction;
+using FileInfo = FileWatcherLinux::FileInfo;
+
+class FileWatcherLinuxTest : public ::testing::Test {
+ public:
+  FileWatcherLinuxTest() : watcher_(watcher_dir_path_) {
+    Log::Initialize(std::make_unique<ConsoleLog>(LogLevel::kInfo));
+  }
+  ~FileWatcherLinuxTest() { Log::Shutdown(); }
+
+  void SetUp() override {
+    EXPECT_OK(path::RemoveDirRec(test_dir_path_));
+    EXPECT_OK(path::CreateDirRec(watcher_dir_path_));
+  }
+
+  void TearDown() override { EXPECT_OK(path::RemoveDirRec(test_dir_path_)); }
+
+ protected:
+  void OnFilesChanged() {
+    absl::MutexLock lock(&files_changed_mutex_);
+    files_changed_ = true;
+  }
+
+  void OnDirRecreated() {
+    absl::MutexLock lock(&files_changed_mutex_);
+    dir_recreated_ = true;
+  }
+
+  bool WaitForChange(uint32_t min_event_count = 0) {
+    absl::MutexLock lock(&files_changed_mutex_);
+    bool changed = false;
+    do {
+      auto cond = [this]() { return files_changed_; };
+      changed = files_changed_mutex_.AwaitWithTimeout(absl::Condition(&cond),
+                                                      kWaitTimeout);
+      files_changed_ = false;
+    } while (changed && watcher_.GetEventCountForTesting() < min_event_count);
+    return changed;
+  }
+
+  bool WaitForDirRecreated(uint32_t min_event_count = 0) {
+    absl::MutexLock lock(&files_changed_mutex_);
+    bool changed = false;
+    do {
+      auto cond = [this]() { return dir_recreated_; };
+      changed = files_changed_mutex_.AwaitWithTimeout(absl::Condition(&cond),
+                                                      kWaitTimeout);
+      dir_recreated_ = false;
+    } while (changed &&
+             watcher_.GetDirRecreateEventCountForTesting() < min_event_count);
+    return changed;
+  }
+
+  // Polls for a second until the watcher is running again.
+  bool WaitForRunning() const {
+    for (int n = 0; n < 1000; ++n) {
+      if (watcher_.IsWatching()) return true;
+      Util::Sleep(1);
+    }
+    return false;
+  }
+
+  FileMap GetChangedFiles(size_t number_of_files) {
+    FileMap modified_files;
+
+    // Wait for events, until they are processed.
+    while (modified_files.size() < number_of_files) {
+      if (!WaitForChange()) {
+        LOG_ERROR("No change detected after %s",
+                  absl::FormatDuration(kWaitTimeout));
+        return modified_files;
+      }
+      for (const auto& [path, info] : watcher_.GetModifiedFiles())
+        modified_files.insert_or_assign(path, info);
+    }
+    return modified_files;
+  }
+
+  void ExpectFile(const FileMap& modified_files, const std::string& path) {
+    EXPECT_TRUE(modified_files.find(path) != modified_files.end())
+        << path << " is missing from " << std::endl
+        << modified_files;
+  }
+
+  void ExpectFileInfo(const FileMap& modified_files, const std::string& path,
+                      FileAction action, bool is_dir, uint64_t size) {
+    auto iter = modified_files.find(path);
+    EXPECT_TRUE(iter != modified_files.end())
+        << path << " is missing from " << std::endl
+        << modified_files;
+    if (iter != modified_files.end()) {
+      EXPECT_EQ(iter->second.action, action);
+      EXPECT_EQ(iter->second.is_dir, is_dir);
+      // The size of deleted files is not known anymore.
+      if (action != FileAction::kDeleted) EXPECT_EQ(iter->second.size, size);
+      // Don't bother checking mtime here, it's checked elsewhere.
+    }
+  }
+
+  const std::string test_dir_path_ =
+      path::Join(path::GetTempDir(), kWatcherTestDir);
+
+  const std::string watcher_dir_path_ =
+      path::Join(test_dir_path_, kWatcherWatchedDir);
+
+  const std::string first_file_path_ =
+      path::Join(watcher_dir_path_, kFirstFile);
+  const std::string second_file_path_ =
+      path::Join(watcher_dir_path_, kSecondFile);
+  const std::string first_dir_path_ = path::Join(watcher_dir_path_, kFirstDir);
+  const std::string second_dir_path_ =
+      path::Join(watcher_dir_path_, kSecondDir);
+
+  FileWatcherLinux watcher_;
+
+  bool files_changed_ ABSL_GUARDED_BY(files_changed_mutex_) = false;
+  bool dir_recreated_ ABSL_GUARDED_BY(files_changed_mutex_) = false;
+  absl::Mutex files_changed_mutex_;
+};
+
+TEST_F(FileWatcherLinuxTest, DirDoesNotExist) {
+  FileWatcherLinux watcher("non-existing folder");
+  EXPECT_NOT_OK(watcher.StartWatching([this]() { OnFilesChanged(); }));
+  EXPECT_FALSE(watcher.IsStarted());
+  absl::Status status = watcher.GetStatus();
+  EXPECT_NOT_OK(status);
+  EXPECT_TRUE(absl::IsFailedPrecondition(status));
+  EXPECT_TRUE(absl::StrContains(status.message(), "Could not start watching"));
+}
+
+TEST_F(FileWatcherLinuxTest, CreateFile) {
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+
+  FileMap modified_files = GetChangedFiles(1u);
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFileInfo(modified_files, kFirstFile, FileAction::kAdded, kFile,
+                 kFirstDataSize);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, CreateDir) {
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  EXPECT_OK(path::CreateDir(first_dir_path_));
+
+  FileMap modified_files = GetChangedFiles(1u);
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFileInfo(modified_files, kFirstDir, FileAction::kAdded, kDir, 0);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, RenameDir) {
+  EXPECT_OK(path::CreateDir(first_dir_path_));
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+
+  EXPECT_OK(path::RenameFile(first_dir_path_, second_dir_path_));
+
+  FileMap modified_files = GetChangedFiles(2u);
+  EXPECT_EQ(modified_files.size(), 2u);
+  ExpectFileInfo(modified_files, kFirstDir, FileAction::kDeleted, kDir, 0);
+  ExpectFileInfo(modified_files, kSecondDir, FileAction::kAdded, kDir, 0);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, RenameFile) {
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+
+  EXPECT_OK(path::RenameFile(first_file_path_, second_file_path_));
+
+  FileMap modified_files = GetChangedFiles(2u);
+  EXPECT_EQ(modified_files.size(), 2u);
+  ExpectFileInfo(modified_files, kFirstFile, FileAction::kDeleted, kFile, 0);
+  ExpectFileInfo(modified_files, kSecondFile, FileAction::kAdded, kFile,
+                 kFirstDataSize);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, RemoveDir) {
+  EXPECT_OK(path::CreateDir(first_dir_path_));
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+
+  EXPECT_OK(path::RemoveDirRec(first_dir_path_));
+
+  FileMap modified_files = GetChangedFiles(1u);
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFileInfo(modified_files, kFirstDir, FileAction::kDeleted, kDir, 0);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, ChangeFile) {
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  EXPECT_OK(path::WriteFile(first_file_path_, kSecondData, kSecondDataSize));
+
+  FileMap modified_files = GetChangedFiles(1u);
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFileInfo(modified_files, kFirstFile, FileAction::kModified, kFile,
+                 kSecondDataSize);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, ChangeFileInExistingSubdir) {
+  EXPECT_OK(path::CreateDirRec(path::Join(first_dir_path_, kSecondDir)));
+  std::string file_path = path::Join(first_dir_path_, kSecondDir, kFirstFile);
+  EXPECT_OK(path::WriteFile(file_path, kFirstData, kFirstDataSize));
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+
+  EXPECT_OK(path::WriteFile(file_path, kSecondData, kSecondDataSize));
+
+  FileMap modified_files = GetChangedFiles(1u);
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFileInfo(modified_files, path::Join(kFirstDir, kSecondDir, kFirstFile),
+                 FileAction::kModified, kFile, kSecondDataSize);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, DirHierarchy) {
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  std::vector<std::string> files = {"1.txt", "2.txt", "3.txt", "4.txt",
+                                    "5.txt", "6.txt", "7.txt", "8.txt"};
+  EXPECT_OK(path::CreateDir(first_dir_path_));
+  EXPECT_OK(path::CreateDir(second_dir_path_));
+  for (const std::string& file : files) {
+    for (const auto& path :
+         {first_dir_path_, second_dir_path_, watcher_dir_path_})
+      EXPECT_OK(
+          path::WriteFile(path::Join(path, file), kFirstData, kFirstDataSize));
+  }
+
+  FileMap modified_files = GetChangedFiles(files.size() * 3 + 2);
+  ASSERT_EQ(modified_files.size(), files.size() * 3 + 2);
+
+  for (const std::string& file : files) {
+    ExpectFile(modified_files, path::Join(kFirstDir, file));
+    ExpectFile(modified_files, path::Join(kSecondDir, file));
+    ExpectFile(modified_files, file);
+  }
+  ExpectFile(modified_files, kFirstDir);
+  ExpectFile(modified_files, kSecondDir);
+
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, MoveInDirReportsContents) {
+  // Create a directory tree outside of the watched directory.
+  std::string outside_dir = path::Join(test_dir_path_, kFirstDir);
+  EXPECT_OK(path::CreateDirRec(path::Join(outside_dir, kSecondDir)));
+  EXPECT_OK(path::WriteFile(path::Join(outside_dir, kSecondDir, kFirstFile),
+                            kFirstData, kFirstDataSize));
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+
+  EXPECT_OK(path::RenameFile(outside_dir, first_dir_path_));
+
+  FileMap modified_files = GetChangedFiles(3u);
+  EXPECT_EQ(modified_files.size(), 3u);
+  ExpectFileInfo(modified_files, kFirstDir, FileAction::kAdded, kDir, 0);
+  ExpectFileInfo(modified_files, path::Join(kFirstDir, kSecondDir),
+                 FileAction::kAdded, kDir, 0);
+  ExpectFileInfo(modified_files, path::Join(kFirstDir, kSecondDir, kFirstFile),
+                 FileAction::kAdded, kFile, kFirstDataSize);
+
+  // The moved-in directories are watched, too.
+  std::string file_path = path::Join(first_dir_path_, kSecondDir, kSecondFile);
+  EXPECT_OK(path::WriteFile(file_path, kFirstData, kFirstDataSize));
+  modified_files = GetChangedFiles(1u);
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFile(modified_files, path::Join(kFirstDir, kSecondDir, kSecondFile));
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, MoveOutDirStopsWatching) {
+  EXPECT_OK(path::CreateDir(first_dir_path_));
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+
+  std::string outside_dir = path::Join(test_dir_path_, kFirstDir);
+  EXPECT_OK(path::RenameFile(first_dir_path_, outside_dir));
+  FileMap modified_files = GetChangedFiles(1u);
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFileInfo(modified_files, kFirstDir, FileAction::kDeleted, kDir, 0);
+
+  // Changes in the moved-out directory are not reported anymore.
+  EXPECT_OK(path::WriteFile(path::Join(outside_dir, kFirstFile), kFirstData,
+                            kFirstDataSize));
+  EXPECT_OK(path::WriteFile(second_file_path_, kFirstData, kFirstDataSize));
+  modified_files = GetChangedFiles(1u);
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFile(modified_files, kSecondFile);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, RestartWatchingWithChanges) {
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+  EXPECT_TRUE(WaitForChange(/*min_event_count=*/1));
+  EXPECT_OK(watcher_.StopWatching());
+
+  // first_test_dir should not be in the modification set.
+  EXPECT_OK(path::CreateDir(first_dir_path_));
+
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  EXPECT_OK(path::WriteFile(second_file_path_, kSecondData, kSecondDataSize));
+
+  FileMap modified_files = GetChangedFiles(2u);
+  EXPECT_EQ(modified_files.size(), 2u);
+  ExpectFile(modified_files, kFirstFile);
+  ExpectFile(modified_files, kSecondFile);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, ReadFileNoNotification) {
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  Buffer data;
+  EXPECT_OK(path::ReadFile(first_file_path_, &data));
+
+  EXPECT_FALSE(WaitForChange());
+  EXPECT_TRUE(watcher_.GetModifiedFiles().empty());
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, ActionAddModifyRemove) {
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+  EXPECT_OK(path::WriteFile(first_file_path_, kSecondData, kSecondDataSize));
+  EXPECT_OK(path::RemoveFile(first_file_path_));
+  // The kernel merges consecutive modify events if they were not read yet.
+  EXPECT_TRUE(WaitForChange(/*min_event_count=*/3));  // add, modify, remove
+
+  // The watcher should collapse add-modify-remove sequences and report no
+  // changes.
+  FileMap modified_files = watcher_.GetModifiedFiles();
+  EXPECT_EQ(modified_files.size(), 0u);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, ActionModifyRemove) {
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  EXPECT_OK(path::WriteFile(first_file_path_, kSecondData, kSecondDataSize));
+  EXPECT_OK(path::RemoveFile(first_file_path_));
+  EXPECT_TRUE(WaitForChange(/*min_event_count=*/2));  // 1x modify, 1x remove
+
+  FileMap modified_files = watcher_.GetModifiedFiles();
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFileInfo(modified_files, kFirstFile, FileAction::kDeleted, kFile, 0);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, ModifiedTime) {
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+  EXPECT_TRUE(WaitForChange(/*min_event_count=*/2));  // 1x add, 1x modify
+  FileMap modified_files = watcher_.GetModifiedFiles();
+  ASSERT_EQ(modified_files.size(), 1u);
+  time_t mtime;
+  EXPECT_OK(path::GetFileTime(first_file_path_, &mtime));
+  const FileInfo& info = modified_files.begin()->second;
+  EXPECT_EQ(info.mtime, mtime);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, DeleteWatchedDir) {
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); },
+                                   [this]() { OnDirRecreated(); }, kFWTimeout));
+
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+  EXPECT_TRUE(WaitForChange(/*min_event_count=*/2));  // 1x add, 1x modify
+
+  EXPECT_OK(path::RemoveDirRec(watcher_dir_path_));
+  EXPECT_TRUE(WaitForDirRecreated(1u));
+
+  EXPECT_TRUE(watcher_.GetModifiedFiles().empty());
+  EXPECT_NOT_OK(watcher_.GetStatus());
+  // The error status should not be overwritten.
+  EXPECT_NOT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, RecreateWatchedDir) {
+  EXPECT_OK(path::CreateDir(first_dir_path_));
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); },
+                                   [this]() { OnDirRecreated(); }, kFWTimeout));
+
+  EXPECT_OK(path::RemoveDirRec(watcher_dir_path_));
+  EXPECT_TRUE(WaitForDirRecreated(1u));
+
+  EXPECT_OK(path::CreateDirRec(first_dir_path_));
+  EXPECT_TRUE(WaitForDirRecreated(2u));
+
+  EXPECT_TRUE(watcher_.GetModifiedFiles().empty());
+  EXPECT_OK(watcher_.GetStatus());
+
+  // Wait until the watcher is running again, or else we might miss the file.
+  EXPECT_TRUE(WaitForRunning());
+
+  // Creation of a new file in a subdirectory should be detected.
+  EXPECT_OK(path::WriteFile(path::Join(first_dir_path_, kFirstFile),
+                            kFirstData, kFirstDataSize));
+
+  FileMap modified_files = GetChangedFiles(1u);
+  EXPECT_EQ(modified_files.size(), 1u);
+  ExpectFile(modified_files, path::Join(kFirstDir, kFirstFile));
+
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, RecreateUpperDir) {
+  EXPECT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); },
+                                   [this]() { OnDirRecreated(); }, kFWTimeout));
+
+  // Initially, there should be no dir_recreated_events.
+  EXPECT_EQ(watcher_.GetDirRecreateEventCountForTesting(), 0u);
+  EXPECT_OK(path::RemoveDirRec(test_dir_path_));
+  EXPECT_TRUE(WaitForDirRecreated(1u));
+
+  EXPECT_OK(path::CreateDirRec(test_dir_path_));
+  EXPECT_OK(path::CreateDirRec(watcher_dir_path_));
+  EXPECT_TRUE(WaitForDirRecreated(2u));
+
+  // Only 1 additional event should be registered for creation of the directory.
+  EXPECT_EQ(watcher_.GetDirRecreateEventCountForTesting(), 2u);
+  EXPECT_TRUE(watcher_.GetModifiedFiles().empty());
+  EXPECT_OK(watcher_.GetStatus());
+  EXPECT_TRUE(WaitForRunning());
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+TEST_F(FileWatcherLinuxTest, QueueOverflowSignalsDirRecreated) {
+  uint32_t max_events = 0;
+  std::ifstream max_events_file("/proc/sys/fs/inotify/max_queued_events");
+  if (!(max_events_file >> max_events) || max_events > 100000) {
+    GTEST_SKIP() << "Event queue is too large to overflow";
+  }
+
+  // Block the watcher thread in the callback, so that events queue up.
+  absl::Mutex block_mutex;
+  block_mutex.Lock();
+  EXPECT_OK(watcher_.StartWatching(
+      [this, &block_mutex]() {
+        absl::MutexLock lock(&block_mutex);
+        OnFilesChanged();
+      },
+      [this]() { OnDirRecreated(); }, kFWTimeout));
+  EXPECT_OK(path::WriteFile(first_file_path_, kFirstData, kFirstDataSize));
+  while (watcher_.GetEventCountForTesting() == 0) Util::Sleep(1);
+
+  for (uint32_t n = 0; n <= max_events; ++n) {
+    EXPECT_OK(path::WriteFile(path::Join(watcher_dir_path_, std::to_string(n)),
+                              kFirstData, 0));
+  }
+  block_mutex.Unlock();
+
+  // All changes are discarded, and the caller has to rescan.
+  EXPECT_TRUE(WaitForDirRecreated(1u));
+  EXPECT_TRUE(WaitForRunning());
+  EXPECT_TRUE(watcher_.GetModifiedFiles().empty());
+  EXPECT_OK(watcher_.GetStatus());
+
+  // Changes are detected again.
+  EXPECT_OK(path::CreateDir(first_dir_path_));
+  FileMap modified_files = GetChangedFiles(1u);
+  ExpectFile(modified_files, kFirstDir);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+// Benchmark for the latency between a single file edit in a large directory
+// tree and the change being available to the caller. Run with
+// --gtest_also_run_disabled_tests --gtest_filter=*UpdateLatencyBenchmark.
+TEST_F(FileWatcherLinuxTest, DISABLED_UpdateLatencyBenchmark) {
+  constexpr int kNumDirs = 1000;
+  constexpr int kFilesPerDir = 500;
+  constexpr int kNumEdits = 100;
+
+  Stopwatch sw;
+  for (int d = 0; d < kNumDirs; ++d) {
+    std::string dir = path::Join(watcher_dir_path_, std::to_string(d));
+    ASSERT_OK(path::CreateDir(dir));
+    for (int f = 0; f < kFilesPerDir; ++f)
+      ASSERT_OK(path::WriteFile(path::Join(dir, std::to_string(f)), "", 0));
+  }
+  printf("Created %i files in %0.3f sec\n", kNumDirs * kFilesPerDir,
+         sw.ElapsedSeconds());
+
+  sw.Reset();
+  ASSERT_OK(watcher_.StartWatching([this]() { OnFilesChanged(); }));
+  printf("Started watching in %0.3f sec\n", sw.ElapsedSeconds());
+
+  std::mt19937 rng(3);
+  std::uniform_int_distribution<int> dir_dist(0, kNumDirs - 1);
+  std::uniform_int_distribution<int> file_dist(0, kFilesPerDir - 1);
+  double total_sec = 0, max_sec = 0;
+  for (int n = 0; n < kNumEdits; ++n) {
+    std::string rel_path = path::Join(std::to_string(dir_dist(rng)),
+                                      std::to_string(file_dist(rng)));
+    sw.Reset();
+    ASSERT_OK(path::WriteFile(path::Join(watcher_dir_path_, rel_path),
+                              kFirstData, kFirstDataSize));
+    FileMap modified_files = GetChangedFiles(1u);
+    double sec = sw.ElapsedSeconds();
+    ExpectFile(modified_files, rel_path);
+    total_sec += sec;
+    max_sec = std::max(max_sec, sec);
+  }
+  printf("Edit to change latency: %0.1f us average, %0.1f us max\n",
+         total_sec * 1e6 / kNumEdits, max_sec * 1e6);
+  EXPECT_OK(watcher_.StopWatching());
+}
+
+}  // namespace
+}  // namespace cdc_ft
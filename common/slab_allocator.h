@@ -0,0 +1,111 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMMON_SLAB_ALLOCATOR_H_
+#define COMMON_SLAB_ALLOCATOR_H_
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace cdc_ft {
+
+// Thread-safe allocator for objects of type |T| that allocates memory in slabs
+// of |kObjectsPerSlab| objects. Compared to allocating every object on the
+// heap, this saves the per-allocation overhead and keeps objects close to each
+// other in memory. The memory of deleted objects is reused for new objects,
+// but it is only released when the allocator is destroyed. Object addresses
+// are stable.
+template <class T, size_t kObjectsPerSlab = 1024>
+class SlabAllocator {
+ public:
+  SlabAllocator() = default;
+  ~SlabAllocator() = default;
+
+  SlabAllocator(const SlabAllocator&) = delete;
+  SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+  // Constructs a new object with the given |args|.
+  template <class... Args>
+  T* New(Args&&... args) ABSL_LOCKS_EXCLUDED(mutex_) {
+    void* slot;
+    {
+      absl::MutexLock lock(&mutex_);
+      if (!free_list_) AddSlab();
+      slot = free_list_;
+      free_list_ = free_list_->next;
+      ++size_;
+    }
+    return new (slot) T(std::forward<Args>(args)...);
+  }
+
+  // Destroys |object|, which must have been returned by New(). Objects that
+  // were not deleted when the allocator is destroyed are NOT destroyed.
+  void Delete(T* object) ABSL_LOCKS_EXCLUDED(mutex_) {
+    object->~T();
+    FreeSlot* slot = reinterpret_cast<FreeSlot*>(object);
+    absl::MutexLock lock(&mutex_);
+    slot->next = free_list_;
+    free_list_ = slot;
+    --size_;
+  }
+
+  // Returns the number of objects that were created and not deleted.
+  size_t Size() const ABSL_LOCKS_EXCLUDED(mutex_) {
+    absl::MutexLock lock(&mutex_);
+    return size_;
+  }
+
+  // Returns the number of allocated slabs.
+  size_t NumSlabs() const ABSL_LOCKS_EXCLUDED(mutex_) {
+    absl::MutexLock lock(&mutex_);
+    return slabs_.size();
+  }
+
+ private:
+  // Unused slots form a singly linked list.
+  struct FreeSlot {
+    FreeSlot* next;
+  };
+
+  using Slot = std::aligned_storage_t<std::max(sizeof(T), sizeof(FreeSlot)),
+                                      std::max(alignof(T), alignof(FreeSlot))>;
+
+  // Allocates a new slab and adds its slots to |free_list_|.
+  void AddSlab() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    slabs_.push_back(std::make_unique<Slot[]>(kObjectsPerSlab));
+    Slot* slab = slabs_.back().get();
+    for (size_t n = kObjectsPerSlab; n > 0; --n) {
+      FreeSlot* slot = reinterpret_cast<FreeSlot*>(&slab[n - 1]);
+      slot->next = free_list_;
+      free_list_ = slot;
+    }
+  }
+
+  mutable absl::Mutex mutex_;
+  std::vector<std::unique_ptr<Slot[]>> slabs_ ABSL_GUARDED_BY(mutex_);
+  FreeSlot* free_list_ ABSL_GUARDED_BY(mutex_) = nullptr;
+  size_t size_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace cdc_ft
+
+#endif  // COMMON_SLAB_ALLOCATOR_H_
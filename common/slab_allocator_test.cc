@@ -0,0 +1,110 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "common/slab_allocator.h"
+
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cdc_ft {
+namespace {
+
+class SlabAllocatorTest : public ::testing::Test {};
+
+struct Object {
+  Object(std::string name, int* num_alive)
+      : name(std::move(name)), num_alive(num_alive) {
+    ++*num_alive;
+  }
+  ~Object() { --*num_alive; }
+
+  std::string name;
+  int* num_alive;
+};
+
+TEST_F(SlabAllocatorTest, NewAndDelete) {
+  SlabAllocator<Object, 4> allocator;
+  int num_alive = 0;
+  Object* a = allocator.New("a", &num_alive);
+  Object* b = allocator.New("b", &num_alive);
+  EXPECT_EQ(a->name, "a");
+  EXPECT_EQ(b->name, "b");
+  EXPECT_EQ(num_alive, 2);
+  EXPECT_EQ(allocator.Size(), 2);
+
+  allocator.Delete(a);
+  EXPECT_EQ(num_alive, 1);
+  EXPECT_EQ(allocator.Size(), 1);
+  allocator.Delete(b);
+  EXPECT_EQ(num_alive, 0);
+  EXPECT_EQ(allocator.Size(), 0);
+}
+
+TEST_F(SlabAllocatorTest, ReusesDeletedObjects) {
+  SlabAllocator<Object, 4> allocator;
+  int num_alive = 0;
+  std::vector<Object*> objects;
+  for (int n = 0; n < 6; ++n) {
+    objects.push_back(allocator.New(std::to_string(n), &num_alive));
+  }
+  EXPECT_EQ(allocator.NumSlabs(), 2);
+
+  // Objects are distinct.
+  std::unordered_set<Object*> unique(objects.begin(), objects.end());
+  EXPECT_EQ(unique.size(), objects.size());
+
+  Object* deleted = objects[3];
+  allocator.Delete(deleted);
+  Object* object = allocator.New("new", &num_alive);
+  EXPECT_EQ(object, deleted);
+  EXPECT_EQ(object->name, "new");
+  EXPECT_EQ(allocator.NumSlabs(), 2);
+
+  objects[3] = object;
+  for (Object* object : objects) allocator.Delete(object);
+  EXPECT_EQ(num_alive, 0);
+}
+
+TEST_F(SlabAllocatorTest, ConcurrentNewAndDelete) {
+  SlabAllocator<Object, 16> allocator;
+  int num_alive[4] = {0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&allocator, &num_alive, t]() {
+      std::vector<Object*> objects;
+      for (int n = 0; n < 1000; ++n) {
+        objects.push_back(allocator.New(std::to_string(n), &num_alive[t]));
+        if (n % 3 == 0) {
+          allocator.Delete(objects.back());
+          objects.pop_back();
+        }
+      }
+      for (size_t n = 0; n < objects.size(); ++n) {
+        EXPECT_EQ(objects[n]->num_alive, &num_alive[t]);
+        allocator.Delete(objects[n]);
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  EXPECT_EQ(allocator.Size(), 0);
+  for (int t = 0; t < 4; ++t) EXPECT_EQ(num_alive[t], 0);
+}
+
+}  // namespace
+}  // namespace cdc_ft
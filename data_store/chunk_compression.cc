@@ -0,0 +1,89 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "data_store/chunk_compression.h"
+
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "lib/zstd.h"
+
+namespace cdc_ft {
+namespace chunk_compression {
+namespace {
+
+// Compressed data must be at least 1/kMinSavingsDivisor smaller than the
+// original data, otherwise the chunk is considered incompressible.
+constexpr size_t kMinSavingsDivisor = 8;
+
+// Returns the decompressed size of the frame in |compressed|.
+absl::StatusOr<size_t> GetDecompressedSize(const void* compressed,
+                                           size_t size) {
+  unsigned long long content_size = ZSTD_getFrameContentSize(compressed, size);
+  if (content_size == ZSTD_CONTENTSIZE_ERROR ||
+      content_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+    return absl::DataLossError("Invalid compressed chunk");
+  }
+  return static_cast<size_t>(content_size);
+}
+
+// Decompresses |compressed| into |data| of |data_size| bytes.
+absl::Status DecompressInto(const void* compressed, size_t size, void* data,
+                            size_t data_size) {
+  size_t result = ZSTD_decompress(data, data_size, compressed, size);
+  if (ZSTD_isError(result)) {
+    return absl::DataLossError(absl::StrFormat(
+        "Failed to decompress chunk: %s", ZSTD_getErrorName(result)));
+  }
+  if (result != data_size) {
+    return absl::DataLossError(
+        absl::StrFormat("Decompressed chunk has %u bytes, expected %u", result,
+                        data_size));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+bool Compress(const void* data, size_t size, int level,
+              std::string* compressed) {
+  if (size < kMinSize) return false;
+
+  // Don't bother if the output would not be small enough.
+  size_t max_size = size - size / kMinSavingsDivisor;
+  compressed->resize(ZSTD_compressBound(size));
+  size_t result = ZSTD_compress(const_cast<char*>(compressed->data()),
+                                compressed->size(), data, size, level);
+  if (ZSTD_isError(result) || result > max_size) return false;
+  compressed->resize(result);
+  return true;
+}
+
+absl::Status Decompress(const void* compressed, size_t size, Buffer* data) {
+  absl::StatusOr<size_t> data_size = GetDecompressedSize(compressed, size);
+  if (!data_size.ok()) return data_size.status();
+  data->resize(*data_size);
+  return DecompressInto(compressed, size, data->data(), data->size());
+}
+
+absl::Status Decompress(const void* compressed, size_t size,
+                        std::string* data) {
+  absl::StatusOr<size_t> data_size = GetDecompressedSize(compressed, size);
+  if (!data_size.ok()) return data_size.status();
+  data->resize(*data_size);
+  return DecompressInto(compressed, size, const_cast<char*>(data->data()),
+                        data->size());
+}
+
+}  // namespace chunk_compression
+}  // namespace cdc_ft
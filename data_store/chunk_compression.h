@@ -0,0 +1,52 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DATA_STORE_CHUNK_COMPRESSION_H_
+#define DATA_STORE_CHUNK_COMPRESSION_H_
+
+#include <string>
+
+#include "absl/status/status.h"
+#include "common/buffer.h"
+
+namespace cdc_ft {
+namespace chunk_compression {
+
+// Compression level for chunks that are compressed on the fly for transfer.
+static constexpr int kTransferLevel = 1;
+
+// Default compression level for chunks that are stored compressed on disk.
+static constexpr int kDefaultStorageLevel = 3;
+
+// Chunks smaller than this are never compressed.
+static constexpr size_t kMinSize = 256;
+
+// Compresses |size| bytes of |data| into a single zstd frame using the given
+// compression |level| and stores it in |compressed|. Returns false if |data|
+// is too small or does not compress well enough to be worth the decompression
+// overhead. The content of |compressed| is undefined in that case.
+bool Compress(const void* data, size_t size, int level,
+              std::string* compressed);
+
+// Decompresses the zstd frame of |size| bytes in |compressed| into |data|.
+absl::Status Decompress(const void* compressed, size_t size, Buffer* data);
+absl::Status Decompress(const void* compressed, size_t size,
+                        std::string* data);
+
+}  // namespace chunk_compression
+}  // namespace cdc_ft
+
+#endif  // DATA_STORE_CHUNK_COMPRESSION_H_
@@ -0,0 +1,72 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "data_store/chunk_compression.h"
+
+#include <random>
+
+#include "common/status_test_macros.h"
+#include "gtest/gtest.h"
+
+namespace cdc_ft {
+namespace {
+
+TEST(ChunkCompressionTest, RoundTrip) {
+  std::string data;
+  for (int n = 0; n < 1000; ++n) data += "compressible text ";
+
+  std::string compressed;
+  ASSERT_TRUE(chunk_compression::Compress(
+      data.data(), data.size(), chunk_compression::kTransferLevel,
+      &compressed));
+  EXPECT_LT(compressed.size(), data.size());
+
+  std::string str_data;
+  EXPECT_OK(chunk_compression::Decompress(compressed.data(),
+                                          compressed.size(), &str_data));
+  EXPECT_EQ(str_data, data);
+
+  Buffer buf_data;
+  EXPECT_OK(chunk_compression::Decompress(compressed.data(),
+                                          compressed.size(), &buf_data));
+  EXPECT_EQ(std::string(buf_data.data(), buf_data.size()), data);
+}
+
+TEST(ChunkCompressionTest, SkipsSmallData) {
+  std::string data(chunk_compression::kMinSize - 1, 'a');
+  std::string compressed;
+  EXPECT_FALSE(chunk_compression::Compress(
+      data.data(), data.size(), chunk_compression::kTransferLevel,
+      &compressed));
+}
+
+TEST(ChunkCompressionTest, SkipsIncompressibleData) {
+  std::mt19937 gen(1);
+  std::string data(64 << 10, 0);
+  for (char& c : data) c = static_cast<char>(gen());
+  std::string compressed;
+  EXPECT_FALSE(chunk_compression::Compress(
+      data.data(), data.size(), chunk_compression::kTransferLevel,
+      &compressed));
+}
+
+TEST(ChunkCompressionTest, DecompressInvalidDataFails) {
+  std::string data(1000, 'a');
+  std::string decompressed;
+  EXPECT_ERROR(DataLoss, chunk_compression::Decompress(
+                             data.data(), data.size(), &decompressed));
+}
+
+}  // namespace
+}  // namespace cdc_ft
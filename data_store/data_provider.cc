@@ -20,6 +20,7 @@
 #include "absl/strings/str_format.h"
 #include "common/log.h"
 #include "common/status.h"
+#include "common/status_macros.h"
 #include "common/stopwatch.h"
 #include "manifest/content_id.h"
 
@@ -31,15 +32,24 @@ namespace {
 // be used to identify max. size requests.
 constexpr uint64_t kMaxFuseRequestSize = 1 << 17;
 
+// Returns the number of tasks in |chunks| that are not done.
+size_t CountUndone(const ChunkTransferList& chunks) {
+  return std::count_if(
+      chunks.begin(), chunks.end(),
+      [](const ChunkTransferTask& chunk) { return !chunk.done; });
+}
+
 }  // namespace
 
 DataProvider::DataProvider(
     std::unique_ptr<DataStoreWriter> writer,
     std::vector<std::unique_ptr<DataStoreReader>> readers, size_t prefetch_size,
-    uint32_t cleanup_timeout_sec, uint32_t access_idle_timeout_sec)
+    uint32_t cleanup_timeout_sec, uint32_t access_idle_timeout_sec,
+    uint64_t mem_cache_capacity)
     : prefetch_size_(prefetch_size),
       writer_(std::move(writer)),
       readers_(std::move(readers)),
+      mem_cache_(mem_cache_capacity),
       chunks_updated_{true},
       cleanup_timeout_sec_(cleanup_timeout_sec),
       access_idle_timeout_sec_(access_idle_timeout_sec) {
@@ -63,6 +73,34 @@ void DataProvider::Shutdown() {
   }
 }
 
+MemChunkCache::Statistics DataProvider::GetMemCacheStatistics() const {
+  return mem_cache_.GetStatistics();
+}
+
+void DataProvider::LogMemCacheStatistics() const {
+  if (!mem_cache_.Enabled()) return;
+  MemChunkCache::Statistics stats = mem_cache_.GetStatistics();
+  LOG_INFO(
+      "Memory cache: %u hits, %u misses (%.1f%% hit rate), %u chunks, %u of "
+      "%u bytes used",
+      stats.hits, stats.misses, stats.HitRate() * 100.0,
+      stats.number_of_chunks, stats.size, stats.capacity);
+}
+
+DataProvider::FetchStatistics DataProvider::GetFetchStatistics() const {
+  FetchStatistics stats;
+  stats.hits = hit_chunks_;
+  stats.coalesced = coalesced_chunks_;
+  stats.fetched = fetched_chunks_;
+  return stats;
+}
+
+void DataProvider::LogFetchStatistics() const {
+  FetchStatistics stats = GetFetchStatistics();
+  LOG_INFO("Chunk fetches: %u cache hits, %u coalesced, %u fetched",
+           stats.hits, stats.coalesced, stats.fetched);
+}
+
 size_t DataProvider::PrefetchSize(size_t read_size) const {
   // If the read size matches the maximum FUSE request size, it is very likely
   // that the next chunk is needed as well, so we enlarge the read size by the
@@ -75,79 +113,118 @@ absl::StatusOr<size_t> DataProvider::Get(const ContentIdProto& content_id,
                                          void* data, size_t offset,
                                          size_t size) {
   last_access_sec_ = GetSteadyNowSec();
-  absl::Mutex* content_mutex = GetContentMutex(content_id);
+  size_t mem_read_bytes;
+  if (mem_cache_.Get(content_id, data, offset, size, &mem_read_bytes)) {
+    return mem_read_bytes;
+  }
   absl::StatusOr<size_t> read_bytes;
   if (writer_) {
     {
-      absl::ReaderMutexLock read_lock(content_mutex);
-      read_bytes = writer_->Get(content_id, data, offset, size);
-    }
-    if (read_bytes.ok()) {
-      return read_bytes;
+      absl::ReaderMutexLock read_lock(GetContentMutex(content_id));
+      read_bytes = GetFromWriterAndCache(content_id, data, offset, size);
     }
-    LogWriterWarning(read_bytes.status(), content_id);
-  }
-  // To prevent reading the same chunk from multiple threads, make read/write
-  // atomic.
-  absl::WriterMutexLock write_lock(content_mutex);
-  // Read from the writer_ again, in case the cache has been populated by
-  // another thread.
-  if (writer_ && absl::IsNotFound(read_bytes.status())) {
-    read_bytes = writer_->Get(content_id, data, offset, size);
     if (read_bytes.ok()) {
       return read_bytes;
     }
     LogWriterWarning(read_bytes.status(), content_id);
   }
-  for (auto& reader : readers_) {
-    Buffer buffer;
-    absl::Status status = reader->Get(content_id, &buffer);
-    if (!status.ok()) {
-      // Try next reader if this one doesn't contain the chunk.
-      if (absl::IsNotFound(status)) continue;
-      // TODO: Add reader identification for debugging.
-      return WrapStatus(status, "Failed to get '%s'.",
-                        ContentId::ToHexString(content_id));
-    }
-    if (writer_) {
-      status = writer_->Put(content_id, buffer.data(), buffer.size());
-      chunks_updated_ = true;
-      if (!status.ok()) {
-        LOG_ERROR("Failed to write chunk '%s': %s.",
-                  ContentId::ToHexString(content_id), status.ToString());
-      }
-    }
-    if (buffer.size() <= offset) return 0;
-    size_t return_bytes = std::min(buffer.size() - offset, size);
-    memcpy(data, buffer.data() + offset, return_bytes);
-    return return_bytes;
-  }
-  return absl::NotFoundError(absl::StrFormat(
-      "Failed to find %s.", ContentId::ToHexString(content_id)));
+  Buffer buffer;
+  RETURN_IF_ERROR(FetchChunk(content_id, &buffer));
+  if (buffer.size() <= offset) return 0;
+  size_t return_bytes = std::min(buffer.size() - offset, size);
+  memcpy(data, buffer.data() + offset, return_bytes);
+  return return_bytes;
 }
 
 absl::Status DataProvider::Get(ChunkTransferList* chunks) {
   last_access_sec_ = GetSteadyNowSec();
-  // Try to fetch chunks from the cache first.
-  RETURN_IF_ERROR(GetFromWriter(chunks, /*lock_required=*/true));
+  // Try to fetch chunks from memory and the cache first.
+  size_t undone_count = CountUndone(*chunks);
+  GetFromMemCache(chunks);
+  if (!chunks->ReadDone()) {
+    RETURN_IF_ERROR(GetFromWriter(chunks, /*lock_required=*/true));
+  }
+  hit_chunks_ += undone_count - CountUndone(*chunks);
   if (chunks->ReadDone()) return absl::OkStatus();
 
-  // Get list of all missing chunk IDs.
-  std::vector<const ContentIdProto*> chunk_ids;
-  for (const ChunkTransferTask& chunk : *chunks) {
-    if (!chunk.done) chunk_ids.push_back(&chunk.id);
+  // Fetch the missing chunks that no other thread is fetching yet, then wait
+  // for the fetches of the other threads. Waiting only after publishing the
+  // own fetches avoids deadlocks between threads waiting for each other.
+  ChunkTransferList fetches;
+  std::vector<ChunkTransferTask*> fetched_tasks;
+  std::vector<std::pair<ChunkTransferTask*, std::shared_ptr<InflightChunk>>>
+      waiting_tasks;
+  {
+    absl::MutexLock lock(&inflight_mutex_);
+    for (ChunkTransferTask& chunk : *chunks) {
+      if (chunk.done) continue;
+      auto [it, inserted] = inflight_.try_emplace(ContentId(chunk.id));
+      if (inserted) {
+        it->second = std::make_shared<InflightChunk>();
+        fetches.emplace_back(chunk.id, chunk.offset, chunk.data, chunk.size);
+        fetched_tasks.push_back(&chunk);
+        continue;
+      }
+      ++coalesced_chunks_;
+      if (!chunk.size) {
+        // The chunk is being prefetched already.
+        chunk.done = true;
+        continue;
+      }
+      waiting_tasks.emplace_back(&chunk, it->second);
+    }
   }
 
-  // Acquire writer locks for all missing chunks.
-  WriterMutexLockList locks;
-  WriteLockAll(std::move(chunk_ids), &locks);
+  absl::Status status = FetchFromReaders(&fetches);
+  PublishFetches(&fetches, status);
+  for (size_t n = 0; n < fetches.size(); ++n) {
+    fetched_tasks[n]->done = fetches[n].done;
+  }
+  if (!status.ok()) return status;
 
-  // Read from the |writer_| again, in case the cache has been populated by
-  // another thread. We hold all chunk locks already.
-  RETURN_IF_ERROR(GetFromWriter(chunks, /*lock_required=*/false));
-  if (chunks->ReadDone()) return absl::OkStatus();
+  for (auto& [chunk, inflight] : waiting_tasks) {
+    {
+      absl::MutexLock lock(&inflight_mutex_);
+      inflight_mutex_.Await(absl::Condition(&inflight->done));
+    }
+    // |inflight| is immutable once |inflight->done| is set.
+    if (!inflight->status.ok()) return inflight->status;
+    if (inflight->data.size() >= chunk->offset + chunk->size) {
+      memcpy(chunk->data, inflight->data.data() + chunk->offset, chunk->size);
+      chunk->done = true;
+    }
+  }
+
+  // Chunks that were fetched by another thread, but could not be shared, e.g.
+  // because they were already cached, should be available locally now.
+  if (!chunks->ReadDone()) {
+    GetFromMemCache(chunks);
+    RETURN_IF_ERROR(GetFromWriter(chunks, /*lock_required=*/true));
+  }
+  return absl::OkStatus();
+}
 
-  // Try to read from all readers.
+absl::Status DataProvider::FetchFromReaders(ChunkTransferList* chunks) {
+  if (chunks->empty()) return absl::OkStatus();
+
+  {
+    // Acquire writer locks for all chunks.
+    std::vector<const ContentIdProto*> chunk_ids;
+    for (const ChunkTransferTask& chunk : *chunks) {
+      chunk_ids.push_back(&chunk.id);
+    }
+    WriterMutexLockList locks;
+    WriteLockAll(std::move(chunk_ids), &locks);
+
+    // Read from the |writer_| again, in case the cache has been populated by
+    // another thread. We hold all chunk locks already.
+    RETURN_IF_ERROR(GetFromWriter(chunks, /*lock_required=*/false));
+    if (chunks->ReadDone()) return absl::OkStatus();
+  }
+
+  // Try to read from all readers. The chunk locks are not held, so that other
+  // threads can access unrelated chunks that share the same mutexes.
+  size_t undone_count = CountUndone(*chunks);
   for (auto& reader : readers_) {
     absl::Status status = reader->Get(chunks);
     if (!status.ok()) {
@@ -157,13 +234,22 @@ absl::Status DataProvider::Get(ChunkTransferList* chunks) {
     }
     if (chunks->PrefetchDone()) break;
   }
+  fetched_chunks_ += undone_count - CountUndone(*chunks);
 
-  // Cache complete chunks in the writer.
+  // Cache complete chunks in memory and in the writer.
+  for (ChunkTransferTask& chunk : *chunks) {
+    if (!chunk.done || chunk.chunk_data.empty()) continue;
+    mem_cache_.Put(chunk.id, chunk.chunk_data.data(), chunk.chunk_data.size());
+  }
   if (writer_) {
     for (ChunkTransferTask& chunk : *chunks) {
       if (!chunk.done || chunk.chunk_data.empty()) continue;
-      absl::Status status = writer_->Put(chunk.id, chunk.chunk_data.data(),
-                                         chunk.chunk_data.size());
+      absl::Status status;
+      {
+        absl::WriterMutexLock lock(GetContentMutex(chunk.id));
+        status = writer_->Put(chunk.id, chunk.chunk_data.data(),
+                              chunk.chunk_data.size());
+      }
       chunks_updated_ = true;
       if (!status.ok()) {
         LOG_WARNING("Failed to put '%s' to writer: %s.",
@@ -174,35 +260,86 @@ absl::Status DataProvider::Get(ChunkTransferList* chunks) {
   return absl::OkStatus();
 }
 
-absl::Status DataProvider::Get(const ContentIdProto& content_id, Buffer* data) {
-  last_access_sec_ = GetSteadyNowSec();
-  absl::Mutex* content_mutex = GetContentMutex(content_id);
-  absl::Status status = absl::OkStatus();
+void DataProvider::PublishFetches(ChunkTransferList* chunks,
+                                  const absl::Status& status) {
+  absl::MutexLock lock(&inflight_mutex_);
+  for (ChunkTransferTask& chunk : *chunks) {
+    auto it = inflight_.find(ContentId(chunk.id));
+    assert(it != inflight_.end());
+    if (chunk.done) it->second->data = std::move(chunk.chunk_data);
+    it->second->status = status;
+    it->second->done = true;
+    inflight_.erase(it);
+  }
+}
+
+absl::Status DataProvider::FetchChunk(const ContentIdProto& content_id,
+                                      Buffer* data) {
+  std::shared_ptr<InflightChunk> inflight;
+  bool inserted;
+  {
+    absl::MutexLock lock(&inflight_mutex_);
+    auto result = inflight_.try_emplace(ContentId(content_id));
+    inserted = result.second;
+    if (inserted) result.first->second = std::make_shared<InflightChunk>();
+    inflight = result.first->second;
+  }
+
+  if (inserted) {
+    absl::Status status = FetchChunkFromReaders(content_id, data);
+    absl::MutexLock lock(&inflight_mutex_);
+    if (status.ok()) inflight->data.assign(data->data(), data->size());
+    inflight->status = status;
+    inflight->done = true;
+    inflight_.erase(ContentId(content_id));
+    return status;
+  }
+
+  // Wait for the fetch of the other thread.
+  ++coalesced_chunks_;
+  {
+    absl::MutexLock lock(&inflight_mutex_);
+    inflight_mutex_.Await(absl::Condition(&inflight->done));
+  }
+  // |inflight| is immutable once |inflight->done| is set.
+  if (!inflight->status.ok()) return inflight->status;
+  if (!inflight->data.empty()) {
+    data->clear();
+    data->append(inflight->data.data(), inflight->data.size());
+    return absl::OkStatus();
+  }
+
+  // The fetch did not share the chunk, e.g. because it was cached already.
+  if (mem_cache_.Get(content_id, data)) return absl::OkStatus();
+  if (writer_) {
+    absl::ReaderMutexLock read_lock(GetContentMutex(content_id));
+    if (writer_->Get(content_id, data).ok()) return absl::OkStatus();
+  }
+  return absl::NotFoundError(absl::StrFormat(
+      "Failed to find '%s'.", ContentId::ToHexString(content_id)));
+}
+
+absl::Status DataProvider::FetchChunkFromReaders(
+    const ContentIdProto& content_id, Buffer* data) {
   if (writer_) {
+    // Read from the |writer_| again, in case the cache has been populated by
+    // another thread.
+    absl::Status status;
     {
-      absl::ReaderMutexLock read_lock(content_mutex);
+      absl::WriterMutexLock write_lock(GetContentMutex(content_id));
       status = writer_->Get(content_id, data);
     }
     if (status.ok()) {
+      mem_cache_.Put(content_id, data->data(), data->size());
       return absl::OkStatus();
     }
     LogWriterWarning(status, content_id);
   }
 
-  // To prevent reading the same chunk from multiple threads, make read/write
-  // atomic.
-  absl::WriterMutexLock write_lock(content_mutex);
-  // Read from the writer_ again, in case the cache has been populated by
-  // another thread.
-  if (writer_ && absl::IsNotFound(status)) {
-    status = writer_->Get(content_id, data);
-    if (status.ok()) {
-      return absl::OkStatus();
-    }
-    LogWriterWarning(status, content_id);
-  }
+  // The chunk lock is not held, so that other threads can access unrelated
+  // chunks that share the same mutex.
   for (auto& reader : readers_) {
-    status = reader->Get(content_id, data);
+    absl::Status status = reader->Get(content_id, data);
     if (!status.ok()) {
       // Try next reader if this one doesn't contain the chunk.
       if (absl::IsNotFound(status)) continue;
@@ -210,9 +347,18 @@ absl::Status DataProvider::Get(const ContentIdProto& content_id, Buffer* data) {
       return WrapStatus(status, "Failed to get '%s'.",
                         ContentId::ToHexString(content_id));
     }
+    ++fetched_chunks_;
+    mem_cache_.Put(content_id, data->data(), data->size());
     if (writer_) {
-      writer_->Put(content_id, data->data(), data->size()).IgnoreError();
+      {
+        absl::WriterMutexLock write_lock(GetContentMutex(content_id));
+        status = writer_->Put(content_id, data->data(), data->size());
+      }
       chunks_updated_ = true;
+      if (!status.ok()) {
+        LOG_WARNING("Failed to put '%s' to writer: %s.",
+                    ContentId::ToHexString(content_id), status.message());
+      }
     }
     return absl::OkStatus();
   }
@@ -220,6 +366,76 @@ absl::Status DataProvider::Get(const ContentIdProto& content_id, Buffer* data) {
       "Failed to find '%s'.", ContentId::ToHexString(content_id)));
 }
 
+absl::Status DataProvider::Get(const ContentIdProto& content_id, Buffer* data) {
+  last_access_sec_ = GetSteadyNowSec();
+  if (mem_cache_.Get(content_id, data)) return absl::OkStatus();
+  if (writer_) {
+    absl::Status status;
+    {
+      absl::ReaderMutexLock read_lock(GetContentMutex(content_id));
+      status = writer_->Get(content_id, data);
+    }
+    if (status.ok()) {
+      mem_cache_.Put(content_id, data->data(), data->size());
+      return absl::OkStatus();
+    }
+    LogWriterWarning(status, content_id);
+  }
+  return FetchChunk(content_id, data);
+}
+
+absl::Status DataProvider::Put(const ContentIdProto& content_id,
+                               const void* data, size_t size) {
+  last_access_sec_ = GetSteadyNowSec();
+  mem_cache_.Put(content_id, data, size);
+  if (!writer_) return absl::OkStatus();
+
+  absl::WriterMutexLock write_lock(GetContentMutex(content_id));
+  RETURN_IF_ERROR(writer_->Put(content_id, data, size),
+                  "Failed to store chunk '%s'",
+                  ContentId::ToHexString(content_id));
+  chunks_updated_ = true;
+  return absl::OkStatus();
+}
+
+void DataProvider::AddMetadataChunks(std::vector<ContentIdProto> content_ids) {
+  if (writer_) writer_->AddMetadataChunks(std::move(content_ids));
+}
+
+void DataProvider::StartMetadataGeneration() {
+  if (writer_) writer_->StartMetadataGeneration();
+}
+
+bool DataProvider::IsCached(const ContentIdProto& content_id) {
+  if (mem_cache_.Contains(content_id)) return true;
+  if (!writer_) return false;
+  absl::ReaderMutexLock read_lock(GetContentMutex(content_id));
+  return writer_->Contains(content_id);
+}
+
+absl::StatusOr<std::string> DataProvider::GetChunkFilePath(
+    const ContentIdProto& content_id) {
+  last_access_sec_ = GetSteadyNowSec();
+  // Copying from memory is cheaper than letting the kernel read the file.
+  if (mem_cache_.Contains(content_id)) {
+    return absl::NotFoundError(
+        absl::StrFormat("Chunk %s is cached in memory",
+                        ContentId::ToHexString(content_id)));
+  }
+  if (!writer_) return DataStoreReader::GetChunkFilePath(content_id);
+  absl::Mutex* content_mutex = GetContentMutex(content_id);
+  absl::ReaderMutexLock read_lock(content_mutex);
+  return writer_->GetChunkFilePath(content_id);
+}
+
+absl::Status DataProvider::GetProto(const ContentIdProto& content_id,
+                                    Buffer* buf,
+                                    google::protobuf::Message* proto) {
+  RETURN_IF_ERROR(DataStoreReader::GetProto(content_id, buf, proto));
+  if (writer_) writer_->AddMetadataChunks({content_id});
+  return absl::OkStatus();
+}
+
 void DataProvider::LogWriterWarning(const absl::Status& status,
                                     const ContentIdProto& content_id) {
   if (!absl::IsNotFound(status)) {
@@ -252,6 +468,38 @@ void DataProvider::WriteLockAll(std::vector<const ContentIdProto*> chunk_ids,
   }
 }
 
+absl::StatusOr<size_t> DataProvider::GetFromWriterAndCache(
+    const ContentIdProto& content_id, void* data, size_t offset, size_t size) {
+  if (!mem_cache_.Enabled()) {
+    return writer_->Get(content_id, data, offset, size);
+  }
+
+  // Read the whole chunk, so that it can be served from memory next time.
+  Buffer buffer;
+  RETURN_IF_ERROR(writer_->Get(content_id, &buffer));
+  mem_cache_.Put(content_id, buffer.data(), buffer.size());
+  if (buffer.size() <= offset) return 0;
+  size_t read_bytes = std::min(buffer.size() - offset, size);
+  memcpy(data, buffer.data() + offset, read_bytes);
+  return read_bytes;
+}
+
+void DataProvider::GetFromMemCache(ChunkTransferList* chunks) {
+  if (!mem_cache_.Enabled()) return;
+  for (ChunkTransferTask& chunk : *chunks) {
+    if (chunk.done) continue;
+    if (!chunk.size) {
+      chunk.done = mem_cache_.Contains(chunk.id);
+      continue;
+    }
+    size_t read_bytes;
+    chunk.done =
+        mem_cache_.Get(chunk.id, chunk.data, chunk.offset, chunk.size,
+                       &read_bytes) &&
+        read_bytes == chunk.size;
+  }
+}
+
 absl::Status DataProvider::GetFromWriter(ChunkTransferList* chunks,
                                          bool lock_required) {
   if (!writer_ || chunks->ReadDone()) return absl::OkStatus();
@@ -275,7 +523,8 @@ absl::Status DataProvider::GetFromWriter(ChunkTransferList* chunks,
       }
 
       // Read the requested data.
-      read_bytes = writer_->Get(chunk.id, chunk.data, chunk.offset, chunk.size);
+      read_bytes =
+          GetFromWriterAndCache(chunk.id, chunk.data, chunk.offset, chunk.size);
     }
 
     if (!read_bytes.ok()) {
@@ -287,6 +536,7 @@ absl::Status DataProvider::GetFromWriter(ChunkTransferList* chunks,
       LogWriterWarning(
           MakeStatus("Expected %u bytes, got %u", chunk.size, *read_bytes),
           chunk.id);
+      mem_cache_.Remove(chunk.id);
       // Remove the corrupted chunk from the cache, but only if the chunk was
       // write-locked by the caller.
       if (!lock_required) {
@@ -334,6 +584,8 @@ void DataProvider::CleanupThreadMain() {
       Stopwatch sw;
       absl::Status status = writer_->Cleanup();
       LOG_INFO("Finished cache cleanup in %0.3f seconds", sw.ElapsedSeconds());
+      LogMemCacheStatistics();
+      LogFetchStatistics();
       next_cleanup_time =
           steady_clock_->Now() + std::chrono::seconds(cleanup_timeout_sec_);
       absl::MutexLock cleaned_lock(&cleaned_mutex_);
@@ -18,16 +18,21 @@
 #define DATA_STORE_DATA_PROVIDER_H_
 
 #include <atomic>
+#include <memory>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/statusor.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "common/clock.h"
 #include "data_store/data_store_reader.h"
 #include "data_store/data_store_writer.h"
+#include "data_store/mem_chunk_cache.h"
+#include "manifest/content_id.h"
 #include "manifest/manifest_proto_defs.h"
 
 namespace cdc_ft {
@@ -41,11 +46,14 @@ class DataProvider : public DataStoreReader {
   // Default access-idling time in seconds.
   static constexpr int64_t kAccessIdleSec = 5;
 
+  // |mem_cache_capacity| is the size in bytes of the in-memory chunk cache
+  // that is consulted before |writer|. A capacity of 0 disables it.
   DataProvider(std::unique_ptr<DataStoreWriter> writer,
                std::vector<std::unique_ptr<DataStoreReader>> readers,
                size_t prefetch_size,
                uint32_t cleanup_timeout_sec = kCleanupTimeoutSec,
-               uint32_t access_idle_timeout_sec = kAccessIdleSec);
+               uint32_t access_idle_timeout_sec = kAccessIdleSec,
+               uint64_t mem_cache_capacity = 0);
   DataProvider() = delete;
   DataProvider(const DataProvider&) = delete;
   DataProvider& operator=(const DataProvider&) = delete;
@@ -54,6 +62,46 @@ class DataProvider : public DataStoreReader {
   // Shuts down the background cleanup thread.
   void Shutdown();
 
+  // Returns hit rate and memory usage of the in-memory chunk cache.
+  MemChunkCache::Statistics GetMemCacheStatistics() const;
+
+  // Logs the statistics of the in-memory chunk cache.
+  void LogMemCacheStatistics() const;
+
+  // Number of chunks requested by Get(ChunkTransferList*), by how they were
+  // served.
+  struct FetchStatistics {
+    // Served from the memory cache or the writer.
+    uint64_t hits = 0;
+    // Served by a fetch of another request that was in flight.
+    uint64_t coalesced = 0;
+    // Fetched from the readers.
+    uint64_t fetched = 0;
+  };
+
+  // Returns how chunks were served.
+  FetchStatistics GetFetchStatistics() const;
+
+  // Logs the statistics of chunk fetches.
+  void LogFetchStatistics() const;
+
+  // Stores the chunk |content_id| with |size| bytes of |data| that was
+  // received by other means than the readers, e.g. with a manifest update, in
+  // the memory cache and the writer.
+  absl::Status Put(const ContentIdProto& content_id, const void* data,
+                   size_t size) ABSL_LOCKS_EXCLUDED(*content_mutexes_);
+
+  // Classifies the chunks in |content_ids| as metadata chunks in the writer.
+  void AddMetadataChunks(std::vector<ContentIdProto> content_ids);
+
+  // Starts a new generation of metadata chunks in the writer.
+  void StartMetadataGeneration();
+
+  // Returns true if the chunk |content_id| can be read without the readers,
+  // i.e. if it is in the memory cache or the writer.
+  bool IsCached(const ContentIdProto& content_id)
+      ABSL_LOCKS_EXCLUDED(*content_mutexes_);
+
   // DataStoreReader:
   size_t PrefetchSize(size_t read_size) const override;
   absl::StatusOr<size_t> Get(const ContentIdProto& content_id, void* data,
@@ -63,6 +111,15 @@ class DataProvider : public DataStoreReader {
       ABSL_LOCKS_EXCLUDED(*content_mutexes_) override;
   absl::Status Get(const ContentIdProto& content_id, Buffer* data)
       ABSL_LOCKS_EXCLUDED(*content_mutexes_) override;
+  absl::StatusOr<std::string> GetChunkFilePath(
+      const ContentIdProto& content_id)
+      ABSL_LOCKS_EXCLUDED(*content_mutexes_) override;
+  // Chunks that are parsed as protos are manifests or indirect lists, so they
+  // are classified as metadata chunks in the writer.
+  using DataStoreReader::GetProto;
+  absl::Status GetProto(const ContentIdProto& content_id, Buffer* buf,
+                        google::protobuf::Message* proto)
+      ABSL_LOCKS_EXCLUDED(*content_mutexes_) override;
 
  private:
   friend class DataProviderTest;
@@ -92,12 +149,45 @@ class DataProvider : public DataStoreReader {
   void WriteLockAll(std::vector<const ContentIdProto*> chunk_ids,
                     WriterMutexLockList* locks);
 
+  // Reads data from |writer_|. If |mem_cache_| is enabled, reads the complete
+  // chunk and adds it to |mem_cache_|.
+  absl::StatusOr<size_t> GetFromWriterAndCache(const ContentIdProto& content_id,
+                                               void* data, size_t offset,
+                                               size_t size);
+
+  // Fulfills the chunk transfer tasks in |chunks| whose chunks are present in
+  // |mem_cache_| and marks them as `done`.
+  void GetFromMemCache(ChunkTransferList* chunks);
+
   // Tries to fulfill as many of the chunk transfer tasks in |chunks| as
   // possible. Tasks that are completed are marked as `done`. If |lock_required|
   // is true, a read lock is acquired for each chunk as its read. Otherwise the
   // caller is responsible for acquiring all required locks beforehand.
   absl::Status GetFromWriter(ChunkTransferList* chunks, bool lock_required);
 
+  // Fetches all tasks in |chunks| from |readers_| and caches the chunks. The
+  // chunks must be registered in |inflight_| by the caller.
+  absl::Status FetchFromReaders(ChunkTransferList* chunks)
+      ABSL_LOCKS_EXCLUDED(*content_mutexes_, inflight_mutex_);
+
+  // Hands the data of the fetched tasks in |chunks| and the |status| of the
+  // fetch to the threads waiting for them and removes the chunks from
+  // |inflight_|.
+  void PublishFetches(ChunkTransferList* chunks, const absl::Status& status)
+      ABSL_LOCKS_EXCLUDED(inflight_mutex_);
+
+  // Gets the complete chunk |content_id| from |readers_| into |data|. If
+  // another thread is fetching the chunk already, waits for that fetch
+  // instead.
+  absl::Status FetchChunk(const ContentIdProto& content_id, Buffer* data)
+      ABSL_LOCKS_EXCLUDED(*content_mutexes_, inflight_mutex_);
+
+  // Fetches the complete chunk |content_id| from |readers_| into |data| and
+  // caches it. The chunk must be registered in |inflight_| by the caller.
+  absl::Status FetchChunkFromReaders(const ContentIdProto& content_id,
+                                     Buffer* data)
+      ABSL_LOCKS_EXCLUDED(*content_mutexes_);
+
   // Collects locks for all mutexes.
   void LockAllMutexes(WriterMutexLockList* locks)
       ABSL_LOCKS_EXCLUDED(*content_mutexes_);
@@ -116,9 +206,35 @@ class DataProvider : public DataStoreReader {
   std::unique_ptr<DataStoreWriter> writer_;
   std::vector<std::unique_ptr<DataStoreReader>> readers_;
 
+  // Hot tier for complete chunks, consulted before |writer_|. Content ids are
+  // immutable, so the cache does not need the |content_mutexes_|.
+  MemChunkCache mem_cache_;
+
   // Array of mutexes to protect read/write operations.
   absl::Mutex content_mutexes_[kNumberOfMutexes];
 
+  // A chunk that is being fetched from |readers_| by one of the threads.
+  struct InflightChunk {
+    // Set when the fetch finished.
+    bool done = false;
+    // Status of the fetch. Immutable once |done| is set.
+    absl::Status status;
+    // Complete chunk data if the fetch succeeded. Immutable once |done| is set.
+    std::string data;
+  };
+
+  // Chunks that are being fetched from |readers_|, keyed by content id.
+  // Concurrent requests for the same chunk wait for the fetch that is in flight
+  // instead of fetching the chunk again.
+  absl::Mutex inflight_mutex_;
+  absl::flat_hash_map<ContentId, std::shared_ptr<InflightChunk>> inflight_
+      ABSL_GUARDED_BY(inflight_mutex_);
+
+  // Counters for FetchStatistics.
+  std::atomic<uint64_t> hit_chunks_{0};
+  std::atomic<uint64_t> coalesced_chunks_{0};
+  std::atomic<uint64_t> fetched_chunks_{0};
+
   // Runs periodical cleanup of the data writer.
   std::unique_ptr<std::thread> async_cleaner_;
 
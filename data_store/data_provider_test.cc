@@ -17,7 +17,10 @@
 #include <numeric>
 #include <thread>
 
+#include "absl/strings/match.h"
+#include "absl/synchronization/mutex.h"
 #include "common/path.h"
+#include "common/status_macros.h"
 #include "common/status_test_macros.h"
 #include "common/testing_clock.h"
 #include "data_store/disk_data_store.h"
@@ -135,6 +138,45 @@ class DataProviderTest : public ::testing::Test {
 
 namespace {
 
+// MemDataStore that counts fetches and blocks them until Release() is called.
+// Fetches fail with |status| if it is not OK.
+class BlockingMemDataStore : public MemDataStore {
+ public:
+  absl::Status Get(ChunkTransferList* chunks) override {
+    RETURN_IF_ERROR(Block());
+    return MemDataStore::Get(chunks);
+  }
+
+  absl::Status Get(const ContentIdProto& content_id, Buffer* data) override {
+    RETURN_IF_ERROR(Block());
+    return MemDataStore::Get(content_id, data);
+  }
+
+  void Release(absl::Status status = absl::OkStatus()) {
+    absl::MutexLock lock(&mutex_);
+    released_ = true;
+    status_ = std::move(status);
+  }
+
+  int GetCount() {
+    absl::MutexLock lock(&mutex_);
+    return get_count_;
+  }
+
+ private:
+  absl::Status Block() {
+    absl::MutexLock lock(&mutex_);
+    ++get_count_;
+    mutex_.Await(absl::Condition(&released_));
+    return status_;
+  }
+
+  absl::Mutex mutex_;
+  bool released_ ABSL_GUARDED_BY(mutex_) = false;
+  absl::Status status_ ABSL_GUARDED_BY(mutex_);
+  int get_count_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
 // TODO: Add test with several readers and a writer, which has no data at the
 // beginning. Request the chunk several times (the first time it should be
 // received from reader, the second time - from the writer).
@@ -337,6 +379,259 @@ TEST_F(DataProviderTest, RecoverFromTruncatedChunkInCache) {
   EXPECT_EQ(size, 3);
 }
 
+TEST_F(DataProviderTest, MemoryTierServesChunksFromReader) {
+  auto readers = CreateMemCache({"aaa", "bbb"});
+  auto disk_cache = CreateDiskCache({});
+  DiskDataStore* disk_cache_ptr = disk_cache.get();
+  DataProvider data_provider(std::move(disk_cache), std::move(readers), 0,
+                             DataProvider::kCleanupTimeoutSec,
+                             DataProvider::kAccessIdleSec,
+                             /*mem_cache_capacity=*/1024);
+  char buf[6];
+  ChunkTransferList chunks;
+  chunks.emplace_back(Id("aaa"), 0, buf, 3);
+  chunks.emplace_back(Id("bbb"), 0, buf + 3, 3);
+  EXPECT_OK(data_provider.Get(&chunks));
+  EXPECT_TRUE(chunks.ReadDone());
+  EXPECT_EQ(absl::string_view(buf, 6), "aaabbb");
+
+  // Remove the chunks from disk. They should still be served from memory.
+  EXPECT_OK(disk_cache_ptr->Wipe());
+  memset(buf, 0, sizeof(buf));
+  absl::StatusOr<size_t> bytes_read = data_provider.Get(Id("bbb"), buf, 1, 5);
+  ASSERT_OK(bytes_read);
+  EXPECT_EQ(*bytes_read, 2);
+  EXPECT_EQ(absl::string_view(buf, 2), "bb");
+
+  Buffer buffer;
+  EXPECT_OK(data_provider.Get(Id("aaa"), &buffer));
+  EXPECT_EQ(absl::string_view(buffer.data(), buffer.size()), "aaa");
+
+  MemChunkCache::Statistics stats = data_provider.GetMemCacheStatistics();
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.number_of_chunks, 2);
+  EXPECT_EQ(stats.size, 6);
+}
+
+TEST_F(DataProviderTest, MemoryTierPromotesChunksFromWriter) {
+  auto disk_cache = CreateDiskCache({"aaa"});
+  DiskDataStore* disk_cache_ptr = disk_cache.get();
+  DataProvider data_provider(std::move(disk_cache), {}, 0,
+                             DataProvider::kCleanupTimeoutSec,
+                             DataProvider::kAccessIdleSec,
+                             /*mem_cache_capacity=*/1024);
+  char buf[3];
+  absl::StatusOr<size_t> bytes_read = data_provider.Get(Id("aaa"), buf, 1, 2);
+  ASSERT_OK(bytes_read);
+  EXPECT_EQ(absl::string_view(buf, *bytes_read), "aa");
+
+  // The whole chunk was read into memory.
+  EXPECT_OK(disk_cache_ptr->Wipe());
+  ChunkTransferList chunks;
+  chunks.emplace_back(Id("aaa"), 0, buf, 3);
+  EXPECT_OK(data_provider.Get(&chunks));
+  EXPECT_TRUE(chunks.ReadDone());
+  EXPECT_EQ(absl::string_view(buf, 3), "aaa");
+}
+
+TEST_F(DataProviderTest, PutStoresChunkInWriterAndMemCache) {
+  auto disk_cache = CreateDiskCache({});
+  DiskDataStore* disk_cache_ptr = disk_cache.get();
+  DataProvider data_provider(std::move(disk_cache), {}, 0,
+                             DataProvider::kCleanupTimeoutSec,
+                             DataProvider::kAccessIdleSec,
+                             /*mem_cache_capacity=*/1024);
+  EXPECT_OK(data_provider.Put(Id("aaa"), "aaa", 3));
+
+  // The chunk is served without any reader.
+  Buffer buffer;
+  EXPECT_OK(data_provider.Get(Id("aaa"), &buffer));
+  EXPECT_EQ(absl::string_view(buffer.data(), buffer.size()), "aaa");
+  EXPECT_EQ(data_provider.GetMemCacheStatistics().number_of_chunks, 1);
+
+  // The chunk was persisted in the writer as well.
+  buffer.clear();
+  EXPECT_OK(disk_cache_ptr->Get(Id("aaa"), &buffer));
+  EXPECT_EQ(absl::string_view(buffer.data(), buffer.size()), "aaa");
+}
+
+TEST_F(DataProviderTest, GetChunkFilePathSkipsChunksInMemCache) {
+  DataProvider data_provider(CreateDiskCache({"aaa", "bbb"}), {}, 0,
+                             DataProvider::kCleanupTimeoutSec,
+                             DataProvider::kAccessIdleSec,
+                             /*mem_cache_capacity=*/1024);
+  EXPECT_OK(data_provider.GetChunkFilePath(Id("aaa")));
+
+  // Chunks in memory are served faster by Get().
+  Buffer buffer;
+  EXPECT_OK(data_provider.Get(Id("aaa"), &buffer));
+  EXPECT_TRUE(
+      absl::IsNotFound(data_provider.GetChunkFilePath(Id("aaa")).status()));
+  EXPECT_OK(data_provider.GetChunkFilePath(Id("bbb")));
+}
+
+TEST_F(DataProviderTest, ConcurrentGetsCoalesceFetches) {
+  auto reader = std::make_unique<BlockingMemDataStore>();
+  BlockingMemDataStore* reader_ptr = reader.get();
+  reader->AddData({'a', 'a', 'a'});
+  std::vector<std::unique_ptr<DataStoreReader>> readers;
+  readers.emplace_back(std::move(reader));
+  DataProvider data_provider(CreateDiskCache({}), std::move(readers), 0,
+                             DataProvider::kCleanupTimeoutSec,
+                             DataProvider::kAccessIdleSec,
+                             /*mem_cache_capacity=*/1024);
+
+  char bufs[2][3];
+  std::vector<std::thread> threads;
+  for (int n = 0; n < 2; ++n) {
+    threads.emplace_back([&data_provider, &bufs, n, this]() {
+      ChunkTransferList chunks;
+      chunks.emplace_back(Id("aaa"), n, bufs[n], 3 - n);
+      EXPECT_OK(data_provider.Get(&chunks));
+      EXPECT_TRUE(chunks.ReadDone());
+    });
+  }
+
+  // Wait until one thread fetches the chunk and the other one waits for it.
+  while (reader_ptr->GetCount() == 0 ||
+         data_provider.GetFetchStatistics().coalesced == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  reader_ptr->Release();
+  for (std::thread& thread : threads) thread.join();
+  EXPECT_EQ(absl::string_view(bufs[0], 3), "aaa");
+  EXPECT_EQ(absl::string_view(bufs[1], 2), "aa");
+  EXPECT_EQ(reader_ptr->GetCount(), 1);
+
+  // The chunk is cached now.
+  char buf[3];
+  ChunkTransferList chunks;
+  chunks.emplace_back(Id("aaa"), 0, buf, 3);
+  EXPECT_OK(data_provider.Get(&chunks));
+  EXPECT_EQ(reader_ptr->GetCount(), 1);
+
+  DataProvider::FetchStatistics stats = data_provider.GetFetchStatistics();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.coalesced, 1);
+  EXPECT_EQ(stats.fetched, 1);
+}
+
+TEST_F(DataProviderTest, ConcurrentSingleChunkGetsCoalesceFetches) {
+  auto reader = std::make_unique<BlockingMemDataStore>();
+  BlockingMemDataStore* reader_ptr = reader.get();
+  reader->AddData({'a', 'a', 'a'});
+  std::vector<std::unique_ptr<DataStoreReader>> readers;
+  readers.emplace_back(std::move(reader));
+  DataProvider data_provider(CreateDiskCache({}), std::move(readers), 0);
+
+  char buf[2];
+  Buffer buffer;
+  std::thread range_thread([&data_provider, &buf, this]() {
+    absl::StatusOr<size_t> bytes_read =
+        data_provider.Get(Id("aaa"), buf, 1, 2);
+    ASSERT_OK(bytes_read);
+    EXPECT_EQ(*bytes_read, 2);
+  });
+  std::thread buffer_thread([&data_provider, &buffer, this]() {
+    EXPECT_OK(data_provider.Get(Id("aaa"), &buffer));
+  });
+
+  // Wait until one thread fetches the chunk and the other one waits for it.
+  while (reader_ptr->GetCount() == 0 ||
+         data_provider.GetFetchStatistics().coalesced == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  reader_ptr->Release();
+  range_thread.join();
+  buffer_thread.join();
+  EXPECT_EQ(absl::string_view(buf, 2), "aa");
+  EXPECT_EQ(absl::string_view(buffer.data(), buffer.size()), "aaa");
+  EXPECT_EQ(reader_ptr->GetCount(), 1);
+  EXPECT_EQ(data_provider.GetFetchStatistics().fetched, 1);
+}
+
+TEST_F(DataProviderTest, CoalescedGetsReturnFetchError) {
+  auto reader = std::make_unique<BlockingMemDataStore>();
+  BlockingMemDataStore* reader_ptr = reader.get();
+  reader->AddData({'a', 'a', 'a'});
+  std::vector<std::unique_ptr<DataStoreReader>> readers;
+  readers.emplace_back(std::move(reader));
+  DataProvider data_provider(CreateDiskCache({}), std::move(readers), 0);
+
+  // Two threads request the chunk in a batch and one with a single-chunk Get.
+  // Whoever fetches the chunk first fails, and all of them get that error.
+  char bufs[2][3];
+  std::vector<std::thread> threads;
+  for (int n = 0; n < 2; ++n) {
+    threads.emplace_back([&data_provider, &bufs, n, this]() {
+      ChunkTransferList chunks;
+      chunks.emplace_back(Id("aaa"), 0, bufs[n], 3);
+      absl::Status status = data_provider.Get(&chunks);
+      EXPECT_TRUE(absl::IsUnavailable(status)) << status;
+      EXPECT_TRUE(absl::StrContains(status.message(), "Connection lost"));
+    });
+  }
+  threads.emplace_back([&data_provider, this]() {
+    Buffer buffer;
+    absl::Status status = data_provider.Get(Id("aaa"), &buffer);
+    EXPECT_TRUE(absl::IsUnavailable(status)) << status;
+    EXPECT_TRUE(absl::StrContains(status.message(), "Connection lost"));
+  });
+
+  // Wait until one thread fetches the chunk and the others wait for it.
+  while (reader_ptr->GetCount() == 0 ||
+         data_provider.GetFetchStatistics().coalesced < 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  reader_ptr->Release(absl::UnavailableError("Connection lost"));
+  for (std::thread& thread : threads) thread.join();
+  EXPECT_EQ(reader_ptr->GetCount(), 1);
+}
+
+TEST_F(DataProviderTest, GetProtoClassifiesMetadata) {
+  auto cache = CreateDiskCache({});
+  DiskDataStore* cache_ptr = cache.get();
+  auto reader = std::make_unique<MemDataStore>();
+  ContentIdProto data_id = reader->AddData({'a', 'a', 'a'});
+  ContentIdProto proto_id = reader->AddProto(data_id);
+  std::vector<std::unique_ptr<DataStoreReader>> readers;
+  readers.emplace_back(std::move(reader));
+  DataProvider data_provider(std::move(cache), std::move(readers), 0);
+
+  Buffer buffer;
+  EXPECT_OK(data_provider.Get(data_id, &buffer));
+  ContentIdProto proto;
+  EXPECT_OK(data_provider.GetProto(proto_id, &proto));
+  EXPECT_EQ(proto, data_id);
+  EXPECT_EQ(cache_ptr->GetChunkClass(data_id),
+            DiskDataStore::ChunkClass::kData);
+  EXPECT_EQ(cache_ptr->GetChunkClass(proto_id),
+            DiskDataStore::ChunkClass::kMetadata);
+}
+
+TEST_F(DataProviderTest, MetadataGenerationsPassThroughToWriter) {
+  auto cache = CreateDiskCache({});
+  DiskDataStore* cache_ptr = cache.get();
+  auto reader = std::make_unique<MemDataStore>();
+  ContentIdProto id = reader->AddData({'a', 'a', 'a'});
+  std::vector<std::unique_ptr<DataStoreReader>> readers;
+  readers.emplace_back(std::move(reader));
+  DataProvider data_provider(std::move(cache), std::move(readers), 0);
+  constexpr int kGenerationMs =
+      DiskDataStore::kMinMetadataGenerationSec * 1000;
+
+  data_provider.AddMetadataChunks({id});
+  EXPECT_EQ(cache_ptr->GetChunkClass(id),
+            DiskDataStore::ChunkClass::kMetadata);
+
+  // The previous generation is kept, so it takes two to drop the chunk.
+  clock_.Advance(kGenerationMs);
+  data_provider.StartMetadataGeneration();
+  clock_.Advance(kGenerationMs);
+  data_provider.StartMetadataGeneration();
+  EXPECT_EQ(cache_ptr->GetChunkClass(id), DiskDataStore::ChunkClass::kData);
+}
+
 TEST_F(DataProviderTest, CleanupNotAllChunksRead) {
   auto cache = CreateDiskCache({"aaa", "bbb", "ccc"});
   cache->SetCapacity(5);
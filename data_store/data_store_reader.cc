@@ -54,6 +54,12 @@ size_t DataStoreReader::PrefetchSize(size_t read_size) const {
   return read_size;
 }
 
+absl::StatusOr<std::string> DataStoreReader::GetChunkFilePath(
+    const ContentIdProto& content_id) {
+  return absl::NotFoundError(absl::StrFormat(
+      "No chunk file for '%s'", ContentId::ToHexString(content_id)));
+}
+
 absl::Status DataStoreReader::Get(ChunkTransferList* chunks) {
   absl::StatusOr<uint64_t> bytes_read;
   for (ChunkTransferTask& chunk : *chunks) {
@@ -112,6 +112,16 @@ class DataStoreReader {
   // If the chunk is not found in the data store, returns NotFoundError.
   virtual absl::Status Get(const ContentIdProto& content_id, Buffer* data) = 0;
 
+  // Returns the path of a local file that holds exactly the uncompressed data
+  // of the chunk specified by |content_id|, so that callers can hand the file
+  // to the kernel instead of copying the data through user space. The file
+  // might get removed at any time, so callers must be able to fall back to
+  // Get(). If there is no such file or if Get() serves the chunk faster, e.g.
+  // from memory, returns NotFoundError, which is what the default
+  // implementation does.
+  virtual absl::StatusOr<std::string> GetChunkFilePath(
+      const ContentIdProto& content_id);
+
   // Reads the complete chunk identified by |content_id| and parses it as the
   // given protocol buffer.
   absl::Status GetProto(const ContentIdProto& content_id,
@@ -120,8 +130,8 @@ class DataStoreReader {
   // Reads the complete chunk identified by |content_id| and parses it as the
   // given protocol buffer. Uses the given Buffer |buf| as intermediate
   // storage.
-  absl::Status GetProto(const ContentIdProto& content_id, Buffer* buf,
-                        google::protobuf::Message* proto);
+  virtual absl::Status GetProto(const ContentIdProto& content_id, Buffer* buf,
+                                google::protobuf::Message* proto);
 };  // class DataStoreReader
 
 }  // namespace cdc_ft
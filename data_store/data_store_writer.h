@@ -18,6 +18,7 @@
 #define DATA_STORE_DATA_STORE_WRITER_H_
 
 #include <unordered_set>
+#include <vector>
 
 #include "absl/status/statusor.h"
 #include "common/buffer.h"
@@ -68,6 +69,16 @@ class DataStoreWriter : public DataStoreReader {
   // Removes the data if the data store size exceeds its capacity.
   virtual absl::Status Cleanup() { return absl::OkStatus(); }
 
+  // Classifies the chunks in |content_ids| as metadata chunks, i.e. manifests
+  // and indirect lists, which the store might keep longer than other chunks.
+  // The default implementation does nothing.
+  virtual void AddMetadataChunks(std::vector<ContentIdProto> content_ids) {}
+
+  // Starts a new generation of metadata chunks, e.g. for a new manifest, so
+  // that the store may stop treating the metadata of old manifests as such.
+  // The default implementation does nothing.
+  virtual void StartMetadataGeneration() {}
+
   // Allows to interrupt methods by setting |interrupt_|.
   void RegisterInterrupt(std::atomic<bool>* interrupt) {
     interrupt_ = interrupt;
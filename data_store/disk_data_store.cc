@@ -14,17 +14,24 @@
 
 #include "data_store/disk_data_store.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <memory>
 
+#include "absl/strings/match.h"
 #include "common/log.h"
 #include "common/path.h"
 #include "common/status.h"
 #include "common/status_macros.h"
+#include "data_store/chunk_compression.h"
 
 namespace cdc_ft {
 namespace {
 
+// File name suffix for compressed chunks.
+constexpr char kCompressedSuffix[] = ".zst";
+constexpr size_t kCompressedSuffixLength = sizeof(kCompressedSuffix) - 1;
+
 static constexpr char kDirNames[16] = {'0', '1', '2', '3', '4', '5', '6', '7',
                                        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
 
@@ -76,7 +83,8 @@ DiskDataStore::DiskDataStore(unsigned int depth, std::string cache_root_dir,
     : depth_(depth),
       root_dir_(std::move(cache_root_dir)),
       create_dirs_(create_dirs),
-      clock_(clock) {
+      clock_(clock),
+      metadata_generation_start_(clock->Now()) {
   assert(!root_dir_.empty());
   path::EnsureEndsWithPathSeparator(&root_dir_);
 }
@@ -103,6 +111,14 @@ absl::Status DiskDataStore::Put(const ContentIdProto& content_id,
   if (!create_dirs_) {
     RETURN_IF_ERROR(path::CreateDirRec(path::DirName(path)));
   }
+  std::string compressed;
+  if (compression_level_ > 0 &&
+      chunk_compression::Compress(data, size, compression_level_,
+                                  &compressed)) {
+    path = GetCompressedCacheFilePath(content_id);
+    data = compressed.data();
+    size = compressed.size();
+  }
   RETURN_IF_ERROR(path::WriteFile(path, data, size));
   UpdateModificationTime(path);
   size_.fetch_add(size, std::memory_order_relaxed);
@@ -115,12 +131,26 @@ absl::StatusOr<size_t> DiskDataStore::Get(const ContentIdProto& content_id,
   if (!size) return 0;
   assert(data);
   std::string path = GetCacheFilePath(content_id);
-  size_t read_size;
-  ASSIGN_OR_RETURN(read_size, path::ReadFile(path, data, offset, size),
-                   "Failed to read chunk %s of size %d at offset %d",
-                   ContentId::ToHexString(content_id), size, offset);
+  absl::StatusOr<size_t> read_size = path::ReadFile(path, data, offset, size);
+  if (absl::IsNotFound(read_size.status())) {
+    // The chunk might be stored compressed.
+    Buffer buffer;
+    absl::Status status = GetCompressed(content_id, &buffer);
+    if (!absl::IsNotFound(status)) {
+      RETURN_IF_ERROR(status);
+      if (buffer.size() <= offset) return 0;
+      size_t copy_size = std::min(buffer.size() - offset, size);
+      memcpy(data, buffer.data() + offset, copy_size);
+      return copy_size;
+    }
+  }
+  if (!read_size.ok()) {
+    return WrapStatus(read_size.status(),
+                      "Failed to read chunk %s of size %d at offset %d",
+                      ContentId::ToHexString(content_id), size, offset);
+  }
   UpdateModificationTime(path);
-  return read_size;
+  return *read_size;
 }
 
 absl::Status DiskDataStore::Get(const ContentIdProto& content_id,
@@ -130,8 +160,13 @@ absl::Status DiskDataStore::Get(const ContentIdProto& content_id,
   size_t read_size = 0;
   size_t file_size = 0;
 
-  RETURN_IF_ERROR(path::FileSize(path, &file_size),
-                  "Failed to stat file size for '%s'", path);
+  absl::Status status = path::FileSize(path, &file_size);
+  if (absl::IsNotFound(status)) {
+    // The chunk might be stored compressed.
+    status = GetCompressed(content_id, data);
+    if (!absl::IsNotFound(status)) return status;
+  }
+  RETURN_IF_ERROR(status, "Failed to stat file size for '%s'", path);
   data->resize(file_size);
   ASSIGN_OR_RETURN(read_size, path::ReadFile(path, data->data(), 0, file_size),
                    "Failed to read %s of size %d",
@@ -145,6 +180,42 @@ absl::Status DiskDataStore::Get(const ContentIdProto& content_id,
   return absl::OkStatus();
 }
 
+absl::StatusOr<std::string> DiskDataStore::GetChunkFilePath(
+    const ContentIdProto& content_id) {
+  // Compressed chunks have to be decompressed by Get().
+  std::string path = GetCacheFilePath(content_id);
+  if (!path::FileExists(path)) {
+    return absl::NotFoundError(absl::StrFormat(
+        "No uncompressed file for chunk %s",
+        ContentId::ToHexString(content_id)));
+  }
+  UpdateModificationTime(path);
+  return path;
+}
+
+absl::Status DiskDataStore::GetCompressed(const ContentIdProto& content_id,
+                                          Buffer* data) {
+  std::string path = GetCompressedCacheFilePath(content_id);
+  size_t file_size = 0;
+  RETURN_IF_ERROR(path::FileSize(path, &file_size));
+  Buffer compressed(file_size);
+  size_t read_size = 0;
+  ASSIGN_OR_RETURN(read_size,
+                   path::ReadFile(path, compressed.data(), 0, file_size),
+                   "Failed to read compressed chunk %s of size %d",
+                   ContentId::ToHexString(content_id), file_size);
+  if (read_size != file_size) {
+    return absl::DataLossError(
+        absl::StrFormat("Only %u bytes out of %u are read for %s", read_size,
+                        file_size, ContentId::ToHexString(content_id)));
+  }
+  RETURN_IF_ERROR(
+      chunk_compression::Decompress(compressed.data(), read_size, data),
+      "Failed to decompress chunk %s", ContentId::ToHexString(content_id));
+  UpdateModificationTime(path);
+  return absl::OkStatus();
+}
+
 int64_t DiskDataStore::Capacity() const { return capacity_; }
 
 double DiskDataStore::FillFactor() const { return fill_factor_; }
@@ -157,6 +228,46 @@ const std::string& DiskDataStore::RootDir() const { return root_dir_; }
 
 void DiskDataStore::SetCapacity(int64_t capacity) { capacity_ = capacity; }
 
+void DiskDataStore::SetCompressionLevel(int level) {
+  compression_level_ = level;
+}
+
+int DiskDataStore::CompressionLevel() const { return compression_level_; }
+
+int64_t DiskDataStore::MetadataCapacity() const { return metadata_capacity_; }
+
+void DiskDataStore::SetMetadataCapacity(int64_t capacity) {
+  metadata_capacity_ = capacity;
+}
+
+void DiskDataStore::AddMetadataChunks(std::vector<ContentIdProto> content_ids) {
+  absl::MutexLock lock(&metadata_mutex_);
+  for (ContentIdProto& id : content_ids) metadata_.insert(std::move(id));
+}
+
+void DiskDataStore::StartMetadataGeneration() {
+  absl::MutexLock lock(&metadata_mutex_);
+  SystemClock::Timestamp now = clock_->Now();
+  if (now - metadata_generation_start_ <
+      std::chrono::seconds(kMinMetadataGenerationSec)) {
+    return;
+  }
+  metadata_generation_start_ = now;
+  prev_metadata_ = std::move(metadata_);
+  metadata_.clear();
+}
+
+DiskDataStore::ChunkClass DiskDataStore::GetChunkClass(
+    const ContentIdProto& content_id) const {
+  absl::MutexLock lock(&metadata_mutex_);
+  return IsMetadata(content_id) ? ChunkClass::kMetadata : ChunkClass::kData;
+}
+
+bool DiskDataStore::IsMetadata(const ContentIdProto& content_id) const {
+  return metadata_.find(content_id) != metadata_.end() ||
+         prev_metadata_.find(content_id) != prev_metadata_.end();
+}
+
 absl::Status DiskDataStore::SetFillFactor(double fill_factor) {
   if (fill_factor <= 0 || fill_factor > 1) {
     return absl::FailedPreconditionError(
@@ -208,12 +319,13 @@ absl::Status DiskDataStore::Prune(
 }
 
 absl::Status DiskDataStore::Remove(const ContentIdProto& content_id) {
-  std::string path = GetCacheFilePath(content_id);
-  return path::RemoveFile(path);
+  RETURN_IF_ERROR(path::RemoveFile(GetCacheFilePath(content_id)));
+  return path::RemoveFile(GetCompressedCacheFilePath(content_id));
 }
 
 bool DiskDataStore::Contains(const ContentIdProto& content_id) {
-  return path::Exists(GetCacheFilePath(content_id));
+  return path::Exists(GetCacheFilePath(content_id)) ||
+         path::Exists(GetCompressedCacheFilePath(content_id));
 }
 
 absl::Status DiskDataStore::Cleanup() {
@@ -236,18 +348,53 @@ absl::Status DiskDataStore::Cleanup() {
               if (file1.mtime == file2.mtime) return file1.path < file2.path;
               return file1.mtime < file2.mtime;
             });
-  size_t file_index = 0;
+
+  // Classify the files. Files that don't match the chunk naming scheme are
+  // treated as data.
   const size_t num_of_files = files.size();
-  while (size_ > size_threshold && file_index < num_of_files) {
-    std::string path = path::Join(root_dir_, files[file_index].path);
-    RETURN_IF_ERROR(path::RemoveFile(path));
-    size_.fetch_sub(files[file_index].size, std::memory_order_relaxed);
-    ++file_index;
+  std::vector<bool> is_metadata(num_of_files, false);
+  size_t metadata_size = 0;
+  {
+    absl::MutexLock lock(&metadata_mutex_);
+    bool has_metadata = !metadata_.empty() || !prev_metadata_.empty();
+    for (size_t n = 0; n < num_of_files && has_metadata; ++n) {
+      ContentIdProto id;
+      if (ParseCacheFilePath(files[n].path, &id) && IsMetadata(id)) {
+        is_metadata[n] = true;
+        metadata_size += files[n].size;
+      }
+    }
+  }
+
+  std::vector<bool> removed(num_of_files, false);
+  auto remove_file = [&](size_t n) -> absl::Status {
+    RETURN_IF_ERROR(path::RemoveFile(path::Join(root_dir_, files[n].path)));
+    size_.fetch_sub(files[n].size, std::memory_order_relaxed);
+    if (is_metadata[n]) metadata_size -= files[n].size;
+    removed[n] = true;
     if (interrupt_ && *interrupt_) {
       return absl::CancelledError("Cache cleanup has been cancelled");
     }
+    return absl::OkStatus();
+  };
+
+  // Remove metadata beyond its own budget, then data, and the remaining
+  // metadata only if removing data was not enough.
+  size_t metadata_threshold =
+      static_cast<size_t>(std::max<int64_t>(metadata_capacity_, 0)) *
+      fill_factor_;
+  for (size_t n = 0; n < num_of_files && metadata_size > metadata_threshold;
+       ++n) {
+    if (is_metadata[n]) RETURN_IF_ERROR(remove_file(n));
+  }
+  for (size_t n = 0; n < num_of_files && size_ > size_threshold; ++n) {
+    if (!is_metadata[n]) RETURN_IF_ERROR(remove_file(n));
+  }
+  for (size_t n = 0; n < num_of_files && size_ > size_threshold; ++n) {
+    if (is_metadata[n] && !removed[n]) RETURN_IF_ERROR(remove_file(n));
   }
-  LOG_DEBUG("Cache size after the cleanup: %u bytes", size_.load());
+  LOG_DEBUG("Cache size after the cleanup: %u bytes, %u bytes of metadata",
+            size_.load(), metadata_size);
   return absl::OkStatus();
 }
 
@@ -270,16 +417,30 @@ absl::StatusOr<std::vector<ContentIdProto>> DiskDataStore::List() {
 absl::StatusOr<DiskDataStore::Statistics> DiskDataStore::CalculateStatistics()
     const {
   Statistics statistics;
+  std::vector<std::pair<ContentIdProto, uint64_t>> chunks;
   auto handler = [&](const std::string& dir, const std::string& filename,
                      int64_t /*modified_time*/, uint64_t size,
                      bool is_directory) -> absl::Status {
     if (!is_directory) {
       statistics.size += size;
       ++statistics.number_of_chunks;
+      ContentIdProto id;
+      if (ParseCacheFilePath(path::Join(dir.substr(root_dir_.size()), filename),
+                             &id)) {
+        chunks.emplace_back(std::move(id), size);
+      }
     }
     return absl::OkStatus();
   };
   RETURN_IF_ERROR(path::SearchFiles(root_dir_, true, handler));
+
+  absl::MutexLock lock(&metadata_mutex_);
+  for (const auto& [id, size] : chunks) {
+    if (IsMetadata(id)) {
+      statistics.metadata_size += size;
+      ++statistics.number_of_metadata_chunks;
+    }
+  }
   return statistics;
 }
 
@@ -319,8 +480,16 @@ std::string DiskDataStore::GetCacheFilePath(
   return path::Join(root_dir_, file_name);
 }
 
+std::string DiskDataStore::GetCompressedCacheFilePath(
+    const ContentIdProto& content_id) const {
+  return GetCacheFilePath(content_id) + kCompressedSuffix;
+}
+
 bool DiskDataStore::ParseCacheFilePath(std::string path,
                                        ContentIdProto* content_id) const {
+  if (absl::EndsWith(path, kCompressedSuffix)) {
+    path.resize(path.size() - kCompressedSuffixLength);
+  }
   // Remove path separators.
   if (depth_ > 0) {
     path.erase(std::remove_if(path.begin(), path.end(),
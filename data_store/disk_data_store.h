@@ -18,9 +18,13 @@
 #define DATA_STORE_DISK_DATA_STORE_H_
 
 #include <atomic>
+#include <unordered_set>
+#include <vector>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
 #include "common/buffer.h"
 #include "common/clock.h"
 #include "common/platform.h"
@@ -31,15 +35,29 @@ namespace cdc_ft {
 
 // File-based LRU cache to store data chunks on disk. The LRU strategy is based
 // on each file's mtime, which gets updated on each access.
-// Not thread-safe.
+// If compression is enabled, compressible chunks are stored as zstd frames in
+// files with a ".zst" suffix. Chunks of both kinds can be read regardless of
+// the current setting.
+// Chunks are either metadata chunks, i.e. manifests and indirect asset and
+// chunk lists that every lookup depends on, or data chunks with file contents.
+// Metadata chunks have a separate budget. Within it, they are only evicted if
+// the cache still exceeds its capacity after all data chunks were evicted.
+// Not thread-safe, except for AddMetadataChunks(), StartMetadataGeneration()
+// and GetChunkClass().
 class DiskDataStore : public DataStoreWriter {
  public:
   struct Statistics {
     size_t size = 0;
     size_t number_of_chunks = 0;
+    // Part of the above that belongs to metadata chunks.
+    size_t metadata_size = 0;
+    size_t number_of_metadata_chunks = 0;
   };
 
+  enum class ChunkClass { kData, kMetadata };
+
   static constexpr uint64_t kDefaultCapacity{150ull << 30};  // 150 GiB
+  static constexpr uint64_t kDefaultMetadataCapacity{4ull << 30};  // 4 GiB
 
   // Creates and returns a DiskDataStore that generates the cache directory
   // hierarchy in |cache_root_dir| of |depth| at startup if |create_dirs| is
@@ -59,6 +77,8 @@ class DiskDataStore : public DataStoreWriter {
   absl::StatusOr<size_t> Get(const ContentIdProto& content_id, void* data,
                              size_t offset, size_t size) override;
   absl::Status Get(const ContentIdProto& content_id, Buffer* data) override;
+  absl::StatusOr<std::string> GetChunkFilePath(
+      const ContentIdProto& content_id) override;
 
   // DataStoreWriter:
   absl::Status Put(const ContentIdProto& content_id, const void* data,
@@ -69,7 +89,9 @@ class DiskDataStore : public DataStoreWriter {
   bool Contains(const ContentIdProto& content_id) override;
   // Removes chunks in the LRU order if the cache size exceeds its capacity.
   // Cleans the cache up until its size drops below the cache capacity
-  // limited by the fill factor (capacity * fill factor).
+  // limited by the fill factor (capacity * fill factor). Metadata chunks are
+  // only removed if they exceed the metadata capacity, or if removing all data
+  // chunks is not enough.
   absl::Status Cleanup() override;
 
   // Returns a list of all contained content ids independent of |interrupt_|.
@@ -98,6 +120,39 @@ class DiskDataStore : public DataStoreWriter {
   // No cleanup is performed.
   void SetCapacity(int64_t capacity);
 
+  // Sets the zstd compression level for chunks written by Put(). A level of 0
+  // disables compression.
+  void SetCompressionLevel(int level);
+
+  // Returns the zstd compression level for new chunks, or 0 if disabled.
+  int CompressionLevel() const;
+
+  // Returns the part of the capacity in bytes that metadata chunks may occupy.
+  int64_t MetadataCapacity() const;
+
+  // Sets the part of the capacity in bytes that metadata chunks may occupy.
+  // Within this budget, metadata chunks are evicted after data chunks. Beyond
+  // it, they are evicted in LRU order first. No cleanup is performed.
+  void SetMetadataCapacity(int64_t capacity);
+
+  // Classifies the chunks in |content_ids| as metadata chunks of the current
+  // generation. All other chunks are data chunks. The classification is kept
+  // in memory only.
+  void AddMetadataChunks(std::vector<ContentIdProto> content_ids)
+      ABSL_LOCKS_EXCLUDED(metadata_mutex_) override;
+
+  // Starts a new generation of metadata chunks, e.g. for a new manifest.
+  // Chunks that were not classified as metadata in the current or in the
+  // previous generation become data chunks again, so that the metadata of old
+  // manifests does not occupy the budget. Does nothing if the current
+  // generation started less than kMinMetadataGenerationSec ago, so that the
+  // intermediate manifests of an update share a generation.
+  void StartMetadataGeneration() ABSL_LOCKS_EXCLUDED(metadata_mutex_) override;
+
+  // Returns the class of the chunk |content_id|.
+  ChunkClass GetChunkClass(const ContentIdProto& content_id) const
+      ABSL_LOCKS_EXCLUDED(metadata_mutex_);
+
   // Sets the cache fill factor.
   // |factor| should be a positive number (0,1].
   absl::Status SetFillFactor(double factor);
@@ -106,11 +161,15 @@ class DiskDataStore : public DataStoreWriter {
   // for storing chunks measured in bytes and the number of chunks.
   // Returns an error, if the size could not be calculated.
   // This is an expensive operation.
-  absl::StatusOr<Statistics> CalculateStatistics() const;
+  absl::StatusOr<Statistics> CalculateStatistics() const
+      ABSL_LOCKS_EXCLUDED(metadata_mutex_);
 
   // The number of symbols in the cache's directory names.
   static constexpr int kDirNameLength = 2;
 
+  // Minimum duration of a generation of metadata chunks in seconds.
+  static constexpr int64_t kMinMetadataGenerationSec = 60;
+
  private:
   friend class DataProviderTest;
 
@@ -145,14 +204,28 @@ class DiskDataStore : public DataStoreWriter {
   // Returns the path to the file, which stores the data chunk for |content_id|.
   std::string GetCacheFilePath(const ContentIdProto& content_id) const;
 
+  // Returns the path to the file, which stores the compressed data chunk for
+  // |content_id|.
+  std::string GetCompressedCacheFilePath(
+      const ContentIdProto& content_id) const;
+
+  // Reads and decompresses the compressed chunk for |content_id| into |data|.
+  // Returns a NotFound error if there is no compressed chunk.
+  absl::Status GetCompressed(const ContentIdProto& content_id, Buffer* data);
+
   // Parses the chunk file |path| into its content id if possible.
-  // |path| is expected to look similar to "aa/bb/ccddeeff...".
+  // |path| is expected to look similar to "aa/bb/ccddeeff..." or
+  // "aa/bb/ccddeeff....zst" for compressed chunks.
   // Returns false if parsing fails.
   bool ParseCacheFilePath(std::string path, ContentIdProto* content_id) const;
 
   // Updates modification time of |path|.
   void UpdateModificationTime(const std::string& path);
 
+  // Returns true if |content_id| is classified as a metadata chunk.
+  bool IsMetadata(const ContentIdProto& content_id) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(metadata_mutex_);
+
   // Creates the cache directory hierarchy.
   absl::Status CreateDirHierarchy();
 
@@ -170,7 +243,9 @@ class DiskDataStore : public DataStoreWriter {
   const SystemClock* clock_;
 
   std::atomic<int64_t> capacity_{kDefaultCapacity};
+  std::atomic<int64_t> metadata_capacity_{kDefaultMetadataCapacity};
   std::atomic<double> fill_factor_{kDefaultFillFactor};
+  std::atomic<int> compression_level_{0};
 
   // The total data size is updated at Put(), Prune(), Wipe(), and Cleanup().
   // It is not guaranteed to be correct between cleanups:
@@ -185,6 +260,15 @@ class DiskDataStore : public DataStoreWriter {
   std::atomic<bool> size_initialized_{false};
 
   std::vector<std::string> dirs_;
+
+  // Ids of the chunks that were classified as metadata chunks in the current
+  // and in the previous generation.
+  mutable absl::Mutex metadata_mutex_;
+  std::unordered_set<ContentIdProto> metadata_ ABSL_GUARDED_BY(metadata_mutex_);
+  std::unordered_set<ContentIdProto> prev_metadata_
+      ABSL_GUARDED_BY(metadata_mutex_);
+  SystemClock::Timestamp metadata_generation_start_
+      ABSL_GUARDED_BY(metadata_mutex_);
 };  // class DiskDataStore
 
 };      // namespace cdc_ft
@@ -222,6 +222,82 @@ TEST_F(DiskDataStoreTest, PutTwoRemoveOne) {
   EXPECT_TRUE(cache->Contains(second_content_id_));
 }
 
+TEST_F(DiskDataStoreTest, CleanupKeepsMetadataChunks) {
+  auto cache = CreateCache(0);
+
+  EXPECT_OK(cache->Put(first_content_id_, kFirstData, kFirstDataSize));
+  clock_.Advance(1000);
+  EXPECT_OK(cache->Put(second_content_id_, kSecondData, kSecondDataSize));
+
+  // The first chunk is the least recently used one, but it is metadata.
+  cache->AddMetadataChunks({first_content_id_});
+  EXPECT_EQ(cache->GetChunkClass(first_content_id_),
+            DiskDataStore::ChunkClass::kMetadata);
+  EXPECT_EQ(cache->GetChunkClass(second_content_id_),
+            DiskDataStore::ChunkClass::kData);
+  cache->SetCapacity(kFirstDataSize + 4);
+  EXPECT_OK(cache->Cleanup());
+  EXPECT_TRUE(cache->Contains(first_content_id_));
+  EXPECT_FALSE(cache->Contains(second_content_id_));
+
+  absl::StatusOr<DiskDataStore::Statistics> statistics =
+      cache->CalculateStatistics();
+  ASSERT_OK(statistics);
+  EXPECT_EQ(statistics->metadata_size, kFirstDataSize);
+  EXPECT_EQ(statistics->number_of_metadata_chunks, 1u);
+
+  // Metadata is removed if there is no data left to remove.
+  cache->SetCapacity(0);
+  EXPECT_OK(cache->Cleanup());
+  EXPECT_FALSE(cache->Contains(first_content_id_));
+}
+
+TEST_F(DiskDataStoreTest, CleanupRemovesMetadataBeyondMetadataCapacity) {
+  auto cache = CreateCache(0);
+
+  EXPECT_OK(cache->Put(first_content_id_, kFirstData, kFirstDataSize));
+  clock_.Advance(1000);
+  EXPECT_OK(cache->Put(second_content_id_, kSecondData, kSecondDataSize));
+  cache->AddMetadataChunks({second_content_id_});
+
+  // The metadata chunk exceeds its budget and is removed before the older data
+  // chunk.
+  cache->SetCapacity(kFirstDataSize + kSecondDataSize - 1);
+  cache->SetMetadataCapacity(1);
+  EXPECT_OK(cache->Cleanup());
+  EXPECT_TRUE(cache->Contains(first_content_id_));
+  EXPECT_FALSE(cache->Contains(second_content_id_));
+}
+
+TEST_F(DiskDataStoreTest, StartMetadataGenerationDropsOldMetadata) {
+  auto cache = CreateCache(0);
+  constexpr int kGenerationMs =
+      DiskDataStore::kMinMetadataGenerationSec * 1000;
+
+  cache->AddMetadataChunks({first_content_id_});
+  clock_.Advance(kGenerationMs);
+  cache->StartMetadataGeneration();
+  cache->AddMetadataChunks({second_content_id_});
+
+  // A generation that follows too quickly is not started.
+  cache->StartMetadataGeneration();
+  EXPECT_EQ(cache->GetChunkClass(first_content_id_),
+            DiskDataStore::ChunkClass::kMetadata);
+
+  // The first chunk was not classified in the previous generation.
+  clock_.Advance(kGenerationMs);
+  cache->StartMetadataGeneration();
+  EXPECT_EQ(cache->GetChunkClass(first_content_id_),
+            DiskDataStore::ChunkClass::kData);
+  EXPECT_EQ(cache->GetChunkClass(second_content_id_),
+            DiskDataStore::ChunkClass::kMetadata);
+
+  clock_.Advance(kGenerationMs);
+  cache->StartMetadataGeneration();
+  EXPECT_EQ(cache->GetChunkClass(second_content_id_),
+            DiskDataStore::ChunkClass::kData);
+}
+
 TEST_F(DiskDataStoreTest, PutTwoReadOldRemoveOne) {
   auto cache = CreateCache(0);
 
@@ -449,5 +525,71 @@ TEST_F(DiskDataStoreTest, CleanupForPrefilledCacheSuccess) {
   EXPECT_EQ(1u, statistics->number_of_chunks);
 }
 
+TEST_F(DiskDataStoreTest, PutGetCompressed) {
+  auto cache = CreateCache(1);
+  cache->SetCompressionLevel(3);
+  std::string data(4096, 'a');
+  ContentIdProto id = ContentId::FromDataString(data);
+
+  EXPECT_OK(cache->Put(id, data.data(), data.size()));
+  EXPECT_LT(cache->Size(), data.size());
+  EXPECT_TRUE(cache->Contains(id));
+  absl::StatusOr<std::vector<ContentIdProto>> ids = cache->List();
+  ASSERT_OK(ids);
+  ASSERT_EQ(ids->size(), 1);
+  EXPECT_EQ((*ids)[0], id);
+
+  Buffer buffer;
+  EXPECT_OK(cache->Get(id, &buffer));
+  EXPECT_EQ(std::string(buffer.data(), buffer.size()), data);
+
+  char ret_data[16];
+  absl::StatusOr<size_t> bytes_read =
+      cache->Get(id, ret_data, data.size() - 8, sizeof(ret_data));
+  ASSERT_OK(bytes_read);
+  EXPECT_EQ(*bytes_read, 8);
+  EXPECT_EQ(std::string(ret_data, 8), "aaaaaaaa");
+
+  // Compressed chunks can be read if compression is disabled.
+  cache->SetCompressionLevel(0);
+  EXPECT_OK(cache->Get(id, &buffer));
+  EXPECT_EQ(std::string(buffer.data(), buffer.size()), data);
+
+  EXPECT_OK(cache->Remove(id));
+  EXPECT_FALSE(cache->Contains(id));
+}
+
+TEST_F(DiskDataStoreTest, PutIncompressibleStoresRaw) {
+  auto cache = CreateCache(0);
+  cache->SetCompressionLevel(3);
+  EXPECT_OK(cache->Put(first_content_id_, kFirstData, kFirstDataSize));
+  EXPECT_EQ(kFirstDataSize, cache->Size());
+  EXPECT_TRUE(path::Exists(path::Join(
+      cache_dir_path_, ContentId::ToHexString(first_content_id_))));
+}
+
+TEST_F(DiskDataStoreTest, GetChunkFilePath) {
+  auto cache = CreateCache(1);
+  EXPECT_TRUE(absl::IsNotFound(
+      cache->GetChunkFilePath(first_content_id_).status()));
+
+  EXPECT_OK(cache->Put(first_content_id_, kFirstData, kFirstDataSize));
+  absl::StatusOr<std::string> chunk_path =
+      cache->GetChunkFilePath(first_content_id_);
+  ASSERT_OK(chunk_path);
+  absl::StatusOr<std::string> chunk_data = path::ReadFile(*chunk_path);
+  ASSERT_OK(chunk_data);
+  EXPECT_EQ(*chunk_data,
+            std::string(reinterpret_cast<const char*>(kFirstData),
+                        kFirstDataSize));
+
+  // Compressed chunks are not available as plain files.
+  cache->SetCompressionLevel(3);
+  std::string data(4096, 'a');
+  ContentIdProto id = ContentId::FromDataString(data);
+  EXPECT_OK(cache->Put(id, data.data(), data.size()));
+  EXPECT_TRUE(absl::IsNotFound(cache->GetChunkFilePath(id).status()));
+}
+
 }  // namespace
 }  // namespace cdc_ft
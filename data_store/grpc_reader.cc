@@ -23,9 +23,9 @@
 namespace cdc_ft {
 
 GrpcReader::GrpcReader(std::shared_ptr<grpc::Channel> channel,
-                       bool enable_stats)
-    : client_(std::make_unique<AssetStreamClient>(std::move(channel),
-                                                  enable_stats)) {}
+                       bool enable_stats, bool enable_compression)
+    : client_(std::make_unique<AssetStreamClient>(
+          std::move(channel), enable_stats, enable_compression)) {}
 
 GrpcReader::~GrpcReader() = default;
 
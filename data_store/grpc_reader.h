@@ -32,7 +32,9 @@ class GrpcReader : public DataStoreReader {
  public:
   // |channel| is a grpc channel to connect to.
   // |enable_stats| determines whether additional statistics are sent.
-  GrpcReader(std::shared_ptr<grpc::Channel> channel, bool enable_stats);
+  // |enable_compression| determines whether chunks may be sent compressed.
+  GrpcReader(std::shared_ptr<grpc::Channel> channel, bool enable_stats,
+             bool enable_compression);
   virtual ~GrpcReader();
 
   GrpcReader(const GrpcReader&) = delete;
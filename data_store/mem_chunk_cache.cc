@@ -0,0 +1,199 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "data_store/mem_chunk_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cdc_ft {
+namespace {
+
+// Minimum number of ids to remember in the ghost queue.
+constexpr size_t kMinGhostSize = 64;
+
+}  // namespace
+
+MemChunkCache::MemChunkCache(uint64_t capacity)
+    : capacity_(capacity), small_capacity_(capacity / 10) {}
+
+MemChunkCache::~MemChunkCache() = default;
+
+const MemChunkCache::Entry* MemChunkCache::Access(
+    const ContentId& content_id) {
+  auto it = lookup_.find(content_id);
+  if (it == lookup_.end()) {
+    ++misses_;
+    return nullptr;
+  }
+  ++hits_;
+  Entry& entry = *it->second;
+  uint8_t freq = entry.freq.load(std::memory_order_relaxed);
+  if (freq < kMaxFreq) {
+    entry.freq.compare_exchange_weak(freq, freq + 1,
+                                     std::memory_order_relaxed);
+  }
+  return &entry;
+}
+
+bool MemChunkCache::Get(const ContentIdProto& content_id, void* data,
+                        size_t offset, size_t size, size_t* read_bytes) {
+  if (!Enabled()) return false;
+  absl::ReaderMutexLock lock(&mutex_);
+  const Entry* entry = Access(ContentId(content_id));
+  if (!entry) return false;
+  *read_bytes = 0;
+  if (offset < entry->data.size()) {
+    *read_bytes = std::min(entry->data.size() - offset, size);
+    memcpy(data, entry->data.data() + offset, *read_bytes);
+  }
+  return true;
+}
+
+bool MemChunkCache::Get(const ContentIdProto& content_id, Buffer* data) {
+  if (!Enabled()) return false;
+  absl::ReaderMutexLock lock(&mutex_);
+  const Entry* entry = Access(ContentId(content_id));
+  if (!entry) return false;
+  data->resize(entry->data.size());
+  memcpy(data->data(), entry->data.data(), entry->data.size());
+  return true;
+}
+
+bool MemChunkCache::Contains(const ContentIdProto& content_id) {
+  if (!Enabled()) return false;
+  absl::ReaderMutexLock lock(&mutex_);
+  return lookup_.find(ContentId(content_id)) != lookup_.end();
+}
+
+void MemChunkCache::Put(const ContentIdProto& content_id, const void* data,
+                        size_t size) {
+  // Very large chunks would flush the whole small queue.
+  if (!Enabled() || size > std::max<uint64_t>(small_capacity_, 1)) return;
+
+  const ContentId id(content_id);
+  absl::MutexLock lock(&mutex_);
+  if (lookup_.find(id) != lookup_.end()) return;
+
+  MakeRoom(size);
+
+  // Chunks that were evicted from the small queue recently are considered
+  // hot and go directly into the main queue.
+  Queue queue = Queue::kSmall;
+  auto ghost_it = ghost_lookup_.find(id);
+  if (ghost_it != ghost_lookup_.end()) {
+    ghost_.erase(ghost_it->second);
+    ghost_lookup_.erase(ghost_it);
+    queue = Queue::kMain;
+  }
+
+  EntryList& list = queue == Queue::kSmall ? small_ : main_;
+  list.emplace_front(id, data, size);
+  list.front().queue = queue;
+  (queue == Queue::kSmall ? small_size_ : main_size_) += size;
+  lookup_[id] = list.begin();
+}
+
+void MemChunkCache::Remove(const ContentIdProto& content_id) {
+  if (!Enabled()) return;
+  absl::MutexLock lock(&mutex_);
+  auto it = lookup_.find(ContentId(content_id));
+  if (it != lookup_.end()) Erase(it->second);
+}
+
+void MemChunkCache::Clear() {
+  absl::MutexLock lock(&mutex_);
+  lookup_.clear();
+  small_.clear();
+  main_.clear();
+  ghost_lookup_.clear();
+  ghost_.clear();
+  small_size_ = 0;
+  main_size_ = 0;
+}
+
+MemChunkCache::Statistics MemChunkCache::GetStatistics() const {
+  Statistics stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.capacity = capacity_;
+  absl::ReaderMutexLock lock(&mutex_);
+  stats.size = small_size_ + main_size_;
+  stats.number_of_chunks = lookup_.size();
+  return stats;
+}
+
+void MemChunkCache::MakeRoom(size_t bytes) {
+  while (small_size_ + main_size_ + bytes > capacity_ &&
+         (!small_.empty() || !main_.empty())) {
+    if (!small_.empty() && (small_size_ >= small_capacity_ || main_.empty())) {
+      EvictSmall();
+    } else {
+      EvictMain();
+    }
+  }
+}
+
+void MemChunkCache::EvictSmall() {
+  auto it = std::prev(small_.end());
+  if (it->freq.load(std::memory_order_relaxed) > 0) {
+    // Accessed while in the small queue, promote to the main queue.
+    size_t size = it->data.size();
+    small_size_ -= size;
+    main_size_ += size;
+    it->queue = Queue::kMain;
+    it->freq.store(0, std::memory_order_relaxed);
+    main_.splice(main_.begin(), small_, it);
+    return;
+  }
+  AddGhost(it->id);
+  Erase(it);
+}
+
+void MemChunkCache::EvictMain() {
+  auto it = std::prev(main_.end());
+  uint8_t freq = it->freq.load(std::memory_order_relaxed);
+  if (freq > 0) {
+    // Give the chunk another round.
+    it->freq.store(freq - 1, std::memory_order_relaxed);
+    main_.splice(main_.begin(), main_, it);
+    return;
+  }
+  Erase(it);
+}
+
+void MemChunkCache::AddGhost(const ContentId& content_id) {
+  if (ghost_lookup_.find(content_id) != ghost_lookup_.end()) return;
+  ghost_.push_front(content_id);
+  ghost_lookup_[content_id] = ghost_.begin();
+  size_t max_ghost_size = std::max(kMinGhostSize, lookup_.size());
+  while (ghost_.size() > max_ghost_size) {
+    ghost_lookup_.erase(ghost_.back());
+    ghost_.pop_back();
+  }
+}
+
+void MemChunkCache::Erase(EntryList::iterator it) {
+  size_t size = it->data.size();
+  lookup_.erase(it->id);
+  if (it->queue == Queue::kSmall) {
+    small_size_ -= size;
+    small_.erase(it);
+  } else {
+    main_size_ -= size;
+    main_.erase(it);
+  }
+}
+
+}  // namespace cdc_ft
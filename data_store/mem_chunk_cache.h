@@ -0,0 +1,175 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DATA_STORE_MEM_CHUNK_CACHE_H_
+#define DATA_STORE_MEM_CHUNK_CACHE_H_
+
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "common/buffer.h"
+#include "manifest/content_id.h"
+
+namespace cdc_ft {
+
+// Bounded in-memory cache for complete chunks, used as a hot tier on top of
+// the on-disk chunk cache. Eviction follows the S3-FIFO policy: new chunks
+// enter a small probationary FIFO queue and are only promoted to the main FIFO
+// queue if they are accessed again before reaching its tail. Chunks evicted
+// from the small queue are remembered in a ghost queue, so that they are
+// admitted directly into the main queue if they are requested again soon.
+// This makes the cache resistant to large sequential scans, which would
+// otherwise flush frequently used chunks.
+//
+// Cache hits only require a shared lock. Thread-safe.
+class MemChunkCache {
+ public:
+  struct Statistics {
+    // Number of lookups that were served from memory.
+    uint64_t hits = 0;
+    // Number of lookups that were not found in memory.
+    uint64_t misses = 0;
+    // Total size of all cached chunks in bytes.
+    uint64_t size = 0;
+    // Number of cached chunks.
+    uint64_t number_of_chunks = 0;
+    // Maximum total size of all cached chunks in bytes.
+    uint64_t capacity = 0;
+
+    // Returns the ratio of hits to all lookups, or 0 if there were none.
+    double HitRate() const {
+      uint64_t total = hits + misses;
+      return total > 0 ? static_cast<double>(hits) / total : 0.0;
+    }
+  };
+
+  // Creates a cache that holds at most |capacity| bytes of chunk data. A
+  // capacity of 0 disables the cache.
+  explicit MemChunkCache(uint64_t capacity);
+  MemChunkCache(const MemChunkCache&) = delete;
+  MemChunkCache& operator=(const MemChunkCache&) = delete;
+  ~MemChunkCache();
+
+  // Returns true if the cache can hold any data.
+  bool Enabled() const { return capacity_ > 0; }
+
+  // Copies up to |size| bytes of the chunk |content_id|, starting at |offset|,
+  // into |data|. Returns the number of bytes copied in |read_bytes|. Returns
+  // false if the chunk is not cached.
+  bool Get(const ContentIdProto& content_id, void* data, size_t offset,
+           size_t size, size_t* read_bytes) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Copies the complete chunk |content_id| into |data|. Returns false if the
+  // chunk is not cached.
+  bool Get(const ContentIdProto& content_id, Buffer* data)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Returns true if the chunk |content_id| is cached. Does not count as an
+  // access.
+  bool Contains(const ContentIdProto& content_id) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Adds the complete chunk |content_id| with the given |data| of |size| bytes
+  // to the cache, evicting other chunks as needed. Chunks that exceed the small
+  // queue's capacity are not cached.
+  void Put(const ContentIdProto& content_id, const void* data, size_t size)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Removes the chunk |content_id| from the cache, if present.
+  void Remove(const ContentIdProto& content_id) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Removes all chunks from the cache. Does not reset the statistics.
+  void Clear() ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Returns the current cache statistics.
+  Statistics GetStatistics() const ABSL_LOCKS_EXCLUDED(mutex_);
+
+ private:
+  // Maximum access frequency tracked per chunk.
+  static constexpr uint8_t kMaxFreq = 3;
+
+  enum class Queue { kSmall, kMain };
+
+  struct Entry {
+    Entry(const ContentId& id, const void* data, size_t size)
+        : id(id),
+          data(static_cast<const char*>(data),
+               static_cast<const char*>(data) + size) {}
+
+    ContentId id;
+    std::vector<char> data;
+    Queue queue = Queue::kSmall;
+    // Access counter, updated under a shared lock.
+    std::atomic<uint8_t> freq{0};
+  };
+
+  using EntryList = std::list<Entry>;
+
+  // Looks up |content_id| and counts the access. Returns nullptr if the chunk
+  // is not cached.
+  const Entry* Access(const ContentId& content_id)
+      ABSL_SHARED_LOCKS_REQUIRED(mutex_);
+
+  // Evicts chunks until |bytes| additional bytes fit into the cache.
+  void MakeRoom(size_t bytes) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Evicts one chunk from the small queue, either by promoting it to the main
+  // queue or by dropping it and remembering its id in the ghost queue.
+  void EvictSmall() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Evicts one chunk from the main queue. Chunks that have been accessed get
+  // reinserted with a decremented frequency.
+  void EvictMain() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Adds |content_id| to the ghost queue and trims it to its maximum length.
+  void AddGhost(const ContentId& content_id)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes |it| from its queue and the lookup table.
+  void Erase(EntryList::iterator it) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const uint64_t capacity_;
+  // The small queue holds 10% of the capacity.
+  const uint64_t small_capacity_;
+
+  mutable absl::Mutex mutex_;
+
+  // FIFO queues. New entries are added at the front and evicted at the back.
+  EntryList small_ ABSL_GUARDED_BY(mutex_);
+  EntryList main_ ABSL_GUARDED_BY(mutex_);
+  uint64_t small_size_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint64_t main_size_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  std::unordered_map<ContentId, EntryList::iterator> lookup_
+      ABSL_GUARDED_BY(mutex_);
+
+  // Ids of chunks recently evicted from the small queue. Bounded by the number
+  // of chunks in the main queue.
+  std::list<ContentId> ghost_ ABSL_GUARDED_BY(mutex_);
+  std::unordered_map<ContentId, std::list<ContentId>::iterator> ghost_lookup_
+      ABSL_GUARDED_BY(mutex_);
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace cdc_ft
+
+#endif  // DATA_STORE_MEM_CHUNK_CACHE_H_
@@ -0,0 +1,153 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "data_store/mem_chunk_cache.h"
+
+#include "absl/strings/str_format.h"
+#include "gtest/gtest.h"
+#include "manifest/content_id.h"
+
+namespace cdc_ft {
+namespace {
+
+constexpr char kMissingData[] = "missing";
+
+class MemChunkCacheTest : public ::testing::Test {
+ protected:
+  // Adds a chunk with the given |data| to |cache| and returns its id.
+  ContentIdProto Put(MemChunkCache* cache, const std::string& data) {
+    ContentIdProto id = ContentId::FromDataString(data);
+    cache->Put(id, data.data(), data.size());
+    return id;
+  }
+
+  // Returns a 10 byte chunk that is unique for |n|.
+  std::string Chunk(int n) { return absl::StrFormat("chunk%05d", n); }
+};
+
+TEST_F(MemChunkCacheTest, GetReturnsPutData) {
+  MemChunkCache cache(1000);
+  ContentIdProto id = Put(&cache, "0123456789");
+
+  Buffer buffer;
+  ASSERT_TRUE(cache.Get(id, &buffer));
+  EXPECT_EQ(std::string(buffer.data(), buffer.size()), "0123456789");
+
+  char data[4];
+  size_t read_bytes = 0;
+  ASSERT_TRUE(cache.Get(id, data, 8, sizeof(data), &read_bytes));
+  EXPECT_EQ(read_bytes, 2);
+  EXPECT_EQ(std::string(data, read_bytes), "89");
+
+  ASSERT_TRUE(cache.Get(id, data, 12, sizeof(data), &read_bytes));
+  EXPECT_EQ(read_bytes, 0);
+}
+
+TEST_F(MemChunkCacheTest, GetMissingChunkFails) {
+  MemChunkCache cache(1000);
+  ContentIdProto id = ContentId::FromDataString(std::string(kMissingData));
+  Buffer buffer;
+  EXPECT_FALSE(cache.Get(id, &buffer));
+  EXPECT_FALSE(cache.Contains(id));
+}
+
+TEST_F(MemChunkCacheTest, DisabledCacheStoresNothing) {
+  MemChunkCache cache(0);
+  EXPECT_FALSE(cache.Enabled());
+  ContentIdProto id = Put(&cache, "data");
+  EXPECT_FALSE(cache.Contains(id));
+}
+
+TEST_F(MemChunkCacheTest, OversizedChunkIsNotCached) {
+  MemChunkCache cache(100);
+  ContentIdProto id = Put(&cache, std::string(11, 'x'));
+  EXPECT_FALSE(cache.Contains(id));
+}
+
+TEST_F(MemChunkCacheTest, SizeStaysWithinCapacity) {
+  MemChunkCache cache(100);
+  for (int n = 0; n < 100; ++n) Put(&cache, Chunk(n));
+  MemChunkCache::Statistics stats = cache.GetStatistics();
+  EXPECT_LE(stats.size, 100);
+  EXPECT_EQ(stats.size, stats.number_of_chunks * 10);
+}
+
+TEST_F(MemChunkCacheTest, RemoveAndClear) {
+  MemChunkCache cache(1000);
+  ContentIdProto id1 = Put(&cache, Chunk(1));
+  ContentIdProto id2 = Put(&cache, Chunk(2));
+
+  cache.Remove(id1);
+  EXPECT_FALSE(cache.Contains(id1));
+  EXPECT_TRUE(cache.Contains(id2));
+  EXPECT_EQ(cache.GetStatistics().size, 10);
+
+  cache.Clear();
+  EXPECT_FALSE(cache.Contains(id2));
+  EXPECT_EQ(cache.GetStatistics().size, 0);
+}
+
+TEST_F(MemChunkCacheTest, HotChunksSurviveScan) {
+  // Room for 20 chunks of 10 bytes, 2 of them in the small queue.
+  MemChunkCache cache(200);
+  std::vector<ContentIdProto> hot_ids;
+  Buffer buffer;
+  for (int n = 0; n < 5; ++n) {
+    hot_ids.push_back(Put(&cache, Chunk(n)));
+    ASSERT_TRUE(cache.Get(hot_ids.back(), &buffer));
+  }
+
+  // A long scan of chunks that are only fetched once.
+  for (int n = 1000; n < 2000; ++n) {
+    Put(&cache, Chunk(n));
+    for (const ContentIdProto& hot_id : hot_ids) {
+      EXPECT_TRUE(cache.Get(hot_id, &buffer)) << n;
+    }
+  }
+}
+
+TEST_F(MemChunkCacheTest, GhostHitIsAdmittedToMain) {
+  MemChunkCache cache(200);
+  ContentIdProto id = Put(&cache, Chunk(0));
+
+  // Push the chunk out of the small queue without accessing it.
+  for (int n = 1; n < 40; ++n) Put(&cache, Chunk(n));
+  ASSERT_FALSE(cache.Contains(id));
+
+  // Re-adding it should admit it to the main queue, where it survives another
+  // round of one-time chunks.
+  Put(&cache, Chunk(0));
+  for (int n = 100; n < 110; ++n) Put(&cache, Chunk(n));
+  EXPECT_TRUE(cache.Contains(id));
+}
+
+TEST_F(MemChunkCacheTest, StatisticsCountHitsAndMisses) {
+  MemChunkCache cache(1000);
+  ContentIdProto id = Put(&cache, Chunk(1));
+  Buffer buffer;
+  cache.Get(id, &buffer);
+  cache.Get(id, &buffer);
+  cache.Get(ContentId::FromDataString(std::string(kMissingData)), &buffer);
+
+  MemChunkCache::Statistics stats = cache.GetStatistics();
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.number_of_chunks, 1);
+  EXPECT_EQ(stats.size, 10);
+  EXPECT_EQ(stats.capacity, 1000);
+  EXPECT_DOUBLE_EQ(stats.HitRate(), 2.0 / 3.0);
+}
+
+}  // namespace
+}  // namespace cdc_ft
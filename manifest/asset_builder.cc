@@ -48,6 +48,7 @@ void AssetBuilder::TruncateChunks() {
   proto_->mutable_file_chunks()->Clear();
   proto_->mutable_file_indirect_chunks()->Clear();
   proto_->set_file_size(0);
+  proto_->clear_chunked_size();
 }
 
 void AssetBuilder::SetChunks(const RepeatedChunkRefProto& chunks,
@@ -58,6 +59,7 @@ void AssetBuilder::SetChunks(const RepeatedChunkRefProto& chunks,
   proto_->mutable_file_chunks()->CopyFrom(chunks);
   proto_->mutable_file_indirect_chunks()->Clear();
   proto_->set_file_size(file_size);
+  proto_->clear_chunked_size();
 }
 
 void AssetBuilder::SwapChunks(RepeatedChunkRefProto* chunks,
@@ -67,6 +69,7 @@ void AssetBuilder::SwapChunks(RepeatedChunkRefProto* chunks,
   proto_->mutable_file_chunks()->Swap(chunks);
   proto_->mutable_file_indirect_chunks()->Clear();
   proto_->set_file_size(file_size);
+  proto_->clear_chunked_size();
 }
 
 void AssetBuilder::SetFileSize(uint64_t file_size) {
@@ -75,6 +78,12 @@ void AssetBuilder::SetFileSize(uint64_t file_size) {
   proto_->set_file_size(file_size);
 }
 
+void AssetBuilder::SetChunkedSize(uint64_t chunked_size) {
+  assert(proto_ != nullptr);
+  assert(proto_->type() == AssetProto::FILE);
+  proto_->set_chunked_size(chunked_size);
+}
+
 AssetBuilder AssetBuilder::AppendAsset(const std::string& name,
                                        AssetProto::Type type) {
   assert(proto_ != nullptr);
@@ -107,6 +107,13 @@ class AssetBuilder {
   // Asserts that the asset is actually of type FILE.
   void SetFileSize(uint64_t file_size);
 
+  // For FILE assets that are in progress, sets the number of bytes at the
+  // start of the file that are covered by the chunks. The chunked size is
+  // reset whenever the chunks are replaced.
+  //
+  // Asserts that the asset is actually of type FILE.
+  void SetChunkedSize(uint64_t chunked_size);
+
   // For DIRECTORY assets, adds a new direct asset to the end of the list. Does
   // *not* verify if an asset with that name already exists.
   //
@@ -36,6 +36,17 @@ int HexToInt(char c) {
 }
 }  // namespace
 
+ContentId::ContentId(const ContentIdProto& content_id) {
+  const std::string& hash = content_id.blake3_sum_160();
+  if (hash.size() == kHashSize) memcpy(hash_, hash.data(), kHashSize);
+}
+
+ContentIdProto ContentId::ToProto() const {
+  ContentIdProto content_id;
+  if (!IsEmpty()) content_id.set_blake3_sum_160(hash_, kHashSize);
+  return content_id;
+}
+
 // static
 ContentIdProto ContentId::FromDataString(const std::string& data) {
   return FromArray(data.c_str(), data.size());
@@ -70,6 +81,17 @@ std::string ContentId::ToHexString(const ContentIdProto& content_id) {
   return ret;
 }
 
+// static
+std::string ContentId::ToHexString(const ContentId& content_id) {
+  std::string ret;
+  ret.reserve(kHashSize << 1);
+  for (size_t i = 0; i < kHashSize; ++i) {
+    ret.push_back(IntToHex(content_id.hash_[i] >> 4));
+    ret.push_back(IntToHex(content_id.hash_[i] & 0xf));
+  }
+  return ret;
+}
+
 // static
 bool ContentId::FromHexString(const std::string& str,
                               ContentIdProto* content_id) {
@@ -96,4 +118,10 @@ uint8_t ContentId::GetByte(const ContentIdProto& content_id, size_t pos) {
   if (pos >= content_id.blake3_sum_160().size()) return 0;
   return content_id.blake3_sum_160()[pos];
 }
+
+// static
+uint8_t ContentId::GetByte(const ContentId& content_id, size_t pos) {
+  if (pos >= kHashSize) return 0;
+  return content_id.hash_[pos];
+}
 }  // namespace cdc_ft
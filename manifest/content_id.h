@@ -17,7 +17,9 @@
 #ifndef MANIFEST_CONTENT_ID_H_
 #define MANIFEST_CONTENT_ID_H_
 
+#include <cstring>
 #include <string>
+#include <type_traits>
 
 #include "absl/strings/string_view.h"
 #include "manifest/manifest_proto_defs.h"
@@ -26,11 +28,53 @@ namespace cdc_ft {
 
 // This helper class provides some utility functions to work with ContentIdProto
 // messages.
+//
+// It is also a compact value type for content ids. Unlike ContentIdProto, it
+// stores the hash inline without heap allocations and is cheap to hash and to
+// compare. It should be preferred for in-memory containers. ContentIdProto is
+// meant for serialization.
 class ContentId {
  public:
   // Hashes are 160 bit long.
   static constexpr size_t kHashSize = 20;
 
+  // Creates an all-zero id, which corresponds to an unset ContentIdProto.
+  ContentId() = default;
+
+  // Creates an id from |content_id|. Results in an all-zero id if
+  // |content_id| does not contain a valid hash.
+  explicit ContentId(const ContentIdProto& content_id);
+
+  // Returns the id as proto. An all-zero id results in an unset proto.
+  ContentIdProto ToProto() const;
+
+  // Returns true if the id is all zeros.
+  bool IsEmpty() const { return *this == ContentId(); }
+
+  // Returns the raw hash bytes.
+  const uint8_t* data() const { return hash_; }
+
+  bool operator==(const ContentId& other) const {
+    return memcmp(hash_, other.hash_, kHashSize) == 0;
+  }
+  bool operator!=(const ContentId& other) const { return !(*this == other); }
+  bool operator<(const ContentId& other) const {
+    return memcmp(hash_, other.hash_, kHashSize) < 0;
+  }
+
+  // Returns the first 8 bytes of the hash. Since the id is a cryptographic
+  // hash, they are uniformly distributed and can be used as hash value.
+  size_t Hash() const {
+    size_t hash;
+    memcpy(&hash, hash_, sizeof(hash));
+    return hash;
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const ContentId& content_id) {
+    return H::combine(std::move(h), content_id.Hash());
+  }
+
   // Returns content ID for the |data| passed in as a string.
   static ContentIdProto FromDataString(const std::string& data);
 
@@ -44,6 +88,7 @@ class ContentId {
   // the hex digits of the hash ('0'...'9', 'a'...'f'), so a 160 bit hash
   // results in a string of length kHashSize * 2.
   static std::string ToHexString(const ContentIdProto& content_id);
+  static std::string ToHexString(const ContentId& content_id);
 
   // Converts the given hex string into a content ID. The string is assumed to
   // consist of the hex digits of the hash ('0'...'9', 'a'...'f'), so a 160 bit
@@ -53,8 +98,17 @@ class ContentId {
   // Returns the |pos| byte of |content_id|.
   // Returns 0 if |content_id| is not set or |pos| is invalid.
   static uint8_t GetByte(const ContentIdProto& content_id, size_t pos);
+  static uint8_t GetByte(const ContentId& content_id, size_t pos);
+
+ private:
+  uint8_t hash_[kHashSize] = {};
 };
 
+static_assert(sizeof(ContentId) == ContentId::kHashSize,
+              "ContentId must not have padding");
+static_assert(std::is_trivially_copyable<ContentId>::value,
+              "ContentId must be trivially copyable");
+
 namespace proto {
 
 inline bool operator==(const ContentId& a, const ContentId& b) {
@@ -85,6 +139,11 @@ struct hash<cdc_ft::ContentIdProto> {
   }
 };
 
+template <>
+struct hash<cdc_ft::ContentId> {
+  size_t operator()(const cdc_ft::ContentId& id) const { return id.Hash(); }
+};
+
 }  // namespace std
 
 #endif  // MANIFEST_CONTENT_ID_H_
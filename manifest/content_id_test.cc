@@ -74,6 +74,40 @@ TEST(ContentIdTest, GetByte) {
   EXPECT_EQ(ContentId::GetByte(content_id, 20), 0);
 }
 
+TEST(ContentIdTest, ValueFromProto) {
+  ContentIdProto proto;
+  EXPECT_TRUE(ContentId::FromHexString(kHashHex, &proto));
+  ContentId content_id(proto);
+  EXPECT_EQ(memcmp(content_id.data(), kHash, kHashSize), 0);
+  EXPECT_EQ(content_id.ToProto(), proto);
+  EXPECT_EQ(ContentId::ToHexString(content_id), kHashHex);
+  EXPECT_EQ(ContentId::GetByte(content_id, 0), static_cast<uint8_t>(kHash[0]));
+  EXPECT_EQ(ContentId::GetByte(content_id, 20), 0);
+  EXPECT_FALSE(content_id.IsEmpty());
+}
+
+TEST(ContentIdTest, EmptyValue) {
+  ContentId content_id;
+  EXPECT_TRUE(content_id.IsEmpty());
+  EXPECT_EQ(ContentId(ContentIdProto()), content_id);
+  EXPECT_EQ(content_id.ToProto(), ContentIdProto());
+
+  // Invalid hashes also result in an empty id.
+  ContentIdProto proto;
+  proto.set_blake3_sum_160("too short");
+  EXPECT_TRUE(ContentId(proto).IsEmpty());
+}
+
+TEST(ContentIdTest, CompareAndHashValues) {
+  ContentIdProto a = ContentId::FromDataString(std::string("a"));
+  ContentIdProto b = ContentId::FromDataString(std::string("b"));
+  EXPECT_EQ(ContentId(a), ContentId(a));
+  EXPECT_NE(ContentId(a), ContentId(b));
+  EXPECT_EQ(ContentId(a) < ContentId(b), a < b);
+  EXPECT_EQ(std::hash<ContentId>()(ContentId(a)),
+            std::hash<ContentIdProto>()(a));
+}
+
 }  // namespace
 
 }  // namespace cdc_ft
@@ -0,0 +1,246 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest/dir_scanner.h"
+
+#include <algorithm>
+
+#include "common/path.h"
+
+namespace cdc_ft {
+
+// static
+absl::Status DirScanner::ScanDir(const std::string& src_dir,
+                                 const std::string& rel_path,
+                                 std::vector<AssetInfo>* assets) {
+  std::string full_src_dir = path::Join(src_dir, rel_path);
+
+  path::EnsureEndsWithPathSeparator(&full_src_dir);
+  auto handler = [assets, rel_path = path::ToUnix(rel_path)](
+                     const std::string& dir, const std::string& filename,
+                     int64_t mtime, uint64_t size, bool is_dir) {
+    AssetInfo ai;
+    ai.path = path::JoinUnix(rel_path, filename);
+    ai.type = is_dir ? AssetProto::DIRECTORY : AssetProto::FILE;
+    ai.mtime = mtime;
+    ai.size = is_dir ? 0 : size;
+    assets->push_back(std::move(ai));
+    return absl::OkStatus();
+  };
+#if PLATFORM_WINDOWS
+  // Windows expects a globbing pattern to search a path.
+  std::string src_pattern = path::Join(full_src_dir, "*");
+#else
+  std::string src_pattern = full_src_dir;
+#endif
+  absl::Status status =
+      path::SearchFiles(src_pattern, /*recursive=*/false, handler);
+  std::sort(assets->begin(), assets->end());
+  return status;
+}
+
+DirScanner::DirScanner(std::string src_dir, size_t num_threads,
+                       size_t batch_size, size_t max_buffered_assets)
+    : src_dir_(std::move(src_dir)),
+      batch_size_(std::max<size_t>(batch_size, 1)),
+      max_buffered_assets_(std::max<size_t>(max_buffered_assets, 1)) {
+  queues_.reserve(std::max<size_t>(num_threads, 1));
+  while (queues_.size() < queues_.capacity())
+    queues_.push_back(std::make_unique<WorkerQueue>());
+}
+
+DirScanner::~DirScanner() { Shutdown(); }
+
+void DirScanner::Start(std::string rel_path) {
+  assert(workers_.empty());
+  {
+    absl::MutexLock lock(&queues_[0]->mutex);
+    queues_[0]->dirs.push_back(std::move(rel_path));
+  }
+  queued_dirs_ = 1;
+  pending_dirs_ = 1;
+  {
+    absl::MutexLock lock(&results_mutex_);
+    running_workers_ = queues_.size();
+  }
+  workers_.reserve(queues_.size());
+  for (size_t n = 0; n < queues_.size(); ++n)
+    workers_.emplace_back([this, n]() { ThreadWorkerMain(n); });
+}
+
+void DirScanner::Shutdown() {
+  shutdown_ = true;
+  WakeIdleWorkers();
+  {
+    // Wake up workers waiting for buffer space.
+    absl::MutexLock lock(&results_mutex_);
+  }
+  for (std::thread& worker : workers_) {
+    if (worker.joinable()) worker.join();
+  }
+}
+
+bool DirScanner::IsDone() const {
+  absl::MutexLock lock(&results_mutex_);
+  return running_workers_ == 0;
+}
+
+bool DirScanner::IsScanned(const std::string& rel_path) const {
+  absl::MutexLock lock(&results_mutex_);
+  return scanned_dirs_.find(rel_path) != scanned_dirs_.end();
+}
+
+bool DirScanner::TakeDir(const std::string& rel_path, Dir* dir) {
+  absl::MutexLock lock(&results_mutex_);
+  auto it = scanned_dirs_.find(rel_path);
+  if (it == scanned_dirs_.end()) return false;
+  buffered_assets_ -= it->second.assets.size();
+  *dir = std::move(it->second);
+  scanned_dirs_.erase(it);
+  return true;
+}
+
+void DirScanner::WaitForDirs(absl::Duration timeout) {
+  absl::MutexLock lock(&results_mutex_);
+  consumer_waiting_ = true;
+  auto cond = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(results_mutex_) {
+    return running_workers_ == 0 || num_batches_ != num_batches_seen_;
+  };
+  results_mutex_.AwaitWithTimeout(absl::Condition(&cond), timeout);
+  consumer_waiting_ = false;
+  num_batches_seen_ = num_batches_;
+}
+
+void DirScanner::ThreadWorkerMain(size_t index) {
+  std::vector<ScannedDir> batch;
+  std::string rel_path;
+  while (!shutdown_) {
+    if (buffered_assets_ >= max_buffered_assets_ && !consumer_waiting_) {
+      WaitForBufferSpace(&batch);
+      continue;
+    }
+
+    if (!NextDir(index, &rel_path)) {
+      // Hand out the results before going idle, the consumer might be waiting
+      // for them.
+      Publish(&batch);
+      if (pending_dirs_ == 0) break;
+      WaitForWork();
+      continue;
+    }
+
+    Dir dir;
+    dir.status = ScanDir(src_dir_, path::ToNative(rel_path), &dir.assets);
+    QueueSubDirs(index, dir.assets);
+    batch.emplace_back(std::move(rel_path), std::move(dir));
+    ++num_scanned_dirs_;
+    if (batch.size() >= batch_size_ || consumer_waiting_) Publish(&batch);
+
+    // Sub-directories are queued before the directory is finished, so that
+    // the count does not drop to zero in between.
+    if (--pending_dirs_ == 0) WakeIdleWorkers();
+  }
+  Publish(&batch);
+
+  absl::MutexLock lock(&results_mutex_);
+  --running_workers_;
+}
+
+bool DirScanner::NextDir(size_t index, std::string* rel_path) {
+  {
+    WorkerQueue& own = *queues_[index];
+    absl::MutexLock lock(&own.mutex);
+    if (!own.dirs.empty()) {
+      *rel_path = std::move(own.dirs.back());
+      own.dirs.pop_back();
+      --queued_dirs_;
+      return true;
+    }
+  }
+
+  if (queued_dirs_ == 0) return false;
+  for (size_t n = 1; n < queues_.size(); ++n) {
+    WorkerQueue& victim = *queues_[(index + n) % queues_.size()];
+    absl::MutexLock lock(&victim.mutex);
+    if (!victim.dirs.empty()) {
+      *rel_path = std::move(victim.dirs.front());
+      victim.dirs.pop_front();
+      --queued_dirs_;
+      ++num_steals_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void DirScanner::QueueSubDirs(size_t index,
+                              const std::vector<AssetInfo>& assets) {
+  size_t num_dirs = std::count_if(
+      assets.begin(), assets.end(),
+      [](const AssetInfo& ai) { return ai.type == AssetProto::DIRECTORY; });
+  if (num_dirs == 0) return;
+
+  // Count the directories before they can be taken by other workers.
+  pending_dirs_ += num_dirs;
+  queued_dirs_ += num_dirs;
+  {
+    WorkerQueue& own = *queues_[index];
+    absl::MutexLock lock(&own.mutex);
+    for (const AssetInfo& ai : assets) {
+      if (ai.type == AssetProto::DIRECTORY) own.dirs.push_back(ai.path);
+    }
+  }
+  WakeIdleWorkers();
+}
+
+void DirScanner::WaitForWork() {
+  absl::MutexLock lock(&idle_mutex_);
+  ++num_idle_workers_;
+  auto cond = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(idle_mutex_) {
+    return shutdown_ || queued_dirs_ > 0 || pending_dirs_ == 0;
+  };
+  idle_mutex_.Await(absl::Condition(&cond));
+  --num_idle_workers_;
+}
+
+void DirScanner::WakeIdleWorkers() {
+  if (num_idle_workers_ == 0) return;
+  // Releasing the mutex makes the waiting workers re-evaluate their condition.
+  absl::MutexLock lock(&idle_mutex_);
+}
+
+void DirScanner::WaitForBufferSpace(std::vector<ScannedDir>* batch) {
+  // Hand out the results before pausing, the consumer needs them to make
+  // progress.
+  Publish(batch);
+  absl::MutexLock lock(&results_mutex_);
+  auto cond = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(results_mutex_) {
+    return shutdown_ || consumer_waiting_ ||
+           buffered_assets_ < max_buffered_assets_;
+  };
+  results_mutex_.Await(absl::Condition(&cond));
+}
+
+void DirScanner::Publish(std::vector<ScannedDir>* batch) {
+  if (batch->empty()) return;
+  absl::MutexLock lock(&results_mutex_);
+  for (ScannedDir& scanned : *batch) {
+    buffered_assets_ += scanned.second.assets.size();
+    scanned_dirs_[std::move(scanned.first)] = std::move(scanned.second);
+  }
+  ++num_batches_;
+  batch->clear();
+}
+
+}  // namespace cdc_ft
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANIFEST_DIR_SCANNER_H_
+#define MANIFEST_DIR_SCANNER_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "manifest/manifest_updater.h"
+
+namespace cdc_ft {
+
+// Scans a directory tree on multiple threads.
+//
+// Every worker thread owns a deque of directories to scan. A worker takes
+// directories from the back of its own deque, so that it walks its subtree
+// depth-first, and queues the sub-directories it finds there. When its deque
+// runs empty, it steals from the front of the other workers' deques, which
+// holds the directories closest to the root and thus the largest unscanned
+// subtrees.
+//
+// Scanned directories are published in batches to keep the synchronization
+// with the consumer low. The consumer takes them one by one in any order.
+// Workers pause while the published directories that were not taken yet hold
+// too many assets, so that the listings of a large tree are not all kept in
+// memory at once.
+class DirScanner {
+ public:
+  // Default number of scanned directories a worker publishes at once.
+  static constexpr size_t kDefaultBatchSize = 64;
+
+  // Default number of assets in published directories at which the workers
+  // pause scanning until the consumer takes directories.
+  static constexpr size_t kDefaultMaxBufferedAssets = 256 * 1024;
+
+  // Contents of a scanned directory.
+  struct Dir {
+    // Files and directories in the directory, sorted by path. The paths are
+    // relative Unix paths like the path of the directory itself.
+    std::vector<AssetInfo> assets;
+
+    // Result of reading the directory.
+    absl::Status status;
+  };
+
+  // Lists the files and directories in |src_dir| + |rel_path| and stores them
+  // sorted in |assets|. Does not recurse into sub-directories. |rel_path| is
+  // given as native path.
+  static absl::Status ScanDir(const std::string& src_dir,
+                              const std::string& rel_path,
+                              std::vector<AssetInfo>* assets);
+
+  // Scans directories below |src_dir| using |num_threads| worker threads.
+  // Each worker publishes its scanned directories once it has collected
+  // |batch_size| of them, once it runs out of work or when the consumer is
+  // waiting. Workers pause while the published directories hold at least
+  // |max_buffered_assets| assets, unless the consumer is waiting for more
+  // directories.
+  DirScanner(std::string src_dir, size_t num_threads,
+             size_t batch_size = kDefaultBatchSize,
+             size_t max_buffered_assets = kDefaultMaxBufferedAssets);
+  ~DirScanner();
+
+  DirScanner(const DirScanner&) = delete;
+  DirScanner& operator=(const DirScanner&) = delete;
+
+  // Starts scanning the directory at the relative Unix path |rel_path| and
+  // all of its sub-directories in the background. Must be called only once.
+  void Start(std::string rel_path = std::string());
+
+  // Stops scanning and waits for the worker threads to exit.
+  void Shutdown() ABSL_LOCKS_EXCLUDED(idle_mutex_);
+
+  // Returns true if all directories were scanned and published, or if the
+  // scanner was shut down.
+  bool IsDone() const ABSL_LOCKS_EXCLUDED(results_mutex_);
+
+  // Returns true if the directory at the relative Unix path |rel_path| was
+  // scanned and not taken yet.
+  bool IsScanned(const std::string& rel_path) const
+      ABSL_LOCKS_EXCLUDED(results_mutex_);
+
+  // Moves the contents of the scanned directory at the relative Unix path
+  // |rel_path| into |dir|. Returns false if the directory was not scanned
+  // (yet) or was already taken.
+  bool TakeDir(const std::string& rel_path, Dir* dir)
+      ABSL_LOCKS_EXCLUDED(results_mutex_);
+
+  // Blocks until more directories were published since the last call, until
+  // the scan is done or until |timeout| expires. Must only be called from a
+  // single consumer thread.
+  void WaitForDirs(absl::Duration timeout = absl::InfiniteDuration())
+      ABSL_LOCKS_EXCLUDED(results_mutex_);
+
+  // Returns the number of directories scanned so far.
+  size_t NumScannedDirs() const { return num_scanned_dirs_; }
+
+  // Returns the number of directories that workers stole from other workers.
+  size_t NumSteals() const { return num_steals_; }
+
+  // Returns the number of assets in published directories that were not taken
+  // yet.
+  size_t NumBufferedAssets() const { return buffered_assets_; }
+
+ private:
+  // Directories queued for a single worker thread.
+  struct WorkerQueue {
+    absl::Mutex mutex;
+    std::deque<std::string> dirs ABSL_GUARDED_BY(mutex);
+  };
+
+  using ScannedDir = std::pair<std::string, Dir>;
+
+  // Background thread worker method with the worker index |index|.
+  void ThreadWorkerMain(size_t index);
+
+  // Takes the next directory to scan from the worker queue |index| or steals
+  // one from another queue. Returns false if no directory is queued.
+  bool NextDir(size_t index, std::string* rel_path);
+
+  // Queues the sub-directories in |assets| for worker |index|.
+  void QueueSubDirs(size_t index, const std::vector<AssetInfo>& assets);
+
+  // Waits until directories are queued, the scan is done or the scanner is
+  // shut down.
+  void WaitForWork() ABSL_LOCKS_EXCLUDED(idle_mutex_);
+
+  // Wakes up idle workers, e.g. after new directories were queued.
+  void WakeIdleWorkers() ABSL_LOCKS_EXCLUDED(idle_mutex_);
+
+  // Publishes |batch| and waits while too many assets are buffered, the
+  // consumer is not waiting and the scanner is not shut down.
+  void WaitForBufferSpace(std::vector<ScannedDir>* batch)
+      ABSL_LOCKS_EXCLUDED(results_mutex_);
+
+  // Moves the directories in |batch| to |scanned_dirs_|.
+  void Publish(std::vector<ScannedDir>* batch)
+      ABSL_LOCKS_EXCLUDED(results_mutex_);
+
+  const std::string src_dir_;
+  const size_t batch_size_;
+  const size_t max_buffered_assets_;
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> workers_;
+
+  // Number of directories in all worker queues.
+  std::atomic<size_t> queued_dirs_{0};
+
+  // Number of directories that are queued or being scanned. The scan is done
+  // when this drops to zero.
+  std::atomic<size_t> pending_dirs_{0};
+
+  std::atomic<size_t> num_scanned_dirs_{0};
+  std::atomic<size_t> num_steals_{0};
+  std::atomic_bool shutdown_{false};
+
+  // Idle workers wait on this mutex. Changes to the counters above are
+  // signaled by acquiring and releasing it.
+  absl::Mutex idle_mutex_;
+  std::atomic<size_t> num_idle_workers_{0};
+
+  mutable absl::Mutex results_mutex_;
+  std::unordered_map<std::string, Dir> scanned_dirs_
+      ABSL_GUARDED_BY(results_mutex_);
+  size_t running_workers_ ABSL_GUARDED_BY(results_mutex_) = 0;
+  size_t num_batches_ ABSL_GUARDED_BY(results_mutex_) = 0;
+  size_t num_batches_seen_ ABSL_GUARDED_BY(results_mutex_) = 0;
+
+  // Number of assets in |scanned_dirs_|. Only modified while |results_mutex_|
+  // is held, but read without it to check whether workers need to pause.
+  std::atomic<size_t> buffered_assets_{0};
+
+  // Set while the consumer waits in WaitForDirs(). Makes workers publish their
+  // scanned directories without waiting for a full batch.
+  std::atomic_bool consumer_waiting_{false};
+};
+
+}  // namespace cdc_ft
+
+#endif  // MANIFEST_DIR_SCANNER_H_
@@ -0,0 +1,247 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest/dir_scanner.h"
+
+#include <algorithm>
+
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "common/path.h"
+#include "common/status_test_macros.h"
+#include "common/stopwatch.h"
+#include "gtest/gtest.h"
+
+namespace cdc_ft {
+namespace {
+
+constexpr char kTestDirName[] = "dir_scanner_test";
+
+class DirScannerTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    src_dir_ = path::Join(path::GetTempDir(), kTestDirName);
+    EXPECT_OK(path::RemoveDirRec(src_dir_));
+    EXPECT_OK(path::CreateDirRec(src_dir_));
+  }
+
+  void TearDown() override { EXPECT_OK(path::RemoveDirRec(src_dir_)); }
+
+ protected:
+  // Creates a tree of |depth| levels below |rel_dir| with |num_dirs|
+  // sub-directories and |num_files| files in every directory. Returns the
+  // relative Unix paths of all directories, including |rel_dir|.
+  std::vector<std::string> CreateTree(const std::string& rel_dir, int depth,
+                                      int num_dirs, int num_files) {
+    std::vector<std::string> dirs = {rel_dir};
+    EXPECT_OK(
+        path::CreateDirRec(path::Join(src_dir_, path::ToNative(rel_dir))));
+    for (int n = 0; n < num_files; ++n) {
+      std::string rel_path = path::JoinUnix(rel_dir, absl::StrFormat("f%i", n));
+      EXPECT_OK(path::WriteFile(path::Join(src_dir_, path::ToNative(rel_path)),
+                                rel_path));
+    }
+    if (depth == 0) return dirs;
+    for (int n = 0; n < num_dirs; ++n) {
+      std::vector<std::string> sub_dirs =
+          CreateTree(path::JoinUnix(rel_dir, absl::StrFormat("d%i", n)),
+                     depth - 1, num_dirs, num_files);
+      dirs.insert(dirs.end(), sub_dirs.begin(), sub_dirs.end());
+    }
+    return dirs;
+  }
+
+  // Waits until |scanner| is done and takes all |rel_dirs| from it.
+  void ExpectScanned(DirScanner* scanner,
+                     const std::vector<std::string>& rel_dirs, int num_dirs,
+                     int num_files) {
+    while (!scanner->IsDone()) scanner->WaitForDirs();
+    for (const std::string& rel_dir : rel_dirs) {
+      DirScanner::Dir dir;
+      ASSERT_TRUE(scanner->TakeDir(rel_dir, &dir)) << rel_dir;
+      EXPECT_OK(dir.status);
+      EXPECT_TRUE(std::is_sorted(dir.assets.begin(), dir.assets.end()));
+      int dirs = 0, files = 0;
+      for (const AssetInfo& ai : dir.assets) {
+        EXPECT_EQ(path::DirName(ai.path), rel_dir);
+        (ai.type == AssetProto::DIRECTORY ? dirs : files)++;
+      }
+      // Leaf directories don't have sub-directories.
+      if (dirs > 0) EXPECT_EQ(dirs, num_dirs) << rel_dir;
+      EXPECT_EQ(files, num_files) << rel_dir;
+    }
+    EXPECT_EQ(scanner->NumScannedDirs(), rel_dirs.size());
+  }
+
+  std::string src_dir_;
+};
+
+TEST_F(DirScannerTest, ScanDir) {
+  CreateTree("", 1, 2, 2);
+  std::vector<AssetInfo> assets;
+  EXPECT_OK(DirScanner::ScanDir(src_dir_, "d1", &assets));
+  ASSERT_EQ(assets.size(), 2);
+  EXPECT_EQ(assets[0].path, "d1/f0");
+  EXPECT_EQ(assets[0].type, AssetProto::FILE);
+  EXPECT_EQ(assets[0].size, 5);
+  EXPECT_EQ(assets[1].path, "d1/f1");
+}
+
+TEST_F(DirScannerTest, EmptyDir) {
+  DirScanner scanner(src_dir_, 1);
+  scanner.Start();
+  ExpectScanned(&scanner, {""}, 0, 0);
+}
+
+TEST_F(DirScannerTest, SingleThread) {
+  std::vector<std::string> dirs = CreateTree("", 3, 3, 2);
+  DirScanner scanner(src_dir_, 1);
+  scanner.Start();
+  ExpectScanned(&scanner, dirs, 3, 2);
+  EXPECT_EQ(scanner.NumSteals(), 0);
+}
+
+TEST_F(DirScannerTest, MultipleThreads) {
+  std::vector<std::string> dirs = CreateTree("", 3, 4, 2);
+  DirScanner scanner(src_dir_, 4, /*batch_size=*/1);
+  scanner.Start();
+  ExpectScanned(&scanner, dirs, 4, 2);
+}
+
+TEST_F(DirScannerTest, SubDir) {
+  CreateTree("", 2, 2, 1);
+  DirScanner scanner(src_dir_, 2);
+  scanner.Start("d1");
+  ExpectScanned(&scanner, {"d1", "d1/d0", "d1/d1"}, 2, 1);
+  DirScanner::Dir dir;
+  EXPECT_FALSE(scanner.TakeDir("d0", &dir));
+}
+
+TEST_F(DirScannerTest, TakeDirOnlyOnce) {
+  CreateTree("", 1, 1, 1);
+  DirScanner scanner(src_dir_, 2);
+  scanner.Start();
+  while (!scanner.IsDone()) scanner.WaitForDirs();
+
+  EXPECT_TRUE(scanner.IsScanned("d0"));
+  DirScanner::Dir dir;
+  EXPECT_TRUE(scanner.TakeDir("d0", &dir));
+  EXPECT_FALSE(scanner.IsScanned("d0"));
+  EXPECT_FALSE(scanner.TakeDir("d0", &dir));
+}
+
+TEST_F(DirScannerTest, ShutdownWhileScanning) {
+  CreateTree("", 3, 5, 1);
+  DirScanner scanner(src_dir_, 4, /*batch_size=*/1);
+  scanner.Start();
+  scanner.Shutdown();
+  EXPECT_TRUE(scanner.IsDone());
+}
+
+TEST_F(DirScannerTest, PausesWhileTooManyAssetsAreBuffered) {
+  std::vector<std::string> dirs = CreateTree("", 2, 4, 2);
+  DirScanner scanner(src_dir_, 1, /*batch_size=*/1,
+                     /*max_buffered_assets=*/1);
+  scanner.Start();
+
+  // Waits until |num_dirs| directories were scanned and verifies that the
+  // worker pauses afterwards. Does not call WaitForDirs(), which would let
+  // the worker continue.
+  auto expect_paused_after = [&scanner](size_t num_dirs) {
+    Stopwatch sw;
+    while (scanner.NumScannedDirs() < num_dirs && sw.ElapsedSeconds() < 10)
+      absl::SleepFor(absl::Milliseconds(1));
+    absl::SleepFor(absl::Milliseconds(50));
+    EXPECT_EQ(scanner.NumScannedDirs(), num_dirs);
+    EXPECT_FALSE(scanner.IsDone());
+  };
+
+  // The root directory holds 4 directories and 2 files.
+  expect_paused_after(1);
+  EXPECT_EQ(scanner.NumBufferedAssets(), 6);
+
+  // Taking the root directory makes room for one more directory.
+  DirScanner::Dir dir;
+  ASSERT_TRUE(scanner.TakeDir("", &dir));
+  EXPECT_EQ(scanner.NumBufferedAssets(), 0);
+  expect_paused_after(2);
+
+  // A waiting consumer lets the worker continue.
+  while (!scanner.IsDone()) scanner.WaitForDirs();
+  EXPECT_EQ(scanner.NumScannedDirs(), dirs.size());
+  for (size_t n = 1; n < dirs.size(); ++n)
+    EXPECT_TRUE(scanner.TakeDir(dirs[n], &dir)) << dirs[n];
+  EXPECT_EQ(scanner.NumBufferedAssets(), 0);
+}
+
+TEST_F(DirScannerTest, ShutdownWhilePaused) {
+  CreateTree("", 2, 4, 2);
+  DirScanner scanner(src_dir_, 2, /*batch_size=*/1,
+                     /*max_buffered_assets=*/1);
+  scanner.Start();
+  absl::SleepFor(absl::Milliseconds(50));
+  EXPECT_FALSE(scanner.IsDone());
+  scanner.Shutdown();
+  EXPECT_TRUE(scanner.IsDone());
+}
+
+// Benchmark for scanning a tree with 1M files using an increasing number of
+// threads. Run with
+// --gtest_also_run_disabled_tests --gtest_filter=*ScanScalingBenchmark.
+TEST_F(DirScannerTest, DISABLED_ScanScalingBenchmark) {
+  // 10 x 10 x 10 x 10 directories with 100 files each in the leaf level.
+  constexpr int kDepth = 4;
+  constexpr int kFanOut = 10;
+  constexpr int kFilesPerLeafDir = 100;
+
+  Stopwatch sw;
+  std::vector<std::string> leaf_dirs = {""};
+  for (int level = 0; level < kDepth; ++level) {
+    std::vector<std::string> dirs;
+    for (const std::string& parent : leaf_dirs) {
+      for (int n = 0; n < kFanOut; ++n)
+        dirs.push_back(path::JoinUnix(parent, absl::StrFormat("d%i", n)));
+    }
+    leaf_dirs = std::move(dirs);
+  }
+  for (const std::string& rel_dir : leaf_dirs) {
+    std::string dir = path::Join(src_dir_, path::ToNative(rel_dir));
+    ASSERT_OK(path::CreateDirRec(dir));
+    for (int n = 0; n < kFilesPerLeafDir; ++n) {
+      ASSERT_OK(
+          path::WriteFile(path::Join(dir, absl::StrFormat("f%i", n)), ""));
+    }
+  }
+  printf("Created %zu files in %0.3f sec\n",
+         leaf_dirs.size() * kFilesPerLeafDir, sw.ElapsedSeconds());
+
+  for (size_t num_threads : {1, 2, 4, 8, 16}) {
+    sw.Reset();
+    DirScanner scanner(src_dir_, num_threads);
+    scanner.Start();
+    size_t num_files = 0;
+    DirScanner::Dir dir;
+    for (const std::string& rel_dir : leaf_dirs) {
+      while (!scanner.TakeDir(rel_dir, &dir)) scanner.WaitForDirs();
+      num_files += dir.assets.size();
+    }
+    while (!scanner.IsDone()) scanner.WaitForDirs();
+    printf("%2zu threads: %0.3f sec, %zu dirs, %zu files, %zu steals\n",
+           num_threads, sw.ElapsedSeconds(), scanner.NumScannedDirs(),
+           num_files, scanner.NumSteals());
+  }
+}
+
+}  // namespace
+}  // namespace cdc_ft
@@ -18,11 +18,25 @@
 #include "manifest/stats_printer.h"
 
 namespace cdc_ft {
+namespace {
 
-FileChunkMap::FileChunkMap(bool enable_stats) {
-  if (enable_stats) stats_ = std::make_unique<StatsPrinter>();
+// Returns the index of the shard group that holds |content_id|.
+// ContentId::Hash() uses the first bytes, so use the last ones here.
+uint8_t GetGroupIndex(const ContentId& content_id) {
+  return ContentId::GetByte(content_id, ContentId::kHashSize - 1);
 }
 
+// Returns the index of the shard in its group that holds |content_id|.
+uint8_t GetShardIndex(const ContentId& content_id) {
+  return ContentId::GetByte(content_id, ContentId::kHashSize - 2);
+}
+
+}  // namespace
+
+FileChunkMap::FileChunkMap(bool enable_stats)
+    : snapshot_(MakeEmptySnapshot()),
+      stats_(enable_stats ? std::make_unique<StatsPrinter>() : nullptr) {}
+
 FileChunkMap::~FileChunkMap() = default;
 
 void FileChunkMap::Init(std::string path, uint64_t file_size,
@@ -33,27 +47,24 @@ void FileChunkMap::Init(std::string path, uint64_t file_size,
   file_updates_.push_back(std::move(update));
 }
 
-void FileChunkMap::AppendCopy(std::string path,
-                              const RepeatedChunkRefProto& list,
-                              uint64_t list_offset) {
+void FileChunkMap::Append(std::string path, const RepeatedChunkRefProto& list,
+                          uint64_t list_offset) {
   FileUpdate update(FileUpdateType::kAppend, std::move(path));
   update.chunks.reserve(list.size());
-  for (const ChunkRefProto& ch : list)
-    update.chunks.emplace_back(ch.chunk_id(), ch.offset() + list_offset);
-  file_updates_.push_back(std::move(update));
-}
-
-void FileChunkMap::AppendMove(std::string path, RepeatedChunkRefProto* list,
-                              uint64_t list_offset) {
-  FileUpdate update(FileUpdateType::kAppend, std::move(path));
-  update.chunks.reserve(list->size());
-  for (ChunkRefProto& ch : *list) {
-    update.chunks.emplace_back(std::move(*ch.mutable_chunk_id()),
+  for (const ChunkRefProto& ch : list) {
+    update.chunks.emplace_back(ContentId(ch.chunk_id()),
                                ch.offset() + list_offset);
   }
   file_updates_.push_back(std::move(update));
 }
 
+void FileChunkMap::Append(std::string path, const RepeatedChunkRefProto& list,
+                          uint64_t list_offset, uint64_t file_size) {
+  Append(std::move(path), list, list_offset);
+  file_updates_.back().file_size = file_size;
+  file_updates_.back().set_file_size = true;
+}
+
 void FileChunkMap::Remove(std::string path) {
   FileUpdate update(FileUpdateType::kRemove, std::move(path));
   file_updates_.push_back(std::move(update));
@@ -67,45 +78,64 @@ void FileChunkMap::Clear() {
 void FileChunkMap::FlushUpdates() {
   if (file_updates_.empty()) return;
 
-  absl::MutexLock lock(&mutex_);
+  // New versions of all files touched by the updates, keyed by path. A null
+  // value means that the file was removed. Files in |path_to_file_| are shared
+  // with snapshots and never modified in place.
+  absl::flat_hash_map<std::string, std::shared_ptr<File>> touched;
+  std::vector<std::shared_ptr<const File>> removed_files;
+  bool clear = false;
+
+  // Returns the new version of the file at |path|. On first access, retires
+  // the current version and, if |copy| is true, starts off with a copy of it.
+  auto touch = [this, &touched, &removed_files](
+                   const std::string& path,
+                   bool copy) -> std::shared_ptr<File>& {
+    auto [iter, inserted] = touched.try_emplace(path);
+    if (!inserted) return iter->second;
+    PathToFileMap::iterator p2f_iter = path_to_file_.find(path);
+    if (p2f_iter != path_to_file_.end()) {
+      if (copy) iter->second = std::make_shared<File>(*p2f_iter->second);
+      removed_files.push_back(std::move(p2f_iter->second));
+      path_to_file_.erase(p2f_iter);
+    }
+    return iter->second;
+  };
 
   for (FileUpdate& update : file_updates_) {
     switch (update.type) {
       case FileUpdateType::kInit: {
-        File& file = path_to_file_[update.path];
-        file.size = update.file_size;
-        assert(total_chunks_ >= file.chunks.size());
-        total_chunks_ -= file.chunks.size();
-        total_chunks_ += update.chunks.size();
-        file.chunks = std::move(update.chunks);
+        std::shared_ptr<File>& file = touch(update.path, /*copy=*/false);
+        file = std::make_shared<File>(update.path);
+        file->size = update.file_size;
+        file->chunks = std::move(update.chunks);
         break;
       }
 
       case FileUpdateType::kAppend: {
-        File& file = path_to_file_[update.path];
-        total_chunks_ += update.chunks.size();
-        if (file.chunks.empty()) {
-          file.chunks = std::move(update.chunks);
+        std::shared_ptr<File>& file = touch(update.path, /*copy=*/true);
+        if (!file) file = std::make_shared<File>(update.path);
+        if (update.set_file_size) file->size = update.file_size;
+        if (file->chunks.empty()) {
+          file->chunks = std::move(update.chunks);
         } else {
-          file.chunks.reserve(file.chunks.size() + update.chunks.size());
+          file->chunks.reserve(file->chunks.size() + update.chunks.size());
           std::move(std::begin(update.chunks), std::end(update.chunks),
-                    std::back_inserter(file.chunks));
+                    std::back_inserter(file->chunks));
         }
         break;
       }
 
       case FileUpdateType::kRemove: {
-        const auto iter = path_to_file_.find(update.path);
-        if (iter == path_to_file_.end()) break;
-        assert(total_chunks_ >= iter->second.chunks.size());
-        total_chunks_ -= iter->second.chunks.size();
-        path_to_file_.erase(iter);
+        touch(update.path, /*copy=*/false).reset();
         break;
       }
 
       case FileUpdateType::kClear: {
+        // The new snapshot starts off empty, so there is nothing to remove.
         path_to_file_.clear();
-        total_chunks_ = 0;
+        touched.clear();
+        removed_files.clear();
+        clear = true;
         break;
       }
     }
@@ -113,24 +143,37 @@ void FileChunkMap::FlushUpdates() {
 
   file_updates_.clear();
 
-  UpdateIdToChunkMap();
+  std::vector<std::shared_ptr<const File>> added_files;
+  added_files.reserve(touched.size());
+  for (auto& [path, file] : touched) {
+    if (!file) continue;
+    added_files.push_back(file);
+    path_to_file_[path] = std::move(file);
+  }
+
+  std::atomic_store(&snapshot_,
+                    BuildSnapshot(removed_files, added_files, clear));
+
+  if (stats_) {
+    absl::MutexLock lock(&mutex_);
+    RebuildStats();
+  }
 }
 
-bool FileChunkMap::Lookup(const ContentIdProto& content_id, std::string* path,
-                          uint64_t* offset, uint32_t* size) {
+bool FileChunkMap::Lookup(const ContentId& content_id, std::string* path,
+                          uint64_t* offset, uint32_t* size) const {
   assert(path && offset && size);
 
-  absl::MutexLock lock(&mutex_);
-
-  return FindChunk(content_id, path, offset, size, nullptr);
+  std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&snapshot_);
+  return FindChunk(*snapshot, content_id, path, offset, size, nullptr);
 }
 
-void FileChunkMap::RecordStreamedChunk(const ContentIdProto& content_id,
+void FileChunkMap::RecordStreamedChunk(const ContentId& content_id,
                                        size_t thread_id) {
-  absl::MutexLock lock(&mutex_);
-
   if (!stats_) return;
 
+  absl::MutexLock lock(&mutex_);
+
   if (streamed_chunks_to_thread_.find(content_id) !=
       streamed_chunks_to_thread_.end()) {
     return;
@@ -139,16 +182,18 @@ void FileChunkMap::RecordStreamedChunk(const ContentIdProto& content_id,
   std::string path;
   uint32_t size;
   size_t index;
-  if (FindChunk(content_id, &path, nullptr, &size, &index))
+  if (FindChunk(*std::atomic_load(&snapshot_), content_id, &path, nullptr,
+                &size, &index)) {
     stats_->RecordStreamedChunk(path, index, size, thread_id);
+  }
   streamed_chunks_to_thread_[content_id] = thread_id;
 }
 
-void FileChunkMap::RecordCachedChunk(const ContentIdProto& content_id) {
-  absl::MutexLock lock(&mutex_);
-
+void FileChunkMap::RecordCachedChunk(const ContentId& content_id) {
   if (!stats_) return;
 
+  absl::MutexLock lock(&mutex_);
+
   if (cached_chunks_.find(content_id) != cached_chunks_.end()) return;
 
   // Restarting FUSE might report cached chunks that have been originally
@@ -161,89 +206,187 @@ void FileChunkMap::RecordCachedChunk(const ContentIdProto& content_id) {
   std::string path;
   uint32_t size;
   size_t index;
-  if (FindChunk(content_id, &path, nullptr, &size, &index))
+  if (FindChunk(*std::atomic_load(&snapshot_), content_id, &path, nullptr,
+                &size, &index)) {
     stats_->RecordCachedChunk(path, index, size);
+  }
   cached_chunks_.insert(content_id);
 }
 
 void FileChunkMap::PrintStats() {
-  absl::MutexLock lock(&mutex_);
-
   if (!stats_) return;
 
+  absl::MutexLock lock(&mutex_);
+
   stats_->Print();
 }
 
-bool FileChunkMap::HasStats() const {
-  absl::ReaderMutexLock lock(&mutex_);
-  return stats_ != nullptr;
+bool FileChunkMap::HasStats() const { return stats_ != nullptr; }
+
+// static
+std::shared_ptr<const FileChunkMap::Snapshot>
+FileChunkMap::MakeEmptySnapshot() {
+  static_assert(kFanOut == 256, "Groups and shards are indexed by one byte");
+  auto group = std::make_shared<ShardGroup>();
+  group->shards.fill(std::make_shared<const IdToChunkMap>());
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->groups.fill(std::move(group));
+  return snapshot;
 }
 
-void FileChunkMap::UpdateIdToChunkMap() {
-  assert((mutex_.AssertHeld(), true));
-
-  // Put all chunks into the map.
-  id_to_chunk_.clear();
-  id_to_chunk_.reserve(total_chunks_);
-  for (const auto& [path, file] : path_to_file_) {
-    for (uint32_t n = 0; n < static_cast<uint32_t>(file.chunks.size()); ++n)
-      id_to_chunk_[ContentIdRef(file.chunks[n].content_id)] = {&path, n};
+std::shared_ptr<const FileChunkMap::Snapshot> FileChunkMap::BuildSnapshot(
+    const std::vector<std::shared_ptr<const File>>& removed_files,
+    const std::vector<std::shared_ptr<const File>>& added_files, bool clear) {
+  std::shared_ptr<const Snapshot> base =
+      clear ? MakeEmptySnapshot() : std::atomic_load(&snapshot_);
+
+  // Shards modified by this update, indexed by group and shard index. They are
+  // copied from |base| on first write.
+  std::vector<std::shared_ptr<IdToChunkMap>> new_shards(kFanOut * kFanOut);
+  auto get_shard = [&new_shards,
+                    &base](const ContentId& content_id) -> IdToChunkMap& {
+    uint8_t group_index = GetGroupIndex(content_id);
+    uint8_t shard_index = GetShardIndex(content_id);
+    std::shared_ptr<IdToChunkMap>& shard =
+        new_shards[group_index * kFanOut + shard_index];
+    if (!shard) {
+      shard = std::make_shared<IdToChunkMap>(
+          *base->groups[group_index]->shards[shard_index]);
+    }
+    return *shard;
+  };
+
+  // Points the entry at |iter| to chunk |index| of |file|. The entry is
+  // re-inserted as its key has to point into the new file.
+  auto relocate = [](IdToChunkMap* shard, IdToChunkMap::iterator iter,
+                     std::shared_ptr<const File> file, uint32_t index) {
+    uint32_t ref_count = iter->second.ref_count;
+    ContentIdRef key(file->chunks[index].content_id);
+    shard->erase(iter);
+    shard->emplace(key, ChunkLocation{std::move(file), index, ref_count});
+  };
+
+  // Remove the chunks of removed files. Ids that are still contained in other
+  // files but point into a removed file are collected in |orphans|.
+  absl::flat_hash_set<const File*> removed_set;
+  std::vector<const ContentId*> orphans;
+  for (const std::shared_ptr<const File>& file : removed_files) {
+    removed_set.insert(file.get());
+    for (const FileChunk& chunk : file->chunks) {
+      IdToChunkMap& shard = get_shard(chunk.content_id);
+      IdToChunkMap::iterator iter = shard.find(ContentIdRef(chunk.content_id));
+      assert(iter != shard.end());
+      if (iter == shard.end()) continue;
+      ChunkLocation& loc = iter->second;
+      assert(loc.ref_count > 0);
+      if (--loc.ref_count == 0) {
+        shard.erase(iter);
+      } else if (loc.file == file) {
+        orphans.push_back(&chunk.content_id);
+      }
+    }
   }
 
-  // Might be "<" if multiple files contain the same chunk.
-  assert(id_to_chunk_.size() <= total_chunks_);
-
-  // Rebuild stats if present.
-  if (stats_) {
-    stats_->Clear();
-    for (const auto& [path, file] : path_to_file_)
-      stats_->InitFile(path, file.chunks.size());
-
-    // Fill in the streamed chunks.
-    std::string path;
-    uint32_t size;
-    size_t index;
-    for (const auto& [id, thread_id] : streamed_chunks_to_thread_) {
-      if (FindChunk(id, &path, nullptr, &size, &index))
-        stats_->RecordStreamedChunk(path, index, size, thread_id);
+  // Add the chunks of added files.
+  for (const std::shared_ptr<const File>& file : added_files) {
+    for (uint32_t n = 0; n < static_cast<uint32_t>(file->chunks.size()); ++n) {
+      const ContentId& id = file->chunks[n].content_id;
+      IdToChunkMap& shard = get_shard(id);
+      IdToChunkMap::iterator iter = shard.find(ContentIdRef(id));
+      if (iter == shard.end()) {
+        shard.emplace(ContentIdRef(id), ChunkLocation{file, n, 1});
+        continue;
+      }
+      ++iter->second.ref_count;
+      if (removed_set.contains(iter->second.file.get()))
+        relocate(&shard, iter, file, n);
     }
+  }
 
-    // Fill in the cached chunks.
-    for (const ContentIdProto& id : cached_chunks_) {
-      if (FindChunk(id, &path, nullptr, &size, &index))
-        stats_->RecordCachedChunk(path, index, size);
+  // Relocate the remaining orphans to unchanged files that contain them.
+  absl::flat_hash_set<ContentId> remaining;
+  for (const ContentId* id : orphans) {
+    IdToChunkMap& shard = get_shard(*id);
+    IdToChunkMap::iterator iter = shard.find(ContentIdRef(*id));
+    if (iter != shard.end() && removed_set.contains(iter->second.file.get()))
+      remaining.insert(*id);
+  }
+  for (const auto& [path, file] : path_to_file_) {
+    if (remaining.empty()) break;
+    for (uint32_t n = 0; n < static_cast<uint32_t>(file->chunks.size()); ++n) {
+      const ContentId& id = file->chunks[n].content_id;
+      if (remaining.erase(id) == 0) continue;
+      IdToChunkMap& shard = get_shard(id);
+      relocate(&shard, shard.find(ContentIdRef(id)), file, n);
     }
-
-    // Make sure the above RecordStreamedChunk() calls don't count towards
-    // bandwidth stats.
-    stats_->ResetBandwidthStats();
   }
+  assert(remaining.empty());
+
+  // Copy the groups of modified shards and put the shards in place.
+  auto snapshot = std::make_shared<Snapshot>(*base);
+  std::array<std::shared_ptr<ShardGroup>, kFanOut> new_groups;
+  for (size_t index = 0; index < new_shards.size(); ++index) {
+    if (!new_shards[index]) continue;
+    std::shared_ptr<ShardGroup>& group = new_groups[index / kFanOut];
+    if (!group) {
+      group = std::make_shared<ShardGroup>(*base->groups[index / kFanOut]);
+    }
+    group->shards[index % kFanOut] = std::move(new_shards[index]);
+  }
+  for (size_t n = 0; n < kFanOut; ++n) {
+    if (new_groups[n]) snapshot->groups[n] = std::move(new_groups[n]);
+  }
+  return snapshot;
 }
 
-bool FileChunkMap::FindChunk(const ContentIdProto& content_id,
-                             std::string* path, uint64_t* offset,
-                             uint32_t* size, size_t* index) {
+void FileChunkMap::RebuildStats() {
   assert((mutex_.AssertHeld(), true));
 
-  // Find the |id_to_chunk_| entry by |content_id|. It might not exist if
-  // changes to the manifest have not propagated to gamelets yet.
-  IdToChunkMap::iterator i2c_iter = id_to_chunk_.find(ContentIdRef(content_id));
-  if (i2c_iter == id_to_chunk_.end()) return false;
+  stats_->Clear();
+  for (const auto& [path, file] : path_to_file_)
+    stats_->InitFile(path, file->chunks.size());
+
+  // Fill in the streamed chunks.
+  std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&snapshot_);
+  std::string path;
+  uint32_t size;
+  size_t index;
+  for (const auto& [id, thread_id] : streamed_chunks_to_thread_) {
+    if (FindChunk(*snapshot, id, &path, nullptr, &size, &index))
+      stats_->RecordStreamedChunk(path, index, size, thread_id);
+  }
+
+  // Fill in the cached chunks.
+  for (const ContentId& id : cached_chunks_) {
+    if (FindChunk(*snapshot, id, &path, nullptr, &size, &index))
+      stats_->RecordCachedChunk(path, index, size);
+  }
+
+  // Make sure the above RecordStreamedChunk() calls don't count towards
+  // bandwidth stats.
+  stats_->ResetBandwidthStats();
+}
 
-  // Find the chunk location by path. This lookup should not fail because
-  // |path_to_file_| and |id_to_chunk_| should always be in sync here.
-  const ChunkLocation& loc = i2c_iter->second;
-  PathToFileMap::iterator p2f_iter = path_to_file_.find(*loc.path);
-  assert(p2f_iter != path_to_file_.end());
+// static
+bool FileChunkMap::FindChunk(const Snapshot& snapshot,
+                             const ContentId& content_id, std::string* path,
+                             uint64_t* offset, uint32_t* size, size_t* index) {
+  // Find the entry by |content_id|. It might not exist if changes to the
+  // manifest have not propagated to gamelets yet.
+  const IdToChunkMap& shard = *snapshot.groups[GetGroupIndex(content_id)]
+                                   ->shards[GetShardIndex(content_id)];
+  IdToChunkMap::const_iterator iter = shard.find(ContentIdRef(content_id));
+  if (iter == shard.end()) return false;
 
   // Compute path, chunk offset and chunk size.
-  const File& file = p2f_iter->second;
+  const ChunkLocation& loc = iter->second;
+  const File& file = *loc.file;
   assert(loc.index < file.chunks.size());
   uint64_t this_offset = file.chunks[loc.index].offset;
   uint64_t next_offset = loc.index + 1 == file.chunks.size()
                              ? file.size
                              : file.chunks[loc.index + 1].offset;
-  if (path) *path = *loc.path;
+  if (path) *path = file.path;
   if (offset) *offset = this_offset;
   if (size) *size = static_cast<uint32_t>(next_offset - this_offset);
   if (index) *index = loc.index;
@@ -17,6 +17,7 @@
 #ifndef MANIFEST_FILE_CHUNK_MAP_H_
 #define MANIFEST_FILE_CHUNK_MAP_H_
 
+#include <array>
 #include <memory>
 #include <string>
 #include <vector>
@@ -34,17 +35,23 @@ class StatsPrinter;
 // A file chunk, used by the FileChunkMap.
 struct FileChunk {
   // Id of the chunk.
-  ContentIdProto content_id;
+  ContentId content_id;
 
   // Absolute offset of the chunk in the file.
   uint64_t offset = 0;
 
-  FileChunk(ContentIdProto content_id, uint64_t offset)
-      : content_id(std::move(content_id)), offset(offset) {}
+  FileChunk(const ContentId& content_id, uint64_t offset)
+      : content_id(content_id), offset(offset) {}
 };
 
 // Manages chunk lookups by content id. The class can be populated by passing it
 // to ManifestUpdater and then used to look up chunks by calling Lookup().
+//
+// Lookups read an immutable snapshot of the chunk index and never wait for
+// updates. FlushUpdates() builds the next snapshot from the previous one,
+// copying only the index shards touched by the update, and then publishes it
+// atomically. Old snapshots are released once the last lookup using them
+// completes. Updates must all be made from the same thread.
 class FileChunkMap {
  public:
   // If |enable_stats| is true, keeps detailed statistics on chunk access
@@ -62,15 +69,15 @@ class FileChunkMap {
             std::vector<FileChunk>* chunks = nullptr);
 
   // Appends the chunks in |list| to the entry for |path|. |list_offset| is
-  // added to all chunk offsets in |list|. Copies ContentIdProtos from the list.
+  // added to all chunk offsets in |list|.
   // The operation is queued and gets applied by calling FlushUpdates().
-  void AppendCopy(std::string path, const RepeatedChunkRefProto& list,
-                  uint64_t list_offset);
+  void Append(std::string path, const RepeatedChunkRefProto& list,
+              uint64_t list_offset);
 
-  // Same as above, but modifies |list| by moving ContentIdProtos off the list.
-  // The operation is queued and gets applied by calling FlushUpdates().
-  void AppendMove(std::string path, RepeatedChunkRefProto* list,
-                  uint64_t list_offset);
+  // Like Append(), but also sets the size of the entry to |file_size|. Used to
+  // add the chunks of a file range by range.
+  void Append(std::string path, const RepeatedChunkRefProto& list,
+              uint64_t list_offset, uint64_t file_size);
 
   // Removes the entry for |path|.
   // The operation is queued and gets applied by calling FlushUpdates().
@@ -80,25 +87,27 @@ class FileChunkMap {
   // The operation is queued and gets applied by calling FlushUpdates().
   void Clear();
 
-  // Flushes all updates made by the above functions.
+  // Flushes all updates made by the above functions. Lookups keep using the
+  // previous snapshot until the new one is published.
   void FlushUpdates() ABSL_LOCKS_EXCLUDED(mutex_);
 
   // Looks up the file |path|, the chunk |offset| and chunk |size| by the given
   // |content_id|. Returns false if the entry does not exist.
-  bool Lookup(const ContentIdProto& content_id, std::string* path,
-              uint64_t* offset, uint32_t* size) ABSL_LOCKS_EXCLUDED(mutex_);
+  // Thread-safe and does not block on FlushUpdates().
+  bool Lookup(const ContentId& content_id, std::string* path,
+              uint64_t* offset, uint32_t* size) const;
 
   // Records that a chunk with the given |content_id| was streamed from the
   // workstation.
   // |thread_id| is the id of the thread that requested the chunk on the
   // gamelet, usually the hash of the std::thread::id.
   // No-op if |enable_stats| was false in the constructor.
-  void RecordStreamedChunk(const ContentIdProto& content_id, size_t thread_id)
+  void RecordStreamedChunk(const ContentId& content_id, size_t thread_id)
       ABSL_LOCKS_EXCLUDED(mutex_);
 
   // Records that a chunk with the given |content_id| is cached on the gamelet.
   // No-op if |enable_stats| was false in the constructor.
-  void RecordCachedChunk(const ContentIdProto& content_id)
+  void RecordCachedChunk(const ContentId& content_id)
       ABSL_LOCKS_EXCLUDED(mutex_);
 
   // Prints detailed chunk statistics.
@@ -109,11 +118,16 @@ class FileChunkMap {
 
  private:
   struct File {
+    // Relative Unix path of the file.
+    std::string path;
+
     // All chunks in the file.
     std::vector<FileChunk> chunks;
 
     // Total file size.
     uint64_t size = 0;
+
+    explicit File(std::string path) : path(std::move(path)) {}
   };
 
   enum class FileUpdateType { kInit, kAppend, kRemove, kClear };
@@ -122,6 +136,8 @@ class FileChunkMap {
     FileUpdateType type = FileUpdateType::kInit;
     std::string path;
     uint64_t file_size = 0;
+    // Whether a kAppend update sets |file_size|.
+    bool set_file_size = false;
     std::vector<FileChunk> chunks;
 
     FileUpdate(FileUpdateType type, std::string path)
@@ -129,18 +145,23 @@ class FileChunkMap {
   };
 
   struct ChunkLocation {
-    // Asset path, also key into |path_to_file_| map.
-    const std::string* path = nullptr;
+    // File that contains the chunk. Keeps the file alive as long as any
+    // snapshot references it.
+    std::shared_ptr<const File> file;
 
-    // Index into |path_to_file_[*path].chunks|.
+    // Index into |file->chunks|.
     uint32_t index = 0;
+
+    // Number of chunks in all files with this content id.
+    uint32_t ref_count = 0;
   };
 
-  // Keeps a pointer to a content id proto and compares by value.
+  // Keeps a pointer to a content id and compares by value. Keeps index entries
+  // small since the id is already stored in the file's chunk list.
   struct ContentIdRef {
-    const ContentIdProto* content_id;
+    const ContentId* content_id;
 
-    explicit ContentIdRef(const ContentIdProto& content_id)
+    explicit ContentIdRef(const ContentId& content_id)
         : content_id(&content_id) {}
 
     bool operator==(const ContentIdRef& other) const {
@@ -153,51 +174,76 @@ class FileChunkMap {
 
   struct ContentIdRefHash {
     std::size_t operator()(const ContentIdRef& ref) const noexcept {
-      return hash(*ref.content_id);
+      return ref.content_id->Hash();
     }
-    std::hash<ContentIdProto> hash;
   };
 
-  // Updates |id_to_chunk_|. Also rebuilds |stats_| if present.
-  void UpdateIdToChunkMap() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Maps content id to file and chunk index. The key points into the chunk
+  // list of the file referenced by the value.
+  using IdToChunkMap =
+      absl::flat_hash_map<ContentIdRef, ChunkLocation, ContentIdRefHash>;
+
+  // The index is a two-level tree of small shards, selected by two bytes of
+  // the content id. Updates only copy the shards and groups they touch.
+  static constexpr size_t kFanOut = 256;
+
+  struct ShardGroup {
+    std::array<std::shared_ptr<const IdToChunkMap>, kFanOut> shards;
+  };
+
+  // Immutable view of the index used by lookups.
+  struct Snapshot {
+    std::array<std::shared_ptr<const ShardGroup>, kFanOut> groups;
+  };
+
+  // Returns a snapshot of an empty index.
+  static std::shared_ptr<const Snapshot> MakeEmptySnapshot();
+
+  // Builds a new snapshot from the current one by removing the chunks of
+  // |removed_files| and adding the chunks of |added_files|. If |clear| is true,
+  // starts from an empty index instead.
+  std::shared_ptr<const Snapshot> BuildSnapshot(
+      const std::vector<std::shared_ptr<const File>>& removed_files,
+      const std::vector<std::shared_ptr<const File>>& added_files, bool clear);
 
-  // Finds a chunk its by |content_id|.
+  // Rebuilds |stats_| from |path_to_file_| and the recorded chunks.
+  void RebuildStats() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Finds a chunk its by |content_id| in |snapshot|.
   // |path| returns the relative Unix path of a file that contains the chunk.
   // |offset| returns the offset of the chunk in the file.
   // |size| returns the size of the chunk.
   // |index| returns the index of the chunk in the File struct.
   // All output variables are optional.
-  // Calls MaybeUpdateIdToChunkMap().
   // Returns true if the chunk was found.
-  bool FindChunk(const ContentIdProto& content_id, std::string* path,
-                 uint64_t* offset, uint32_t* size, size_t* index)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static bool FindChunk(const Snapshot& snapshot, const ContentId& content_id,
+                        std::string* path,
+                        uint64_t* offset, uint32_t* size, size_t* index);
 
   // Queued updates.
   std::vector<FileUpdate> file_updates_;
 
   // Maps the relative Unix path of assets to its file size and chunks.
-  using PathToFileMap = absl::flat_hash_map<std::string, File>;
-  PathToFileMap path_to_file_ ABSL_GUARDED_BY(mutex_);
-
-  // Maps content id to path and chunk index.
-  using IdToChunkMap =
-      absl::flat_hash_map<ContentIdRef, ChunkLocation, ContentIdRefHash>;
-  IdToChunkMap id_to_chunk_ ABSL_GUARDED_BY(mutex_);
+  // Only accessed by the updating thread.
+  using PathToFileMap =
+      absl::flat_hash_map<std::string, std::shared_ptr<const File>>;
+  PathToFileMap path_to_file_;
 
-  size_t total_chunks_ ABSL_GUARDED_BY(mutex_) = 0;
+  // Current snapshot. Must be accessed with std::atomic_load/atomic_store.
+  std::shared_ptr<const Snapshot> snapshot_;
 
   // Keeps detailed chunk access statistics.
   // Only used if |enable_stats| was set to true in the constructor.
-  std::unique_ptr<StatsPrinter> stats_ ABSL_GUARDED_BY(mutex_);
+  const std::unique_ptr<StatsPrinter> stats_ ABSL_PT_GUARDED_BY(mutex_);
 
   // All chunks streamed from/cached on the gamelet.
   // The data is used to rebuild stats in case of a the manifest update.
   // Only used if |enable_stats| was set to true in the constructor.
-  absl::flat_hash_map<ContentIdProto, size_t> streamed_chunks_to_thread_
+  absl::flat_hash_map<ContentId, size_t> streamed_chunks_to_thread_
       ABSL_GUARDED_BY(mutex_);
-  absl::flat_hash_set<ContentIdProto> cached_chunks_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_set<ContentId> cached_chunks_ ABSL_GUARDED_BY(mutex_);
 
+  // Protects the stats.
   mutable absl::Mutex mutex_;
 };
 
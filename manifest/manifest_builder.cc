@@ -14,6 +14,7 @@
 
 #include "manifest/manifest_builder.h"
 
+#include <algorithm>
 #include <cassert>
 #include <deque>
 
@@ -42,6 +43,27 @@ inline std::string JoinUnixPath(const std::vector<absl::string_view>& path) {
   return JoinStrings(path, 0, path.size(), '/');
 }
 
+// Returns true if an indirect list of |list_size| bytes should end after its
+// last item, which has a proto size of |item_size| and is identified by
+// |item_hash|.
+//
+// Lists end at content-defined boundaries rather than when they are full, so
+// that inserting or removing an item only changes the list that contains it
+// instead of shifting the items of all subsequent lists. Once a list is a
+// quarter full, every byte is a boundary with the same probability, which
+// makes lists about 2/3 of |max_size| on average. Lists that only fit a few
+// items are always filled up.
+inline bool IsIndirectListBoundary(uint64_t item_hash, size_t item_size,
+                                   size_t list_size, size_t max_size) {
+  if (item_size * 16 > max_size || list_size < max_size / 4) return false;
+  return item_hash % max_size < item_size * 2;
+}
+
+// Returns a hash of the asset |name| that is stable across processes.
+inline uint64_t AssetNameHash(const std::string& name) {
+  return ContentId(ContentId::FromDataString(name)).Hash();
+}
+
 }  // namespace
 
 ManifestBuilder::ManifestBuilder(CdcParamsProto cdc_params,
@@ -70,6 +92,7 @@ absl::Status ManifestBuilder::LoadManifest(const ContentIdProto& manifest_id) {
 
 void ManifestBuilder::Reset() {
   asset_lists_.clear();
+  dirty_asset_lists_.clear();
   manifest_id_.Clear();
   manifest_bytes_written_ = 0;
   manifest_chunks_written_ = 0;
@@ -212,6 +235,9 @@ absl::StatusOr<AssetProto*> ManifestBuilder::FindOrCreateDirPathRec(
     result = FindMutableAssetInList(name, AssetProto::DIRECTORY, overwrite,
                                     asset_list->mutable_assets());
     if (result.ok()) {
+      // The sub-directory is stored inline, so any change to it or below it
+      // changes this list as well.
+      dirty_asset_lists_.insert(asset_list);
       // Recurse into the sub-directory.
       return FindOrCreateDirPathRec(path, path_idx + 1, result.value(),
                                     create_dirs);
@@ -260,6 +286,8 @@ absl::StatusOr<AssetProto*> ManifestBuilder::FindAssetInDir(
                      dir->name());
     result = FindMutableAssetInList(name, asset_list->mutable_assets());
     if (result.ok()) {
+      // The returned asset might be modified by the caller.
+      dirty_asset_lists_.insert(asset_list);
       return result.value();
     }
     if (!absl::IsNotFound(result.status())) {
@@ -315,6 +343,7 @@ absl::Status ManifestBuilder::DeleteAssetFromDir(absl::string_view name,
                      "Failed to look up asset '%s' in directory '%s'", name,
                      dir->name());
     if (DeleteAssetFromList(name, asset_list->mutable_assets())) {
+      dirty_asset_lists_.insert(asset_list);
       return absl::OkStatus();
     }
   }
@@ -416,6 +445,11 @@ absl::Status ManifestBuilder::FlushDir(AssetProto* dir) {
       continue;
     }
     AssetListProto* asset_list = asset_list_it->second;
+    // Skip any list that was not modified, its content ID is still valid.
+    if (dirty_asset_lists_.erase(asset_list) == 0) {
+      ++it;
+      continue;
+    }
     // Flush the list and enforce the chunk size limit.
     RETURN_IF_ERROR(FlushAssetList(asset_list->mutable_assets()),
                     "Failed to flush indirect asset list %s in directory '%s'",
@@ -458,8 +492,11 @@ absl::Status ManifestBuilder::FlushAssetList(RepeatedAssetProto* assets) {
 inline void SortByProtoSizeDesc(RepeatedAssetProto* assets) {
   std::sort(assets->begin(), assets->end(),
             [](const AssetProto& a, const AssetProto& b) -> bool {
-              // Compare greater than for descending order.
-              return a.ByteSizeLong() > b.ByteSizeLong();
+              // Compare greater than for descending order. Break ties by name
+              // so that the same assets are moved to indirect lists.
+              size_t a_size = a.ByteSizeLong(), b_size = b.ByteSizeLong();
+              if (a_size != b_size) return a_size > b_size;
+              return a.name() < b.name();
             });
 }
 
@@ -544,13 +581,15 @@ absl::Status ManifestBuilder::EnforceFileProtoSize(
   // |arena_|, we don't need to worry about leaking memory here.
   ChunkListProto* chunk_list = MakeProto<ChunkListProto>();
   size_t chunk_list_size = 0;
-  uint64_t chunk_list_offset = overflow.back()->offset();
+  uint64_t chunk_list_offset = 0;
   const size_t max_size = manifest_->cdc_params().avg_chunk_size();
   while (!overflow.empty()) {
     ChunkRefProto* chunk_ref = overflow.back();
     overflow.pop_back();
-    // Convert the chunk's absolute offset to a relative one.
+    // The first chunk in the list defines the chunk list's offset.
     uint64_t chunk_absolute_offset = chunk_ref->offset();
+    if (chunk_list_size == 0) chunk_list_offset = chunk_absolute_offset;
+    // Convert the chunk's absolute offset to a relative one.
     chunk_ref->set_offset(chunk_absolute_offset - chunk_list_offset);
     size_t chunkref_proto_size =
         chunk_ref->ByteSizeLong() + kRepeatedProtoFieldOverhead;
@@ -561,7 +600,6 @@ absl::Status ManifestBuilder::EnforceFileProtoSize(
                                          file->add_file_indirect_chunks()));
       chunk_list->Clear();
       chunk_list_size = 0;
-      // The first chunk in the list defines the chunk list's offset.
       chunk_list_offset = chunk_absolute_offset;
       chunk_ref->set_offset(0);
       chunkref_proto_size =
@@ -574,6 +612,17 @@ absl::Status ManifestBuilder::EnforceFileProtoSize(
     // When the estimates get us above the limit, calculate the accurate size.
     if (chunk_list_size > max_size)
       chunk_list_size = chunk_list->ByteSizeLong();
+    // End the list at a content-defined boundary. Chunk IDs are hashes, so
+    // they can be used as hash values directly.
+    if (!overflow.empty() &&
+        IsIndirectListBoundary(ContentId(chunk_ref->chunk_id()).Hash(),
+                               chunkref_proto_size, chunk_list_size,
+                               max_size)) {
+      RETURN_IF_ERROR(WriteBackChunkList(chunk_list_offset, *chunk_list,
+                                         file->add_file_indirect_chunks()));
+      chunk_list->Clear();
+      chunk_list_size = 0;
+    }
   }
   // Write back final chunk list.
   return WriteBackChunkList(chunk_list_offset, *chunk_list,
@@ -645,6 +694,8 @@ absl::Status ManifestBuilder::AppendAllocatedIndirectAssets(
   // list, but ignores any overhead from the embedding proto format (which
   // should be negliable).
   size_t proto_size = 0;
+  // Whether the list currently in use ends at a content-defined boundary.
+  bool list_ended = false;
 
   // Find or create the AssetListProto where we can append the assets.
   if (dir->dir_indirect_assets_size() > 0) {
@@ -663,6 +714,13 @@ absl::Status ManifestBuilder::AppendAllocatedIndirectAssets(
     asset_list = MakeProto<AssetListProto>();
   }
 
+  // Append the assets in the order of their names, so that the same assets
+  // end up in the same lists. They are released from the back.
+  std::sort(assets->pointer_begin(), assets->pointer_end(),
+            [](const AssetProto* a, const AssetProto* b) {
+              return a->name() > b->name();
+            });
+
   while (!assets->empty()) {
     // Use the UnsafeArena* function to avoid a heap copy of the message. Even
     // though it is released from the proto, the memory is still owned by the
@@ -670,10 +728,11 @@ absl::Status ManifestBuilder::AppendAllocatedIndirectAssets(
     AssetProto* asset = assets->UnsafeArenaReleaseLast();
     size_t asset_proto_size =
         asset->ByteSizeLong() + kRepeatedProtoFieldOverhead;
-    // See if we need to create a new AssetListProto.
+    // See if we need to create a new AssetListProto, either because the
+    // current list is full or because it ended at a content-defined boundary.
     if (max_size > 0 && proto_size > 0 &&
-        proto_size + asset_proto_size > max_size) {
-      // Write back the full list to the data store.
+        (list_ended || proto_size + asset_proto_size > max_size)) {
+      // Write back the current list to the data store.
       RETURN_IF_ERROR(
           WriteBackAssetList(
               asset_list, dir->mutable_dir_indirect_assets(asset_list_index)),
@@ -687,6 +746,9 @@ absl::Status ManifestBuilder::AppendAllocatedIndirectAssets(
     // Append the allocated asset to the current list.
     asset_list->mutable_assets()->UnsafeArenaAddAllocated(asset);
     proto_size += asset_proto_size;
+    list_ended = max_size > 0 &&
+                 IsIndirectListBoundary(AssetNameHash(asset->name()),
+                                        asset_proto_size, proto_size, max_size);
   }
 
   // Write back the final asset list.
@@ -705,6 +767,8 @@ absl::StatusOr<ContentIdProto> ManifestBuilder::Flush() {
     InitNewAsset("", AssetProto::DIRECTORY, manifest_->mutable_root_dir());
   }
   RETURN_IF_ERROR(FlushDir(manifest_->mutable_root_dir()));
+  // Lists that are still marked are no longer referenced by any directory.
+  dirty_asset_lists_.clear();
   RETURN_IF_ERROR(WriteProto(*manifest_, &manifest_id_));
   return manifest_id_;
 }
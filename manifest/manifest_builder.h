@@ -19,6 +19,7 @@
 
 #include <cstddef>
 #include <list>
+#include <unordered_set>
 
 #include "absl/status/statusor.h"
 #include "data_store/data_store_writer.h"
@@ -94,6 +95,10 @@ class ManifestBuilder {
   // manifest into chunks of sizes as specified by the CdcParamsProto given
   // during construction.
   //
+  // Only the indirect asset lists that were modified since the last call are
+  // written back, all other lists keep their content IDs. The manifest proto
+  // itself is always written.
+  //
   // Calling this function might invalidate pointers to wrapped protos that were
   // returned by GetOrCreateAsset() or AssetBuilder methods.
   absl::StatusOr<ContentIdProto> Flush();
@@ -110,7 +115,8 @@ class ManifestBuilder {
   const ManifestProto* Manifest() const;
 
   // Returns a list of the content IDs of all manifest chunks that have been
-  // written back to the data store during the last call of Flush().
+  // written back to the data store during the last call of Flush(). Unmodified
+  // indirect asset lists are not written back and are not included.
   const std::vector<ContentIdProto>& FlushedContentIds() const;
 
   // Access statistics after Flush() about the manifest that was built.
@@ -207,7 +213,7 @@ class ManifestBuilder {
 
   // Flushes all pending information for |dir| and all sub-directories, enforces
   // the chunk size limit, updates the content IDs, and writes the chunks to the
-  // chunk store.
+  // chunk store. Indirect asset lists that were not modified are skipped.
   absl::Status FlushDir(AssetProto* dir);
 
   // Flushes all DIRECTORY assets in the given list recursively.
@@ -285,6 +291,12 @@ class ManifestBuilder {
   // List of AssetListProtos loaded from data_store_.
   AssetListMap asset_lists_;
 
+  // Loaded AssetListProtos that might have been modified since the last call
+  // to Flush(). Since directories are stored inline, a list is marked whenever
+  // an asset is looked up through it, which includes all lists on the path
+  // from the manifest root to a modified asset.
+  std::unordered_set<const AssetListProto*> dirty_asset_lists_;
+
   // Useful stats.
   size_t manifest_bytes_written_ = 0;
   size_t manifest_chunks_written_ = 0;
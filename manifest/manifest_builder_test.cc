@@ -14,6 +14,8 @@
 
 #include "manifest/manifest_builder.h"
 
+#include <set>
+
 #include "absl/time/clock.h"
 #include "common/path.h"
 #include "common/status_test_macros.h"
@@ -775,7 +777,8 @@ TEST_F(ManifestBuilderTest, DirectAndIndirectChunks) {
   ManifestBuilder builder(cdc_params_, &cache_);
   AssetMap assets;
   // Each chunk adds 30 bytes each, so one IndirectChunkList of
-  // 1024 bytes can fit 34 chunks (= 1020 bytes).
+  // 1024 bytes can fit 34 chunks (= 1020 bytes). Lists also end early at
+  // content-defined boundaries.
   assets["a"] = {"00", "01", "02", "03", "04", "05", "06", "07", "08",
                  "09", "10", "11", "12", "13", "14", "15", "16", "17",
                  "18", "19", "20", "21", "22", "23", "24", "25", "26",
@@ -784,8 +787,9 @@ TEST_F(ManifestBuilderTest, DirectAndIndirectChunks) {
   ASSERT_OK(AddAssets(assets, &builder));
   ASSERT_OK(builder.Flush());
   VerifyAssets(assets, builder.ManifestId());
-  // Expecting 1 manifest proto and 1 ChunkList protos.
-  EXPECT_EQ(cache_.Chunks().size(), 2);
+  // Expecting 1 manifest proto and 3 ChunkList protos, as the chunk ids of
+  // these chunks hit 2 boundaries.
+  EXPECT_EQ(cache_.Chunks().size(), 4);
   EXPECT_EQ(builder.FlushedContentIds().size(), cache_.Chunks().size());
   // Verify that the chunk size is not exeeded.
   size_t max_proto_size = ActualMaxProtoSize();
@@ -959,8 +963,9 @@ TEST_F(ManifestBuilderTest, DeleteIndirectAssets) {
   ASSERT_OK(builder.Flush());
   expected_assets_[AssetProto::FILE].erase("f1");
   VerifyAssets(assets, builder.ManifestId());
-  // 1 manifest + at least 1 AssetList
-  EXPECT_GT(builder.FlushedContentIds().size(), 1);
+  // "f1" is a direct asset of the root directory, so none of the AssetLists
+  // changed and only the manifest is written.
+  EXPECT_EQ(builder.FlushedContentIds().size(), 1);
 
   EXPECT_OK(builder.DeleteAsset("d1/f3"));
   ASSERT_OK(builder.Flush());
@@ -975,8 +980,155 @@ TEST_F(ManifestBuilderTest, DeleteIndirectAssets) {
   expected_assets_[AssetProto::FILE].erase("d1/d2/f5");
   expected_assets_[AssetProto::FILE].erase("d1/d2/f6");
   VerifyAssets(assets, builder.ManifestId());
-  // 1 manifest + at least 2 AssetLists
-  EXPECT_GT(builder.FlushedContentIds().size(), 2);
+  // 1 manifest + at least 1 AssetList
+  EXPECT_GT(builder.FlushedContentIds().size(), 1);
+}
+
+TEST_F(ManifestBuilderTest, IndirectListsAreContentDefined) {
+  cdc_params_.set_avg_chunk_size(1024);
+  AssetMap assets;
+  // A directory spread over many indirect asset lists and a file spread over
+  // many indirect chunk lists.
+  for (int f = 0; f < 512; ++f)
+    assets[absl::StrFormat("dir/file%03d", f)] = {""};
+  StringList& big = assets["big"];
+  for (int n = 0; n < 512; ++n) big.push_back(absl::StrFormat("chunk%03d", n));
+
+  ManifestBuilder builder(cdc_params_, &cache_);
+  ASSERT_OK(AddAssets(assets, &builder));
+  ASSERT_OK(builder.Flush());
+  std::set<ContentIdProto> old_ids(builder.FlushedContentIds().begin(),
+                                   builder.FlushedContentIds().end());
+  ASSERT_GT(old_ids.size(), 32);
+
+  // Insert a file into the directory and a chunk into the file, and build the
+  // manifest from scratch.
+  assets["dir/file255a"] = {""};
+  big.insert(big.begin() + 255, "chunk255a");
+  ManifestBuilder builder2(cdc_params_, &cache_);
+  ASSERT_OK(AddAssets(assets, &builder2));
+  ASSERT_OK(builder2.Flush());
+  VerifyAssets(assets, builder2.ManifestId());
+
+  // Besides the manifest and the list containing the directory, only the lists
+  // around the inserted file and chunk are different.
+  size_t num_new_ids = 0;
+  for (const ContentIdProto& id : builder2.FlushedContentIds())
+    num_new_ids += old_ids.find(id) == old_ids.end();
+  EXPECT_GE(num_new_ids, 4);
+  EXPECT_LE(num_new_ids, 8);
+}
+
+TEST_F(ManifestBuilderTest, IndirectListsAreContentDefinedIncrementally) {
+  cdc_params_.set_avg_chunk_size(1024);
+  AssetMap assets;
+  for (int f = 0; f < 512; ++f)
+    assets[absl::StrFormat("dir/file%03d", f)] = {""};
+  StringList& big = assets["big"];
+  for (int n = 0; n < 512; ++n) big.push_back(absl::StrFormat("chunk%03d", n));
+
+  ManifestBuilder builder(cdc_params_, &cache_);
+  ASSERT_OK(AddAssets(assets, &builder));
+  ASSERT_OK(builder.Flush());
+  std::set<ContentIdProto> old_ids(builder.FlushedContentIds().begin(),
+                                   builder.FlushedContentIds().end());
+  ASSERT_GT(old_ids.size(), 32);
+
+  // Insert a file into the directory and a chunk into the file in the loaded
+  // manifest, like the manifest updater does.
+  ManifestBuilder builder2(cdc_params_, &cache_);
+  ASSERT_OK(builder2.LoadManifest(builder.ManifestId()));
+  ASSERT_OK(AddAssets({{"dir/file255a", {""}}}, &builder2));
+  assets["dir/file255a"] = {""};
+  big.insert(big.begin() + 255, "chunk255a");
+  absl::StatusOr<AssetBuilder> big_builder =
+      builder2.GetOrCreateAsset("big", AssetProto::FILE);
+  ASSERT_OK(big_builder);
+  big_builder->TruncateChunks();
+  ASSERT_OK(AddAssets({{"big", big}}, &builder2));
+  ASSERT_OK(builder2.Flush());
+  VerifyAssets(assets, builder2.ManifestId());
+
+  // Only the manifest, the root directory's list containing "dir", the chunk
+  // list containing the inserted chunk and two lists of "dir" are new. Assets
+  // moved out of the directory proto are appended to its last list, and those
+  // that don't fit go to a new one.
+  size_t num_new_ids = 0;
+  for (const ContentIdProto& id : builder2.FlushedContentIds())
+    num_new_ids += old_ids.find(id) == old_ids.end();
+  EXPECT_EQ(num_new_ids, 5);
+}
+
+TEST_F(ManifestBuilderTest, FlushWritesOnlyModifiedAssetLists) {
+  cdc_params_.set_avg_chunk_size(1024);
+  ManifestBuilder builder(cdc_params_, &cache_);
+  AssetMap assets;
+  // 16 directories with 128 empty files each, so that every directory spreads
+  // its files over several indirect asset lists.
+  for (int d = 0; d < 16; ++d) {
+    for (int f = 0; f < 128; ++f)
+      assets[absl::StrFormat("dir%02d/file%03d", d, f)] = {""};
+  }
+  ASSERT_OK(AddAssets(assets, &builder));
+  ASSERT_OK(builder.Flush());
+  VerifyAssets(assets, builder.ManifestId());
+  ASSERT_GT(builder.FlushedContentIds().size(), 32);
+
+  // Flushing an unmodified manifest only writes the manifest proto.
+  ContentIdProto manifest_id = builder.ManifestId();
+  ASSERT_OK(builder.Flush());
+  EXPECT_EQ(builder.ManifestId(), manifest_id);
+  EXPECT_EQ(builder.FlushedContentIds().size(), 1);
+
+  // Modifying a single file writes the manifest proto, the list containing the
+  // directory and the directory's list containing the file. If the directory
+  // is over the size limit, some assets are moved to its last list as well.
+  absl::StatusOr<AssetBuilder> file =
+      builder.GetOrCreateAsset("dir07/file013", AssetProto::FILE);
+  ASSERT_OK(file);
+  file->SetPermissions(0750u);
+  ASSERT_OK(builder.Flush());
+  VerifyAssets(assets, builder.ManifestId());
+  EXPECT_NE(builder.ManifestId(), manifest_id);
+  EXPECT_GE(builder.FlushedContentIds().size(), 2);
+  EXPECT_LE(builder.FlushedContentIds().size(), 4);
+
+  // Deleting a single file behaves the same.
+  assets.erase("dir11/file003");
+  expected_assets_[AssetProto::FILE].erase("dir11/file003");
+  ASSERT_OK(builder.DeleteAsset("dir11/file003"));
+  ASSERT_OK(builder.Flush());
+  VerifyAssets(assets, builder.ManifestId());
+  EXPECT_GE(builder.FlushedContentIds().size(), 2);
+  EXPECT_LE(builder.FlushedContentIds().size(), 4);
+}
+
+TEST_F(ManifestBuilderTest, FlushLoadedManifestWritesOnlyModifiedAssetLists) {
+  cdc_params_.set_avg_chunk_size(1024);
+  ManifestBuilder builder(cdc_params_, &cache_);
+  AssetMap assets;
+  for (int d = 0; d < 16; ++d) {
+    for (int f = 0; f < 128; ++f)
+      assets[absl::StrFormat("dir%02d/file%03d", d, f)] = {""};
+  }
+  ASSERT_OK(AddAssets(assets, &builder));
+  ASSERT_OK(builder.Flush());
+
+  ManifestBuilder builder2(cdc_params_, &cache_);
+  ASSERT_OK(builder2.LoadManifest(builder.ManifestId()));
+  ASSERT_OK(builder2.Flush());
+  EXPECT_EQ(builder2.ManifestId(), builder.ManifestId());
+  EXPECT_EQ(builder2.FlushedContentIds().size(), 1);
+
+  // Only the lists on the path to the modified file are written back.
+  absl::StatusOr<AssetBuilder> file =
+      builder2.GetOrCreateAsset("dir15/file127", AssetProto::FILE);
+  ASSERT_OK(file);
+  file->SetPermissions(0750u);
+  ASSERT_OK(builder2.Flush());
+  VerifyAssets(assets, builder2.ManifestId());
+  EXPECT_GE(builder2.FlushedContentIds().size(), 2);
+  EXPECT_LE(builder2.FlushedContentIds().size(), 4);
 }
 
 TEST_F(ManifestBuilderTest, LoadAndUpdateManifest) {
@@ -0,0 +1,163 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest/manifest_delta.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_format.h"
+#include "common/status.h"
+#include "common/status_macros.h"
+
+namespace cdc_ft {
+
+ManifestDelta::ManifestDelta(DataStoreReader* data_store, size_t max_bytes)
+    : data_store_(data_store), max_bytes_(max_bytes) {}
+
+absl::Status ManifestDelta::Compute(const ContentIdProto& old_manifest_id,
+                                    const ContentIdProto& new_manifest_id) {
+  chunks_.clear();
+  chunk_ids_.clear();
+  total_bytes_ = 0;
+  complete_ = true;
+  if (old_manifest_id == new_manifest_id) return absl::OkStatus();
+
+  ManifestProto new_manifest;
+  RETURN_IF_ERROR(AddChunk(new_manifest_id, &new_manifest),
+                  "Failed to load manifest '%s'",
+                  ContentId::ToHexString(new_manifest_id));
+
+  // The client is expected to have all chunks of the old manifest. If it
+  // cannot be read, everything is sent.
+  ManifestProto old_manifest;
+  const AssetProto* old_root = nullptr;
+  if (!old_manifest_id.blake3_sum_160().empty() &&
+      data_store_->GetProto(old_manifest_id, &buffer_, &old_manifest).ok()) {
+    old_root = &old_manifest.root_dir();
+  }
+  return DiffDir(old_root, new_manifest.root_dir());
+}
+
+absl::Status ManifestDelta::DiffDir(const AssetProto* old_dir,
+                                    const AssetProto& new_dir) {
+  // Indirect asset lists that are part of both directories are known to the
+  // client, and so are all assets in them. The remaining old assets are mapped
+  // by name, so that they can be compared with the new ones. Lists that cannot
+  // be read are treated as missing.
+  absl::flat_hash_set<ContentId> shared_list_ids;
+  std::vector<AssetListProto> old_lists;
+  absl::flat_hash_map<absl::string_view, const AssetProto*> old_assets;
+  if (old_dir) {
+    absl::flat_hash_set<ContentId> new_list_ids;
+    for (const ContentIdProto& id : new_dir.dir_indirect_assets())
+      new_list_ids.insert(ContentId(id));
+    for (const ContentIdProto& id : old_dir->dir_indirect_assets()) {
+      if (new_list_ids.contains(ContentId(id))) {
+        shared_list_ids.insert(ContentId(id));
+        continue;
+      }
+      old_lists.emplace_back();
+      if (!data_store_->GetProto(id, &buffer_, &old_lists.back()).ok())
+        old_lists.pop_back();
+    }
+    for (const AssetProto& asset : old_dir->dir_assets())
+      old_assets[asset.name()] = &asset;
+    for (const AssetListProto& list : old_lists) {
+      for (const AssetProto& asset : list.assets())
+        old_assets[asset.name()] = &asset;
+    }
+  }
+
+  auto diff_asset = [this, &old_assets](const AssetProto& asset) {
+    auto it = old_assets.find(asset.name());
+    return DiffAsset(it != old_assets.end() ? it->second : nullptr, asset);
+  };
+
+  for (const AssetProto& asset : new_dir.dir_assets()) {
+    if (!complete_) return absl::OkStatus();
+    RETURN_IF_ERROR(diff_asset(asset));
+  }
+
+  for (const ContentIdProto& id : new_dir.dir_indirect_assets()) {
+    if (!complete_) return absl::OkStatus();
+    if (shared_list_ids.contains(ContentId(id))) continue;
+    AssetListProto list;
+    RETURN_IF_ERROR(AddChunk(id, &list), "Failed to load asset list '%s'",
+                    ContentId::ToHexString(id));
+    for (const AssetProto& asset : list.assets()) {
+      if (!complete_) return absl::OkStatus();
+      RETURN_IF_ERROR(diff_asset(asset));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ManifestDelta::DiffAsset(const AssetProto* old_asset,
+                                      const AssetProto& new_asset) {
+  if (old_asset && old_asset->type() != new_asset.type()) old_asset = nullptr;
+
+  switch (new_asset.type()) {
+    case AssetProto::FILE: {
+      absl::flat_hash_set<ContentId> old_list_ids;
+      if (old_asset) {
+        for (const IndirectChunkListProto& icl :
+             old_asset->file_indirect_chunks()) {
+          old_list_ids.insert(ContentId(icl.chunk_list_id()));
+        }
+      }
+      for (const IndirectChunkListProto& icl :
+           new_asset.file_indirect_chunks()) {
+        if (!complete_) return absl::OkStatus();
+        if (old_list_ids.contains(ContentId(icl.chunk_list_id()))) continue;
+        RETURN_IF_ERROR(AddChunk(icl.chunk_list_id()),
+                        "Failed to load chunk list '%s'",
+                        ContentId::ToHexString(icl.chunk_list_id()));
+      }
+      return absl::OkStatus();
+    }
+
+    case AssetProto::DIRECTORY:
+      if (old_asset && *old_asset == new_asset) return absl::OkStatus();
+      return DiffDir(old_asset, new_asset);
+
+    default:
+      return absl::OkStatus();
+  }
+}
+
+absl::Status ManifestDelta::AddChunk(const ContentIdProto& id,
+                                     google::protobuf::Message* proto) {
+  // The same list might be referenced multiple times, e.g. by two equal
+  // files. Asset lists are still parsed every time, since the old assets to
+  // compare with might differ.
+  bool is_new = !chunk_ids_.contains(ContentId(id));
+  if (!is_new && !proto) return absl::OkStatus();
+
+  RETURN_IF_ERROR(data_store_->Get(id, &buffer_));
+  if (proto && !proto->ParseFromArray(buffer_.data(), buffer_.size())) {
+    return MakeStatus("Failed to parse %s proto with size %u",
+                      proto->GetTypeName(), buffer_.size());
+  }
+
+  if (!is_new) return absl::OkStatus();
+  if (!chunks_.empty() && total_bytes_ + buffer_.size() > max_bytes_) {
+    complete_ = false;
+    return absl::OkStatus();
+  }
+  chunk_ids_.insert(ContentId(id));
+  chunks_.push_back({id, std::string(buffer_.data(), buffer_.size())});
+  total_bytes_ += buffer_.size();
+  return absl::OkStatus();
+}
+
+}  // namespace cdc_ft
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANIFEST_MANIFEST_DELTA_H_
+#define MANIFEST_MANIFEST_DELTA_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "data_store/data_store_reader.h"
+#include "manifest/content_id.h"
+#include "manifest/manifest_proto_defs.h"
+
+namespace cdc_ft {
+
+// Determines the manifest chunks that a client needs in order to load a new
+// manifest when it has already loaded an old one. These are the manifest
+// itself, the indirect asset lists and the indirect chunk lists of the new
+// manifest that are not referenced by the old manifest.
+//
+// Since chunks are content-addressed, unchanged directories and lists are
+// identified by comparing protos and ids and are not descended into.
+class ManifestDelta {
+ public:
+  // Default limit for the total size of the collected chunks.
+  static constexpr size_t kDefaultMaxBytes = 16 << 20;
+
+  struct Chunk {
+    ContentIdProto id;
+    std::string data;
+  };
+
+  // Reads manifest chunks from |data_store|. Stops collecting chunks once
+  // their total size would exceed |max_bytes|. The first chunk is always
+  // collected.
+  explicit ManifestDelta(DataStoreReader* data_store,
+                         size_t max_bytes = kDefaultMaxBytes);
+
+  // Collects the chunks of the manifest |new_manifest_id| that are not part
+  // of the manifest |old_manifest_id|, starting with the new manifest. If
+  // |old_manifest_id| is empty or parts of the old manifest cannot be read,
+  // the corresponding chunks of the new manifest are collected as well.
+  // Returns an error if a chunk of the new manifest cannot be read.
+  absl::Status Compute(const ContentIdProto& old_manifest_id,
+                       const ContentIdProto& new_manifest_id);
+
+  // Returns the chunks collected by the last call to Compute().
+  const std::vector<Chunk>& Chunks() const { return chunks_; }
+
+  // Moves the collected chunks out of the delta.
+  std::vector<Chunk> ReleaseChunks() { return std::move(chunks_); }
+
+  // Returns false if chunks were left out because of the size limit.
+  bool Complete() const { return complete_; }
+
+ private:
+  // Collects the changed chunks below the directory |new_dir|. |old_dir| is
+  // the same directory in the old manifest or nullptr if it did not exist.
+  absl::Status DiffDir(const AssetProto* old_dir, const AssetProto& new_dir);
+
+  // Collects the changed chunks of the asset |new_asset|. |old_asset| is the
+  // asset with the same name in the old manifest or nullptr.
+  absl::Status DiffAsset(const AssetProto* old_asset,
+                         const AssetProto& new_asset);
+
+  // Reads the chunk |id| and collects it unless it was collected before.
+  // Parses the chunk into |proto| if given. Sets |complete_| to false if the
+  // chunk does not fit into the size limit anymore.
+  absl::Status AddChunk(const ContentIdProto& id,
+                        google::protobuf::Message* proto = nullptr);
+
+  DataStoreReader* const data_store_;
+  const size_t max_bytes_;
+
+  std::vector<Chunk> chunks_;
+  absl::flat_hash_set<ContentId> chunk_ids_;
+  size_t total_bytes_ = 0;
+  bool complete_ = true;
+  Buffer buffer_;
+};
+
+}  // namespace cdc_ft
+
+#endif  // MANIFEST_MANIFEST_DELTA_H_
@@ -0,0 +1,219 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest/manifest_delta.h"
+
+#include <set>
+
+#include "absl/strings/str_format.h"
+#include "common/status_test_macros.h"
+#include "data_store/mem_data_store.h"
+#include "gtest/gtest.h"
+#include "manifest/manifest_builder.h"
+
+namespace cdc_ft {
+namespace {
+
+constexpr char kBigFile[] = "dir0/big";
+
+class ManifestDeltaTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    cdc_params_.set_avg_chunk_size(1024);
+    builder_ = std::make_unique<ManifestBuilder>(cdc_params_, &store_);
+
+    // 8 directories with 64 files each, so that they are spread over several
+    // indirect asset lists, and a file with enough chunks to require indirect
+    // chunk lists.
+    for (int d = 0; d < 8; ++d) {
+      for (int f = 0; f < 64; ++f) {
+        EXPECT_OK(builder_->GetOrCreateAsset(
+            absl::StrFormat("dir%i/file%02i", d, f), AssetProto::FILE));
+      }
+    }
+    SetBigFileChunks(/*replaced_chunk=*/-1);
+    ASSERT_OK(builder_->Flush());
+  }
+
+ protected:
+  // Sets 500 chunks for the big file. Replaces the chunk at index
+  // |replaced_chunk| by a different one.
+  void SetBigFileChunks(int replaced_chunk) {
+    absl::StatusOr<AssetBuilder> big =
+        builder_->GetOrCreateAsset(kBigFile, AssetProto::FILE);
+    ASSERT_OK(big);
+    big->TruncateChunks();
+    for (int n = 0; n < 500; ++n)
+      big->AppendChunk(MakeChunkId(n == replaced_chunk ? -n : n), 1024);
+  }
+
+  static ContentIdProto MakeChunkId(int n) {
+    return ContentId::FromDataString(absl::StrFormat("chunk%i", n));
+  }
+
+  // Returns the ids of all manifest chunks of the manifest |manifest_id|.
+  std::set<ContentIdProto> AllChunks(const ContentIdProto& manifest_id) {
+    std::set<ContentIdProto> ids = {manifest_id};
+    ManifestProto manifest;
+    EXPECT_OK(store_.GetProto(manifest_id, &manifest));
+    CollectChunks(manifest.root_dir(), &ids);
+    return ids;
+  }
+
+  void CollectChunks(const AssetProto& asset, std::set<ContentIdProto>* ids) {
+    for (const IndirectChunkListProto& icl : asset.file_indirect_chunks())
+      ids->insert(icl.chunk_list_id());
+    for (const AssetProto& child : asset.dir_assets())
+      CollectChunks(child, ids);
+    for (const ContentIdProto& id : asset.dir_indirect_assets()) {
+      ids->insert(id);
+      AssetListProto list;
+      EXPECT_OK(store_.GetProto(id, &list));
+      for (const AssetProto& child : list.assets()) CollectChunks(child, ids);
+    }
+  }
+
+  // Returns the ids of the chunks in |delta| and verifies their data.
+  std::set<ContentIdProto> DeltaChunks(const ManifestDelta& delta) {
+    std::set<ContentIdProto> ids;
+    for (const ManifestDelta::Chunk& chunk : delta.Chunks()) {
+      EXPECT_EQ(ContentId::FromDataString(chunk.data), chunk.id);
+      EXPECT_TRUE(ids.insert(chunk.id).second) << "Duplicate chunk";
+    }
+    return ids;
+  }
+
+  // Returns the chunks in |a| that are not in |b|.
+  static std::set<ContentIdProto> Difference(
+      const std::set<ContentIdProto>& a, const std::set<ContentIdProto>& b) {
+    std::set<ContentIdProto> diff;
+    for (const ContentIdProto& id : a) {
+      if (b.find(id) == b.end()) diff.insert(id);
+    }
+    return diff;
+  }
+
+  CdcParamsProto cdc_params_;
+  MemDataStore store_;
+  std::unique_ptr<ManifestBuilder> builder_;
+};
+
+TEST_F(ManifestDeltaTest, SameManifest) {
+  ManifestDelta delta(&store_);
+  EXPECT_OK(delta.Compute(builder_->ManifestId(), builder_->ManifestId()));
+  EXPECT_TRUE(delta.Chunks().empty());
+  EXPECT_TRUE(delta.Complete());
+}
+
+TEST_F(ManifestDeltaTest, NoOldManifest) {
+  ContentIdProto new_id = builder_->ManifestId();
+  ManifestDelta delta(&store_);
+  EXPECT_OK(delta.Compute(ContentIdProto(), new_id));
+  EXPECT_TRUE(delta.Complete());
+  ASSERT_FALSE(delta.Chunks().empty());
+  EXPECT_EQ(delta.Chunks()[0].id, new_id);
+
+  std::set<ContentIdProto> all_chunks = AllChunks(new_id);
+  EXPECT_GT(all_chunks.size(), 16);
+  EXPECT_EQ(DeltaChunks(delta), all_chunks);
+}
+
+TEST_F(ManifestDeltaTest, MissingOldManifest) {
+  ContentIdProto new_id = builder_->ManifestId();
+  ManifestDelta delta(&store_);
+  EXPECT_OK(delta.Compute(MakeChunkId(-1), new_id));
+  EXPECT_EQ(DeltaChunks(delta), AllChunks(new_id));
+}
+
+TEST_F(ManifestDeltaTest, ModifiedFile) {
+  ContentIdProto old_id = builder_->ManifestId();
+  absl::StatusOr<AssetBuilder> file =
+      builder_->GetOrCreateAsset("dir5/file42", AssetProto::FILE);
+  ASSERT_OK(file);
+  file->SetPermissions(0750u);
+  ASSERT_OK(builder_->Flush());
+  ContentIdProto new_id = builder_->ManifestId();
+
+  ManifestDelta delta(&store_);
+  EXPECT_OK(delta.Compute(old_id, new_id));
+  EXPECT_TRUE(delta.Complete());
+  ASSERT_FALSE(delta.Chunks().empty());
+  EXPECT_EQ(delta.Chunks()[0].id, new_id);
+
+  std::set<ContentIdProto> changed =
+      Difference(AllChunks(new_id), AllChunks(old_id));
+  EXPECT_LE(changed.size(), 4);
+  EXPECT_EQ(DeltaChunks(delta), changed);
+}
+
+TEST_F(ManifestDeltaTest, ModifiedFileChunks) {
+  ContentIdProto old_id = builder_->ManifestId();
+  SetBigFileChunks(/*replaced_chunk=*/250);
+  ASSERT_OK(builder_->Flush());
+  ContentIdProto new_id = builder_->ManifestId();
+
+  ManifestDelta delta(&store_);
+  EXPECT_OK(delta.Compute(old_id, new_id));
+  std::set<ContentIdProto> changed =
+      Difference(AllChunks(new_id), AllChunks(old_id));
+  EXPECT_EQ(DeltaChunks(delta), changed);
+}
+
+TEST_F(ManifestDeltaTest, DeletedAndAddedAssets) {
+  ContentIdProto old_id = builder_->ManifestId();
+  ASSERT_OK(builder_->DeleteAsset("dir3"));
+  EXPECT_OK(builder_->GetOrCreateAsset("dir8/file00", AssetProto::FILE));
+  ASSERT_OK(builder_->Flush());
+  ContentIdProto new_id = builder_->ManifestId();
+
+  ManifestDelta delta(&store_);
+  EXPECT_OK(delta.Compute(old_id, new_id));
+  std::set<ContentIdProto> changed =
+      Difference(AllChunks(new_id), AllChunks(old_id));
+  EXPECT_EQ(DeltaChunks(delta), changed);
+}
+
+TEST_F(ManifestDeltaTest, SizeLimit) {
+  ContentIdProto new_id = builder_->ManifestId();
+  ManifestDelta delta(&store_, /*max_bytes=*/4096);
+  EXPECT_OK(delta.Compute(ContentIdProto(), new_id));
+  EXPECT_FALSE(delta.Complete());
+  ASSERT_FALSE(delta.Chunks().empty());
+  EXPECT_EQ(delta.Chunks()[0].id, new_id);
+
+  size_t total_bytes = 0;
+  for (const ManifestDelta::Chunk& chunk : delta.Chunks())
+    total_bytes += chunk.data.size();
+  EXPECT_LE(total_bytes, 4096);
+  EXPECT_LT(delta.Chunks().size(), AllChunks(new_id).size());
+}
+
+TEST_F(ManifestDeltaTest, MissingNewChunk) {
+  ContentIdProto old_id = builder_->ManifestId();
+  SetBigFileChunks(/*replaced_chunk=*/250);
+  ASSERT_OK(builder_->Flush());
+  ContentIdProto new_id = builder_->ManifestId();
+
+  std::set<ContentIdProto> changed =
+      Difference(AllChunks(new_id), AllChunks(old_id));
+  changed.erase(new_id);
+  ASSERT_FALSE(changed.empty());
+  store_.Chunks().erase(*changed.begin());
+
+  ManifestDelta delta(&store_);
+  EXPECT_NOT_OK(delta.Compute(old_id, new_id));
+}
+
+}  // namespace
+}  // namespace cdc_ft
@@ -213,7 +213,8 @@ void ManifestTestBase::ValidateChunkLookup(const std::string& rel_path,
     uint64_t lookup_offset = 0;
     uint32_t lookup_size = 0;
     EXPECT_EQ(
-        file_chunks->Lookup(id, &lookup_path, &lookup_offset, &lookup_size),
+        file_chunks->Lookup(ContentId(id), &lookup_path, &lookup_offset,
+                            &lookup_size),
         expect_contained);
     if (expect_contained) {
       EXPECT_EQ(lookup_path, rel_path);
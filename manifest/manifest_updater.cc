@@ -14,19 +14,23 @@
 
 #include "manifest/manifest_updater.h"
 
+#include <algorithm>
 #include <future>
 #include <thread>
 
+#include "absl/hash/hash.h"
 #include "absl/strings/match.h"
 #include "absl/strings/string_view.h"
 #include "common/log.h"
 #include "common/path.h"
+#include "common/status.h"
 #include "common/stopwatch.h"
 #include "common/threadpool.h"
 #include "common/util.h"
 #include "data_store/data_store_writer.h"
 #include "fastcdc/fastcdc.h"
 #include "manifest/asset_builder.h"
+#include "manifest/dir_scanner.h"
 #include "manifest/file_chunk_map.h"
 #include "manifest/manifest_builder.h"
 #include "manifest/manifest_iterator.h"
@@ -45,38 +49,6 @@ class Finalizer {
   std::function<void()> finalize_;
 };
 
-// Returns AssetInfos for all files and dirs in |src_dir| + |rel_path|. Does not
-// recurse into sub-directories.
-absl::Status GetAllSrcAssets(const std::string& src_dir,
-                             const std::string& rel_path,
-                             std::vector<AssetInfo>* src_assets) {
-  std::string full_src_dir = path::Join(src_dir, rel_path);
-
-  path::EnsureEndsWithPathSeparator(&full_src_dir);
-  auto handler = [src_assets, &src_dir = full_src_dir,
-                  rel_path = path::ToUnix(rel_path)](
-                     const std::string& dir, const std::string& filename,
-                     int64_t mtime, uint64_t size, bool is_dir) {
-    AssetInfo ai;
-    ai.path = path::JoinUnix(rel_path, filename);
-    ai.type = is_dir ? AssetProto::DIRECTORY : AssetProto::FILE;
-    ai.mtime = mtime;
-    ai.size = is_dir ? 0 : size;
-    src_assets->push_back(std::move(ai));
-    return absl::OkStatus();
-  };
-#if PLATFORM_WINDOWS
-  // Windows expects a globbing pattern to search a path.
-  std::string src_pattern = path::Join(full_src_dir, "*");
-#else
-  std::string src_pattern = src_dir;
-#endif
-  absl::Status status =
-      path::SearchFiles(src_pattern, /*recursive=*/false, handler);
-  std::sort(src_assets->begin(), src_assets->end());
-  return status;
-}
-
 // Creates a fastcdc::Config struct from a CdcParamsProto.
 fastcdc::Config CdcConfigFromProto(const CdcParamsProto& cfg_pb) {
   return fastcdc::Config(cfg_pb.min_chunk_size(), cfg_pb.avg_chunk_size(),
@@ -94,21 +66,64 @@ bool ValidateCdcParams(const CdcParamsProto& params) {
 // pool.
 size_t MaxQueuedTasks(const Threadpool& pool) { return pool.NumThreads() << 1; }
 
+// Returns a hash of the names, types, mtimes and sizes of the |assets| in a
+// directory listing.
+size_t GetListingHash(const std::vector<AssetInfo>& assets) {
+  return absl::Hash<std::vector<AssetInfo>>()(assets);
+}
+
+// Adds the IDs of the manifest chunks referenced by |asset| and its children to
+// |ids|. Asset lists that cannot be read are skipped.
+void CollectAssetContentIds(DataStoreReader* data_store,
+                            const AssetProto& asset,
+                            std::unordered_set<ContentIdProto>* ids) {
+  for (const IndirectChunkListProto& icl : asset.file_indirect_chunks())
+    ids->insert(icl.chunk_list_id());
+  for (const AssetProto& child : asset.dir_assets())
+    CollectAssetContentIds(data_store, child, ids);
+  for (const ContentIdProto& id : asset.dir_indirect_assets()) {
+    AssetListProto list;
+    if (!data_store->GetProto(id, &list).ok()) continue;
+    ids->insert(id);
+    for (const AssetProto& child : list.assets())
+      CollectAssetContentIds(data_store, child, ids);
+  }
+}
+
+// Adds the IDs of the indirect asset lists |list_ids| and of the indirect chunk
+// lists of the files in them to |ids|. Lists that cannot be read are added as
+// well, so that pruning reports them as missing.
+void CollectAssetListContentIds(DataStoreReader* data_store,
+                                const RepeatedContentIdProto& list_ids,
+                                std::vector<ContentId>* ids) {
+  for (const ContentIdProto& id : list_ids) {
+    ids->emplace_back(id);
+    AssetListProto list;
+    if (!data_store->GetProto(id, &list).ok()) continue;
+    for (const AssetProto& asset : list.assets()) {
+      for (const IndirectChunkListProto& icl : asset.file_indirect_chunks())
+        ids->emplace_back(icl.chunk_list_id());
+    }
+  }
+}
+
+// Adds the IDs of all readable chunks of the manifest |manifest_id| to |ids|.
+void CollectManifestContentIds(DataStoreReader* data_store,
+                               const ContentIdProto& manifest_id,
+                               std::unordered_set<ContentIdProto>* ids) {
+  ManifestProto manifest;
+  if (!data_store->GetProto(manifest_id, &manifest).ok()) return;
+  ids->insert(manifest_id);
+  CollectAssetContentIds(data_store, manifest.root_dir(), ids);
+}
+
 }  // namespace
 
-void AssetInfo::AppendCopyChunks(const RepeatedChunkRefProto& list,
-                                 uint64_t list_offset) {
+void AssetInfo::AppendChunks(const RepeatedChunkRefProto& list,
+                             uint64_t list_offset) {
   chunks.reserve(chunks.size() + list.size());
   for (const ChunkRefProto& ch : list)
-    chunks.emplace_back(ch.chunk_id(), ch.offset() + list_offset);
-}
-
-void AssetInfo::AppendMoveChunks(RepeatedChunkRefProto* list,
-                                 uint64_t list_offset) {
-  chunks.reserve(chunks.size() + list->size());
-  for (ChunkRefProto& ch : *list)
-    chunks.emplace_back(std::move(*ch.mutable_chunk_id()),
-                        ch.offset() + list_offset);
+    chunks.emplace_back(ContentId(ch.chunk_id()), ch.offset() + list_offset);
 }
 
 // Common fields for tasks that fill in manifest data.
@@ -145,28 +160,42 @@ class ManifestTask : public Task {
   // Returns the pending asset's deadline.
   absl::Time Deadline() const { return asset_.deadline; }
 
+  // Returns the pending asset processed by this task.
+  const PendingAsset& Pending() const { return asset_; }
+
  protected:
   const std::string src_dir_;
   const PendingAsset asset_;
   absl::Status status_;
 };
 
-// ThreadPool task that runs the CDC chunker on a given file.
+// ThreadPool task that runs the CDC chunker on a given file. Starts at the
+// offset of the pending asset and stops at the first chunk boundary after
+// |range_size| bytes, unless |range_size| is zero.
 class FileChunkerTask : public ManifestTask {
  public:
   FileChunkerTask(std::string src_dir, PendingAsset asset,
-                  const fastcdc::Config* cfg, Buffer buffer)
+                  const fastcdc::Config* cfg, uint64_t range_size,
+                  Buffer buffer)
       : ManifestTask(std::move(src_dir), std::move(asset)),
         cfg_(cfg),
+        range_size_(range_size),
         buffer_(std::move(buffer)) {
     assert(cfg_->max_size > 0);
   }
 
+  // Returns the offset at which chunking started.
+  uint64_t Offset() const { return asset_.offset; }
+
   // Returns the number of bytes processed. Should match file size unless some
-  // error occurred.
+  // error occurred or only a range of the file was chunked.
   // Should not be accessed before the task is finished.
   uint64_t ProcessedBytes() const { return processed_bytes_; }
 
+  // Returns true if the file was chunked up to its end.
+  // Should not be accessed before the task is finished.
+  bool Done() const { return done_; }
+
   // True if the file looks like a Linux executable based on elf/shebang magic
   // headers.
   // Should not be accessed before the task is finished.
@@ -193,40 +222,64 @@ class FileChunkerTask : public ManifestTask {
       return;
     }
     path::FileCloser closer(*file);
+    const uint64_t start = Offset();
+    if (start > 0 && fseek64(*file, start, SEEK_SET) != 0) {
+      status_ = MakeStatus("Failed to seek to offset %u in file '%s'", start,
+                           file_path);
+      return;
+    }
 
-    auto chunk_handler = [chunks = &chunks_, offset = &processed_bytes_](
-                             const void* data, size_t size) {
+    auto chunk_handler = [chunks = &chunks_, offset = &processed_bytes_,
+                          start](const void* data, size_t size) {
       ChunkRefProto* chunk = chunks->Add();
       *chunk->mutable_chunk_id() = ContentId::FromArray(data, size);
-      chunk->set_offset(*offset);
+      chunk->set_offset(start + *offset);
       *offset += size;
     };
     fastcdc::Chunker chunker(*cfg_, chunk_handler);
 
-    bool first_chunk = true;
-    auto stream_handler = [&chunker, &is_cancelled, &first_chunk,
-                           is_executable = &is_executable_,
+    // The chunker does not carry any state across chunk boundaries, so a range
+    // that starts at a boundary yields the same chunks as chunking the whole
+    // file at once. Unchunked data at the end of a range is read again by the
+    // next range.
+    bool first_chunk = start == 0;
+    bool range_done = false;
+    auto stream_handler = [this, &chunker, &is_cancelled, &first_chunk,
+                           &range_done,
                            &file_path](const void* data, size_t size) {
       chunker.Process(static_cast<const uint8_t*>(data), size);
       if (first_chunk) {
         first_chunk = false;
-        *is_executable = Util::IsExecutable(data, size);
+        is_executable_ = Util::IsExecutable(data, size);
+      }
+      if (is_cancelled()) {
+        return absl::CancelledError(
+            absl::StrFormat("chunking file '%s' cancelled", file_path));
+      }
+      if (data && range_size_ > 0 && processed_bytes_ >= range_size_) {
+        range_done = true;
+        return absl::AbortedError("Range done");
       }
-      return is_cancelled() ? absl::CancelledError(absl::StrFormat(
-                                  "chunking file '%s' cancelled", file_path))
-                            : absl::OkStatus();
+      return absl::OkStatus();
     };
 
     status_ = path::StreamReadFileContents(*file, &buffer_, stream_handler);
+    if (range_done) {
+      status_ = absl::OkStatus();
+      return;
+    }
     chunker.Finalize();
+    done_ = true;
   }
 
  private:
   const fastcdc::Config* const cfg_;
+  const uint64_t range_size_;
 
   google::protobuf::RepeatedPtrField<ChunkRefProto> chunks_;
   uint64_t processed_bytes_ = 0;
   bool is_executable_ = false;
+  bool done_ = false;
   Buffer buffer_;
 };
 
@@ -239,13 +292,28 @@ class DirScannerTask : public ManifestTask {
         dir_(dir),
         data_store_(data_store) {}
 
+  // Uses the directory contents in |scanned| instead of reading the directory
+  // in ThreadRun().
+  void SetScannedDir(DirScanner::Dir scanned) {
+    scanned_ = std::move(scanned);
+    has_scanned_ = true;
+  }
+
   // Task:
   void ThreadRun(IsCancelledPredicate is_cancelled) override {
     std::vector<AssetInfo> src_assets, manifest_assets;
-    // Collect all files from the given directory.
-    status_ = GetAllSrcAssets(src_dir_, path::ToNative(RelativeUnixFilePath()),
-                              &src_assets);
+    // Collect all files from the given directory, unless they were scanned
+    // already.
+    if (has_scanned_) {
+      src_assets = std::move(scanned_.assets);
+      status_ = std::move(scanned_.status);
+    } else {
+      status_ = DirScanner::ScanDir(
+          src_dir_, path::ToNative(RelativeUnixFilePath()), &src_assets);
+    }
     if (!status_.ok()) return;
+    num_entries_ = src_assets.size();
+    listing_hash_ = GetListingHash(src_assets);
     // Collect all assets from the manifest.
     status_ = GetAllAssetsFromDirAsset(&manifest_assets, is_cancelled);
     if (!status_.ok()) return;
@@ -259,9 +327,21 @@ class DirScannerTask : public ManifestTask {
     return &manifest_content_ids_;
   }
 
+  // Returns the IDs of the indirect asset lists that were fetched and of the
+  // indirect chunk lists of the files in them.
+  std::vector<ContentId>* AssetListContentIds() {
+    return &asset_list_content_ids_;
+  }
+
   // Returns the AssetBuilder representing the directory this task is scanning.
   AssetBuilder* Dir() { return &dir_; }
 
+  // Returns the number of entries in the scanned directory.
+  size_t NumEntries() const { return num_entries_; }
+
+  // Returns the hash of the scanned directory listing.
+  size_t ListingHash() const { return listing_hash_; }
+
   // Returns the list of assets that need to be added or updated in the
   // directory that this task was scanning.
   ManifestUpdater::OperationList* Operations() { return &operations_; }
@@ -270,10 +350,12 @@ class DirScannerTask : public ManifestTask {
   using Operator = ManifestUpdater::Operator;
 
   // Stores AssetInfo structs for all assets found in |assets| in the
-  // target param |asset_infos|.
+  // target param |asset_infos|. If |from_asset_list| is true, |assets| were
+  // read from an indirect asset list.
   void GetAssetInfosFromList(const std::string& rel_path,
                              const RepeatedAssetProto& assets,
-                             std::vector<AssetInfo>* asset_infos) {
+                             std::vector<AssetInfo>* asset_infos,
+                             bool from_asset_list) {
     asset_infos->reserve(asset_infos->size() + assets.size());
 
     for (const AssetProto& asset : assets) {
@@ -282,10 +364,11 @@ class DirScannerTask : public ManifestTask {
       ai.type = asset.type();
       ai.mtime = asset.mtime_seconds();
       ai.size = asset.type() == AssetProto::DIRECTORY ? 0 : asset.file_size();
+      ai.in_progress = asset.in_progress();
 
       if (asset.type() == AssetProto::FILE) {
         // Copy chunks from the direct chunk list.
-        ai.AppendCopyChunks(asset.file_chunks(), 0);
+        ai.AppendChunks(asset.file_chunks(), 0);
 
         // Append all chunk IDs from indirect chunk lists.
         for (const IndirectChunkListProto& icl : asset.file_indirect_chunks()) {
@@ -303,9 +386,11 @@ class DirScannerTask : public ManifestTask {
                 ai.path, status.ToString());
             break;
           }
-          ai.AppendMoveChunks(chunk_list.mutable_chunks(), icl.offset());
+          ai.AppendChunks(chunk_list.chunks(), icl.offset());
           // Collect the content IDs of all indirect chunk lists.
           manifest_content_ids_.push_back(icl.chunk_list_id());
+          if (from_asset_list)
+            asset_list_content_ids_.emplace_back(icl.chunk_list_id());
         }
       }
 
@@ -319,7 +404,8 @@ class DirScannerTask : public ManifestTask {
                                         IsCancelledPredicate is_cancelled) {
     // Collect all direct assets from the manifest.
     std::string rel_path = dir_.RelativeFilePath();
-    GetAssetInfosFromList(rel_path, dir_.Proto()->dir_assets(), asset_infos);
+    GetAssetInfosFromList(rel_path, dir_.Proto()->dir_assets(), asset_infos,
+                          /*from_asset_list=*/false);
     // Load all indirect asset lists, if there are any.
     if (dir_.Proto()->dir_indirect_assets_size() > 0) {
       auto it = dir_.Proto()->mutable_dir_indirect_assets()->begin();
@@ -329,9 +415,11 @@ class DirScannerTask : public ManifestTask {
         AssetListProto list;
         absl::Status status = data_store_->GetProto(*it, &list);
         if (status.ok()) {
-          GetAssetInfosFromList(rel_path, list.assets(), asset_infos);
+          GetAssetInfosFromList(rel_path, list.assets(), asset_infos,
+                                /*from_asset_list=*/true);
           // Collect the content IDs of all indirect asset lists.
           manifest_content_ids_.push_back(*it);
+          asset_list_content_ids_.emplace_back(*it);
           ++it;
         } else {
           // In case of an error, log a warning and continue.
@@ -375,6 +463,8 @@ class DirScannerTask : public ManifestTask {
                  // For files, compare the size.
                  (src_iter->type != AssetProto::FILE ||
                   src_iter->size == manifest_iter->size) &&
+                 // Assets from an interrupted update are incomplete.
+                 !manifest_iter->in_progress &&
                  // Directories always need to be updated recursively.
                  src_iter->type != AssetProto::DIRECTORY) {
         // Assets match, keep content IDs from the manifest asset for populating
@@ -393,7 +483,12 @@ class DirScannerTask : public ManifestTask {
 
   DataStoreReader* data_store_;
   AssetBuilder dir_;
+  DirScanner::Dir scanned_;
+  bool has_scanned_ = false;
+  size_t num_entries_ = 0;
+  size_t listing_hash_ = 0;
   std::vector<ContentIdProto> manifest_content_ids_;
+  std::vector<ContentId> asset_list_content_ids_;
   ManifestUpdater::OperationList operations_;
 };
 
@@ -439,6 +534,9 @@ absl::Status ManifestUpdater::UpdateAll(FileChunkMap* file_chunks,
                                         PushManifestHandler push_handler) {
   RETURN_IF_ERROR(ManifestUpdater::IsValidDir(cfg_.src_dir));
 
+  // Files might have changed arbitrarily since the last update.
+  if (file_changed_handler_) file_changed_handler_(std::string());
+
   // Don't use the Windows localized time from path::GetStats.
   time_t mtime;
   RETURN_IF_ERROR(path::GetFileTime(cfg_.src_dir, &mtime));
@@ -508,12 +606,24 @@ absl::Status ManifestUpdater::FlushAndPushManifest(
     std::unordered_set<ContentIdProto>* manifest_content_ids,
     PushManifestHandler push_manifest_handler) {
   file_chunks->FlushUpdates();
+  RETURN_IF_ERROR(PublishPartialFiles(),
+                  "Failed to publish partially chunked files");
   ASSIGN_OR_RETURN(manifest_id_, manifest_builder_->Flush(),
                    "Failed to flush intermediate manifest");
   // Add all content IDs that were just written back.
   manifest_content_ids->insert(manifest_builder_->FlushedContentIds().begin(),
                                manifest_builder_->FlushedContentIds().end());
-  if (push_manifest_handler) push_manifest_handler(manifest_id_);
+  if (push_manifest_handler) {
+    // Store the intermediate manifest id, so that all files processed so far
+    // are not re-chunked if the process is stopped before the update is done.
+    if (recursive_) {
+      std::string id_str = manifest_id_.SerializeAsString();
+      RETURN_IF_ERROR(
+          data_store_->Put(GetManifestStoreId(), id_str.data(), id_str.size()),
+          "Failed to store intermediate manifest id");
+    }
+    push_manifest_handler(manifest_id_);
+  }
   last_manifest_flush_ = absl::Now();
   return absl::OkStatus();
 }
@@ -559,21 +669,32 @@ void ManifestUpdater::PrioritizeQueuedAssets() {
 
 ManifestUpdater::QueueTasksResult ManifestUpdater::QueueTasks(
     bool drain_dir_scanner_tasks, Threadpool* pool,
-    const fastcdc::Config* cdc_cfg) {
+    const fastcdc::Config* cdc_cfg, FileChunkMap* file_chunks,
+    std::unordered_set<ContentIdProto>* manifest_content_ids) {
   // Prioritize requested assets before queuing new tasks.
   PrioritizeQueuedAssets();
   const size_t max_tasks_queued = MaxQueuedTasks(*pool);
   size_t file_chunker_tasks = 0, dir_scanner_tasks = 0;
 
-  // Skip DIRECTORY assets if we should drain DirScannerTasks.
+  // Skip DIRECTORY assets if we should drain DirScannerTasks. Otherwise, skip
+  // the directories that the parallel scanner has not reached yet.
   PendingAssetsQueue::AcceptFunc accept = nullptr;
   if (drain_dir_scanner_tasks) {
     accept = [](const PendingAsset& p) {
       return p.type != AssetProto::DIRECTORY;
     };
+  } else if (dir_scanner_ && !dir_scanner_->IsDone()) {
+    accept = [scanner = dir_scanner_.get()](const PendingAsset& p) {
+      return p.type != AssetProto::DIRECTORY ||
+             scanner->IsScanned(path::JoinUnix(p.relative_path, p.filename));
+    };
   }
 
   absl::StatusOr<AssetBuilder> dir;
+  std::string dir_path;
+  DirScanner::Dir scanned;
+  bool has_scanned = false;
+  std::unique_ptr<DirScannerTask> task;
   PendingAsset asset;
 
   while (pool->NumQueuedTasks() < max_tasks_queued && !buffers_.empty() &&
@@ -581,7 +702,7 @@ ManifestUpdater::QueueTasksResult ManifestUpdater::QueueTasks(
     switch (asset.type) {
       case AssetProto::FILE:
         pool->QueueTask(std::make_unique<FileChunkerTask>(
-            cfg_.src_dir, std::move(asset), cdc_cfg,
+            cfg_.src_dir, std::move(asset), cdc_cfg, cfg_.chunker_range_size,
             std::move(buffers_.back())));
         buffers_.pop_back();
         ++file_chunker_tasks;
@@ -591,9 +712,9 @@ ManifestUpdater::QueueTasksResult ManifestUpdater::QueueTasks(
         // Flushing the manifest may invalidate the pointers to the directory
         // proto returned from GetOrCreateAsset(), so the manifest cannot be
         // flushed as long as DirScannerTask are in the queue.
+        dir_path = path::JoinUnix(asset.relative_path, asset.filename);
         dir = manifest_builder_->GetOrCreateAsset(
-            path::JoinUnix(asset.relative_path, asset.filename),
-            AssetProto::DIRECTORY, /*force_create=*/true);
+            dir_path, AssetProto::DIRECTORY, /*force_create=*/true);
         if (!dir.ok()) {
           LOG_ERROR(
               "Failed to locate directory '%s' in the manifest, skipping it: "
@@ -601,9 +722,34 @@ ManifestUpdater::QueueTasksResult ManifestUpdater::QueueTasks(
               asset.relative_path, dir.status().ToString());
           continue;
         }
-        pool->QueueTask(std::make_unique<DirScannerTask>(
-            cfg_.src_dir, std::move(asset), std::move(dir.value()),
-            data_store_));
+        has_scanned = dir_scanner_ && dir_scanner_->TakeDir(dir_path, &scanned);
+
+        // Directories that did not change only need to be descended into.
+        if (has_scanned && scanned.status.ok() &&
+            ApplyUnchangedDir(&scanned.assets, &dir.value(), asset.deadline,
+                              file_chunks, manifest_content_ids)) {
+          continue;
+        }
+
+        // Directories that are new to the manifest don't need to be compared
+        // to anything, so the scanned assets are added right away.
+        if (has_scanned && scanned.status.ok() &&
+            dir->Proto()->dir_assets_size() == 0 &&
+            dir->Proto()->dir_indirect_assets_size() == 0) {
+          absl::Status status = ApplyScannedDir(&scanned.assets, &dir.value(),
+                                                asset.deadline, file_chunks);
+          if (!status.ok()) {
+            LOG_ERROR("Failed to process directory '%s': %s", dir_path,
+                      status.ToString());
+          }
+          continue;
+        }
+
+        task = std::make_unique<DirScannerTask>(cfg_.src_dir, std::move(asset),
+                                                std::move(dir.value()),
+                                                data_store_);
+        if (has_scanned) task->SetScannedDir(std::move(scanned));
+        pool->QueueTask(std::move(task));
         ++dir_scanner_tasks;
         break;
 
@@ -630,6 +776,18 @@ absl::Status ManifestUpdater::ApplyOperations(
 
     ++stats_.total_assets_deleted;
     file_chunks->Remove(ai.path);
+    // Drop the remaining ranges of deleted files, also below deleted
+    // directories.
+    for (auto it = partial_files_.begin(); it != partial_files_.end();) {
+      const std::string& path = it->first;
+      if (absl::StartsWith(path, ai.path) &&
+          (path.size() == ai.path.size() || path[ai.path.size()] == '/')) {
+        it = partial_files_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (file_changed_handler_) file_changed_handler_(ai.path);
     if (last_deleted && absl::StartsWith(ai.path, *last_deleted) &&
         ai.path[last_deleted->size()] == '/') {
       // Optimization: |path| is part of a deleted dir, so it can be
@@ -676,12 +834,14 @@ absl::Status ManifestUpdater::ApplyOperations(
     asset_builder.SetMtimeSeconds(ai.mtime);
 
     if (ai.type == AssetProto::FILE) {
+      if (file_changed_handler_) file_changed_handler_(ai.path);
       // Assume everything is executable for the intermediate manifest.
       // The executable bit is derived from the file data, which is not
       // available at this point.
       asset_builder.SetPermissions(kExecutablePerms);
       asset_builder.TruncateChunks();
       asset_builder.SetFileSize(ai.size);
+      partial_files_.erase(ai.path);
       // Queue chunker tasks for files.
       asset_builder.SetInProgress(true);
     } else if (ai.type == AssetProto::DIRECTORY) {
@@ -706,34 +866,91 @@ absl::Status ManifestUpdater::HandleFileChunkerResult(
   const std::string rel_file_path = task->RelativeUnixFilePath();
   buffers_.emplace_back(task->ReleaseBuffer());
 
+  // Later ranges of files that were queued again or deleted in the meantime
+  // are outdated.
+  auto partial = partial_files_.find(rel_file_path);
+  if (task->Offset() > 0 && (partial == partial_files_.end() ||
+                             partial->second.chunked_size != task->Offset())) {
+    return absl::OkStatus();
+  }
+
   AssetBuilder asset_builder;
   ASSIGN_OR_RETURN(asset_builder, manifest_builder_->GetOrCreateAsset(
                                       rel_file_path, AssetProto::FILE));
-  asset_builder.SetInProgress(false);
   if (!task->Status().ok()) {
     // In case of an error, pretend the file is empty.
-    asset_builder.SetFileSize(0);
+    asset_builder.SetInProgress(false);
+    asset_builder.TruncateChunks();
     file_chunks->Init(rel_file_path, 0);
+    if (partial != partial_files_.end()) partial_files_.erase(partial);
+    // Compare the directory again in the next UpdateAll().
+    new_dir_states_.erase(path::DirName(rel_file_path));
 
     ++stats_.total_files_failed;
     return task->Status();
   }
 
-  // Update the asset and the stats.
-  uint64_t file_size = task->ProcessedBytes();
+  // Update the stats.
+  const uint64_t chunked_size = task->Offset() + task->ProcessedBytes();
   stats_.total_chunks += task->Chunks()->size();
-  stats_.total_processed_bytes += file_size;
-  ++stats_.total_files_added_or_updated;
+  stats_.total_processed_bytes += task->ProcessedBytes();
+
+  // Only the chunks of this range are added to |file_chunks|, the ones of
+  // previous ranges are there already.
+  if (task->Offset() == 0) file_chunks->Init(rel_file_path, chunked_size);
+  file_chunks->Append(rel_file_path, *task->Chunks(), 0, chunked_size);
+
+  RepeatedChunkRefProto* chunks = task->Chunks();
+  bool is_executable = task->IsExecutable();
+  if (task->Offset() > 0 || !task->Done()) {
+    // Collect the chunks of all ranges. The first range determines whether the
+    // file is executable.
+    PartialFile& pf = partial_files_[rel_file_path];
+    if (task->Offset() == 0) {
+      pf = PartialFile();
+      pf.is_executable = is_executable;
+    }
+    pf.chunks.MergeFrom(*chunks);
+    pf.chunked_size = chunked_size;
+    chunks = &pf.chunks;
+    is_executable = pf.is_executable;
+
+    if (!task->Done()) {
+      // The chunks of the ranges so far are copied to the manifest when it is
+      // flushed the next time, see PublishPartialFiles(). Queue the next
+      // range.
+      pf.unpublished = true;
+      PendingAsset next = task->Pending();
+      next.offset = chunked_size;
+      queue_.AddPartial(std::move(next));
+      return absl::OkStatus();
+    }
+  }
 
-  asset_builder.SwapChunks(task->Chunks(), file_size);
-  asset_builder.SetPermissions(task->IsExecutable()
+  // Update the asset.
+  ++stats_.total_files_added_or_updated;
+  uint64_t file_size = chunked_size;
+  asset_builder.SetInProgress(false);
+  asset_builder.SwapChunks(chunks, file_size);
+  asset_builder.SetPermissions(is_executable
                                    ? kExecutablePerms
                                    : ManifestBuilder::kDefaultFilePerms);
+  partial_files_.erase(rel_file_path);
+  return absl::OkStatus();
+}
 
-  file_chunks->Init(rel_file_path, file_size);
-  file_chunks->AppendCopy(rel_file_path, asset_builder.Proto()->file_chunks(),
-                          0);
-
+absl::Status ManifestUpdater::PublishPartialFiles() {
+  for (auto& [rel_file_path, pf] : partial_files_) {
+    if (!pf.unpublished) continue;
+    AssetBuilder asset_builder;
+    ASSIGN_OR_RETURN(asset_builder, manifest_builder_->GetOrCreateAsset(
+                                        rel_file_path, AssetProto::FILE));
+    uint64_t file_size =
+        std::max<uint64_t>(asset_builder.Proto()->file_size(), pf.chunked_size);
+    asset_builder.SetChunks(pf.chunks, file_size);
+    asset_builder.SetChunkedSize(pf.chunked_size);
+    pf.unpublished = false;
+  }
   return absl::OkStatus();
 }
 
@@ -752,16 +969,123 @@ absl::Status ManifestUpdater::HandleDirScannerResult(
   absl::Time deadline = task->Deadline() > absl::Now() ? task->Deadline()
                                                        : absl::InfiniteFuture();
 
+  // The indirect asset lists might be modified by the operations below, the
+  // state refers to the ones that were read.
+  const RepeatedContentIdProto& list_ids =
+      task->Dir()->Proto()->dir_indirect_assets();
+  DirState state{task->Dir()->Proto()->mtime_seconds(), task->NumEntries(),
+                 task->ListingHash(),
+                 std::vector<ContentId>(list_ids.begin(), list_ids.end()),
+                 std::move(*task->AssetListContentIds())};
+
   // DirScannerTasks are inherently recursive.
   RETURN_IF_ERROR(ApplyOperations(task->Operations(), file_chunks, task->Dir(),
                                   deadline, /*recursive=*/true));
   task->Dir()->SetInProgress(false);
+  if (task->Status().ok())
+    new_dir_states_[task->RelativeUnixFilePath()] = std::move(state);
   // Union all manifest chunk content IDs.
   manifest_content_ids->insert(task->ManifestContentIds()->begin(),
                                task->ManifestContentIds()->end());
   return task->Status();
 }
 
+absl::Status ManifestUpdater::ApplyScannedDir(std::vector<AssetInfo>* assets,
+                                              AssetBuilder* dir,
+                                              absl::Time deadline,
+                                              FileChunkMap* file_chunks) {
+  // Propagate the deadline to the children like HandleDirScannerResult().
+  if (deadline <= absl::Now()) deadline = absl::InfiniteFuture();
+
+  DirState state = GetDirState(*dir, *assets);
+  OperationList operations;
+  operations.reserve(assets->size());
+  for (AssetInfo& ai : *assets)
+    operations.emplace_back(Operator::kAdd, std::move(ai));
+  RETURN_IF_ERROR(ApplyOperations(&operations, file_chunks, dir, deadline,
+                                  /*recursive=*/true));
+  dir->SetInProgress(false);
+  new_dir_states_[dir->RelativeFilePath()] = state;
+  return absl::OkStatus();
+}
+
+// static
+ManifestUpdater::DirState ManifestUpdater::GetDirState(
+    const AssetBuilder& dir, const std::vector<AssetInfo>& assets) {
+  return DirState{dir.Proto()->mtime_seconds(), assets.size(),
+                  GetListingHash(assets)};
+}
+
+bool ManifestUpdater::ApplyUnchangedDir(
+    std::vector<AssetInfo>* assets, AssetBuilder* dir, absl::Time deadline,
+    FileChunkMap* file_chunks,
+    std::unordered_set<ContentIdProto>* manifest_content_ids) {
+  if (!cfg_.skip_unchanged_dirs) return false;
+  std::string dir_path = dir->RelativeFilePath();
+  auto it = dir_states_.find(dir_path);
+  if (it == dir_states_.end()) return false;
+  // The listing includes the mtimes and sizes of all files, so files that were
+  // modified in place change the state as well.
+  DirState state = GetDirState(*dir, *assets);
+  if (state != it->second) return false;
+
+  // Retain the manifest chunks of the directory when pruning. The indirect
+  // asset lists are only read if they changed since the state was taken, e.g.
+  // because a sub-directory was updated.
+  const RepeatedContentIdProto& list_ids = dir->Proto()->dir_indirect_assets();
+  state.asset_list_ids =
+      std::vector<ContentId>(list_ids.begin(), list_ids.end());
+  if (state.asset_list_ids == it->second.asset_list_ids) {
+    state.asset_list_content_ids = std::move(it->second.asset_list_content_ids);
+  } else {
+    CollectAssetListContentIds(data_store_, list_ids,
+                               &state.asset_list_content_ids);
+  }
+  for (const ContentId& id : state.asset_list_content_ids)
+    manifest_content_ids->insert(id.ToProto());
+  for (const AssetProto& asset : dir->Proto()->dir_assets()) {
+    for (const IndirectChunkListProto& icl : asset.file_indirect_chunks())
+      manifest_content_ids->insert(icl.chunk_list_id());
+  }
+
+  // The manifest and |file_chunks| are still up to date for all files, but
+  // the sub-directories might have changed.
+  if (deadline <= absl::Now()) deadline = absl::InfiniteFuture();
+  OperationList operations;
+  for (AssetInfo& ai : *assets) {
+    if (ai.type == AssetProto::DIRECTORY)
+      operations.emplace_back(Operator::kUpdate, std::move(ai));
+  }
+  absl::Status status = ApplyOperations(&operations, file_chunks, dir,
+                                        deadline, /*recursive=*/true);
+  dir->SetInProgress(false);
+  if (!status.ok()) {
+    LOG_ERROR("Failed to process directory '%s': %s", dir_path,
+              status.ToString());
+    return true;
+  }
+  new_dir_states_[dir_path] = std::move(state);
+  ++stats_.total_dirs_skipped;
+  return true;
+}
+
+void ManifestUpdater::InvalidateDirStates(const OperationList& operations) {
+  for (const Operation& op : operations) {
+    const std::string& rel_path = op.info.path;
+    if (rel_path.empty()) {
+      dir_states_.clear();
+      return;
+    }
+    // Remove the states of the parent directory, of the asset itself and of
+    // everything below it. The latter are the paths from "<path>/" up to, but
+    // not including "<path>0", since '0' follows '/'.
+    dir_states_.erase(path::DirName(rel_path));
+    dir_states_.erase(rel_path);
+    dir_states_.erase(dir_states_.lower_bound(rel_path + '/'),
+                      dir_states_.lower_bound(rel_path + '0'));
+  }
+}
+
 absl::Status ManifestUpdater::Update(OperationList* operations,
                                      FileChunkMap* file_chunks,
                                      PushManifestHandler push_handler,
@@ -773,6 +1097,17 @@ absl::Status ManifestUpdater::Update(OperationList* operations,
       cfg_.src_dir, operations->size(), recursive ? "" : "non-");
 
   stats_ = UpdaterStats();
+  recursive_ = recursive;
+
+  // Directories affected by the operations need to be compared again by the
+  // next UpdateAll(). If a recursive update fails, no directory is skipped by
+  // the next one.
+  if (!recursive) InvalidateDirStates(*operations);
+  bool succeeded = false;
+  Finalizer dir_states_finalizer([this, recursive, &succeeded]() {
+    if (recursive && !succeeded) dir_states_.clear();
+    new_dir_states_.clear();
+  });
 
   // Collects the content IDs that make up the manifest when recursing. They are
   // used to prune the manifest cache directory at the end of the Update()
@@ -786,8 +1121,25 @@ absl::Status ManifestUpdater::Update(OperationList* operations,
   manifest_builder_ =
       std::make_unique<ManifestBuilder>(cdc_params, data_store_);
 
-  // Release the ManifestBuilder at the end of this function to free memory.
-  Finalizer finalizer([b = &manifest_builder_]() { b->reset(); });
+  // Release the ManifestBuilder and the directory scanner at the end of this
+  // function to free memory.
+  Finalizer finalizer(
+      [b = &manifest_builder_, s = &dir_scanner_, p = &partial_files_]() {
+        b->reset();
+        s->reset();
+        p->clear();
+      });
+
+  const size_t num_threads = cfg_.num_threads > 0
+                                 ? cfg_.num_threads
+                                 : std::thread::hardware_concurrency();
+
+  // Read the whole source tree in parallel while the manifest is loaded and
+  // updated.
+  if (recursive) {
+    dir_scanner_ = std::make_unique<DirScanner>(cfg_.src_dir, num_threads);
+    dir_scanner_->Start();
+  }
 
   // Load the manifest id from the store.
   ContentIdProto manifest_id;
@@ -812,8 +1164,7 @@ absl::Status ManifestUpdater::Update(OperationList* operations,
   RETURN_IF_ERROR(ApplyOperations(operations, file_chunks, nullptr,
                                   absl::InfiniteFuture(), recursive));
 
-  Threadpool pool(cfg_.num_threads > 0 ? cfg_.num_threads
-                                       : std::thread::hardware_concurrency());
+  Threadpool pool(num_threads);
   // Pre-allocate one buffer per queueable task with 2 * max_chunk_size.
   const size_t max_queued_tasks = MaxQueuedTasks(pool);
   buffers_.reserve(max_queued_tasks);
@@ -839,12 +1190,19 @@ absl::Status ManifestUpdater::Update(OperationList* operations,
     // queue from those tasks so that the push is safe.
     bool drain_dir_scanners = WantManifestFlushed(push_handler);
 
-    QueueTasksResult queued = QueueTasks(drain_dir_scanners, &pool, &cdc_cfg);
+    QueueTasksResult queued =
+        QueueTasks(drain_dir_scanners, &pool, &cdc_cfg, file_chunks,
+                   &manifest_content_ids);
     total_tasks_queued += queued.dir_scanners + queued.file_chunkers;
     scanner_tasks_queued += queued.dir_scanners;
 
+    if (total_tasks_queued == 0) {
+      // All pending assets are directories the scanner has not reached yet.
+      if (dir_scanner_) dir_scanner_->WaitForDirs(kMaxScannerWaitTime);
+      continue;
+    }
+
     std::unique_ptr<Task> task = pool.GetCompletedTask();
-    assert(total_tasks_queued > 0);
     --total_tasks_queued;
 
     FileChunkerTask* chunker_task = dynamic_cast<FileChunkerTask*>(task.get());
@@ -885,18 +1243,41 @@ absl::Status ManifestUpdater::Update(OperationList* operations,
 
   // Remove manifest chunks that are no longer referenced when recursing through
   // all sub-directories. This also makes sure that all referenced manifest
-  // chunks are present.
+  // chunks are present. The chunks of skipped directories were collected from
+  // their directory states.
+  //
+  // Pruning is delayed by one manifest. Clients request manifest deltas against
+  // the last manifest they received, so the chunks of the manifests pushed
+  // since the last pruning are retained until the next one.
   if (status.ok() && recursive) {
+    if (!retained_content_ids_valid_ &&
+        !manifest_id.blake3_sum_160().empty()) {
+      CollectManifestContentIds(data_store_, manifest_id,
+                                &retained_content_ids_);
+    }
+    std::unordered_set<ContentIdProto> ids_to_keep = manifest_content_ids;
+    for (const ContentIdProto& id : retained_content_ids_) {
+      // Retained chunks are not required to be present.
+      if (data_store_->Contains(id)) ids_to_keep.insert(id);
+    }
     // Retain the chunk that stores the manifest ID.
-    manifest_content_ids.insert(GetManifestStoreId());
-    status = data_store_->Prune(std::move(manifest_content_ids));
+    ids_to_keep.insert(GetManifestStoreId());
+    status = data_store_->Prune(std::move(ids_to_keep));
     if (!status.ok()) {
       // Signal to the caller that the manifest needs to be rebuilt from
       // scratch.
       return absl::UnavailableError(status.ToString());
     }
+    retained_content_ids_ = std::move(manifest_content_ids);
+    retained_content_ids_valid_ = true;
+  } else {
+    retained_content_ids_.insert(manifest_content_ids.begin(),
+                                 manifest_content_ids.end());
   }
 
+  if (recursive) dir_states_ = std::move(new_dir_states_);
+  succeeded = true;
+
   LOG_INFO("Manifest for '%s' successfully updated in %0.3f seconds",
            cfg_.src_dir, sw.ElapsedSeconds());
 
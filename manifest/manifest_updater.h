@@ -18,12 +18,16 @@
 #define MANIFEST_MANIFEST_UPDATER_H_
 
 #include <list>
+#include <map>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "absl/status/statusor.h"
 #include "common/buffer.h"
 #include "manifest/asset_builder.h"
+#include "manifest/content_id.h"
 #include "manifest/file_chunk_map.h"
 #include "manifest/manifest_proto_defs.h"
 #include "manifest/pending_assets_queue.h"
@@ -35,6 +39,7 @@ struct Config;
 
 class AssetBuilder;
 class DataStoreWriter;
+class DirScanner;
 class DirScannerTask;
 class FileChunkerTask;
 class ManifestBuilder;
@@ -55,6 +60,18 @@ struct UpdaterConfig {
 
   // Size of the chunker thread pool. Defaults to the number of available CPUs.
   uint32_t num_threads = 0;
+
+  // If true, UpdateAll() does not compare directories to the manifest that
+  // did not change since they were synced by a previous UpdateAll(). The
+  // directory listings are still read, so that files that were modified in
+  // place are detected. Requires that the same FileChunkMap is passed to all
+  // updates.
+  bool skip_unchanged_dirs = false;
+
+  // Files larger than this are chunked in ranges of about this size. The
+  // chunks of every range are published in the manifest, and prioritized
+  // assets are processed before the next range. Zero disables ranges.
+  uint64_t chunker_range_size = 64 << 20;
 };
 
 struct UpdaterStats {
@@ -70,6 +87,10 @@ struct UpdaterStats {
   // Total no. of directories where processing failed.
   size_t total_dirs_failed = 0;
 
+  // Total no. of directories that were not compared to the manifest since
+  // they did not change.
+  size_t total_dirs_skipped = 0;
+
   // Total no. of assets that were deleted (not counting subdirectory files).
   size_t total_assets_deleted = 0;
 
@@ -97,13 +118,13 @@ struct AssetInfo {
   // one AssetInfo to another.
   std::vector<FileChunk> chunks;
 
-  // Appends the chunks from |list| to |chunks|.
-  void AppendCopyChunks(const RepeatedChunkRefProto& list,
-                        uint64_t list_offset);
+  // True if the asset was read from a manifest that was stored before the
+  // asset was completely processed. Such assets are never reused as is. This
+  // flag is ignored when comparing one AssetInfo to another.
+  bool in_progress = false;
 
-  // Appends the chunks from |list| to |chunks|, but moves the data out of
-  // |list| instead of copying, wherever possible.
-  void AppendMoveChunks(RepeatedChunkRefProto* list, uint64_t list_offset);
+  // Appends the chunks from |list| to |chunks|.
+  void AppendChunks(const RepeatedChunkRefProto& list, uint64_t list_offset);
 
   bool operator==(const AssetInfo& other) const {
     return path == other.path && type == other.type && mtime == other.mtime &&
@@ -113,6 +134,12 @@ struct AssetInfo {
 
   // Compares by file path.
   bool operator<(const AssetInfo& other) const { return path < other.path; }
+
+  // Hashes the same fields that are compared by operator==.
+  template <typename H>
+  friend H AbslHashValue(H h, const AssetInfo& ai) {
+    return H::combine(std::move(h), ai.path, ai.type, ai.mtime, ai.size);
+  }
 };
 
 // Incrementally updates a manifest
@@ -144,6 +171,10 @@ class ManifestUpdater {
   using PushManifestHandler =
       std::function<void(const ContentIdProto& manifest_id)>;
 
+  // Called with the relative Unix path of an asset that was added, updated or
+  // deleted. An empty path means that any file might have changed.
+  using FileChangedHandler = std::function<void(const std::string& rel_path)>;
+
   // |data_store| is used to store manifest chunks. File data chunks are not
   // stored explicitly as they can be read from the original files.
   // |cfg| determines the source directory to update the manifest from as well
@@ -155,7 +186,14 @@ class ManifestUpdater {
   ManifestUpdater& operator=(const ManifestUpdater&) = delete;
 
   // Reads the full source directory and syncs the manifest to it. Prunes old,
-  // unreferenced manifest chunks. Updates and flushes |file_chunks|.
+  // unreferenced manifest chunks. The chunks of the previous manifests are kept
+  // until the next UpdateAll(), so that clients can still request a manifest
+  // delta against them. Updates and flushes |file_chunks|.
+  //
+  // If UpdaterConfig::skip_unchanged_dirs is set, directories whose mtime and
+  // listing did not change since the last successful UpdateAll() are not
+  // compared to the manifest, but only descended into. Their listings are
+  // still read.
   //
   // If a valid |push_handler| is passed, then a manifest is flushed at least
   // twice and the handler is called:
@@ -198,6 +236,12 @@ class ManifestUpdater {
   void AddPriorityAssets(std::vector<std::string> rel_paths)
       ABSL_LOCKS_EXCLUDED(priority_mutex_);
 
+  // Sets a |handler| that is notified about changed assets, e.g. to invalidate
+  // cached file handles. Must not be called while an update is in progress.
+  void SetFileChangedHandler(FileChangedHandler handler) {
+    file_changed_handler_ = std::move(handler);
+  }
+
  private:
   // Holds the number of queued tasks returned by QueueTasks().
   struct QueueTasksResult {
@@ -206,10 +250,15 @@ class ManifestUpdater {
 
   // Adds enough pending assets from |queue_| as tasks to the |pool| to keep all
   // worker threads busy. If |drain_dir_scanner_tasks| is true, only
-  // FileChunkerTasks are queued, others are skipped. Returns the number of
-  // tasks that were queued as a QueueTaskResult.
-  QueueTasksResult QueueTasks(bool drain_dir_scanner_tasks, Threadpool* pool,
-                              const fastcdc::Config* cdc_cfg);
+  // FileChunkerTasks are queued, others are skipped. Directories that were
+  // read by |dir_scanner_| and are new to the manifest are added directly
+  // without queuing a task. The manifest chunks of unchanged directories are
+  // added to |manifest_content_ids|. Returns the number of tasks that were
+  // queued as a QueueTaskResult.
+  QueueTasksResult QueueTasks(
+      bool drain_dir_scanner_tasks, Threadpool* pool,
+      const fastcdc::Config* cdc_cfg, FileChunkMap* file_chunks,
+      std::unordered_set<ContentIdProto>* manifest_content_ids);
 
   // Modifies the list of queued tasks to prioritize those assets that were
   // previously selected using the AddPriorityAssets() method.
@@ -260,21 +309,84 @@ class ManifestUpdater {
                                FileChunkMap* file_chunks, AssetBuilder* parent,
                                absl::Time deadline, bool recursive);
 
-  // Handles the results of a completed FileChunkerTask.
+  // Handles the results of a completed FileChunkerTask. If the task chunked a
+  // range of the file, adds the chunks of the range to |file_chunks| and queues
+  // the next range.
   absl::Status HandleFileChunkerResult(FileChunkerTask* task,
                                        FileChunkMap* file_chunks);
 
+  // Copies the chunks of files that are chunked in ranges to the manifest if
+  // new ranges were chunked since the last call. Called before the manifest is
+  // flushed, so that the beginning of those files can be read already.
+  absl::Status PublishPartialFiles();
+
+  // Adds the scanned |assets| as children of the new directory |dir| and
+  // queues them up for processing with the given |deadline|.
+  absl::Status ApplyScannedDir(std::vector<AssetInfo>* assets,
+                               AssetBuilder* dir, absl::Time deadline,
+                               FileChunkMap* file_chunks);
+
   // Handles the results of a completed DirScannerTask.
   absl::Status HandleDirScannerResult(
       DirScannerTask* task, FileChunkMap* file_chunks,
       std::unordered_set<ContentIdProto>* manifest_content_ids);
 
+  // State of a directory when it was synced to the manifest.
+  struct DirState {
+    int64_t mtime = 0;
+    size_t num_entries = 0;
+    size_t listing_hash = 0;
+
+    // IDs of the indirect asset lists of the directory and the IDs of these
+    // lists and of the indirect chunk lists of the files in them. They are
+    // retained when the manifest chunks are pruned and the directory is
+    // skipped. Not part of the comparison.
+    std::vector<ContentId> asset_list_ids;
+    std::vector<ContentId> asset_list_content_ids;
+
+    bool operator==(const DirState& other) const {
+      return mtime == other.mtime && num_entries == other.num_entries &&
+             listing_hash == other.listing_hash;
+    }
+    bool operator!=(const DirState& other) const { return !(*this == other); }
+  };
+
+  // Returns the state of the directory |dir| with the scanned |assets|.
+  static DirState GetDirState(const AssetBuilder& dir,
+                              const std::vector<AssetInfo>& assets);
+
+  // If the directory |dir| with the scanned |assets| did not change since the
+  // last UpdateAll(), only queues its sub-directories with the given
+  // |deadline| and returns true. The IDs of the manifest chunks that the
+  // directory references are added to |manifest_content_ids|. Returns false if
+  // the directory needs to be compared to the manifest.
+  bool ApplyUnchangedDir(
+      std::vector<AssetInfo>* assets, AssetBuilder* dir, absl::Time deadline,
+      FileChunkMap* file_chunks,
+      std::unordered_set<ContentIdProto>* manifest_content_ids);
+
+  // Removes the states of all directories that are affected by |operations|.
+  void InvalidateDirStates(const OperationList& operations);
+
   // Queue of pending assets waiting for completion.
   PendingAssetsQueue queue_;
 
   // Pool of pre-allocated buffers
   std::vector<Buffer> buffers_;
 
+  // Chunks of a file that is chunked in ranges.
+  struct PartialFile {
+    RepeatedChunkRefProto chunks;
+    uint64_t chunked_size = 0;
+    bool is_executable = false;
+    // True if |chunks| were not set in the manifest yet.
+    bool unpublished = false;
+  };
+
+  // Files that are chunked in ranges and not complete yet, by relative Unix
+  // file path.
+  std::unordered_map<std::string, PartialFile> partial_files_;
+
   // Store for manifest chunks and the manifest id itself.
   DataStoreWriter* const data_store_;
 
@@ -300,6 +412,36 @@ class ManifestUpdater {
   // The time when the manifest was flushed last.
   absl::Time last_manifest_flush_;
 
+  // True while a recursive Update() is running. Intermediate manifests are
+  // only stored as the current manifest in this case, so that an interrupted
+  // UpdateAll() can resume from it. Assets that are still in progress are
+  // processed again by the next UpdateAll().
+  bool recursive_ = false;
+
+  // Notified about added, updated and deleted assets.
+  FileChangedHandler file_changed_handler_;
+
+  // Reads the source directory in parallel during a recursive Update().
+  std::unique_ptr<DirScanner> dir_scanner_;
+
+  // States of the directories that were synced by the last successful
+  // UpdateAll() and were not modified since, by relative Unix path. Ordered,
+  // so that the states of all directories below a path are adjacent.
+  std::map<std::string, DirState> dir_states_;
+
+  // States of the directories synced by the running UpdateAll(). They replace
+  // |dir_states_| once the update succeeded.
+  std::map<std::string, DirState> new_dir_states_;
+
+  // IDs of the chunks of the manifests pushed since the last time the manifest
+  // chunks were pruned. They are kept by the next pruning, so that clients can
+  // still request a manifest delta against them.
+  std::unordered_set<ContentIdProto> retained_content_ids_;
+
+  // False until the manifest chunks were pruned once. The first pruning
+  // retains the chunks of the manifest that was loaded from the store.
+  bool retained_content_ids_valid_ = false;
+
   // How much time we allow at least for processing a prioritized asset. The
   // manifest won't be flushed for that time, to allow more assets to be
   // finalized before the manifest is sent to the client.
@@ -309,6 +451,11 @@ class ManifestUpdater {
   // How often we allow an intermediate manifest to be flushed and pushed.
   static constexpr absl::Duration kMinDelayBetweenFlush =
       absl::Milliseconds(500);
+
+  // How long we wait at most for the directory scanner when there is nothing
+  // else to do. Limits the delay of a manifest flush that became due.
+  static constexpr absl::Duration kMaxScannerWaitTime =
+      absl::Milliseconds(100);
 };
 
 };  // namespace cdc_ft
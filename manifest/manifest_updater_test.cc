@@ -15,6 +15,7 @@
 #include "manifest/manifest_updater.h"
 
 #include "absl/strings/match.h"
+#include "absl/time/clock.h"
 #include "common/path.h"
 #include "common/status_test_macros.h"
 #include "common/test_main.h"
@@ -23,6 +24,7 @@
 #include "gtest/gtest.h"
 #include "manifest/file_chunk_map.h"
 #include "manifest/manifest_builder.h"
+#include "manifest/manifest_delta.h"
 #include "manifest/manifest_iterator.h"
 #include "manifest/manifest_test_base.h"
 
@@ -55,6 +57,45 @@ class ManifestUpdaterTest : public ManifestTestBase {
   void TearDown() override { path::RemoveDirRec(empty_dir_).IgnoreError(); }
 
  protected:
+  // Writes a file with |size| bytes of pseudo-random data to |empty_dir_| and
+  // configures small chunks and ranges, so that the file is chunked in many
+  // ranges. Returns the file data.
+  std::string SetUpLargeFile(size_t size) {
+    std::string data(size, 0);
+    uint64_t state = 1;
+    for (char& c : data) {
+      state = state * 6364136223846793005ull + 1442695040888963407ull;
+      c = static_cast<char>(state >> 56);
+    }
+    EXPECT_OK(path::WriteFile(path::Join(empty_dir_, "big"), data));
+
+    cfg_.src_dir = empty_dir_;
+    cfg_.min_chunk_size = 256;
+    cfg_.avg_chunk_size = 512;
+    cfg_.max_chunk_size = 1024;
+    cfg_.chunker_range_size = 4096;
+    return data;
+  }
+
+  // Returns the operations that add the file "big" of |file_size| bytes and
+  // the root directory of |empty_dir_| for a recursive Update(). With a single
+  // thread, the root directory is scanned right after the first range of the
+  // file was chunked.
+  ManifestUpdater::OperationList MakeFileAndRootOps(uint64_t file_size) {
+    AssetInfo file;
+    file.path = "big";
+    file.size = file_size;
+    time_t mtime;
+    if (path::GetFileTime(path::Join(empty_dir_, "big"), &mtime).ok())
+      file.mtime = static_cast<int64_t>(mtime);
+    AssetInfo root;
+    root.type = AssetProto::DIRECTORY;
+    EXPECT_OK(path::GetFileTime(empty_dir_, &mtime));
+    root.mtime = static_cast<int64_t>(mtime);
+    return {{Operator::kAdd, std::move(file)},
+            {Operator::kAdd, std::move(root)}};
+  }
+
   std::string empty_dir_ = path::Join(path::GetTempDir(), "empty");
 };
 
@@ -188,6 +229,8 @@ TEST_F(ManifestUpdaterTest, UpdateAll_PrunesUnreferencedChunks) {
       << std::endl
       << DumpDataStoreProtos();
 
+  // Pruning is delayed by one manifest.
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
   EXPECT_OK(updater.UpdateAll(&file_chunks_));
   EXPECT_OK(updater.UpdateAll(&file_chunks_));
   // 1 for manifest id, 1 for manifest, 6 indirect assets.
@@ -225,13 +268,63 @@ TEST_F(ManifestUpdaterTest, UpdateAll_RecoversFromMissingChunks) {
 
   EXPECT_OK(updater.UpdateAll(&file_chunks_));
   // 1 for manifest id, 1 for manifest, 6 indirect assets.
-  // There would be 9 chunks without the removal above, see UpdateAll_Prune.
-  EXPECT_EQ(data_store_.Chunks().size(), 8)
+  // 1 for the previous manifest, which is retained until the next UpdateAll().
+  EXPECT_EQ(data_store_.Chunks().size(), 9)
       << "Manifest: " << ContentId::ToHexString(updater.ManifestId())
       << std::endl
       << DumpDataStoreProtos();
 }
 
+// UpdateAll() keeps the chunks of the previous manifest, so that a manifest
+// delta can still be computed against it.
+TEST_F(ManifestUpdaterTest, UpdateAll_KeepsPreviousManifestForDelta) {
+  // Reduce chunk sizes to produce a bunch of indirect lists.
+  cfg_.min_chunk_size = 8;
+  cfg_.avg_chunk_size = 16;
+  cfg_.max_chunk_size = 32;
+
+  std::string path = path::Join(empty_dir_, "a", "f0");
+  for (const char* rel_path : {"a/f0", "a/f1", "b/f0", "b/f1"}) {
+    std::string file_path = path::Join(empty_dir_, path::ToNative(rel_path));
+    EXPECT_OK(path::CreateDirRec(path::DirName(file_path)));
+    EXPECT_OK(path::WriteFile(file_path, std::string(100, rel_path[0])));
+  }
+
+  cfg_.src_dir = empty_dir_;
+  ManifestUpdater updater(&data_store_, cfg_);
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  ContentIdProto first_id = updater.ManifestId();
+
+  EXPECT_OK(path::WriteFile(path, "modified"));
+  EXPECT_OK(path::SetFileTime(path, 1234567890));
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  ContentIdProto second_id = updater.ManifestId();
+  ASSERT_NE(first_id, second_id);
+
+  // The delta only contains the changed chunks.
+  ManifestDelta delta(&data_store_);
+  EXPECT_OK(delta.Compute(ContentIdProto(), second_id));
+  const size_t num_all_chunks = delta.Chunks().size();
+  EXPECT_OK(delta.Compute(first_id, second_id));
+  EXPECT_TRUE(delta.Complete());
+  EXPECT_LT(delta.Chunks().size(), num_all_chunks);
+  EXPECT_TRUE(data_store_.Contains(first_id));
+
+  // The next UpdateAll() prunes the first manifest.
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  EXPECT_FALSE(data_store_.Contains(first_id));
+  EXPECT_TRUE(data_store_.Contains(second_id));
+
+  // A new updater retains the manifest loaded from the store.
+  EXPECT_OK(path::WriteFile(path, "modified again"));
+  EXPECT_OK(path::SetFileTime(path, 1234567890));
+  ManifestUpdater new_updater(&data_store_, cfg_);
+  EXPECT_OK(new_updater.UpdateAll(&file_chunks_));
+  EXPECT_NE(new_updater.ManifestId(), second_id);
+  EXPECT_OK(delta.Compute(second_id, new_updater.ManifestId()));
+  EXPECT_LT(delta.Chunks().size(), num_all_chunks);
+}
+
 // Verifies that |file_chunks_| contains the expected chunks after UpdateAll().
 TEST_F(ManifestUpdaterTest, UpdateAll_FileChunkMapFromScratch) {
   // Reduce chunk sizes to produce a bunch of indirect lists.
@@ -299,6 +392,65 @@ TEST_F(ManifestUpdaterTest, UpdateAll_PushIntermediateManifest) {
   EXPECT_TRUE(InProgress(intermediate_id, ""));
 }
 
+// Verifies that intermediate manifests of UpdateAll() are stored, so that an
+// interrupted update can be resumed.
+TEST_F(ManifestUpdaterTest, UpdateAll_StoresIntermediateManifestId) {
+  std::vector<ContentIdProto> pushed_ids, stored_ids;
+  auto push_manifest = [this, &pushed_ids,
+                        &stored_ids](const ContentIdProto& manifest_id) {
+    ContentIdProto stored_id;
+    EXPECT_OK(data_store_.GetProto(manifest_store_id_, &stored_id));
+    pushed_ids.push_back(manifest_id);
+    stored_ids.push_back(stored_id);
+  };
+
+  cfg_.src_dir = path::Join(base_dir_, "non_empty");
+  ManifestUpdater updater(&data_store_, cfg_);
+  EXPECT_OK(updater.UpdateAll(&file_chunks_, push_manifest));
+  EXPECT_GE(pushed_ids.size(), 2);
+  EXPECT_EQ(pushed_ids, stored_ids);
+}
+
+// Runs UpdateAll() on a manifest that was stored while some files were still
+// in progress. Only those files should be processed again.
+TEST_F(ManifestUpdaterTest, UpdateAll_ResumesInterruptedUpdate) {
+  cfg_.src_dir = path::Join(base_dir_, "non_empty");
+  {
+    ManifestUpdater updater(&data_store_, cfg_);
+    ASSERT_OK(updater.UpdateAll(&file_chunks_));
+  }
+
+  // Simulate an interrupted update where subdir/b.txt was not chunked yet.
+  ContentIdProto manifest_id;
+  ASSERT_OK(data_store_.GetProto(manifest_store_id_, &manifest_id));
+  CdcParamsProto params;
+  params.set_min_chunk_size(cfg_.min_chunk_size);
+  params.set_avg_chunk_size(cfg_.avg_chunk_size);
+  params.set_max_chunk_size(cfg_.max_chunk_size);
+  ManifestBuilder builder(params, &data_store_);
+  ASSERT_OK(builder.LoadManifest(manifest_id));
+  absl::StatusOr<AssetBuilder> asset =
+      builder.GetOrCreateAsset("subdir/b.txt", AssetProto::FILE);
+  ASSERT_OK(asset);
+  asset->TruncateChunks();
+  asset->SetInProgress(true);
+  absl::StatusOr<ContentIdProto> flushed_id = builder.Flush();
+  ASSERT_OK(flushed_id);
+  std::string ser_id = flushed_id->SerializeAsString();
+  ASSERT_OK(data_store_.Put(manifest_store_id_, ser_id.data(), ser_id.size()));
+  file_chunks_.Clear();
+
+  ManifestUpdater updater(&data_store_, cfg_);
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+
+  const UpdaterStats& stats = updater.Stats();
+  EXPECT_EQ(stats.total_files_added_or_updated, 1);
+  EXPECT_EQ(stats.total_processed_bytes, kFileSizeB);
+  EXPECT_FALSE(InProgress(updater.ManifestId(), "subdir/b.txt"));
+  ValidateChunkLookup("a.txt", true);
+  ValidateChunkLookup("subdir/b.txt", true);
+}
+
 // Runs Update() with a single file to be added.
 TEST_F(ManifestUpdaterTest, Update_AddFile) {
   cfg_.src_dir = path::Join(base_dir_, "non_empty");
@@ -713,6 +865,224 @@ TEST_F(ManifestUpdaterTest, UpdateAll_NonEmptySrcDirectoryMultiTimesNoChange) {
   EXPECT_EQ(stats.total_processed_bytes, 0);
 }
 
+// Runs UpdateAll() on a wider tree with multiple threads, so that the
+// directories are scanned in parallel.
+TEST_F(ManifestUpdaterTest, UpdateAll_ParallelScan) {
+  // Create 3 levels of 3 directories with 2 files each.
+  std::vector<std::string> rel_dirs = {""}, rel_paths;
+  for (size_t n = 0; n < rel_dirs.size(); ++n) {
+    const std::string rel_dir = rel_dirs[n];
+    for (const char* name : {"f0", "f1"}) {
+      rel_paths.push_back(path::JoinUnix(rel_dir, name));
+      EXPECT_OK(path::WriteFile(
+          path::Join(empty_dir_, path::ToNative(rel_paths.back())), name));
+    }
+    if (std::count(rel_dir.begin(), rel_dir.end(), '/') == 2) continue;
+    for (const char* name : {"d0", "d1", "d2"}) {
+      rel_dirs.push_back(path::JoinUnix(rel_dir, name));
+      rel_paths.push_back(rel_dirs.back());
+      EXPECT_OK(path::CreateDirRec(
+          path::Join(empty_dir_, path::ToNative(rel_dirs.back()))));
+    }
+  }
+  const size_t num_dirs = rel_dirs.size() - 1;
+  const size_t num_files = rel_paths.size() - num_dirs;
+
+  cfg_.src_dir = empty_dir_;
+  cfg_.num_threads = 4;
+  ManifestUpdater updater(&data_store_, cfg_);
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+
+  UpdaterStats stats = updater.Stats();
+  EXPECT_EQ(stats.total_assets_added_or_updated, num_dirs + num_files);
+  EXPECT_EQ(stats.total_files_added_or_updated, num_files);
+  EXPECT_EQ(stats.total_dirs_failed, 0);
+  std::vector<AssetInfoForTest> manifest_assets =
+      GetAllManifestAssets(updater.ManifestId());
+  std::vector<std::string> manifest_paths;
+  for (const AssetInfoForTest& ai : manifest_assets) {
+    EXPECT_FALSE(ai.in_progress) << ai.info.path;
+    manifest_paths.push_back(ai.info.path);
+  }
+  std::sort(manifest_paths.begin(), manifest_paths.end());
+  std::sort(rel_paths.begin(), rel_paths.end());
+  EXPECT_EQ(manifest_paths, rel_paths);
+
+  // Directories that are in the manifest already are compared to the scanned
+  // contents.
+  EXPECT_OK(path::WriteFile(path::Join(empty_dir_, "d2", "d1", "new"), "new"));
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  stats = updater.Stats();
+  EXPECT_EQ(stats.total_files_added_or_updated, 1);
+  EXPECT_EQ(GetAllManifestAssets(updater.ManifestId()).size(),
+            rel_paths.size() + 1);
+}
+
+// Runs UpdateAll() multiple times with |skip_unchanged_dirs| enabled.
+// Directories are only compared to the manifest if their listing changed.
+TEST_F(ManifestUpdaterTest, UpdateAll_SkipsUnchangedDirs) {
+  for (const char* rel_path : {"a/f0", "a/f1", "b/f0", "b/c/f0"}) {
+    std::string path = path::Join(empty_dir_, path::ToNative(rel_path));
+    EXPECT_OK(path::CreateDirRec(path::DirName(path)));
+    EXPECT_OK(path::WriteFile(path, rel_path));
+  }
+
+  cfg_.src_dir = empty_dir_;
+  cfg_.skip_unchanged_dirs = true;
+  ManifestUpdater updater(&data_store_, cfg_);
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  EXPECT_EQ(updater.Stats().total_files_added_or_updated, 4);
+  EXPECT_EQ(updater.Stats().total_dirs_skipped, 0);
+
+  // The root directory, a, b and b/c are unchanged.
+  ContentIdProto manifest_id = updater.ManifestId();
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  EXPECT_EQ(updater.Stats().total_files_added_or_updated, 0);
+  EXPECT_EQ(updater.Stats().total_dirs_skipped, 4);
+  EXPECT_EQ(updater.ManifestId(), manifest_id);
+  ValidateChunkLookup("b/c/f0", true);
+
+  // Modify a file in place. The directory mtime might not change, but the
+  // listing does.
+  std::string path = path::Join(empty_dir_, "b", "c", "f0");
+  EXPECT_OK(path::WriteFile(path, "modified"));
+  EXPECT_OK(path::SetFileTime(path, 1234567890));
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  EXPECT_EQ(updater.Stats().total_files_added_or_updated, 1);
+  EXPECT_EQ(updater.Stats().total_dirs_skipped, 3);
+  EXPECT_NE(updater.ManifestId(), manifest_id);
+
+  // Changes applied by Update() are compared again by the next UpdateAll().
+  EXPECT_OK(updater.Update(MakeUpdateOps({"a/f0"}), &file_chunks_, nullptr));
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  EXPECT_EQ(updater.Stats().total_files_added_or_updated, 0);
+  EXPECT_EQ(updater.Stats().total_dirs_skipped, 3);
+}
+
+// Prunes manifest chunks if directories are skipped. The chunks of the skipped
+// directories are retained.
+TEST_F(ManifestUpdaterTest, UpdateAll_PrunesWithSkippedDirs) {
+  // Reduce chunk sizes to produce a bunch of indirect lists.
+  cfg_.min_chunk_size = 8;
+  cfg_.avg_chunk_size = 16;
+  cfg_.max_chunk_size = 32;
+  for (const char* rel_path : {"a/f0", "a/f1", "b/f0", "b/c/f0", "b/c/f1"}) {
+    std::string path = path::Join(empty_dir_, path::ToNative(rel_path));
+    EXPECT_OK(path::CreateDirRec(path::DirName(path)));
+    EXPECT_OK(path::WriteFile(path, std::string(100, rel_path[2])));
+  }
+
+  cfg_.src_dir = empty_dir_;
+  cfg_.skip_unchanged_dirs = true;
+  ManifestUpdater updater(&data_store_, cfg_);
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  ContentIdProto first_id = updater.ManifestId();
+
+  std::string path = path::Join(empty_dir_, "b", "c", "f0");
+  EXPECT_OK(path::WriteFile(path, std::string(100, 'x')));
+  EXPECT_OK(path::SetFileTime(path, 1234567890));
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  EXPECT_EQ(updater.Stats().total_dirs_skipped, 3);
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  EXPECT_EQ(updater.Stats().total_dirs_skipped, 4);
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  EXPECT_EQ(updater.Stats().total_dirs_skipped, 4);
+
+  // Pruning is delayed by one manifest. Only the chunks of the current manifest
+  // and the manifest id are left.
+  EXPECT_FALSE(data_store_.Contains(first_id));
+  ManifestDelta delta(&data_store_);
+  EXPECT_OK(delta.Compute(ContentIdProto(), updater.ManifestId()));
+  EXPECT_GT(delta.Chunks().size(), 1);
+  EXPECT_EQ(data_store_.Chunks().size(), delta.Chunks().size() + 1)
+      << DumpDataStoreProtos();
+  ASSERT_NO_FATAL_FAILURE(ExpectManifestEquals(
+      {"a", "a/f0", "a/f1", "b", "b/f0", "b/c", "b/c/f0", "b/c/f1"},
+      updater.ManifestId()));
+}
+
+// Chunks a large file in ranges. The result is the same as if the file was
+// chunked at once.
+TEST_F(ManifestUpdaterTest, UpdateAll_ChunksLargeFileInRanges) {
+  std::string data = SetUpLargeFile(64 << 10);
+  cfg_.chunker_range_size = 0;
+  MemDataStore ref_data_store;
+  FileChunkMap ref_file_chunks(/*enable_stats=*/false);
+  ManifestUpdater ref_updater(&ref_data_store, cfg_);
+  EXPECT_OK(ref_updater.UpdateAll(&ref_file_chunks));
+
+  cfg_.chunker_range_size = 4096;
+  ManifestUpdater updater(&data_store_, cfg_);
+  EXPECT_OK(updater.UpdateAll(&file_chunks_));
+  EXPECT_EQ(updater.ManifestId(), ref_updater.ManifestId());
+
+  const UpdaterStats& stats = updater.Stats();
+  EXPECT_EQ(stats.total_files_added_or_updated, 1);
+  EXPECT_EQ(stats.total_processed_bytes, data.size());
+  EXPECT_EQ(stats.total_chunks, ref_updater.Stats().total_chunks);
+  ValidateChunkLookup("big", true);
+}
+
+// Deletes a file while it is chunked in ranges. The pending ranges of the file
+// are dropped.
+TEST_F(ManifestUpdaterTest, Update_DeletesFileChunkedInRanges) {
+  std::string data = SetUpLargeFile(64 << 10);
+  const std::string file_path = path::Join(empty_dir_, "big");
+  EXPECT_OK(path::RemoveFile(file_path));
+  ManifestUpdater updater(&data_store_, cfg_);
+  ManifestUpdater::OperationList ops = MakeFileAndRootOps(data.size());
+
+  // The directory scanner lists the empty root directory before the file is
+  // written, so the root directory scan deletes the file after its first range.
+  bool pushed = false;
+  auto push_handler = [&](const ContentIdProto&) {
+    if (pushed) return;
+    pushed = true;
+    absl::SleepFor(absl::Milliseconds(100));
+    EXPECT_OK(path::WriteFile(file_path, data));
+  };
+  EXPECT_OK(updater.Update(&ops, &file_chunks_, push_handler,
+                           /*recursive=*/true));
+  EXPECT_TRUE(pushed);
+
+  const UpdaterStats& stats = updater.Stats();
+  EXPECT_EQ(stats.total_assets_deleted, 1);
+  EXPECT_LT(stats.total_processed_bytes, data.size());
+  ASSERT_NO_FATAL_FAILURE(ExpectManifestEquals({}, updater.ManifestId()));
+  ValidateChunkLookup("big", false);
+}
+
+// Updates a file while it is chunked in ranges. The file is chunked again from
+// the start.
+TEST_F(ManifestUpdaterTest, Update_RequeuesFileChunkedInRanges) {
+  std::string data = SetUpLargeFile(64 << 10);
+  MemDataStore ref_data_store;
+  FileChunkMap ref_file_chunks(/*enable_stats=*/false);
+  ManifestUpdater ref_updater(&ref_data_store, cfg_);
+  EXPECT_OK(ref_updater.UpdateAll(&ref_file_chunks));
+
+  // The root directory scan finds the file in progress and updates it after
+  // its first range. Give the directory scanner time to list the root
+  // directory.
+  ManifestUpdater updater(&data_store_, cfg_);
+  ManifestUpdater::OperationList ops = MakeFileAndRootOps(data.size());
+  bool pushed = false;
+  auto push_handler = [&pushed](const ContentIdProto&) {
+    if (pushed) return;
+    pushed = true;
+    absl::SleepFor(absl::Milliseconds(100));
+  };
+  EXPECT_OK(updater.Update(&ops, &file_chunks_, push_handler,
+                           /*recursive=*/true));
+  EXPECT_TRUE(pushed);
+  EXPECT_EQ(updater.ManifestId(), ref_updater.ManifestId());
+
+  const UpdaterStats& stats = updater.Stats();
+  EXPECT_EQ(stats.total_files_added_or_updated, 1);
+  EXPECT_GT(stats.total_processed_bytes, data.size());
+  ValidateChunkLookup("big", true);
+}
+
 TEST_F(ManifestUpdaterTest, IsValidDir) {
   EXPECT_OK(ManifestUpdater::IsValidDir(path::Join(base_dir_, "non_empty")));
   EXPECT_TRUE(absl::IsNotFound(
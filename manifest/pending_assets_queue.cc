@@ -30,6 +30,10 @@ void PendingAssetsQueue::Add(PendingAsset pending) {
 
   // Pending assets with a deadline will be added at the end of other
   // prioritized assets.
+  AddPartial(std::move(pending));
+}
+
+void PendingAssetsQueue::AddPartial(PendingAsset pending) {
   auto it =
       std::find_if(queue_.begin(), queue_.end(), [](const PendingAsset& pa) {
         return pa.deadline == absl::InfiniteFuture();
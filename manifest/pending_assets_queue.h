@@ -49,6 +49,10 @@ struct PendingAsset {
   // File name of the asset that still needs processing.
   std::string filename;
 
+  // For FILE assets that are chunked in ranges, the offset at which the next
+  // range starts. This is always a chunk boundary.
+  uint64_t offset = 0;
+
   // If this asset was explicitly prioritized, this field is set to true,
   // otherwise false.
   bool prioritized = false;
@@ -77,6 +81,11 @@ class PendingAssetsQueue {
   // deadline.
   void Add(PendingAsset pending);
 
+  // Adds the partially processed asset |pending| after the assets having a
+  // deadline, so that it is completed before other assets are started, but
+  // prioritized assets still go first.
+  void AddPartial(PendingAsset pending);
+
   // Removes a PendingAsset from the queue and stores it in |pending|. If
   // |accept| is given, then only items for which |accept| returns true are
   // considered. Returns true if an item was stored in |pending|, otherwise
@@ -0,0 +1,108 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest/pending_assets_queue.h"
+
+#include <vector>
+
+#include "common/status_test_macros.h"
+#include "data_store/mem_data_store.h"
+#include "gtest/gtest.h"
+#include "manifest/manifest_builder.h"
+
+namespace cdc_ft {
+namespace {
+
+constexpr absl::Duration kMinProcessingTime = absl::Seconds(1);
+
+class PendingAssetsQueueTest : public ::testing::Test {
+ protected:
+  // Returns a pending FILE asset "|name|" in the root directory that should be
+  // completed by |deadline|.
+  static PendingAsset MakeFile(const std::string& name,
+                               absl::Time deadline = absl::InfiniteFuture()) {
+    return PendingAsset(AssetProto::FILE, "", name, deadline);
+  }
+
+  // Dequeues all assets and returns their names in queue order.
+  std::vector<std::string> DequeueAll() {
+    std::vector<std::string> names;
+    PendingAsset pending;
+    while (queue_.Dequeue(&pending)) names.push_back(pending.filename);
+    return names;
+  }
+
+  PendingAssetsQueue queue_{kMinProcessingTime};
+  absl::Time now_ = absl::Now();
+};
+
+TEST_F(PendingAssetsQueueTest, AddQueuesDeadlinesFirst) {
+  queue_.Add(MakeFile("a"));
+  queue_.Add(MakeFile("prio1", now_));
+  queue_.Add(MakeFile("b"));
+  queue_.Add(MakeFile("prio2", now_));
+  EXPECT_EQ(DequeueAll(),
+            std::vector<std::string>({"prio1", "prio2", "a", "b"}));
+  EXPECT_TRUE(queue_.Empty());
+}
+
+TEST_F(PendingAssetsQueueTest, AddPartialQueuesAfterPrioritizedAssets) {
+  queue_.Add(MakeFile("a"));
+  queue_.Add(MakeFile("prio1", now_));
+  queue_.AddPartial(MakeFile("partial"));
+
+  // Assets prioritized after the partial asset was queued still go first.
+  queue_.Add(MakeFile("prio2", now_));
+  queue_.Add(MakeFile("b"));
+  EXPECT_EQ(DequeueAll(), std::vector<std::string>(
+                              {"prio1", "prio2", "partial", "a", "b"}));
+}
+
+TEST_F(PendingAssetsQueueTest, DequeueWithAcceptSkipsAssets) {
+  queue_.Add(MakeFile("a"));
+  queue_.AddPartial(MakeFile("partial"));
+
+  PendingAsset pending;
+  EXPECT_TRUE(queue_.Dequeue(&pending, [](const PendingAsset& pa) {
+    return pa.filename == "a";
+  }));
+  EXPECT_EQ(pending.filename, "a");
+  EXPECT_EQ(DequeueAll(), std::vector<std::string>({"partial"}));
+}
+
+TEST_F(PendingAssetsQueueTest, PrioritizeMovesInProgressAssetBeforePartial) {
+  MemDataStore store;
+  ManifestBuilder builder(CdcParamsProto(), &store);
+  for (const char* name : {"a", "b", "done"}) {
+    absl::StatusOr<AssetBuilder> asset =
+        builder.GetOrCreateAsset(name, AssetProto::FILE);
+    ASSERT_OK(asset);
+    asset->SetInProgress(std::string(name) != "done");
+  }
+
+  queue_.Add(MakeFile("a"));
+  queue_.Add(MakeFile("b"));
+  queue_.Add(MakeFile("done"));
+  queue_.AddPartial(MakeFile("partial"));
+
+  // Assets that are no longer in progress or not in the manifest are ignored.
+  absl::Time deadline = queue_.Prioritize(
+      {{"b", now_}, {"done", now_}, {"missing", now_}}, &builder);
+  EXPECT_EQ(deadline, now_ + kMinProcessingTime);
+  EXPECT_EQ(DequeueAll(),
+            std::vector<std::string>({"b", "partial", "a", "done"}));
+}
+
+}  // namespace
+}  // namespace cdc_ft